@@ -0,0 +1,52 @@
+#ifndef _AUTO_EXPOSURE_H
+#define _AUTO_EXPOSURE_H
+
+#include "frame_params.h"
+#include "frame_stats.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Control law of the firmware's auto exposure, which replaces the sensors' own (register 0x2100).
+ *
+ * The brightness of a frame is its mean pixel value, with the region of interest weighted more
+ * (see frame_stats.h). The controller works on the product of exposure and gains: it scales the
+ * settings that the measured frame was taken with by target / brightness, moves 'speed' / 256 of
+ * the way there, and splits the result up into exposure first, then analog gain, then digital
+ * gain. Because it starts from the measured frame's own settings rather than the newest ones, it
+ * doesn't overshoot while earlier corrections are still on their way through the sensor.
+ */
+typedef struct auto_exposure_config {
+    // Mean pixel value to aim for, and how far off it may be before anything is changed.
+    uint8_t target;
+    uint8_t tolerance;
+
+    // Limits of the settings that the controller picks. Exposure is in lines, analog gain is
+    // 2^max_analog_gain (0 - 3) and digital gain is in 2.6 fixed point (0x40 - 0xff).
+    uint16_t max_exposure_lines;
+    uint8_t max_analog_gain;
+    uint8_t max_digital_gain;
+
+    // 1 - 256: fraction of the correction that's applied per frame, in 1/256ths.
+    uint16_t speed;
+
+    // Pixels inside 'roi' count 'roi_weight' times.
+    frame_stats_roi_t roi;
+    uint8_t roi_weight;
+} auto_exposure_config_t;
+
+/**
+ * Returns false if 'cfg' can't be used.
+ */
+bool auto_exposure_config_is_valid(const auto_exposure_config_t* cfg);
+
+/**
+ * Works out the settings that should follow a frame that was taken with 'measured' and came out
+ * with a weighted mean of 'brightness'. Returns false if its brightness is close enough to the
+ * target that nothing needs to change.
+ */
+bool auto_exposure_step(const auto_exposure_config_t* cfg, const camera_frame_params_t* measured,
+                        uint32_t brightness, camera_frame_params_t* next);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _BIT_DEPTH_H
+#define _BIT_DEPTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Reduced bit depth streaming (see CAMERA_READ_CONFIG_DEPTH): packed 8-bit pixels are cut down to
+ * 4, 2 or 1 bits and bit-packed before they're sent, so that the same link carries 2 to 8 times
+ * as many frames.
+ *
+ * A pixel p becomes p >> (8 - bits), or for 1 bit, 1 if p >= threshold. With dithering, p is
+ * scaled to p - (p >> bits) and an ordered 4x4 Bayer pattern that's spread over one output step is
+ * added to it (saturating) first, which keeps the mean brightness of an area once the host scales
+ * the values back up by 255 / (2^bits - 1); a 1-bit dithered pixel is 1 if that comes to 128 or
+ * more, whatever the threshold.
+ *
+ * Pixels are packed MSB first: the leftmost pixel of every byte is in its top bits. Every row
+ * starts on a byte boundary, so a row that doesn't fill its last byte is padded with 0 bits. Must
+ * match camerainterface.py:unpack_depth.
+ */
+
+typedef struct bit_depth {
+    // 8, 4, 2 or 1. 8 leaves pixels as they are.
+    uint8_t bits;
+
+    // Only for 1 bit without dithering.
+    uint8_t threshold;
+
+    bool dither;
+} bit_depth_t;
+
+/**
+ * Returns true if 'd' is a depth that rows can be reduced to.
+ */
+bool bit_depth_valid(const bit_depth_t* d);
+
+/**
+ * Number of bytes that a row of 'width' pixels takes at 'bits' bits per pixel.
+ */
+uint32_t bit_depth_row_bytes(uint32_t width, uint32_t bits);
+
+/**
+ * Reduces row 'y' of a frame, which is 'width' 8-bit pixels at 'src', to d->bits bits per pixel
+ * and packs it into bit_depth_row_bytes() bytes at 'dst'. 'dst' may be 'src': the packed row never
+ * gets ahead of what's been read.
+ */
+void bit_depth_reduce_row(const bit_depth_t* d, const uint8_t* src, uint32_t width, uint32_t y,
+                          uint8_t* dst);
+
+#endif
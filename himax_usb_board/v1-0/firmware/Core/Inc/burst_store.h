@@ -0,0 +1,49 @@
+#ifndef _BURST_STORE_H
+#define _BURST_STORE_H
+
+#include "camera_read_task.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * RAM that burst and pre-trigger captures record frames into (see CAMERA_READ_CONFIG_BURST and
+ * CAMERA_READ_CONFIG_RING). It's whatever RAM the linker script leaves over between the heap and
+ * the stack, so it grows and shrinks with the rest of the firmware.
+ *
+ * Frames are kept in a ring, oldest first, each one as its camera_frame_header_t followed by its
+ * pixels. A frame that doesn't fit in before the end of the store goes at its start. Only
+ * camera_read_task uses the store.
+ */
+
+// Size of the store in bytes.
+uint32_t burst_store_capacity();
+
+// Bytes that a frame with 'payload_len' bytes of pixels takes up in the store.
+uint32_t burst_store_entry_size(uint32_t payload_len);
+
+// Throws away every frame.
+void burst_store_reset();
+
+/**
+ * Makes room for a frame with header 'hdr' and hdr->payload_len bytes of pixels after the newest
+ * one. If 'evict' is set, the oldest frames are thrown away as far as needed; otherwise the store
+ * counts as full once it would have to. Returns where its pixels go, or NULL if it doesn't fit.
+ * The frame isn't kept unless burst_store_commit() is called before the next
+ * burst_store_begin().
+ */
+uint8_t* burst_store_begin(const camera_frame_header_t* hdr, bool evict);
+
+// Keeps the frame that was started last.
+void burst_store_commit();
+
+// Number of frames that are kept.
+uint32_t burst_store_count();
+
+/**
+ * Takes the oldest frame out of the store. Copies its header to 'hdr' and returns its pixels, or
+ * returns NULL if the store is empty. The pixels stay put until the next burst_store_begin().
+ */
+const uint8_t* burst_store_pop(camera_frame_header_t* hdr);
+
+#endif
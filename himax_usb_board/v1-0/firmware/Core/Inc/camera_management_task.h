@@ -4,22 +4,33 @@
 #include "main.h"
 #include "cmsis_os.h"
 #include "hm01b0_init_bytes.h"
+#include "usb_task.h"
+#include "trigger.h"
+#include "frame_params.h"
+#include "auto_exposure.h"
 
 typedef enum camera_management_type {
     /**
      * Raw i2c write to a camera config register.
      * For some registers (like ones that affect image resolution), this might cause the camera to
      * crash. Changing image resolution should instead be done via the dedicated functions so that
+     * DCMI is reconfigured along with the sensor.
      *
-     * UNIMPLEMENTED
+     * The write is queued on i2c_task without touching DCMI, and answered once it's done. Writes
+     * that the register shadow shows to be redundant are answered right away.
      */
     CAMERA_MANAGEMENT_TYPE_REG_WRITE = 0,
 
     /**
-     * Selects whether the hm01b0 or the hm0360 is active.
-     * This command will have to stop the DCMI interface and reconfigure the DCMI.
+     * Selects whether the hm01b0 or the hm0360 is connected to DCMI. This is carried out as a
+     * transaction that only selects the sensor, so the switch is self-contained. If DCMI is
+     * running, it's halted at the end of the current frame while the new sensor wakes up. DCMI
+     * then gets the crop and packing that were last used with the new sensor and is restarted if
+     * it was running before, and the old sensor is put to sleep.
      *
-     * UNIMPLEMENTED
+     * The response's detail is the time the switch took in microseconds. If DCMI doesn't halt in
+     * time, nothing changes and the status is CAMERA_RESPONSE_INVALID_STATE; a new sensor that
+     * doesn't wake up gives CAMERA_RESPONSE_BUS_ERROR.
      */
     CAMERA_MANAGEMENT_TYPE_SENSOR_SEL,
 
@@ -35,11 +46,59 @@ typedef enum camera_management_type {
     CAMERA_MANAGEMENT_TYPE_DCMI_RESUME,
 
     /**
-     * Configures the frequency of the trigger and whether this camera is a controller or peripheral
-     *
-     * UNIMPLEMENTED
+     * Configures the trigger generator (see trigger.h): whether this camera is a controller or
+     * peripheral, the trigger period, pulse width and delay.
      */
     CAMERA_MANAGEMENT_TYPE_TRIGGER_CONFIG,
+
+    /**
+     * Applies a camera_transaction_t at the next frame boundary. The transaction itself is passed
+     * through camera_transaction_queue because it's too large for the request queue.
+     */
+    CAMERA_MANAGEMENT_TYPE_TRANSACTION,
+
+    /**
+     * Reads up to CAMERA_REG_READ_MAX 8-bit registers of one sensor. Values that are in the
+     * register shadow (see sensor_shadow.h) are answered without touching the bus.
+     */
+    CAMERA_MANAGEMENT_TYPE_REG_READ,
+
+    /**
+     * Switches a sensor to one of the precompiled modes in sensor_modes_table.h. This is applied
+     * like a transaction that also sets the mode's crop and packing.
+     */
+    CAMERA_MANAGEMENT_TYPE_SET_MODE,
+
+    /**
+     * Alternates DCMI between the two sensors every 'interleave_frames' frames, or stops doing so
+     * if that's 0. Every frame's header says which sensor it came from.
+     *
+     * If a switch fails, interleaving stops, and the next interleave request is answered with the
+     * switch's status and detail (as for a transaction) without being carried out.
+     */
+    CAMERA_MANAGEMENT_TYPE_INTERLEAVE,
+
+    /**
+     * Replaces the per-frame exposure / gain schedule. One entry is written to the sensor that's
+     * connected to DCMI at every frame boundary, under group hold, so that all of its registers
+     * take effect on the same frame; the frame headers echo the settings that each frame was
+     * taken with. Without 'repeat', the last entry stays in effect once the schedule has run out;
+     * with it, the schedule starts over. An empty schedule stops the current one.
+     *
+     * The response is sent once the first entry has been written; its detail is the sequence
+     * number of the first frame that's taken with it. The sensor's own auto exposure has to be
+     * off, or it will fight the schedule.
+     */
+    CAMERA_MANAGEMENT_TYPE_FRAME_PARAMS,
+
+    /**
+     * Turns the firmware's auto exposure (see auto_exposure.h) on or off. While it's on, the
+     * brightness of every frame is measured while it's packed, and corrected exposure and gains
+     * are written under group hold at frame boundaries like schedule entries, so the frame
+     * headers echo them. It ends a schedule and is ended by one, and by host writes to exposure
+     * or gain registers. The sensor's own auto exposure has to be off.
+     */
+    CAMERA_MANAGEMENT_TYPE_AUTO_EXPOSURE,
 } camera_management_type_e;
 
 
@@ -61,17 +120,82 @@ typedef struct i2c_reg_write {
 } i2c_reg_write_t;
 
 
+// This must match the max_count of pb_camera_management_request_reg_read.register_addresses and
+// the max_size of pb_camera_response.reg_values in camera_command.options.
+#define CAMERA_REG_READ_MAX 16
+
+// This must match the max_count of pb_camera_management_request_frame_params.entries in
+// camera_command.options.
+#define CAMERA_FRAME_PARAMS_MAX 8
+
+// This must match the max_count of pb_camera_transaction.reg_writes in camera_command.options,
+// which says how many writes fit in a request.
+#define CAMERA_TRANSACTION_MAX_REG_WRITES 64
+
+/**
+ * A batch of configuration changes that are applied together. See camera_command.proto:
+ * pb_camera_transaction for the order in which they're applied.
+ */
+typedef struct camera_transaction {
+    // Should be 7 bits, right-justified.
+    uint8_t peripheral_address;
+
+    // Each entry is (register address << 8) | data.
+    int reg_writes_count;
+    uint32_t reg_writes[CAMERA_TRANSACTION_MAX_REG_WRITES];
+
+    // These are only applied if the corresponding 'has_' flag is set.
+    bool has_sensor_select;
+    int sensor_select;
+
+    bool has_crop;
+    struct {
+        int start_x;
+        int start_y;
+        int len_x;
+        int len_y;
+    } crop;
+
+    bool has_pack;
+    bool pack;
+
+    // Start DCMI afterwards even if it was halted before the transaction.
+    bool resume;
+
+    // If this isn't NULL, it's a script from sensor_mode_scripts that's written after reg_writes,
+    // followed by a command update.
+    const uint8_t* reg_script;
+} camera_transaction_t;
+
 typedef struct camera_management_request {
     camera_management_type_e request_type;
 
+    // Acknowledged once the request has been carried out.
+    camera_request_ack_t ack;
+
     union {
         i2c_reg_write_t reg_write;
+        struct {
+            uint8_t peripheral_address;
+            uint8_t count;
+            uint16_t regs[CAMERA_REG_READ_MAX];
+        } reg_read;
         int sensor_select;
         struct {
-            //
-            int period;
-            int controller;
-        } trigger_setup;
+            int mode;
+            bool resume;
+        } set_mode;
+        int interleave_frames;
+        trigger_config_t trigger_config;
+        struct {
+            uint8_t count;
+            bool repeat;
+            camera_frame_params_t entries[CAMERA_FRAME_PARAMS_MAX];
+        } frame_params;
+        struct {
+            bool enable;
+            auto_exposure_config_t config;
+        } auto_exposure;
     } params;
 } camera_management_request_t;
 
@@ -92,9 +216,36 @@ void camera_management_task_enqueue_request(const camera_management_request_t* r
 
 /**
  * These utility functions enqueue the corresponding type of camera management request.
+ * 'ack' may be NULL if no response should be sent to the host.
  */
-void camera_management_task_reg_write(uint8_t i2c_addr, uint16_t reg_addr, uint8_t data);
+void camera_management_task_reg_write(uint8_t i2c_addr, uint16_t reg_addr, uint8_t data,
+                                      const camera_request_ack_t* ack);
+
+// Reads 'count' registers, which don't have to be consecutive. The values are sent in the response.
+void camera_management_task_reg_read(uint8_t i2c_addr, const uint16_t* regs, int count,
+                                     const camera_request_ack_t* ack);
 
 // "true" selects hm01b0, "false" selects hm0360.
-void camera_management_task_sensor_select(bool which);
+void camera_management_task_sensor_select(bool which, const camera_request_ack_t* ack);
+
+// 'mode' is one of the SENSOR_MODE_* ids in sensor_modes_table.h.
+void camera_management_task_set_mode(int mode, bool resume, const camera_request_ack_t* ack);
+
+// 0 stops interleaving.
+void camera_management_task_interleave(int frames_per_sensor, const camera_request_ack_t* ack);
+
+void camera_management_task_trigger_config(const trigger_config_t* cfg,
+                                           const camera_request_ack_t* ack);
+
+// 'count' entries of 'entries'; 0 stops the schedule.
+void camera_management_task_frame_params(const camera_frame_params_t* entries, int count,
+                                         bool repeat, const camera_request_ack_t* ack);
+
+// 'cfg' may be NULL when turning auto exposure off.
+void camera_management_task_auto_exposure(bool enable, const auto_exposure_config_t* cfg,
+                                          const camera_request_ack_t* ack);
+
+// Copies 't' into camera_transaction_queue; blocks if a previous transaction is still pending.
+void camera_management_task_transaction(const camera_transaction_t* t,
+                                        const camera_request_ack_t* ack);
 #endif
@@ -3,6 +3,15 @@
 
 #include "main.h"
 #include "cmsis_os.h"
+#include "usb_task.h"
+#include "frame_stats.h"
+
+// Event bits in camera_read_task_events.
+#define CAMERA_READ_EVENT_HALTED (1 << 0)
+
+// Most lookup table entries that one CAMERA_READ_CONFIG_LUT request carries. Must match
+// camera_command.options:pb_camera_read_request_lut.entries.
+#define CAMERA_LUT_PIECE 64
 
 typedef enum camera_read_config_type {
     // specifies image sensor size for DCMI
@@ -16,15 +25,200 @@ typedef enum camera_read_config_type {
     // sends bytes in 2 cycles
     CAMERA_READ_CONFIG_SETPACKING,
 
+    // Starts or stops the synthetic test-pattern source. See camera_test_pattern_e.
+    CAMERA_READ_CONFIG_TEST_PATTERN,
+
+    // Chooses what's sent to USB for every frame: the pixels of every n-th frame or of none, and
+    // a statistics record (see frame_stats.h) or not. Takes effect at the next frame start.
+    CAMERA_READ_CONFIG_STREAM,
+
+    // Records the next frames into RAM (see burst_store.h) as fast as they come in, then sends
+    // them. Nothing else goes to USB until the burst has been sent. The request is acknowledged
+    // once recording is done, with the number of frames that were recorded as the detail.
+    CAMERA_READ_CONFIG_BURST,
+
+    // Arms or disarms a pre-trigger capture: the newest frames are kept in RAM without being sent
+    // until an event, then some more are recorded and all of them are sent like a burst. Events
+    // are CAMERA_READ_CONFIG_EVENT, rising edges on gpio3 and motion between frames.
+    CAMERA_READ_CONFIG_RING,
+
+    // Fires the event of an armed pre-trigger capture.
+    CAMERA_READ_CONFIG_EVENT,
+
+    // Turns changed-tile streaming (see tile_delta.h) on or off. Takes effect at the next frame
+    // start, which is a keyframe.
+    CAMERA_READ_CONFIG_DELTA,
+
+    // Chooses how frames that are streamed whole are compressed. See camera_codec_e. Takes effect
+    // at the next frame start.
+    CAMERA_READ_CONFIG_CODEC,
+
+    // Sets the number of bits per pixel that frames streamed whole are sent with; see bit_depth.h.
+    // Takes effect at the next frame start.
+    CAMERA_READ_CONFIG_DEPTH,
+
+    // Uploads a piece of a pixel lookup table, or swaps the uploaded table in at the next frame
+    // start. See camera_read_task_lut_write() and camera_read_task_lut_commit().
+    CAMERA_READ_CONFIG_LUT,
+
+    // Turns the focus metric record (see focus_metric.h) that's sent after every frame on or off,
+    // and sets the region that it covers. Takes effect at the next frame start.
+    CAMERA_READ_CONFIG_FOCUS,
+
     // This command can stop or start DCMI reads.
-    // DCMI reading must be stopped before crop or size are changed, but DCMI reads won't halt
-    // until frame end is reached.
-    // If a DCMI halt is pending, camera_read_task will defer further config requests until the
-    // DCMI has been halted.
-    // If no DCMI halt is pending but there are config requests, then the requests will be discarded
+    // Size, crop and packing can be changed while DCMI is running: the change is latched at the
+    // end of the current frame. DCMI only needs to be halted to switch image sensors.
+    // DCMI reads won't halt until frame end is reached.
+    // If a DCMI halt is pending, camera_read_task will defer further halt / resume requests until
+    // the DCMI has been halted. Other config requests are handled right away.
     CAMERA_READ_CONFIG_HALT
 } camera_read_config_type_e;
 
+/**
+ * Synthetic image sources. These must be kept in sync with camera_command.proto:
+ * pb_camera_read_request_test_pattern.pattern_e, which also describes the patterns.
+ */
+typedef enum camera_test_pattern {
+    CAMERA_TEST_PATTERN_OFF = 0,
+    CAMERA_TEST_PATTERN_RAMP = 1,
+    CAMERA_TEST_PATTERN_COUNTER = 2,
+    CAMERA_TEST_PATTERN_LFSR = 3
+} camera_test_pattern_e;
+
+/**
+ * Compression of streamed frames. These must be kept in sync with camera_command.proto:
+ * pb_camera_read_request_codec.codec_e.
+ */
+typedef enum camera_codec {
+    CAMERA_CODEC_NONE = 0,
+
+    // Every DMA chunk is sent as a CAMERA_FRAME_FORMAT_LOSSLESS slice; see lossless_codec.h.
+    CAMERA_CODEC_LOSSLESS = 1,
+
+    // The bands of 8 rows that every DMA chunk finishes are sent as a CAMERA_FRAME_FORMAT_DCT
+    // slice; see dct_codec.h.
+    CAMERA_CODEC_DCT = 2
+} camera_codec_e;
+
+/**
+ * Every frame sent over USB starts with the 320-byte frame marker ('magic' in
+ * camera_read_task_util.hc), followed by this header, followed by payload_len bytes of image data.
+ * All fields are little-endian. Must match camerainterface.py:FRAME_HEADER_FORMAT.
+ */
+typedef struct __attribute__((packed)) camera_frame_header {
+    // CAMERA_FRAME_HEADER_VERSION and sizeof(camera_frame_header_t)
+    uint8_t version;
+    uint8_t header_len;
+
+    // CAMERA_FRAME_FLAG_* bits
+    uint16_t flags;
+
+    // Counts every frame that camera_read_task starts, including frames that are dropped later on.
+    uint32_t sequence;
+
+    // timebase_now_us() when the frame started.
+    uint32_t timestamp_us;
+
+    // Size of the image in pixels, after packing.
+    uint16_t width;
+    uint16_t height;
+
+    // CAMERA_FRAME_FORMAT_*, CAMERA_FRAME_SOURCE_* and CAMERA_FRAME_SENSOR_*
+    uint8_t format;
+    uint8_t source;
+    uint8_t sensor;
+
+    // Bits per pixel that the frame is streamed with: 8, or 4, 2 or 1 for
+    // CAMERA_FRAME_FORMAT_LOW_DEPTH.
+    uint8_t depth;
+
+    // Number of bytes of image data after the header.
+    uint32_t payload_len;
+
+    // trigger_last_us() when the frame started: the rising edge of the last trigger pulse sent to
+    // the sensors, or 0 if the trigger is off. timestamp_us - trigger_us is the trigger-to-frame
+    // latency.
+    uint32_t trigger_us;
+
+    // Sequence number of the last sync pulse before the frame started (see trigger.h), which is
+    // the same on every board of a synchronized chain, or CAMERA_FRAME_SYNC_NONE. sync_offset_us
+    // is how long after that pulse the frame started.
+    uint32_t sync_sequence;
+    uint32_t sync_offset_us;
+
+    // Exposure and gain settings that were in effect for the frame (see frame_params.h). Only
+    // valid if CAMERA_FRAME_FLAG_PARAMS_VALID is set.
+    uint16_t exposure_lines;
+    uint8_t analog_gain;
+    uint8_t digital_gain;
+} camera_frame_header_t;
+
+#define CAMERA_FRAME_HEADER_VERSION 6
+
+#define CAMERA_FRAME_FLAG_NONE 0
+
+// exposure_lines, analog_gain and digital_gain are known. They're only known for frames that were
+// taken with settings from the per-frame schedule (CAMERA_MANAGEMENT_TYPE_FRAME_PARAMS).
+#define CAMERA_FRAME_FLAG_PARAMS_VALID (1 << 0)
+
+// The frame was recorded by a burst capture and is sent some time after it was taken; it isn't
+// live. Everything else in the header is as it was when the frame was taken.
+#define CAMERA_FRAME_FLAG_REPLAY (1 << 1)
+
+// The frame is the first one that started after the event of a pre-trigger capture. The frames
+// before it were kept from before the event.
+#define CAMERA_FRAME_FLAG_EVENT (1 << 2)
+
+// The frame is sent whole so that the host can rebuild the CAMERA_FRAME_FORMAT_DELTA frames that
+// follow it.
+#define CAMERA_FRAME_FLAG_KEYFRAME (1 << 3)
+
+// The frame's pixels went through the uploaded lookup table (see camera_read_task_lut_commit())
+// when they were packed.
+#define CAMERA_FRAME_FLAG_LUT (1 << 4)
+
+// 8 bits per pixel, row-major, no compression.
+#define CAMERA_FRAME_FORMAT_RAW8 0
+
+// The payload is the frame's frame_stats_record_t instead of its pixels. width and height are
+// still the frame's.
+#define CAMERA_FRAME_FORMAT_STATS 1
+
+// Only the tiles that changed since the last keyframe's reference; see tile_delta.h for the
+// layout. width and height are still the frame's.
+#define CAMERA_FRAME_FORMAT_DELTA 2
+
+// The payload is a slice of the frame's rows, compressed as described in lossless_codec.h. A
+// frame is made up of several of these, each with its own frame marker and header. width and
+// height are still the frame's.
+#define CAMERA_FRAME_FORMAT_LOSSLESS 3
+
+// Like CAMERA_FRAME_FORMAT_LOSSLESS, but the slices are lossy; see dct_codec.h.
+#define CAMERA_FRAME_FORMAT_DCT 4
+
+// depth bits per pixel, bit-packed row by row as described in bit_depth.h.
+#define CAMERA_FRAME_FORMAT_LOW_DEPTH 5
+
+// The payload is the result of running the detection network on the frame, a detect_record_t;
+// see detect_task.h. It follows the frame's pixels, if they're sent. width and height are still
+// the frame's.
+#define CAMERA_FRAME_FORMAT_DETECT 6
+
+// The payload is the frame's focus_record_t; see focus_metric.h. width and height are still the
+// frame's.
+#define CAMERA_FRAME_FORMAT_FOCUS 7
+
+#define CAMERA_FRAME_SOURCE_DCMI 0
+#define CAMERA_FRAME_SOURCE_TEST_PATTERN 1
+
+// Which image sensor the frame came from. These match CAMERA_MANAGEMENT_SENSOR_SELECT_*.
+#define CAMERA_FRAME_SENSOR_HM01B0 0
+#define CAMERA_FRAME_SENSOR_HM0360 1
+#define CAMERA_FRAME_SENSOR_NONE 0xff
+
+// Matches TRIGGER_SYNC_NONE.
+#define CAMERA_FRAME_SYNC_NONE 0xfffffffful
+
 /**
  * This preapres the camera read process to change...
  *  - image size
@@ -35,6 +229,9 @@ typedef enum camera_read_config_type {
 typedef struct camera_read_config {
     camera_read_config_type_e config_type;
 
+    // Acknowledged once the config has been applied (or, for halts, once DCMI has halted).
+    camera_request_ack_t ack;
+
     union {
         // Width and height of image.
         struct {
@@ -43,9 +240,9 @@ typedef struct camera_read_config {
         } image_dims;
 
         // Crop start and length.
-        // NB: current firmware restriction requres len_x * len_y to be an integer multiple of 9600.
-        // this is due to dma transfer size - I *think* that violating this will cause some sort of
-        // frame desync of DMA stall.
+        // NB: every frame has to end on a DMA transfer boundary, so the firmware needs a whole
+        // number of lines (at most one raw buffer's worth) that evenly divides len_y and makes a
+        // multiple of 4 bytes. See camera_read_task_crop_is_valid().
         struct {
             int start_x;
             int start_y;
@@ -58,12 +255,72 @@ typedef struct camera_read_config {
             bool pack;
         } pack_options;
 
-        //
+        // true to halt, false to resume.
         struct {
-            void (*halt_callback)(void**);
-            void** halt_callback_user;
             bool halt;
         } halt_options;
+
+        // frame_rate is in frames per second; 0 means as fast as USB allows.
+        struct {
+            camera_test_pattern_e pattern;
+            uint32_t frame_rate;
+        } test_pattern;
+
+        // pixel_interval: the pixels of every pixel_interval-th frame are sent; 0 sends none.
+        struct {
+            uint32_t pixel_interval;
+            bool stats;
+        } stream;
+
+        struct {
+            uint32_t frames;
+        } burst;
+
+        // motion_threshold: mean absolute difference of the tile means of two frames in a row
+        // (see frame_stats.h) that counts as an event, or 0 for none.
+        struct {
+            uint32_t pre_frames;
+            uint32_t post_frames;
+            bool gpio;
+            uint8_t motion_threshold;
+        } ring;
+
+        // See tile_delta_t. keyframe_interval: every keyframe_interval-th frame that's sent is a
+        // keyframe, or only the ones that are needed if that's 0.
+        struct {
+            bool enable;
+            uint8_t threshold;
+            uint8_t hysteresis;
+            uint32_t keyframe_interval;
+        } delta;
+
+        // quality: 1 - 100, only for CAMERA_CODEC_DCT.
+        struct {
+            camera_codec_e codec;
+            uint8_t quality;
+        } codec;
+
+        // See bit_depth_t.
+        struct {
+            uint8_t bits;
+            uint8_t threshold;
+            bool dither;
+        } depth;
+
+        // Unless commit is set, entries[0 .. count - 1] go to entries offset onwards of the
+        // table that's being uploaded. With commit set, count is the size of the table.
+        struct {
+            bool commit;
+            uint16_t offset;
+            uint16_t count;
+            uint8_t entries[CAMERA_LUT_PIECE];
+        } lut;
+
+        // roi: see focus_metric_begin().
+        struct {
+            bool enable;
+            frame_stats_roi_t roi;
+        } focus;
     } params;
 } camera_read_config_t;
 
@@ -75,20 +332,150 @@ void camera_read_task(void const* args);
 void camera_read_task_enqueue_config(const camera_read_config_t* req);
 
 // These utility methods are utility methods for accessing camera_read_task_enqueue_config.
-// They should only be called if the DCMI interface has been disabled.
-void camera_read_task_set_size(int width, int height);
-void camera_read_task_set_crop(int start_x, int start_y, int len_x, int len_y);
-void camera_read_task_enable_packing();
-void camera_read_task_disable_packing();
+// If DCMI is running, the new settings take effect on the first frame that starts after the
+// camera read task receives them, and 'ack' is answered at that point.
+// 'ack' may be NULL if no response should be sent to the host.
+void camera_read_task_set_size(int width, int height, const camera_request_ack_t* ack);
+void camera_read_task_set_crop(int start_x, int start_y, int len_x, int len_y,
+                               const camera_request_ack_t* ack);
+void camera_read_task_enable_packing(const camera_request_ack_t* ack);
+void camera_read_task_disable_packing(const camera_request_ack_t* ack);
+
+/**
+ * Returns true if a crop of len_x * len_y bytes can be read by the DMA. See the note on crop_dims.
+ */
+bool camera_read_task_crop_is_valid(int len_x, int len_y);
+
+bool camera_read_task_is_running();
+
+/**
+ * Blocks until the current frame has ended and the sensor is in vertical blanking. Returns
+ * immediately if DCMI is halted, and returns false if no frame ended within 'timeout' ticks.
+ */
+bool camera_read_task_wait_frame_boundary(TickType_t timeout);
+
+/**
+ * Sequence number (see camera_frame_header_t) of the frame that started at the last frame
+ * boundary.
+ */
+uint32_t camera_read_task_frame_start_sequence();
+
+/**
+ * Asks the camera read task to halt the DCMI interface at the end of the current frame. This
+ * doesn't wait for the halt: 'ack' is answered once DCMI has halted, and tasks that need to wait
+ * for it can call camera_read_task_wait_halted().
+ */
+void camera_read_task_halt_dcmi(const camera_request_ack_t* ack);
+
+/**
+ * Asks the camera read task to resume the DCMI interface. If a halt is still pending, the resume
+ * happens after it.
+ */
+void camera_read_task_resume_dcmi(const camera_request_ack_t* ack);
+
+/**
+ * Starts feeding frames of the given test pattern through the packing / USB path. DCMI must be
+ * halted. Passing CAMERA_TEST_PATTERN_OFF stops it.
+ */
+void camera_read_task_set_test_pattern(camera_test_pattern_e pattern, uint32_t frame_rate,
+                                       const camera_request_ack_t* ack);
+
+/**
+ * Sends the pixels of every 'pixel_interval'-th frame (by sequence number), or of none if that's 0,
+ * and a statistics record after every frame if 'stats' is set. Statistics are gathered from every
+ * frame either way.
+ */
+void camera_read_task_set_stream(uint32_t pixel_interval, bool stats,
+                                 const camera_request_ack_t* ack);
+
+/**
+ * Records up to 'frames' frames into RAM, starting at the next frame start, and sends them once
+ * it's done. Fails with CAMERA_RESPONSE_INVALID_STATE if a burst is already going on.
+ */
+void camera_read_task_burst(uint32_t frames, const camera_request_ack_t* ack);
+
+/**
+ * Keeps the newest 'pre_frames' frames in RAM - fewer if 'post_frames' more wouldn't fit after
+ * them - until an event, then records 'post_frames' more and sends them all with
+ * CAMERA_FRAME_FLAG_REPLAY set. Events are camera_read_task_event(), rising edges on gpio3 if
+ * 'gpio' is set, and frames whose tile means moved by 'motion_threshold' on average if that isn't
+ * 0. 'pre_frames' = 0 disarms. Nothing but responses is sent while armed.
+ *
+ * Fails with CAMERA_RESPONSE_INVALID_STATE while a burst is being recorded or sent.
+ */
+void camera_read_task_ring(uint32_t pre_frames, uint32_t post_frames, bool gpio,
+                           uint8_t motion_threshold, const camera_request_ack_t* ack);
+
+/**
+ * Fires the event of an armed pre-trigger capture. Fails with CAMERA_RESPONSE_INVALID_STATE if
+ * none is armed.
+ */
+void camera_read_task_event(const camera_request_ack_t* ack);
+
+/**
+ * Sends the frames that would be streamed as changed tiles against a reference frame, see
+ * tile_delta.h, with a keyframe every 'keyframe_interval' frames and whenever the host's
+ * reference is lost. Tiles count as changed if their mean absolute difference from the
+ * reference is above 'threshold', or 'threshold' - 'hysteresis' if they changed in the last frame.
+ * Frames that are too big for the reference are sent as they are.
+ *
+ * Fails with CAMERA_RESPONSE_BAD_REQUEST if 'hysteresis' is more than 'threshold'.
+ */
+void camera_read_task_set_delta(bool enable, uint8_t threshold, uint8_t hysteresis,
+                                uint32_t keyframe_interval, const camera_request_ack_t* ack);
+
+/**
+ * Compresses the frames that are streamed whole with 'codec' from the next frame start on. That
+ * includes keyframes if the codec is lossless, but not frames that go into the burst store.
+ * Frames that are too wide for the codec are sent as they are. 'quality' (1 - 100) is only used by
+ * CAMERA_CODEC_DCT; a request for it fails with CAMERA_RESPONSE_BAD_REQUEST if it's out of range.
+ */
+void camera_read_task_set_codec(camera_codec_e codec, uint8_t quality,
+                                const camera_request_ack_t* ack);
+
+/**
+ * Sends the frames that are streamed whole with 'bits' (8, 4, 2 or 1) bits per pixel from the next
+ * frame start on, see bit_depth.h. 1-bit pixels are set if they're at least 'threshold', unless
+ * they're dithered. Compressed frames, keyframes of changed-tile streaming and burst frames are
+ * still sent with 8 bits. Fails with CAMERA_RESPONSE_BAD_REQUEST for any other number of bits.
+ */
+void camera_read_task_set_depth(uint8_t bits, uint8_t threshold, bool dither,
+                                const camera_request_ack_t* ack);
+
+/**
+ * Writes 'count' (at most CAMERA_LUT_PIECE) entries of the pixel lookup table that's being
+ * uploaded, starting at entry 'offset'. The table that's in use isn't touched. Fails with
+ * CAMERA_RESPONSE_BAD_REQUEST if the entries run past the end of the table, and with
+ * CAMERA_RESPONSE_INVALID_STATE while a committed table is still waiting to be swapped in.
+ */
+void camera_read_task_lut_write(uint32_t offset, const uint8_t* entries, uint32_t count,
+                                const camera_request_ack_t* ack);
+
+/**
+ * Swaps the uploaded lookup table in at the next frame start, or right away if DCMI is halted
+ * and no test pattern is running. From then on, every packed pixel p is sent as table[p], and
+ * frames carry CAMERA_FRAME_FLAG_LUT. The table is applied while the pixels are packed, so
+ * statistics, auto exposure, changed tiles, codecs and bit depth reduction all see the pixels
+ * that come out of it.
+ *
+ * 'size' is 256 for a full table, 16 for one whose entry i stands for pixels 16i - 16i + 15,
+ * and 0 to go back to sending pixels as they are. Anything else fails with
+ * CAMERA_RESPONSE_BAD_REQUEST. 'ack' is answered once the table is in use, with the sequence
+ * number of the first frame that it's applied to as the detail.
+ */
+void camera_read_task_lut_commit(uint32_t size, const camera_request_ack_t* ack);
 
 /**
- * Asks the camera read task to halt the DCMI interface. Blocks until this is done.
+ * Sends a focus_record_t after every frame that isn't part of a burst if 'enable' is set, whether
+ * or not the frame's pixels are sent. It covers 'roi', or the whole frame if that has no size;
+ * see focus_metric.h.
  */
-void camera_read_task_halt_dcmi();
+void camera_read_task_set_focus(bool enable, const frame_stats_roi_t* roi,
+                                const camera_request_ack_t* ack);
 
 /**
- * Asks the camera read task to resume the DCMI interface. Blocks until this is done.
+ * Blocks until DCMI is halted, or for at most 'timeout' ticks. Returns true if DCMI is halted.
  */
-void camera_read_task_resume_dcmi();
+bool camera_read_task_wait_halted(TickType_t timeout);
 
 #endif
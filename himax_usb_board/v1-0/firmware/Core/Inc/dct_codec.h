@@ -0,0 +1,81 @@
+#ifndef _DCT_CODEC_H
+#define _DCT_CODEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Lossy compression of packed 8-bit pixels (see CAMERA_CODEC_DCT), along the lines of baseline
+ * JPEG: 8x8 blocks are transformed with a DCT, quantized and run-length / entropy coded.
+ *
+ * Blocks are coded a row of blocks (a band of 8 pixel rows) at a time, as soon as the band's last
+ * row has been packed, so bands carry over from one DMA chunk to the next. All bands that are
+ * finished in a chunk are sent as one slice, behind its own frame marker and header; a chunk that
+ * finishes no band sends nothing. Bands at the right and bottom edges of the image are filled up
+ * by repeating the last column / row.
+ *
+ * Pixels are level-shifted by -128 and transformed with the orthonormal 2-D DCT-II, which is two
+ * 8x8 matrix products with CMSIS-DSP. Coefficients are divided by the JPEG luminance quantization
+ * table (ITU T.81 annex K), scaled for 'quality' 1 - 100 the way libjpeg does it, and by 2^shift on
+ * top of that if the band didn't fit in its share of the output buffer otherwise.
+ *
+ * A slice is a dct_slice_header_t followed by its bands, each one made up of shift, the length of
+ * its bits in bytes (16 bits) and the bits, MSB first, padded to a byte. Every block is coded in
+ * zigzag order as
+ *   - the difference of its DC coefficient from the last block's (0 for the first block of a
+ *     band) as a signed Exp-Golomb code: 0, 1, -1, 2, -2, ... are coded as 0, 1, 2, 3, 4, ...
+ *   - for every non-zero AC coefficient, the number of zeros before it plus 1 and its magnitude
+ *     minus 1 as unsigned Exp-Golomb codes, then its sign (1 for negative),
+ *   - a 0 as end of block (the code '1').
+ *
+ * All of this must match camerainterface.py:decode_dct_slice.
+ */
+
+// Widest rows that can be coded. Wider frames are sent as they are.
+#define DCT_CODEC_MAX_WIDTH 640
+
+#define DCT_CODEC_BLOCK 8
+
+typedef struct __attribute__((packed)) dct_slice_header {
+    // Rows of the frame that the slice holds, and the number of bands that they're coded in.
+    uint16_t first_row;
+    uint16_t rows;
+    uint8_t quality;
+    uint8_t bands;
+    uint16_t reserved0;
+
+    // CPU cycles that it took to code the slice, as measured with the microsecond timebase.
+    uint32_t encode_cycles;
+} dct_slice_header_t;
+
+typedef struct dct_codec {
+    // Frame that's being coded.
+    uint16_t width, height;
+    uint16_t blocks_x;
+    uint8_t quality;
+
+    // Quantization step of every coefficient in zigzag order, and 4096 / step: the coefficients
+    // come out of the DCT 16 times too big, so that's what they're multiplied by in 1/65536ths.
+    uint8_t step[64];
+    uint16_t recip[64];
+} dct_codec_t;
+
+/**
+ * Returns true if frames that are 'width' pixels wide can be coded.
+ */
+bool dct_codec_fits(uint32_t width);
+
+/**
+ * Starts coding a 'width' x 'height' frame at 'quality' (1 - 100).
+ */
+void dct_codec_begin(dct_codec_t* c, uint16_t width, uint16_t height, uint8_t quality);
+
+/**
+ * Adds 'n' packed rows, the first of which is row 'y' of the frame, and codes the bands that they
+ * finish into a slice at 'out', which has room for 'out_size' bytes. Returns the length of the
+ * slice, or 0 if no band was finished.
+ */
+uint32_t dct_codec_add_rows(dct_codec_t* c, const uint8_t* rows, uint32_t y, uint32_t n,
+                            uint8_t* out, uint32_t out_size);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef _DETECT_NET_H
+#define _DETECT_NET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * A small int8 CNN for presence detection (see detect_task.h), in the style of the MobileNet
+ * models used for Visual Wake Words, run with CMSIS-NN's q7 functions.
+ *
+ * The input is a 64x64 grey image, pixel p as p - 128. The layers are
+ *   0  3x3 conv, stride 2,      1 ->  8 channels, 32x32
+ *   1  3x3 depthwise, stride 1,        8 channels, 32x32
+ *   2  1x1 conv,                8 -> 16 channels, 32x32
+ *   3  3x3 depthwise, stride 2,       16 channels, 16x16
+ *   4  1x1 conv,               16 -> 32 channels, 16x16
+ *   5  3x3 depthwise, stride 2,       32 channels,  8x8
+ *   6  1x1 conv,               32 -> 64 channels,  8x8
+ *   7  3x3 depthwise, stride 1,       64 channels,  8x8
+ *   8  1x1 conv,               64 -> 64 channels,  8x8
+ *      8x8 average pool
+ *   9  fully connected,        64 -> classes
+ *      softmax
+ * with zero padding of 1 around every 3x3 layer and ReLU after layers 0 - 8. That's about 900k
+ * multiply-accumulates per inference.
+ *
+ * The network has no weights of its own: a model is a detect_model_header_t followed by the
+ * weights and biases of layers 0 - 9 in that order, each array starting on a 4-byte boundary of
+ * the model. Weights are laid out the way CMSIS-NN takes them:
+ *   3x3 conv        [out][ky][kx][in]
+ *   3x3 depthwise   [ky][kx][channel]
+ *   1x1 conv, fc    [out][in]
+ * Every layer computes out = sat8(((bias << bias_shift) + sum + 2^(out_shift - 1)) >> out_shift)
+ * with its own shifts from the header, and the average pool and softmax are those of CMSIS-NN
+ * (arm_avepool_q7_HWC, arm_softmax_q7). All of this must match camerainterface.py:detect_reference.
+ */
+
+#define DETECT_NET_INPUT_DIM 64
+#define DETECT_NET_LAYERS 10
+#define DETECT_NET_MAX_CLASSES 4
+
+// "DNN1" in the first 4 bytes of a model.
+#define DETECT_NET_MODEL_MAGIC 0x314e4e44ul
+
+// Size of a model with DETECT_NET_MAX_CLASSES classes.
+#define DETECT_NET_MAX_MODEL_BYTES 8532
+
+typedef struct __attribute__((packed)) detect_model_header {
+    uint32_t magic;
+
+    // Chosen by whoever made the model; it's sent back with every result.
+    uint32_t model_id;
+
+    // 1 - DETECT_NET_MAX_CLASSES outputs of the last layer.
+    uint8_t classes;
+    uint8_t reserved0[3];
+
+    // Per layer, see above. out_shift must be 1 - 31 and bias_shift at most 24.
+    struct __attribute__((packed)) {
+        uint8_t bias_shift;
+        uint8_t out_shift;
+    } shifts[DETECT_NET_LAYERS];
+} detect_model_header_t;
+
+/**
+ * Size in bytes of a model with 'classes' classes.
+ */
+uint32_t detect_net_model_size(uint32_t classes);
+
+/**
+ * Checks the 'size'-byte model at 'model', which must be 4-byte aligned and stay put, and makes
+ * it the one that detect_net_run() uses. Returns false, leaving no model loaded, if it doesn't
+ * make sense.
+ */
+bool detect_net_load(const uint8_t* model, uint32_t size);
+
+/**
+ * Forgets the loaded model.
+ */
+void detect_net_unload();
+
+/**
+ * Returns the header of the loaded model, or NULL if there's none.
+ */
+const detect_model_header_t* detect_net_model();
+
+/**
+ * Runs the loaded model on the DETECT_NET_INPUT_DIM x DETECT_NET_INPUT_DIM image at 'input' and
+ * writes the outputs of the last layer to 'logits' and their softmax to 'scores' (0 - 127, 128
+ * being a probability of 1), one per class. There must be a model.
+ */
+void detect_net_run(const int8_t* input, int8_t* logits, int8_t* scores);
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef _DETECT_TASK_H
+#define _DETECT_TASK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "camera_read_task.h"
+#include "detect_net.h"
+#include "usb_task.h"
+
+/**
+ * On-device detection: detect_task runs the network in detect_net.h on frames, and sends its
+ * result for every one of them as a CAMERA_FRAME_FORMAT_DETECT record, behind a frame marker and
+ * the frame's header. It runs below the other tasks, so it only takes time that they leave over;
+ * frames that come in while it's still busy with the last one are skipped.
+ *
+ * camera_read_task feeds it while it packs a frame: the pixels nearest to the centres of a 64x64
+ * grid over the frame (pixel ((2i + 1) * width / 128, (2j + 1) * height / 128) for input (i, j)),
+ * as they come out of the lookup table. Frames smaller than 64x64 aren't looked at. Must match
+ * camerainterface.py:detect_input.
+ *
+ * Models are uploaded from the host into RAM DETECT_MODEL_PIECE bytes at a time and then
+ * committed; nothing runs until there's one. With gating on, camera_read_task only streams the
+ * pixels of frames while the last result had the class that's being looked for at or above the
+ * threshold, so the host gets nothing but records and statistics until something is seen. The
+ * frame that a result is for has already been sent (or not) by the time the result is in, so
+ * gating always goes by an earlier frame.
+ */
+
+// Most model bytes that one detect_task_model_write() request carries. Must match
+// camera_command.options:pb_detect_request_model.data.
+#define DETECT_MODEL_PIECE 128
+
+/**
+ * Payload of a CAMERA_FRAME_FORMAT_DETECT record. Must match
+ * camerainterface.py:DETECT_RECORD_FORMAT.
+ */
+typedef struct __attribute__((packed)) detect_record {
+    // model_id of the model that was run.
+    uint32_t model_id;
+
+    // How long the network took, and how long it was from the frame's start until the result was
+    // ready, in timebase microseconds.
+    uint32_t inference_us;
+    uint32_t latency_us;
+
+    // Frames that were due to be looked at since detection was configured, but were skipped
+    // because the network was still busy.
+    uint32_t skipped;
+
+    uint8_t classes;
+
+    // 1 if the score of the class that's being looked for is at or above the threshold.
+    uint8_t present;
+    uint16_t reserved0;
+
+    // Outputs of the last layer and their softmax (0 - 127), for the model's classes.
+    int8_t logits[DETECT_NET_MAX_CLASSES];
+    int8_t scores[DETECT_NET_MAX_CLASSES];
+} detect_record_t;
+
+typedef enum detect_request_type {
+    // Writes a piece of the model that's being uploaded. See detect_task_model_write().
+    DETECT_REQUEST_MODEL_WRITE,
+
+    // Checks the uploaded model and starts using it. See detect_task_model_commit().
+    DETECT_REQUEST_MODEL_COMMIT,
+
+    // See detect_task_configure().
+    DETECT_REQUEST_CONFIG,
+
+    // From camera_read_task: the network input of the frame with header params.frame is ready.
+    DETECT_REQUEST_FRAME
+} detect_request_type_e;
+
+typedef struct detect_request {
+    detect_request_type_e type;
+
+    // Acknowledged once the request has been carried out. Not used for frames.
+    camera_request_ack_t ack;
+
+    union {
+        struct {
+            uint16_t offset;
+            uint16_t count;
+            uint8_t data[DETECT_MODEL_PIECE];
+        } write;
+
+        struct {
+            uint32_t size;
+        } commit;
+
+        struct {
+            uint32_t interval;
+            uint8_t threshold;
+            uint8_t class_index;
+            bool gate;
+        } config;
+
+        camera_frame_header_t frame;
+    } params;
+} detect_request_t;
+
+void detect_task(void const* args);
+
+/**
+ * Writes 'count' (at most DETECT_MODEL_PIECE) bytes of the model that's being uploaded, starting
+ * at byte 'offset'. The model that's in use is unloaded: nothing runs until the next commit.
+ * Fails with CAMERA_RESPONSE_BAD_REQUEST if the bytes run past DETECT_NET_MAX_MODEL_BYTES.
+ */
+void detect_task_model_write(uint32_t offset, const uint8_t* data, uint32_t count,
+                             const camera_request_ack_t* ack);
+
+/**
+ * Loads the first 'size' bytes that were uploaded as the model; see detect_net.h for what a model
+ * looks like. Fails with CAMERA_RESPONSE_BAD_REQUEST, leaving no model loaded, if it doesn't make
+ * sense.
+ */
+void detect_task_model_commit(uint32_t size, const camera_request_ack_t* ack);
+
+/**
+ * Runs the model on every 'interval'-th frame (by sequence number), or on none if that's 0, while
+ * no burst is going on. A result is 'present' if the score of class 'class_index' is at least
+ * 'threshold' (0 - 127). With 'gate' set, frames' pixels are only streamed while the last result
+ * was present. Fails with CAMERA_RESPONSE_BAD_REQUEST if the threshold or class is out of range.
+ */
+void detect_task_configure(uint32_t interval, uint8_t threshold, uint8_t class_index, bool gate,
+                           const camera_request_ack_t* ack);
+
+// These are called by camera_read_task, in this order, for every frame that it packs.
+
+/**
+ * Called at the start of a frame with its header. Starts taking the frame's network input if
+ * it's due to be looked at, the network is free and the frame is 'allowed' (it isn't while a
+ * burst is going on).
+ */
+void detect_task_frame_start(const camera_frame_header_t* hdr, bool allowed);
+
+/**
+ * Called with every packed row of the frame, 'y' being the row's number.
+ */
+void detect_task_add_row(uint32_t y, const uint8_t* row);
+
+/**
+ * Called at the end of the frame. Hands its input to detect_task if it's all there.
+ */
+void detect_task_frame_end();
+
+/**
+ * Returns false if gating is on and the last result wasn't present, which means that frames'
+ * pixels shouldn't be streamed.
+ */
+bool detect_task_gate_open();
+
+#endif
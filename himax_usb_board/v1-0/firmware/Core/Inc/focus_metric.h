@@ -0,0 +1,85 @@
+#ifndef _FOCUS_METRIC_H
+#define _FOCUS_METRIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "frame_stats.h"
+
+/**
+ * Focus metrics that camera_read_task works out from a region of every frame's packed pixels
+ * while it packs them (see CAMERA_READ_CONFIG_FOCUS), for aligning optics without pulling whole
+ * frames to the host.
+ *
+ * At every pixel of the region whose 8 neighbours are in the region too, with a, b and c the
+ * rows above, at and below it:
+ *   gx = (a[x+1] - a[x-1]) + 2 (b[x+1] - b[x-1]) + (c[x+1] - c[x-1])     (Sobel)
+ *   gy = (c[x-1] + 2 c[x] + c[x+1]) - (a[x-1] + 2 a[x] + a[x+1])
+ *   l  = a[x] + c[x] + b[x-1] + b[x+1] - 4 b[x]                          (Laplacian)
+ * and the sums of gx^2 + gy^2 (Tenengrad), of l and of l^2 are sent, exactly, so that the host
+ * can work out the mean Tenengrad and the variance of the Laplacian. Must match
+ * camerainterface.py:focus_reference.
+ *
+ * Every value fits in 16 bits, so two pixels at a time go through the M7's halfword SIMD
+ * instructions, and the sums of squares through its dual multiply-accumulates.
+ */
+
+// Widest region that can be covered. Wider ones are cut down to this.
+#define FOCUS_METRIC_MAX_WIDTH 640
+
+typedef struct focus_metric {
+    // The part of the frame that's covered, [x0, x1) x [y0, y1).
+    uint16_t x0, x1, y0, y1;
+
+    // The last two rows of the region that were added, rows[newest] being the later one.
+    uint8_t rows[2][FOCUS_METRIC_MAX_WIDTH];
+    int newest;
+
+    uint32_t count;
+    uint64_t tenengrad;
+    int64_t laplacian_sum;
+    uint64_t laplacian_sq;
+
+    // Time spent on the frame, in timebase microseconds.
+    uint32_t busy_us;
+} focus_metric_t;
+
+/**
+ * What the host gets of a frame's focus metrics. It's sent like a frame, behind a frame marker and
+ * a camera_frame_header_t with format CAMERA_FRAME_FORMAT_FOCUS. All fields are little-endian.
+ * Must match camerainterface.py:FOCUS_RECORD_FORMAT.
+ */
+typedef struct __attribute__((packed)) focus_record {
+    // The region that was covered, after it was fitted into the frame.
+    uint16_t start_x, start_y, len_x, len_y;
+
+    // Number of pixels that the sums are taken over.
+    uint32_t count;
+
+    // CPU cycles that the frame's metrics took, as measured with the microsecond timebase.
+    uint32_t cycles;
+
+    uint64_t tenengrad;
+    int64_t laplacian_sum;
+    uint64_t laplacian_sq;
+} focus_record_t;
+
+/**
+ * Starts working out the metrics of a 'width' x 'height' frame in 'f', over 'roi' cut down to fit
+ * the frame, or over the whole frame if 'roi' has no size. Only camera_read_task calls this and
+ * focus_metric_add_rows().
+ */
+void focus_metric_begin(focus_metric_t* f, uint16_t width, uint16_t height,
+                        const frame_stats_roi_t* roi);
+
+/**
+ * Adds 'n' rows of 'width' packed pixels, the first of which is row 'y' of the frame. Rows must
+ * come in order.
+ */
+void focus_metric_add_rows(focus_metric_t* f, uint32_t y, const uint8_t* rows, uint32_t width,
+                           uint32_t n);
+
+// Boils 'f' down to what's sent to the host.
+void focus_metric_make_record(const focus_metric_t* f, focus_record_t* r);
+
+#endif
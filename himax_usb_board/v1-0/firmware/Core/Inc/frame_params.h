@@ -0,0 +1,57 @@
+#ifndef _FRAME_PARAMS_H
+#define _FRAME_PARAMS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Exposure and gain settings of one frame, in the units of the sensors' registers.
+ */
+typedef struct camera_frame_params {
+    // Integration time in lines (registers 0x0202 / 0x0203).
+    uint16_t exposure_lines;
+
+    // Analog gain is 2^analog_gain (register 0x0205, bits 6:4).
+    uint8_t analog_gain;
+
+    // Digital gain in 2.6 fixed point, so 0x40 is 1x (registers 0x020e / 0x020f).
+    uint8_t digital_gain;
+} camera_frame_params_t;
+
+/**
+ * Settings that are written under group hold are handed over at the next frame start, but with a
+ * rolling shutter the first rows of that frame have been integrating since before then. Frames
+ * are taken with new settings this many frames after the frame that they were handed over at.
+ *
+ * This is what the sensor datasheets lead to expect; bwcount.py --bracket measures it.
+ */
+#define CAMERA_FRAME_PARAMS_LATENCY 1
+
+/**
+ * Keeps track of which exposure and gain settings are in effect for which frame, so that frame
+ * headers can echo them.
+ *
+ * Only settings that go through camera_management_task's per-frame schedule are known. A register
+ * write from the host that touches exposure, gain or auto exposure makes them unknown again.
+ *
+ * All functions are safe to call from any task.
+ */
+
+// Records that 'p' is in effect from frame 'sequence' (see camera_frame_header_t.sequence) on.
+void frame_params_record(uint32_t sequence, const camera_frame_params_t* p);
+
+// Forgets everything that was recorded.
+void frame_params_forget();
+
+/**
+ * Puts the settings that are in effect for frame 'sequence' into 'p' and returns true, or returns
+ * false if they aren't known.
+ */
+bool frame_params_lookup(uint32_t sequence, camera_frame_params_t* p);
+
+/**
+ * Returns true if a write to 'reg' changes exposure or gain behind the schedule's back.
+ */
+bool frame_params_reg_is_tracked(uint16_t reg);
+
+#endif
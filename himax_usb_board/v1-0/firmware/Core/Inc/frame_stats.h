@@ -0,0 +1,113 @@
+#ifndef _FRAME_STATS_H
+#define _FRAME_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Statistics that camera_read_task gathers from every frame's pixels while it packs them, so that
+ * they don't cost an extra pass over the image.
+ *
+ * A frame's statistics are published once its last row has been packed, whether or not its
+ * pixels made it to USB. Other tasks can pick up the newest ones with frame_stats_latest(), and
+ * the host can have them sent as a frame_stats_record_t after every frame.
+ */
+
+// The image is divided into a grid of this many tiles, whose means are kept separately.
+#define FRAME_STATS_TILES_X 8
+#define FRAME_STATS_TILES_Y 8
+
+/**
+ * A rectangle of the packed image (in the pixels of camera_frame_header_t.width / height) whose
+ * pixels are also summed on their own. A zero-sized region covers nothing.
+ */
+typedef struct frame_stats_roi {
+    uint16_t start_x, start_y, len_x, len_y;
+} frame_stats_roi_t;
+
+typedef struct frame_stats {
+    // camera_frame_header_t.sequence of the frame, and its size in pixels.
+    uint32_t sequence;
+    uint16_t width, height;
+
+    // Sum and number of all pixels.
+    uint32_t sum;
+    uint32_t count;
+
+    // Sum and number of the pixels inside the region of interest.
+    frame_stats_roi_t roi;
+    uint32_t roi_sum;
+    uint32_t roi_count;
+
+    uint32_t histogram[256];
+
+    // Pixel sums of the tiles, and the number of rows in each row of tiles.
+    uint32_t tile_sum[FRAME_STATS_TILES_Y][FRAME_STATS_TILES_X];
+    uint32_t tile_rows[FRAME_STATS_TILES_Y];
+} frame_stats_t;
+
+/**
+ * What the host gets of a frame's statistics. It's sent like a frame, behind a frame marker and a
+ * camera_frame_header_t with format CAMERA_FRAME_FORMAT_STATS, so it carries the frame's sequence
+ * number, timestamps and exposure. All fields are little-endian. Must match
+ * camerainterface.py:STATS_RECORD_FORMAT.
+ */
+typedef struct __attribute__((packed)) frame_stats_record {
+    uint8_t min;
+    uint8_t max;
+    uint8_t tiles_x;
+    uint8_t tiles_y;
+
+    // Mean pixel value in 1/256ths.
+    uint16_t mean_x256;
+
+    // Every histogram bin is the number of pixels with that value, shifted right by
+    // histogram_shift so that it fits in 16 bits.
+    uint8_t histogram_shift;
+    uint8_t reserved0;
+    uint16_t histogram[256];
+
+    // Mean of every tile, row by row.
+    uint8_t tiles[FRAME_STATS_TILES_Y * FRAME_STATS_TILES_X];
+} frame_stats_record_t;
+
+/**
+ * Sets the region of interest. It's picked up at the next frame start. Can be called from any task.
+ */
+void frame_stats_set_roi(const frame_stats_roi_t* roi);
+
+/**
+ * Starts gathering statistics for frame 'sequence', which is 'width' x 'height' packed pixels, in
+ * 's'. Only camera_read_task calls this and frame_stats_add_rows().
+ */
+void frame_stats_begin(frame_stats_t* s, uint32_t sequence, uint16_t width, uint16_t height);
+
+/**
+ * Adds 'n' rows of packed pixels, the first of which is row 'y' of the frame.
+ */
+void frame_stats_add_rows(frame_stats_t* s, uint32_t y, const uint8_t* rows, uint32_t n);
+
+// Makes 's' the newest finished statistics.
+void frame_stats_publish(const frame_stats_t* s);
+
+/**
+ * Copies the newest finished statistics into 's'. Returns false if no frame has finished yet.
+ * Can be called from any task.
+ */
+bool frame_stats_latest(frame_stats_t* s);
+
+/**
+ * Mean pixel value, with every pixel inside the region of interest counted 'roi_weight' times.
+ * Returns 0 for a frame without pixels.
+ */
+uint32_t frame_stats_weighted_mean(const frame_stats_t* s, uint32_t roi_weight);
+
+// Boils 's' down to what's sent to the host.
+void frame_stats_make_record(const frame_stats_t* s, frame_stats_record_t* r);
+
+/**
+ * Puts the mean of every tile into 'tiles', row by row, like frame_stats_record_t.tiles.
+ */
+void frame_stats_tile_means(const frame_stats_t* s, uint8_t* tiles);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef _I2C_TASK_H
+#define _I2C_TASK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Largest read or write that fits in one i2c_transfer_t.
+#define I2C_TRANSFER_MAX_LEN 32
+
+typedef enum i2c_transfer_type {
+    I2C_TRANSFER_WRITE = 0,
+    I2C_TRANSFER_READ
+} i2c_transfer_type_e;
+
+typedef struct i2c_transfer i2c_transfer_t;
+
+/**
+ * Called by i2c_task when a transfer has finished. The next transfer doesn't start until this
+ * returns, so it shouldn't block.
+ */
+typedef void (*i2c_transfer_callback_t)(const i2c_transfer_t* t);
+
+/**
+ * One register read or write. Both of our sensors have 16-bit register addresses and
+ * auto-increment the address after every byte, so 'len' bytes go to / come from consecutive
+ * registers starting at 'reg'.
+ */
+struct i2c_transfer {
+    // Should be 7 bits, right-justified (i.e. r/w bit not included).
+    uint8_t peripheral_address;
+    i2c_transfer_type_e type;
+    uint16_t reg;
+
+    // Data to write, or the data that was read.
+    uint16_t len;
+    uint8_t data[I2C_TRANSFER_MAX_LEN];
+
+    // Filled in by i2c_task. 'status' is HAL_OK, HAL_ERROR (see 'error' for HAL_I2C_ERROR_* bits,
+    // e.g. HAL_I2C_ERROR_AF for a NACK) or HAL_TIMEOUT.
+    HAL_StatusTypeDef status;
+    uint32_t error;
+
+    // Ways to find out that the transfer is done; any of them can be left NULL. 'reply' gets a
+    // copy of the finished transfer, then 'notify' is sent a task notification, then 'callback'
+    // runs on i2c_task.
+    i2c_transfer_t* reply;
+    TaskHandle_t notify;
+    i2c_transfer_callback_t callback;
+
+    // Passed through to the callback untouched.
+    uint32_t context[2];
+};
+
+/**
+ * i2c_task owns hi2c1. It carries out queued transfers one after the other using interrupts and
+ * DMA, and gets the bus going again by itself if a sensor leaves it stuck.
+ */
+void i2c_task(void const* args);
+
+/**
+ * Queues a transfer without waiting for it. Returns false if the queue stayed full for 'timeout'.
+ */
+bool i2c_task_submit(const i2c_transfer_t* t, TickType_t timeout);
+
+/**
+ * Queues a transfer and blocks until it's done. The status and any data that was read are
+ * written back into 't'. Uses the calling task's notification value.
+ */
+HAL_StatusTypeDef i2c_task_transfer(i2c_transfer_t* t);
+
+// How many times the bus had to be recovered since boot.
+uint32_t i2c_task_bus_recoveries();
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _LOSSLESS_CODEC_H
+#define _LOSSLESS_CODEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Lossless compression of packed 8-bit pixels (see CAMERA_CODEC_LOSSLESS), in the spirit of
+ * LOCO-I / JPEG-LS: every pixel is predicted from its neighbours and the prediction error is
+ * Golomb-Rice coded.
+ *
+ * A frame is compressed one DMA chunk at a time, and every chunk becomes a slice that can be
+ * decoded on its own: the first row of a slice is predicted as if there was nothing above it.
+ *
+ * The predictor is left + above - above-left (zero outside the slice), rather than JPEG-LS's
+ * median edge detector. It predicts a little worse on edges, but it's cheap to compute four pixels
+ * at a time with the M7's byte-wise SIMD instructions, and the host can undo it for a whole slice
+ * at once with two cumulative sums. Prediction errors are taken mod 256 and zigzagged to 0 - 255
+ * (0, -1, 1, -2, ...).
+ *
+ * Every row gets its own Rice parameter k (0 - 7), picked from the mean of its errors. A slice is
+ * a lossless_slice_header_t followed by its rows, each one either
+ *   - k, the length of its unary bits in bytes (16 bits), the low k bits of every error packed
+ *     LSB first (padded to a byte), then the rest of every error (e >> k) in unary: that many 0
+ *     bits and a 1, LSB first, or
+ *   - LOSSLESS_RAW_ROW and the row's pixels, if coding it wouldn't save anything.
+ * Keeping the unary bits apart from the fixed-size bits is what lets the host find every code
+ * without walking the bits one by one.
+ *
+ * All of this must match camerainterface.py:decode_lossless_slice.
+ */
+
+// Widest rows that can be coded. Wider frames are sent as they are.
+#define LOSSLESS_MAX_WIDTH 640
+
+// Marks a row that's sent as it is.
+#define LOSSLESS_RAW_ROW 0xff
+
+typedef struct __attribute__((packed)) lossless_slice_header {
+    // Rows of the frame that the slice holds.
+    uint16_t first_row;
+    uint16_t rows;
+
+    // If this is set, the rows follow as they are, without any row headers. This is what happens
+    // if the coded rows wouldn't fit in the output buffer.
+    uint8_t stored;
+    uint8_t reserved0[3];
+
+    // CPU cycles that it took to code the slice, as measured with the microsecond timebase.
+    uint32_t encode_cycles;
+} lossless_slice_header_t;
+
+/**
+ * Returns true if frames that are 'width' pixels wide can be coded.
+ */
+bool lossless_fits(uint32_t width);
+
+/**
+ * Codes 'rows' rows of 'width' pixels, which are rows 'first_row' onwards of the frame, into a
+ * slice at 'out' and returns its length. 'out' has room for 'out_size' bytes, which must be at
+ * least sizeof(lossless_slice_header_t) + rows * width.
+ */
+uint32_t lossless_encode_slice(const uint8_t* pixels, uint32_t width, uint32_t first_row,
+                               uint32_t rows, uint8_t* out, uint32_t out_size);
+
+#endif
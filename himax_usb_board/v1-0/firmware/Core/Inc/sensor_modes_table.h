@@ -0,0 +1,57 @@
+// Generated by util/sensor_modes.py; don't edit. Change the modes there instead.
+
+#ifndef _SENSOR_MODES_TABLE_H
+#define _SENSOR_MODES_TABLE_H
+
+#include <stdint.h>
+
+#define SENSOR_MODE_COUNT 6
+
+// The firmware doesn't know which mode a sensor is in.
+#define SENSOR_MODE_UNKNOWN (-1)
+
+// sensor_mode_diffs entry for modes of two different sensors.
+#define SENSOR_MODE_NO_DIFF 0xffff
+
+enum {
+    SENSOR_MODE_HM01B0_QVGA = 0,    // 324x244 window, the init table's frame timing
+    SENSOR_MODE_HM01B0_QQVGA = 1,    // 2x2 binned QVGA window; about twice the frame rate
+    SENSOR_MODE_HM01B0_FULL = 2,    // full 324x324 array
+    SENSOR_MODE_HM0360_QVGA = 3,    // 2x subsampled, the init table's frame timing
+    SENSOR_MODE_HM0360_VGA = 4,    // full 640x480 array
+    SENSOR_MODE_HM0360_QQVGA = 5,    // 4x subsampled; half the QVGA frame length
+};
+
+// The modes that the sensors' init tables leave them in.
+#define SENSOR_MODE_BOOT_HM01B0 SENSOR_MODE_HM01B0_QVGA
+#define SENSOR_MODE_BOOT_HM0360 SENSOR_MODE_HM0360_QVGA
+
+typedef struct sensor_mode {
+    // Should be 7 bits, right-justified.
+    uint8_t peripheral_address;
+
+    // CAMERA_MANAGEMENT_SENSOR_SELECT_*
+    uint8_t sensor_select;
+
+    // DCMI read path settings that go with the mode. The crop is in DCMI bytes.
+    uint8_t pack;
+    uint16_t crop_start_x;
+    uint16_t crop_start_y;
+    uint16_t crop_len_x;
+    uint16_t crop_len_y;
+
+    // Offset in sensor_mode_scripts of the script that sets every register of the mode.
+    uint16_t full;
+} sensor_mode_t;
+
+extern const sensor_mode_t sensor_modes[SENSOR_MODE_COUNT];
+
+// sensor_mode_diffs[from][to] is the offset in sensor_mode_scripts of the script that
+// switches a sensor from one of its modes to another.
+extern const uint16_t sensor_mode_diffs[SENSOR_MODE_COUNT][SENSOR_MODE_COUNT];
+
+// Each script is a series of runs of consecutive registers: [reg_h, reg_l, n, n values].
+// A run with n = 0 ends the script. The firmware follows every script with a command update.
+extern const uint8_t sensor_mode_scripts[];
+
+#endif
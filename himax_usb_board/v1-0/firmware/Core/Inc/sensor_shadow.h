@@ -0,0 +1,46 @@
+#ifndef _SENSOR_SHADOW_H
+#define _SENSOR_SHADOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * A shadow copy of each image sensor's registers, keyed by the sensor's 7-bit i2c address.
+ *
+ * It holds the last value that was successfully written to or read from every register the
+ * firmware has touched since the sensor's last software reset, or that's queued to be written to
+ * it; a queued write that fails is forgotten. That lets redundant writes be skipped and register
+ * reads be answered without any i2c traffic.
+ *
+ * Some registers can't be trusted to the shadow: ones that the sensor changes by itself (frame
+ * counter, auto exposure results) and ones where the write itself is what matters (software
+ * reset, command update). These are 'volatile'.
+ *
+ * All functions are safe to call from any task.
+ */
+
+/**
+ * If the shadow has a trustworthy value for 'reg', puts it in 'val' and returns true.
+ * Always returns false for volatile registers.
+ */
+bool sensor_shadow_lookup(uint8_t peripheral_address, uint16_t reg, uint8_t* val);
+
+/**
+ * Returns true if writing 'val' to 'reg' wouldn't change anything.
+ */
+bool sensor_shadow_write_is_redundant(uint8_t peripheral_address, uint16_t reg, uint8_t val);
+
+/**
+ * Records 'len' values for consecutive registers starting at 'reg' after they've been
+ * successfully written or read, or once they're queued to be written. A write to the software
+ * reset register clears the shadow.
+ */
+void sensor_shadow_update(uint8_t peripheral_address, uint16_t reg, const uint8_t* vals, int len,
+                          bool is_write);
+
+/**
+ * Forgets registers whose value is unknown, e.g. after a write to them failed.
+ */
+void sensor_shadow_forget(uint8_t peripheral_address, uint16_t reg, int len);
+
+#endif
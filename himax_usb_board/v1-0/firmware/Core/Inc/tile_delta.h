@@ -0,0 +1,89 @@
+#ifndef _TILE_DELTA_H
+#define _TILE_DELTA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Changed-tile streaming (see CAMERA_READ_CONFIG_DELTA). camera_read_task keeps a reference frame
+ * that matches what the host has put together from the frames it was sent. Every new frame is
+ * compared with it in tiles of TILE_DELTA_TILE x TILE_DELTA_TILE pixels while it's packed, and
+ * only the tiles that changed are sent and copied into the reference.
+ *
+ * A tile has changed if the mean absolute difference of its pixels from the reference is above
+ * 'threshold'. A tile that changed in the last frame stays changed as long as the difference is
+ * above threshold - hysteresis, so that a moving object's trail settles fully instead of leaving
+ * the host with whatever was just below the threshold.
+ *
+ * The payload of a CAMERA_FRAME_FORMAT_DELTA frame is a bitmap with one bit per tile, row by row,
+ * LSB first, padded to a multiple of 4 bytes, followed by the pixels of every tile whose bit is
+ * set, each one row-major. Tiles at the right and bottom edges of the image are cut off there.
+ * Must match camerainterface.py:DeltaReconstructor.
+ */
+
+#define TILE_DELTA_TILE 16
+
+// Largest frames that the reference can hold.
+#define TILE_DELTA_MAX_WIDTH 640
+#define TILE_DELTA_MAX_PIXELS (320 * 240)
+#define TILE_DELTA_MAX_TILES 512
+
+#define TILE_DELTA_MAX_BITMAP_BYTES (TILE_DELTA_MAX_TILES / 8)
+
+typedef struct tile_delta {
+    uint8_t threshold, hysteresis;
+
+    // Frame that's being compared.
+    uint16_t width, height;
+    uint16_t tiles_x, tiles_y;
+
+    // Where the payload goes, how much room there is and how much of it is taken.
+    uint8_t* out;
+    uint32_t out_size, out_len;
+    bool overflow;
+
+    // Sums of absolute differences of the tiles of the current row of tiles.
+    uint32_t sad[TILE_DELTA_MAX_WIDTH / TILE_DELTA_TILE];
+
+    // Tiles that changed in the last frame that was sent.
+    uint8_t changed[TILE_DELTA_MAX_BITMAP_BYTES];
+} tile_delta_t;
+
+/**
+ * Returns true if a 'width' x 'height' frame fits in the reference.
+ */
+bool tile_delta_fits(uint32_t width, uint32_t height);
+
+// Bytes of the tile bitmap of a 'width' x 'height' frame.
+uint32_t tile_delta_bitmap_bytes(uint32_t width, uint32_t height);
+
+/**
+ * Starts a keyframe. Its rows go into the reference with tile_delta_keyframe_rows() and it's sent
+ * whole.
+ */
+void tile_delta_begin_keyframe(tile_delta_t* d, uint16_t width, uint16_t height);
+
+/**
+ * Copies 'n' rows of a keyframe, the first of which is row 'y', into the reference.
+ */
+void tile_delta_keyframe_rows(tile_delta_t* d, uint32_t y, const uint8_t* rows, uint32_t n);
+
+/**
+ * Starts comparing a frame with the reference. Its payload goes to 'out', which has room for
+ * 'out_size' bytes. The frame must have the size of the last keyframe.
+ */
+void tile_delta_begin(tile_delta_t* d, uint8_t* out, uint32_t out_size);
+
+/**
+ * Compares 'n' rows of the frame, the first of which is row 'y'. Returns false if the changed
+ * tiles have overflowed 'out'. By then the reference holds part of the frame, so the frame can't be
+ * sent and the next one has to be a keyframe.
+ */
+bool tile_delta_add_rows(tile_delta_t* d, uint32_t y, const uint8_t* rows, uint32_t n);
+
+/**
+ * Returns the length of the frame's payload.
+ */
+uint32_t tile_delta_end(tile_delta_t* d);
+
+#endif
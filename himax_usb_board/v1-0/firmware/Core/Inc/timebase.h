@@ -0,0 +1,24 @@
+#ifndef _TIMEBASE_H
+#define _TIMEBASE_H
+
+#include "main.h"
+
+/**
+ * Starts TIM5 as a free-running 32-bit microsecond counter.
+ *
+ * TIM5 is the only 32-bit timer on this board that isn't already spoken for (TIM2 generates the
+ * hm01b0's MCLK), so it serves as the common timebase for everything that needs timestamps or
+ * latency measurements. The counter wraps every ~71 minutes; take differences with unsigned
+ * arithmetic.
+ */
+void timebase_init();
+
+/**
+ * Returns the current value of the microsecond counter. Safe to call from ISRs.
+ */
+static inline uint32_t timebase_now_us()
+{
+    return TIM5->CNT;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef _TRIGGER_H
+#define _TRIGGER_H
+
+#include "main.h"
+
+#include <stdbool.h>
+
+/**
+ * Hardware-timed trigger pulses for the image sensors and for other boards.
+ *
+ * All edges are scheduled on TIM5, the microsecond timebase (see timebase.h), so they land on
+ * exact microseconds and don't drift:
+ *   - TIM5 CH2 drives hm01b0_trig (PA1) directly from the compare unit, so the hm01b0's pulse has
+ *     no software jitter. hm0360_trig follows it from the compare interrupt.
+ *   - TIM5 CH1 has no pin. On a controller, its compare interrupt drives the sync output on gpio4,
+ *     which goes to the next board's gpio3.
+ *
+ * A controller generates a pulse on gpio4 every 'period_us' and triggers its own sensors
+ * 'delay_us' after that. A peripheral does the same for every rising edge on gpio3, which it
+ * catches through EXTI9. It copies both edges of gpio3 to gpio4 straight from the interrupt, so
+ * boards can be daisy-chained.
+ *
+ * Sync pulses carry their own sequence number, so every board in a chain agrees on it. They come
+ * in blocks of TRIGGER_SYNC_BLOCK: the first pulse of a block is a marker, 3 * width_us wide, and
+ * pulse i after it carries bit (i - 1) of the marker's sequence number, LSB first: 2 * width_us
+ * for a 1, width_us for a 0. A peripheral knows the sequence number once it has seen a whole
+ * block, and counts pulses from there on, checking the count against every block that follows.
+ * All boards in a chain must be configured with the same width_us.
+ *
+ * Both interrupts run at NVIC priority 1, above configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, so
+ * FreeRTOS critical sections never delay them. They must not call into FreeRTOS.
+ */
+
+typedef enum trigger_role {
+    // No pulses. The sensors free-run.
+    TRIGGER_ROLE_OFF = 0,
+    TRIGGER_ROLE_CONTROLLER = 1,
+    TRIGGER_ROLE_PERIPHERAL = 2
+} trigger_role_e;
+
+typedef struct trigger_config {
+    trigger_role_e role;
+
+    // Time between pulses; only used by a controller.
+    uint32_t period_us;
+
+    // Width of the sensor and sync pulses.
+    uint32_t width_us;
+
+    // Time from the sync pulse (sent or received) to the sensor pulse.
+    uint32_t delay_us;
+} trigger_config_t;
+
+// Pulses and gaps shorter than this can't be kept up with by the compare interrupt.
+#define TRIGGER_MIN_US 4
+
+#define TRIGGER_SYNC_BLOCK 33
+
+// Sequence number of a peripheral that hasn't decoded a whole block yet.
+#define TRIGGER_SYNC_NONE 0xfffffffful
+
+/**
+ * Sets up the trigger pins and interrupts with the trigger off. Call after timebase_init().
+ */
+void trigger_init();
+
+/**
+ * Stops any pulses that are in progress and starts over with 'cfg'. Returns false and leaves the
+ * trigger off if 'cfg' is invalid (pulses too short, or width + delay or a marker pulse don't fit
+ * in the period). A controller starts over at sequence number 0.
+ */
+bool trigger_configure(const trigger_config_t* cfg);
+
+/**
+ * timebase_now_us() of the rising edge of the last sensor pulse, or 0 if there hasn't been one
+ * since the trigger was configured. Safe to call from ISRs.
+ */
+uint32_t trigger_last_us();
+
+// Number of sensor pulses since the trigger was configured.
+uint32_t trigger_count();
+
+// Number of sensor pulses that were skipped because the previous one wasn't over.
+uint32_t trigger_missed();
+
+/**
+ * Gets the sequence number and the local timebase_now_us() of the rising edge of the last sync
+ * pulse. The sequence number is TRIGGER_SYNC_NONE if the trigger is off or a peripheral hasn't
+ * synced up yet. Safe to call from ISRs.
+ */
+void trigger_sync_last(uint32_t* sequence, uint32_t* at_us);
+
+/**
+ * Makes rising edges on gpio3 events (see CAMERA_READ_CONFIG_RING) while the trigger isn't a
+ * peripheral. A peripheral needs gpio3 for sync pulses, so it never sees events.
+ */
+void trigger_event_enable(bool enable);
+
+/**
+ * Returns true if there's been an event since the last call.
+ */
+bool trigger_event_take();
+
+#endif
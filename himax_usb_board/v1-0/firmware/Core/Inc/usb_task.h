@@ -1,14 +1,66 @@
 #ifndef _USB_TASK_H
 #define _USB_TASK_H
 
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
 typedef struct usb_write_request {
     /// Source memory to copy from
     void* buf;
 
     /// length of buffer
     uint32_t len;
+
+    /// If this isn't NULL, it's given once the USB peripheral is done with 'buf' and it can be
+    /// reused.
+    SemaphoreHandle_t done;
 } usb_write_request_t;
 
+/**
+ * Status codes reported back to the host in a pb_camera_response.
+ * These must be kept in sync with camera_command.proto:pb_camera_response.status_e.
+ */
+typedef enum camera_response_status {
+    CAMERA_RESPONSE_OK = 0,
+    CAMERA_RESPONSE_BAD_REQUEST = 1,
+    CAMERA_RESPONSE_BUS_ERROR = 2,
+    CAMERA_RESPONSE_INVALID_STATE = 3,
+    CAMERA_RESPONSE_UNSUPPORTED = 4
+} camera_response_status_e;
+
+/**
+ * Every request that's handed from usb_read_task to another task carries one of these so that
+ * the task that finally carries out the request can acknowledge it.
+ */
+typedef struct camera_request_ack {
+    // request_id supplied by the host. 0 means that the host doesn't want a response.
+    uint32_t request_id;
+
+    // timebase_now_us() at the moment the request was decoded.
+    uint32_t received_us;
+} camera_request_ack_t;
+
 void usb_task(void const* args);
 
+/**
+ * Queues a pb_camera_response for the given request on the USB stream. Does nothing if the host
+ * didn't ask for a response. Must be called from task context, and outside of critical sections:
+ * it waits for a response buffer and for room in usb_request_queue if the USB link is behind.
+ */
+void usb_task_send_response(const camera_request_ack_t* ack,
+                            camera_response_status_e status,
+                            int32_t detail);
+
+/**
+ * Same as usb_task_send_response, with up to 16 bytes of data (e.g. register values) in
+ * pb_camera_response.reg_values.
+ */
+void usb_task_send_response_data(const camera_request_ack_t* ack,
+                                 camera_response_status_e status,
+                                 int32_t detail,
+                                 const uint8_t* data,
+                                 int len);
+
 #endif
@@ -0,0 +1,63 @@
+#include "auto_exposure.h"
+
+// 1x digital gain in 2.6 fixed point.
+#define DIGITAL_GAIN_1X 0x40
+
+// Limits of the correction per frame: a saturated or black frame doesn't say how far off it is.
+#define AUTO_EXPOSURE_MAX_RATIO 4
+
+bool auto_exposure_config_is_valid(const auto_exposure_config_t* cfg)
+{
+    return (cfg->target != 0) && (cfg->speed >= 1) && (cfg->speed <= 256) &&
+           (cfg->max_exposure_lines >= 1) && (cfg->max_analog_gain <= 3) &&
+           (cfg->max_digital_gain >= DIGITAL_GAIN_1X) && (cfg->roi_weight >= 1);
+}
+
+bool auto_exposure_step(const auto_exposure_config_t* cfg, const camera_frame_params_t* measured,
+                        uint32_t brightness, camera_frame_params_t* next)
+{
+    const int32_t error = (int32_t)brightness - cfg->target;
+    if ((error <= cfg->tolerance) && (error >= -(int32_t)cfg->tolerance))
+        return false;
+
+    // Total exposure in lines at 1/64x gain. 1 line at 1x is the least there is.
+    const int64_t least = DIGITAL_GAIN_1X;
+    int64_t total = ((int64_t)measured->exposure_lines << measured->analog_gain) *
+                    measured->digital_gain;
+    if (total < least)
+        total = least;
+
+    int64_t desired = (total * cfg->target) / ((brightness != 0) ? brightness : 1);
+    if (desired > (total * AUTO_EXPOSURE_MAX_RATIO))
+        desired = total * AUTO_EXPOSURE_MAX_RATIO;
+    if (desired < (total / AUTO_EXPOSURE_MAX_RATIO))
+        desired = total / AUTO_EXPOSURE_MAX_RATIO;
+
+    int64_t t = total + (((desired - total) * cfg->speed) / 256);
+    if (t < least)
+        t = least;
+
+    // Exposure adds no noise, so it goes up first. Whatever's left is made up with analog gain
+    // in powers of two, then with digital gain.
+    int64_t lines = t / DIGITAL_GAIN_1X;
+    if (lines > cfg->max_exposure_lines)
+        lines = cfg->max_exposure_lines;
+    if (lines < 1)
+        lines = 1;
+
+    const int64_t gain = t / lines;
+    int analog = 0;
+    while ((analog < cfg->max_analog_gain) && (gain >= ((int64_t)DIGITAL_GAIN_1X << (analog + 1))))
+        analog++;
+
+    int64_t digital = gain >> analog;
+    if (digital > cfg->max_digital_gain)
+        digital = cfg->max_digital_gain;
+    if (digital < DIGITAL_GAIN_1X)
+        digital = DIGITAL_GAIN_1X;
+
+    next->exposure_lines = (uint16_t)lines;
+    next->analog_gain = (uint8_t)analog;
+    next->digital_gain = (uint8_t)digital;
+    return true;
+}
@@ -0,0 +1,131 @@
+#include "bit_depth.h"
+#include "main.h"
+
+#include <string.h>
+
+// 4x4 Bayer matrix, in 1/16ths of an output step.
+static const uint8_t bayer[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5},
+};
+
+bool bit_depth_valid(const bit_depth_t* d)
+{
+    return (d->bits == 8) || (d->bits == 4) || (d->bits == 2) || (d->bits == 1);
+}
+
+uint32_t bit_depth_row_bytes(uint32_t width, uint32_t bits)
+{
+    return ((width * bits) + 7) / 8;
+}
+
+/**
+ * Scales 4 pixels by 1 - 2^-bits and adds their dither offsets, if they're dithered; 'scale_mask'
+ * is 0 if they aren't. Values are cut off to the top 'bits' bits after this, so the dithered
+ * levels average out to the pixel's value on the 0 - 255 scale that q * 255 / (2^bits - 1) gets
+ * back to.
+ */
+static inline uint32_t dither_word4(uint32_t w, uint32_t bits, uint32_t scale_mask,
+                                    uint32_t dither_word)
+{
+    return __UQADD8(__USUB8(w, (w >> bits) & scale_mask), dither_word);
+}
+
+/**
+ * Reduces and packs pixels 'i' onwards of the row one at a time. 'dither' holds the dither
+ * offsets of the row's pixels, by x mod 4, and 'threshold' is what a 1-bit pixel is compared to.
+ */
+static void reduce_tail(const bit_depth_t* d, const uint8_t* src, uint32_t i, uint32_t width,
+                        const uint8_t* dither, uint32_t threshold, uint8_t* dst)
+{
+    uint32_t acc = 0, n = 0;
+    dst += (i * d->bits) / 8;
+    for (; i < width; i++) {
+        uint32_t p = src[i];
+        if (d->dither)
+            p -= p >> d->bits;
+        p += dither[i & 3];
+        if (p > 0xff)
+            p = 0xff;
+        const uint32_t q = (d->bits == 1) ? (p >= threshold) : (p >> (8 - d->bits));
+        acc = (acc << d->bits) | q;
+        n += d->bits;
+        if (n == 8) {
+            *dst++ = acc;
+            acc = n = 0;
+        }
+    }
+    if (n != 0)
+        *dst = acc << (8 - n);
+}
+
+void bit_depth_reduce_row(const bit_depth_t* d, const uint8_t* src, uint32_t width, uint32_t y,
+                          uint8_t* dst)
+{
+    // dither offsets repeat every 4 pixels, so one word holds them for 4 pixels at a time.
+    uint8_t dither[4] = {0};
+    if (d->dither) {
+        const uint32_t step = 256u >> d->bits;
+        for (int x = 0; x < 4; x++)
+            dither[x] = (bayer[y & 3][x] * step) / 16;
+    }
+    uint32_t dither_word;
+    memcpy(&dither_word, dither, sizeof(dither_word));
+    const uint32_t scale_mask = d->dither ? ((0xffu >> d->bits) * 0x01010101u) : 0;
+    const uint32_t threshold = d->dither ? 128 : d->threshold;
+
+    uint32_t i = 0;
+    switch (d->bits) {
+        case 4:
+            // 4 pixels -> 2 bytes: the top nibbles of pixels 0 and 2 stay where they are, those of
+            // pixels 1 and 3 come down next to them.
+            for (; (i + 4) <= width; i += 4) {
+                uint32_t w;
+                memcpy(&w, src + i, sizeof(w));
+                w = dither_word4(w, 4, scale_mask, dither_word);
+                const uint32_t c = (w & 0x00f000f0u) | ((w >> 12) & 0x000f000fu);
+                dst[(i / 2) + 0] = c & 0xff;
+                dst[(i / 2) + 1] = (c >> 16) & 0xff;
+            }
+            break;
+
+        case 2:
+            // 4 pixels -> 1 byte: the multiply moves the 2-bit values of pixels 0 - 3 to bits
+            // 30, 28, 26 and 24 without any of the other products reaching them.
+            for (; (i + 4) <= width; i += 4) {
+                uint32_t w;
+                memcpy(&w, src + i, sizeof(w));
+                w = dither_word4(w, 2, scale_mask, dither_word);
+                dst[i / 4] = (((w >> 6) & 0x03030303u) * 0x40100401u) >> 24;
+            }
+            break;
+
+        case 1: {
+            // 8 pixels -> 1 byte: USUB8 sets a GE flag for every pixel that's >= threshold, SEL
+            // turns those into the pixels' bits and USADA8 adds them up.
+            const uint32_t threshold_word = threshold * 0x01010101u;
+            for (; (i + 8) <= width; i += 8) {
+                uint32_t w0, w1;
+                memcpy(&w0, src + i, sizeof(w0));
+                memcpy(&w1, src + i + 4, sizeof(w1));
+                w0 = dither_word4(w0, 1, scale_mask, dither_word);
+                w1 = dither_word4(w1, 1, scale_mask, dither_word);
+                __USUB8(w0, threshold_word);
+                const uint32_t b0 = __SEL(0x10204080u, 0);
+                __USUB8(w1, threshold_word);
+                const uint32_t b1 = __SEL(0x01020408u, 0);
+                dst[i / 8] = __USADA8(b0, 0, __USADA8(b1, 0, 0));
+            }
+            break;
+        }
+
+        default:
+            if (dst != src)
+                memcpy(dst, src, width);
+            return;
+    }
+
+    reduce_tail(d, src, i, width, dither, threshold, dst);
+}
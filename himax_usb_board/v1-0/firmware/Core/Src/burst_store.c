@@ -0,0 +1,134 @@
+#include "burst_store.h"
+
+#include <string.h>
+
+// Ends of the leftover RAM; see STM32F750Z8Tx_FLASH.ld.
+extern uint8_t _sburst_store[];
+extern uint8_t _eburst_store[];
+
+// The frames are at [head, tail) or, once they've wrapped around to the start of the store, at
+// [head, wrap) followed by [0, tail).
+static uint32_t head;
+static uint32_t tail;
+static uint32_t wrap;
+static bool wrapped;
+static uint32_t count;
+
+// Size of the frame that was started last, or 0 if there's none.
+static uint32_t pending;
+
+uint32_t burst_store_capacity()
+{
+    return _eburst_store - _sburst_store;
+}
+
+/**
+ * Frames start on word boundaries so that their headers and pixels can be read a word at a time.
+ */
+uint32_t burst_store_entry_size(uint32_t payload_len)
+{
+    return (sizeof(camera_frame_header_t) + payload_len + 3) & ~3ul;
+}
+
+void burst_store_reset()
+{
+    head = 0;
+    tail = 0;
+    wrap = 0;
+    wrapped = false;
+    count = 0;
+    pending = 0;
+}
+
+/**
+ * Drops the oldest frame and returns its offset.
+ */
+static uint32_t drop_oldest()
+{
+    camera_frame_header_t hdr;
+    const uint32_t at = head;
+    memcpy(&hdr, _sburst_store + at, sizeof(hdr));
+    head += burst_store_entry_size(hdr.payload_len);
+    count--;
+    if (wrapped && (head >= wrap)) {
+        head = 0;
+        wrapped = false;
+    }
+    if (count == 0)
+        burst_store_reset();
+    return at;
+}
+
+/**
+ * Works out where a 'size' byte frame would go after the newest one without moving anything:
+ * returns whether it fits, and if so its offset and whether it has to go around to the start of
+ * the store.
+ */
+static bool find_room(uint32_t size, uint32_t* at, bool* wraps)
+{
+    *wraps = false;
+    if (!wrapped) {
+        if ((tail + size) <= burst_store_capacity()) {
+            *at = tail;
+            return true;
+        }
+
+        // go around to the start of the store, in front of the oldest frame.
+        *wraps = true;
+        *at = 0;
+        return size <= head;
+    }
+
+    *at = tail;
+    return (tail + size) <= head;
+}
+
+uint8_t* burst_store_begin(const camera_frame_header_t* hdr, bool evict)
+{
+    const uint32_t size = burst_store_entry_size(hdr->payload_len);
+    pending = 0;
+    if (size > burst_store_capacity())
+        return NULL;
+
+    // an empty store always has room, so this ends.
+    uint32_t at;
+    bool wraps;
+    while (!find_room(size, &at, &wraps)) {
+        if (!evict)
+            return NULL;
+        drop_oldest();
+    }
+
+    if (wraps) {
+        wrap = tail;
+        wrapped = true;
+        tail = 0;
+    }
+    memcpy(_sburst_store + at, hdr, sizeof(*hdr));
+    pending = size;
+    return _sburst_store + at + sizeof(*hdr);
+}
+
+void burst_store_commit()
+{
+    if (pending == 0)
+        return;
+    tail += pending;
+    pending = 0;
+    count++;
+}
+
+uint32_t burst_store_count()
+{
+    return count;
+}
+
+const uint8_t* burst_store_pop(camera_frame_header_t* hdr)
+{
+    if (count == 0)
+        return NULL;
+
+    const uint32_t at = drop_oldest();
+    memcpy(hdr, _sburst_store + at, sizeof(*hdr));
+    return _sburst_store + at + sizeof(*hdr);
+}
@@ -1,10 +1,21 @@
 #include "camera_management_task.h"
+#include "camera_read_task.h"
 #include "usb_task.h"
+#include "i2c_task.h"
+#include "sensor_shadow.h"
+#include "sensor_modes_table.h"
 #include "hm01b0_init_bytes.h"
 #include "hm0360_init_bytes.h"
+#include "timebase.h"
+#include "trigger.h"
+#include "frame_params.h"
+#include "frame_stats.h"
+#include "auto_exposure.h"
 
 #define __unused __attribute__((unused))
 
+#include <string.h>
+
 ////////////////////////////////////////////////////////////////
 // FreeRTOS includes
 #include "FreeRTOS.h"
@@ -14,153 +25,736 @@
 #include "list.h"
 #include "portmacro.h"
 
+extern QueueHandle_t camera_management_task_request_queue;
+extern QueueHandle_t camera_transaction_queue;
+
+void hm01b0_i2c_reset();
+HAL_StatusTypeDef hm01b0_i2c_init();
+
+HAL_StatusTypeDef hm0360_i2c_init();
+
+// Both sensors latch new frame timing and window settings when this is written.
+#define HIMAX_COMMAND_UPDATE_REG 0x0104
+
+// Exposure and gain registers, which are the same on both sensors. See frame_params.h for units.
+#define HIMAX_INTEGRATION_H_REG 0x0202
+#define HIMAX_INTEGRATION_L_REG 0x0203
+#define HIMAX_ANALOG_GAIN_REG 0x0205
+#define HIMAX_DIGITAL_GAIN_H_REG 0x020e
+#define HIMAX_DIGITAL_GAIN_L_REG 0x020f
+
+// The mode that each sensor is in, indexed by CAMERA_MANAGEMENT_SENSOR_SELECT_*.
+static int sensor_mode[2] = {SENSOR_MODE_UNKNOWN, SENSOR_MODE_UNKNOWN};
+
+/**
+ * Collects writes to consecutive sensor registers so that they can be sent as one i2c write:
+ * both sensors auto-increment the register address after every data byte.
+ */
+typedef struct sensor_burst {
+    i2c_transfer_t t;
+
+    // Caller-defined index of the first write in the burst.
+    int first;
+} sensor_burst_t;
+
+static void sensor_burst_init(sensor_burst_t* b, uint8_t peripheral_address)
+{
+    memset(b, 0, sizeof(*b));
+    b->t.peripheral_address = peripheral_address;
+    b->t.type = I2C_TRANSFER_WRITE;
+}
+
+/**
+ * Sends the writes that have been collected in 'b', if there are any, and waits for i2c_task to
+ * finish them. The register shadow is kept up to date.
+ */
+static HAL_StatusTypeDef sensor_burst_flush(sensor_burst_t* b)
+{
+    if (b->t.len == 0)
+        return HAL_OK;
+
+    const HAL_StatusTypeDef err = i2c_task_transfer(&b->t);
+    if (err == HAL_OK)
+        sensor_shadow_update(b->t.peripheral_address, b->t.reg, b->t.data, b->t.len, true);
+    else
+        sensor_shadow_forget(b->t.peripheral_address, b->t.reg, b->t.len);
+    b->t.len = 0;
+    return err;
+}
+
 /**
- * Triggers
+ * Adds one register write to 'b'. If it doesn't continue the burst, the burst is sent first and
+ * a new one is started with 'index' as its first write. A failure is from the burst that was sent.
  *
- * The easiest way to do this is to:
- *   - by default, the camera does not record frames and instead waits for a trigger.
- *   - if the user button is short-pressed, the camera starts to generate triggers and also record
- *     frames.
- *   - Not ideal, but inter-camera triggers and mcu -> sensor triggers will all be processed by
- *     software interrupts.
- *   - Inter-camera triggers will be generated by software as well.
+ * A write that the register shadow says wouldn't change anything is dropped, unless it continues
+ * the burst: one more data byte is cheaper than splitting the burst in two. Registers that are
+ * already in the burst are never dropped, since the shadow doesn't know about the values that are
+ * waiting to be sent to them.
  */
+static HAL_StatusTypeDef sensor_burst_add(sensor_burst_t* b, int index, uint16_t addr, uint8_t data)
+{
+    const bool continues = (b->t.len != 0) && (addr == (uint16_t)(b->t.reg + b->t.len)) &&
+                           (b->t.len < I2C_TRANSFER_MAX_LEN);
+    const bool in_burst = (b->t.len != 0) && ((uint16_t)(addr - b->t.reg) < b->t.len);
+    if (!continues && !in_burst &&
+        sensor_shadow_write_is_redundant(b->t.peripheral_address, addr, data))
+        return HAL_OK;
+
+    if ((b->t.len != 0) && !continues) {
+        const HAL_StatusTypeDef err = sensor_burst_flush(b);
+        if (err != HAL_OK)
+            return err;
+    }
 
-// PF9 is the external trigger signal.
-void EXTI9_5_IRQHandler() {
-    if (EXTI->PR & (1 << 9)) {
-        // send trigger pulse to hm01b0 by enabling tim5 for a one-shot
-        TIM5->CR1 |= (1 << 0);
+    if (b->t.len == 0) {
+        b->t.reg = addr;
+        b->first = index;
+    }
+    b->t.data[b->t.len++] = data;
+    return HAL_OK;
+}
 
-        // Clear exti 9
-        EXTI->PR |= (1 << 9);
+/**
+ * Writes one 8-bit register of an image sensor and waits for it. 'peripheral_address' is the 7-bit
+ * i2c address.
+ */
+static HAL_StatusTypeDef sensor_reg_write(uint8_t peripheral_address, uint16_t addr, uint8_t data)
+{
+    i2c_transfer_t t = {
+        .peripheral_address = peripheral_address,
+        .type = I2C_TRANSFER_WRITE,
+        .reg = addr,
+        .len = 1,
+        .data = {data}
+    };
+    const HAL_StatusTypeDef err = i2c_task_transfer(&t);
+    if (err == HAL_OK)
+        sensor_shadow_update(peripheral_address, addr, &data, 1, true);
+    else
+        sensor_shadow_forget(peripheral_address, addr, 1);
+    return err;
+}
 
-        // toggle LED1
-        // HAL_GPIO_TogglePin(led1_GPIO_Port, led1_Pin);
+/**
+ * Runs on i2c_task when a register write from the host has finished. The shadow already has the
+ * value from when the write was submitted - later writes to the same register may have been
+ * submitted since, so it's only touched if the write failed.
+ */
+static void host_reg_write_done(const i2c_transfer_t* t)
+{
+    camera_request_ack_t ack;
+    memcpy(&ack, t->context, sizeof(ack));
+    if (t->status == HAL_OK) {
+        usb_task_send_response(&ack, CAMERA_RESPONSE_OK, 0);
+    } else {
+        sensor_shadow_forget(t->peripheral_address, t->reg, t->len);
+        usb_task_send_response(&ack, CAMERA_RESPONSE_BUS_ERROR, t->error);
     }
 }
 
-// TODO: if we are a trigger generator, then have a timer interrupt that triggers the other lilcam and
-// also our image sensor
+/**
+ * Reads 'count' registers into 'vals'. Registers in the shadow are taken from there; the rest are
+ * read from the sensor, one i2c read per run of consecutive addresses.
+ *
+ * Returns the index of the first register that couldn't be read, or -1 if they all were.
+ */
+static int sensor_reg_read(uint8_t peripheral_address, const uint16_t* regs, int count,
+                           uint8_t* vals)
+{
+    bool cached[CAMERA_REG_READ_MAX];
+    for (int i = 0; i < count; i++)
+        cached[i] = sensor_shadow_lookup(peripheral_address, regs[i], &vals[i]);
+
+    for (int i = 0; i < count; ) {
+        if (cached[i]) {
+            i++;
+            continue;
+        }
 
-extern QueueHandle_t camera_management_task_request_queue;
+        // extend the run for as long as the addresses are consecutive and uncached.
+        int n = 1;
+        while (((i + n) < count) && !cached[i + n] && (regs[i + n] == (uint16_t)(regs[i] + n)))
+            n++;
+
+        i2c_transfer_t t = {
+            .peripheral_address = peripheral_address,
+            .type = I2C_TRANSFER_READ,
+            .reg = regs[i],
+            .len = n
+        };
+        if (i2c_task_transfer(&t) != HAL_OK)
+            return i;
+
+        memcpy(&vals[i], t.data, n);
+        sensor_shadow_update(peripheral_address, regs[i], t.data, n, false);
+        i += n;
+    }
+    return -1;
+}
 
-#define TG_TASK_BUFSZ 512
-osThreadId TGTaskHandle;
-uint32_t TGTaskBuffer[ TG_TASK_BUFSZ ];
-osStaticThreadDef_t TGTaskControlBlock;
+/**
+ * If a register write from the host hits one of the registers that sensor modes set, the sensor
+ * isn't in a known mode anymore and the next mode switch has to write the whole mode.
+ */
+static void sensor_mode_check_write(uint8_t peripheral_address, uint16_t reg)
+{
+    for (int m = 0; m < SENSOR_MODE_COUNT; m++) {
+        if (sensor_modes[m].peripheral_address != peripheral_address)
+            continue;
+
+        // every mode of a sensor sets the same registers.
+        const uint8_t* p = &sensor_mode_scripts[sensor_modes[m].full];
+        for (; p[2] != 0; p += 3 + p[2]) {
+            const uint16_t first = (p[0] << 8) | p[1];
+            if ((reg >= first) && (reg < (first + p[2])))
+                sensor_mode[sensor_modes[m].sensor_select] = SENSOR_MODE_UNKNOWN;
+        }
+        return;
+    }
+}
 
-static volatile TIM_TypeDef* tim5 = TIM5;
+static void frame_params_check_write(uint16_t reg);
 
 /**
- * This task waits for a user button press. If the user quick-presses button 'A', then the camera
- * switches between triggered and trigger-gen mode.
- *
- * Led 1 mirrors trigger status.
+ * Adds the writes of a mode script (see sensor_modes_table.h) and a command update to 'b'. Runs
+ * are numbered from 'index' on.
  */
-void trigger_generation_task(void* args)
+static HAL_StatusTypeDef apply_mode_script(sensor_burst_t* b, const uint8_t* p, int index)
 {
-    const int MODE_TRIGGERED = 0;
-    const int MODE_TRIGGER_GEN = 1;
+    HAL_StatusTypeDef err = HAL_OK;
+    for (; (p[2] != 0) && (err == HAL_OK); p += 3 + p[2], index++) {
+        const uint16_t first = (p[0] << 8) | p[1];
+        for (int k = 0; (k < p[2]) && (err == HAL_OK); k++)
+            err = sensor_burst_add(b, index, first + k, p[3 + k]);
+    }
 
-    int button_prev = !HAL_GPIO_ReadPin(user_button_GPIO_Port, user_button_Pin);
-    int mode = MODE_TRIGGER_GEN;
-    while (1) {
-        // todo: make rate programmable.
-        // todo: don't launch trigger unless hm01b0 is ready to read another frame
-        osDelay(100);
-        if (mode == MODE_TRIGGER_GEN) {
-            // send trigger to other microcontroller
-            HAL_GPIO_WritePin(gpio4_GPIO_Port, gpio4_Pin, GPIO_PIN_SET);
-
-            HAL_GPIO_WritePin(hm01b0_trig_GPIO_Port, hm01b0_trig_Pin, GPIO_PIN_SET);
-            //TIM5->CR1 |= (1 << 0);
-
-            // toggle LED1
-            //HAL_GPIO_WritePin(led1_GPIO_Port, led1_Pin, GPIO_PIN_SET);
+    if (err == HAL_OK)
+        err = sensor_burst_add(b, index, HIMAX_COMMAND_UPDATE_REG, 0x01);
+    return err;
+}
+
+static int active_sensor()
+{
+    return (HAL_GPIO_ReadPin(camera_select_GPIO_Port, camera_select_Pin) == GPIO_PIN_SET) ?
+        CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0 :
+        CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360;
+}
+
+static void select_sensor(int which)
+{
+    if (which == CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0)
+        HAL_GPIO_WritePin(camera_select_GPIO_Port, camera_select_Pin, GPIO_PIN_SET);
+    else if (which == CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360)
+        HAL_GPIO_WritePin(camera_select_GPIO_Port, camera_select_Pin, GPIO_PIN_RESET);
+}
+
+#define HIMAX_MODE_SELECT_REG 0x0100
+#define HIMAX_MODE_STANDBY 0x00
+#define HIMAX_MODE_STREAMING 0x01
+
+// Whether each sensor is streaming, indexed by CAMERA_MANAGEMENT_SENSOR_SELECT_*. Both are once
+// their init tables have been written.
+static bool sensor_awake[2] = {true, true};
+
+/**
+ * Gets a sensor streaming again after sensor_sleep(). Does nothing if it's already streaming.
+ */
+static HAL_StatusTypeDef sensor_wake(int which)
+{
+    if (sensor_awake[which])
+        return HAL_OK;
+
+    HAL_StatusTypeDef err = HAL_OK;
+    if (which == CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360)
+        HAL_GPIO_WritePin(hm0360_xsleep_GPIO_Port, hm0360_xsleep_Pin, GPIO_PIN_SET);
+    else
+        err = sensor_reg_write(0x24, HIMAX_MODE_SELECT_REG, HIMAX_MODE_STREAMING);
+
+    sensor_awake[which] = (err == HAL_OK);
+    return err;
+}
+
+/**
+ * Stops a sensor that isn't connected to DCMI from streaming. Both keep their registers: the
+ * hm0360 goes to sleep through its xsleep pin, and the hm01b0, which doesn't have one, is put in
+ * standby over i2c. xshutdown isn't used because the sensor would have to be initialized again.
+ */
+static HAL_StatusTypeDef sensor_sleep(int which)
+{
+    if (!sensor_awake[which])
+        return HAL_OK;
+
+    HAL_StatusTypeDef err = HAL_OK;
+    if (which == CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360)
+        HAL_GPIO_WritePin(hm0360_xsleep_GPIO_Port, hm0360_xsleep_Pin, GPIO_PIN_RESET);
+    else
+        err = sensor_reg_write(0x24, HIMAX_MODE_SELECT_REG, HIMAX_MODE_STANDBY);
+
+    sensor_awake[which] = (err != HAL_OK);
+    return err;
+}
+
+/**
+ * The DCMI read path settings that were last used with each sensor, indexed by
+ * CAMERA_MANAGEMENT_SENSOR_SELECT_*. They're restored when DCMI is switched back to that sensor.
+ */
+typedef struct sensor_dcmi_settings {
+    int start_x;
+    int start_y;
+    int len_x;
+    int len_y;
+    bool pack;
+} sensor_dcmi_settings_t;
+
+static sensor_dcmi_settings_t sensor_dcmi[2];
+
+static void sensor_dcmi_from_mode(int which, int mode)
+{
+    const sensor_mode_t* m = &sensor_modes[mode];
+    sensor_dcmi[which] = (sensor_dcmi_settings_t){
+        m->crop_start_x, m->crop_start_y, m->crop_len_x, m->crop_len_y, m->pack
+    };
+}
+
+static void apply_sensor_dcmi(int which)
+{
+    const sensor_dcmi_settings_t* d = &sensor_dcmi[which];
+    camera_read_task_set_size(d->len_x, d->len_y, NULL);
+    camera_read_task_set_crop(d->start_x, d->start_y, d->len_x, d->len_y, NULL);
+    if (d->pack) camera_read_task_enable_packing(NULL);
+    else camera_read_task_disable_packing(NULL);
+}
+
+// If frames stop arriving (e.g. the sensor is waiting on a trigger), a transaction that's waiting
+// for a frame boundary gives up after this long and is applied anyways. One that's waiting for
+// DCMI to halt for a sensor switch is given up altogether.
+#define CAMERA_TRANSACTION_FRAME_TIMEOUT (250 / portTICK_PERIOD_MS)
+
+/**
+ * Carries out a transaction.
+ *
+ * DCMI is only halted if the transaction switches image sensors while DCMI is running; the halt
+ * itself takes effect at the end of the current frame. Otherwise, register writes are issued right
+ * after the current frame ends, and crop / packing changes are latched by the camera read task at
+ * the end of the frame after that.
+ *
+ * A sensor switch is self-contained: the new sensor is woken up while the old one finishes its
+ * frame, DCMI gets the crop and packing that were last used with the new sensor (unless the
+ * transaction sets its own), and the old sensor is put to sleep once DCMI is running again.
+ *
+ * Returns the status for the host; 'detail' is filled in for errors. If the halt for a sensor
+ * switch doesn't happen within CAMERA_TRANSACTION_FRAME_TIMEOUT, nothing is applied and the status
+ * is CAMERA_RESPONSE_INVALID_STATE.
+ */
+static camera_response_status_e apply_transaction(const camera_transaction_t* t, int32_t* detail)
+{
+    *detail = 0;
+    if (t->has_crop && !camera_read_task_crop_is_valid(t->crop.len_x, t->crop.len_y))
+        return CAMERA_RESPONSE_BAD_REQUEST;
+
+    const int old_sensor = active_sensor();
+    const bool sensor_changes = t->has_sensor_select && (t->sensor_select != old_sensor);
+
+    const bool was_running = camera_read_task_is_running();
+    const bool do_halt = sensor_changes && was_running;
+    if (do_halt)
+        camera_read_task_halt_dcmi(NULL);
+
+    // Waking the hm01b0 takes an i2c write; it overlaps with the rest of the old sensor's frame.
+    HAL_StatusTypeDef wake_err = HAL_OK;
+    if (sensor_changes)
+        wake_err = sensor_wake(t->sensor_select);
+
+    if (do_halt) {
+        // with no frames coming in (a trigger peripheral without pulses, a stalled sensor) the halt
+        // never happens. The transaction is given up rather than blocking this task: DCMI goes
+        // back to running once the halt does happen, and the sensor that was woken goes back to
+        // sleep.
+        if (!camera_read_task_wait_halted(CAMERA_TRANSACTION_FRAME_TIMEOUT)) {
+            camera_read_task_resume_dcmi(NULL);
+            if (wake_err == HAL_OK)
+                sensor_sleep(t->sensor_select);
+            return CAMERA_RESPONSE_INVALID_STATE;
         }
+    } else {
+        camera_read_task_wait_frame_boundary(CAMERA_TRANSACTION_FRAME_TIMEOUT);
+    }
 
-        osDelay(1);
+    if (t->has_sensor_select)
+        select_sensor(t->sensor_select);
+    const int sensor = active_sensor();
+
+    // the settings that were recorded belong to the old sensor, and mode scripts may set exposure.
+    if (sensor_changes || (t->reg_script != NULL))
+        frame_params_forget();
+
+    // Runs of consecutive registers go out as single writes. If one fails, the response points
+    // at the first write of the run.
+    camera_response_status_e status = CAMERA_RESPONSE_OK;
+    static sensor_burst_t b;
+    sensor_burst_init(&b, t->peripheral_address);
+    HAL_StatusTypeDef err = HAL_OK;
+    for (int i = 0; (i < t->reg_writes_count) && (err == HAL_OK); i++) {
+        const uint32_t w = t->reg_writes[i];
+        sensor_mode_check_write(t->peripheral_address, (w >> 8) & 0xffff);
+        frame_params_check_write((w >> 8) & 0xffff);
+        err = sensor_burst_add(&b, i, (w >> 8) & 0xffff, w & 0xff);
+    }
+    if ((err == HAL_OK) && (t->reg_script != NULL))
+        err = apply_mode_script(&b, t->reg_script, t->reg_writes_count);
+    if (err == HAL_OK)
+        err = sensor_burst_flush(&b);
+
+    if (err != HAL_OK) {
+        status = CAMERA_RESPONSE_BUS_ERROR;
+        *detail = b.first;
+    }
 
-        if (mode == MODE_TRIGGER_GEN) {
-            // send trigger to other microcontroller
-            HAL_GPIO_WritePin(gpio4_GPIO_Port, gpio4_Pin, GPIO_PIN_RESET);
-            //HAL_GPIO_WritePin(led1_GPIO_Port, led1_Pin, GPIO_PIN_RESET);
+    // The camera read task handles these in order, before the resume below. If DCMI is running,
+    // they don't need a halt.
+    if (status == CAMERA_RESPONSE_OK) {
+        if (t->has_crop) {
+            sensor_dcmi[sensor].start_x = t->crop.start_x;
+            sensor_dcmi[sensor].start_y = t->crop.start_y;
+            sensor_dcmi[sensor].len_x = t->crop.len_x;
+            sensor_dcmi[sensor].len_y = t->crop.len_y;
         }
+        if (t->has_pack)
+            sensor_dcmi[sensor].pack = t->pack;
+    }
+    if (sensor_changes || ((status == CAMERA_RESPONSE_OK) && (t->has_crop || t->has_pack)))
+        apply_sensor_dcmi(sensor);
+
+    if (do_halt || (t->resume && !was_running))
+        camera_read_task_resume_dcmi(NULL);
+
+    if (sensor_changes)
+        sensor_sleep(old_sensor);
+
+    // a sensor that didn't wake up won't send any frames, so that's the error to report.
+    if ((status == CAMERA_RESPONSE_OK) && (wake_err != HAL_OK)) {
+        status = CAMERA_RESPONSE_BUS_ERROR;
+        *detail = -1;
+    }
+    return status;
+}
+
+/**
+ * State of interleaved capture; see CAMERA_MANAGEMENT_TYPE_INTERLEAVE.
+ */
+static struct {
+    // 0 if the sensors aren't being interleaved.
+    int frames_per_sensor;
+
+    // Frames from the active sensor since the last switch.
+    int frames;
+
+    // Why the last switch failed, which stopped interleaving. Reported in the response to the next
+    // interleave request.
+    camera_response_status_e status;
+    int32_t detail;
+} interleave;
 
-        // check button
-        int button_now = !HAL_GPIO_ReadPin(user_button_GPIO_Port, user_button_Pin);
-        if (button_prev && !button_now) {
-            mode = (mode == MODE_TRIGGERED) ? MODE_TRIGGER_GEN : MODE_TRIGGERED;
+static int other_sensor(int which)
+{
+    return (which == CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0) ?
+        CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360 :
+        CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0;
+}
+
+/**
+ * Called at every frame boundary while the sensors are interleaved. Switches DCMI over to the
+ * other sensor after every 'frames_per_sensor' frames.
+ *
+ * The switch is asked for when the last frame starts, so the halt lands right at its end. The other
+ * sensor is woken up a frame before that so that it's already streaming when DCMI switches over;
+ * what's lost is the rest of the new sensor's frame that's in progress at that point.
+ */
+static void interleave_frame()
+{
+    const int k = interleave.frames_per_sensor;
+
+    // 'frames' counts the frames of the active sensor that have started.
+    interleave.frames++;
+    if (interleave.frames >= k) {
+        static camera_transaction_t t;
+        memset(&t, 0, sizeof(t));
+        t.has_sensor_select = true;
+        t.sensor_select = other_sensor(active_sensor());
+
+        int32_t detail = 0;
+        const camera_response_status_e status = apply_transaction(&t, &detail);
+        interleave.frames = 0;
+
+        // Retrying at the next frame would go on tagging frames with a sensor that may never
+        // send any, so interleaving stops here and leaves whichever sensor DCMI ended up with.
+        if (status != CAMERA_RESPONSE_OK) {
+            interleave.frames_per_sensor = 0;
+            interleave.status = status;
+            interleave.detail = detail;
+            return;
         }
     }
+
+    if (interleave.frames >= (k - 1))
+        sensor_wake(other_sensor(active_sensor()));
 }
 
-extern I2C_HandleTypeDef hi2c1;
+/**
+ * State of the per-frame exposure / gain schedule; see CAMERA_MANAGEMENT_TYPE_FRAME_PARAMS.
+ */
+static struct {
+    camera_frame_params_t entries[CAMERA_FRAME_PARAMS_MAX];
+
+    // 0 if there's no schedule.
+    int count;
+
+    // Entry that's written at the next frame boundary.
+    int next;
+    bool repeat;
 
-static void init_internal_hw_trig()
+    // Answered once the first entry has been written.
+    camera_request_ack_t ack;
+    bool ack_pending;
+} param_schedule;
+
+/**
+ * State of the firmware's auto exposure; see CAMERA_MANAGEMENT_TYPE_AUTO_EXPOSURE.
+ */
+static struct {
+    bool enabled;
+    auto_exposure_config_t config;
+
+    // Settings that were last written, and the frame whose statistics they were worked out from.
+    camera_frame_params_t written;
+    uint32_t measured_sequence;
+
+    // First frame that's taken with the settings that auto exposure took over with.
+    bool seeded;
+    uint32_t seed_first;
+} ae;
+
+/**
+ * Ends the schedule. If its request hasn't been answered yet, it's answered with 'status'.
+ */
+static void param_schedule_stop(camera_response_status_e status, int32_t detail)
+{
+    if (param_schedule.ack_pending)
+        usb_task_send_response(&param_schedule.ack, status, detail);
+    param_schedule.ack_pending = false;
+    param_schedule.count = 0;
+}
+
+/**
+ * A register write from the host that changes exposure or gain ends the schedule, and the frame
+ * headers can't tell what the settings are anymore.
+ */
+static void frame_params_check_write(uint16_t reg)
+{
+    if (!frame_params_reg_is_tracked(reg))
+        return;
+    frame_params_forget();
+    param_schedule_stop(CAMERA_RESPONSE_INVALID_STATE, 0);
+    ae.enabled = false;
+}
+
+/**
+ * Writes one entry of the schedule. The writes are held by the sensor until the command update at
+ * the end, which hands them over together at the next frame start.
+ *
+ * Stops at the first write that fails, so that a half-written entry is never handed over.
+ */
+static HAL_StatusTypeDef write_frame_params(uint8_t peripheral_address,
+                                            const camera_frame_params_t* p)
 {
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    const uint16_t regs[] = {
+        HIMAX_INTEGRATION_H_REG, HIMAX_INTEGRATION_L_REG, HIMAX_ANALOG_GAIN_REG,
+        HIMAX_DIGITAL_GAIN_H_REG, HIMAX_DIGITAL_GAIN_L_REG, HIMAX_COMMAND_UPDATE_REG
+    };
+    const uint8_t vals[] = {
+        p->exposure_lines >> 8, p->exposure_lines & 0xff, (p->analog_gain & 0x07) << 4,
+        (p->digital_gain >> 6) & 0x03, (p->digital_gain & 0x3f) << 2, 0x01
+    };
+
+    static sensor_burst_t b;
+    sensor_burst_init(&b, peripheral_address);
+    HAL_StatusTypeDef err = HAL_OK;
+    for (int i = 0; (i < (sizeof(regs) / sizeof(regs[0]))) && (err == HAL_OK); i++)
+        err = sensor_burst_add(&b, i, regs[i], vals[i]);
+    if (err == HAL_OK)
+        err = sensor_burst_flush(&b);
+    return err;
+}
 
-    // setup TIM5 channel 2 on PA1 to trigger hm01b0
-#if 0
-    __HAL_RCC_TIM5_CLK_ENABLE();
+static uint8_t active_sensor_address()
+{
+    return (active_sensor() == CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0) ? 0x24 : 0x35;
+}
 
-    // setup hm01b0 trigger pin as TIM5 CH2
-    GPIO_InitStruct.Pin = hm01b0_trig_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull = GPIO_NOPULL;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-    GPIO_InitStruct.Alternate = GPIO_AF2_TIM5;
-    HAL_GPIO_Init(hm01b0_trig_GPIO_Port, &GPIO_InitStruct);
+/**
+ * Writes 'p' to the active sensor right after a frame boundary and records which frame will be
+ * the first one to be taken with it; that frame's sequence number goes to 'first'.
+ */
+static HAL_StatusTypeDef apply_frame_params(const camera_frame_params_t* p, uint32_t* first)
+{
+    *first = camera_read_task_frame_start_sequence() + 1 + CAMERA_FRAME_PARAMS_LATENCY;
+    const HAL_StatusTypeDef err = write_frame_params(active_sensor_address(), p);
+    if (err == HAL_OK)
+        frame_params_record(*first, p);
+    else
+        frame_params_forget();
+    return err;
+}
 
-    // timer in one-pulse mode
-    TIM5->CR1 |= (1 << 3);
+/**
+ * Takes over from whatever exposure the active sensor has now: reads it back and writes it again,
+ * so that the frames after it have known settings to correct from.
+ *
+ * The exposure and gain registers are volatile in the register shadow (auto exposure itself
+ * rewrites them every frame), so the read always goes over I2C: one read per run of consecutive
+ * registers, queued behind whatever i2c_task is already doing.
+ */
+static HAL_StatusTypeDef ae_seed()
+{
+    static const uint16_t regs[] = {
+        HIMAX_INTEGRATION_H_REG, HIMAX_INTEGRATION_L_REG, HIMAX_ANALOG_GAIN_REG,
+        HIMAX_DIGITAL_GAIN_H_REG, HIMAX_DIGITAL_GAIN_L_REG
+    };
+    uint8_t v[sizeof(regs) / sizeof(regs[0])];
+    if (sensor_reg_read(active_sensor_address(), regs, sizeof(regs) / sizeof(regs[0]), v) >= 0)
+        return HAL_ERROR;
+
+    ae.written = (camera_frame_params_t){
+        .exposure_lines = (v[0] << 8) | v[1],
+        .analog_gain = (v[2] >> 4) & 0x07,
+        .digital_gain = ((v[3] & 0x03) << 6) | (v[4] >> 2)
+    };
+    ae.seeded = true;
+    return apply_frame_params(&ae.written, &ae.seed_first);
+}
 
-    // put channel 2 in PWM1 Mode
-    TIM5->CCMR1 &= ~((0xfful << 8) | (1ul << 24));
-    TIM5->CCMR1 |=  (6 << 12);
-    TIM5->CCER  &= ~(0xful << 4);
-    TIM5->CCER  |=  (1 << 5) | (1 << 4);
+/**
+ * Called at every frame boundary while auto exposure is on: corrects the settings from the
+ * newest frame statistics. Nothing is written unless the settings change.
+ */
+static void ae_frame()
+{
+    // a frame_stats_t is too big for the task's stack.
+    static frame_stats_t stats;
+    if (!frame_stats_latest(&stats) || (stats.sequence == ae.measured_sequence))
+        return;
+
+    // Statistics from before auto exposure took over, or from before a sensor switch, don't
+    // have settings to go with them.
+    camera_frame_params_t measured;
+    if (!frame_params_lookup(stats.sequence, &measured)) {
+        if (ae.seeded && ((int32_t)(stats.sequence - ae.seed_first) < 0))
+            return;
+        if (ae_seed() != HAL_OK)
+            ae.enabled = false;
+        return;
+    }
+    ae.measured_sequence = stats.sequence;
+
+    camera_frame_params_t next;
+    const uint32_t brightness = frame_stats_weighted_mean(&stats, ae.config.roi_weight);
+    if (!auto_exposure_step(&ae.config, &measured, brightness, &next) ||
+        !memcmp(&next, &ae.written, sizeof(next)))
+        return;
+
+    uint32_t first;
+    if (apply_frame_params(&next, &first) != HAL_OK) {
+        ae.enabled = false;
+        return;
+    }
+    ae.written = next;
+}
 
-    // pulse for a bit.
-    // Note that channel is inverted because "idle state" for the timer is '0' and the one-shot
-    // doesn't support
-    // the CCR2 = 1 causes a very short (~10s of ns) delay
-    TIM5->CCR2 = 1;
-    TIM5->ARR = 5000;
-#endif
-    // setup gpio3 (trigger in) as input
-    GPIO_InitStruct.Pin = gpio3_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-    GPIO_InitStruct.Pull = GPIO_PULLDOWN;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-    HAL_GPIO_Init(GPIOF, &GPIO_InitStruct);
+/**
+ * Called at every frame boundary while there's a schedule: writes its next entry and records which
+ * frame will be the first one to be taken with it.
+ */
+static void param_schedule_frame()
+{
+    uint32_t first;
+    if (apply_frame_params(&param_schedule.entries[param_schedule.next], &first) != HAL_OK) {
+        param_schedule_stop(CAMERA_RESPONSE_BUS_ERROR, param_schedule.next);
+        return;
+    }
 
-    // setup exti 9 to be triggered by PF9.
-    // P'F' requires '5'. (A = '0', B = '1', etc)
-    SYSCFG->EXTICR[9 >> 2] &= ~(0b1111 << ((9 & 0x03) * 4));
-    SYSCFG->EXTICR[9 >> 2] |=  (0b0101 << ((9 & 0x03) * 4));
+    if (param_schedule.ack_pending) {
+        usb_task_send_response(&param_schedule.ack, CAMERA_RESPONSE_OK, first);
+        param_schedule.ack_pending = false;
+    }
 
-    EXTI->RTSR |= (1 << 9);           // Enable rising edge on exti trigger 9
-    EXTI->PR   |= (1 << 9);           // Clear exti channel 9
-    EXTI->IMR  |= (1 << 9);           // Unmask exti 9
+    if (++param_schedule.next == param_schedule.count) {
+        if (param_schedule.repeat)
+            param_schedule.next = 0;
+        else
+            param_schedule.count = 0;
+    }
+}
 
-    // Enable exti[9:5] irq with a high priority (1)
-    HAL_NVIC_SetPriority(EXTI9_5_IRQn, 1, 0);
-    HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+// Is there anything that has to be done at every frame boundary?
+static bool frame_work_pending()
+{
+    return (interleave.frames_per_sensor != 0) || (param_schedule.count != 0) || ae.enabled;
 }
 
-void hm01b0_i2c_reset();
-void hm01b0_i2c_init();
+/**
+ * Waits for the next frame boundary and does what has to be done there. Exposure settings go
+ * first, while the sensor is still in blanking.
+ */
+static void frame_step()
+{
+    if (!camera_read_task_wait_frame_boundary(CAMERA_TRANSACTION_FRAME_TIMEOUT))
+        return;
+
+    if (param_schedule.count != 0)
+        param_schedule_frame();
+    if (ae.enabled)
+        ae_frame();
+    if (interleave.frames_per_sensor != 0)
+        interleave_frame();
+}
 
-void hm0360_i2c_init();
+/**
+ * Switches the mode's sensor to it, writing only the registers that differ from the sensor's
+ * current mode.
+ */
+static void apply_mode(int mode, bool resume, const camera_request_ack_t* ack)
+{
+    const sensor_mode_t* m = &sensor_modes[mode];
+    const int from = sensor_mode[m->sensor_select];
+
+    static camera_transaction_t t;
+    memset(&t, 0, sizeof(t));
+    t.peripheral_address = m->peripheral_address;
+    t.reg_script = &sensor_mode_scripts[(from == SENSOR_MODE_UNKNOWN) ?
+                                        m->full : sensor_mode_diffs[from][mode]];
+    t.has_sensor_select = true;
+    t.sensor_select = m->sensor_select;
+    t.has_crop = true;
+    t.crop.start_x = m->crop_start_x;
+    t.crop.start_y = m->crop_start_y;
+    t.crop.len_x = m->crop_len_x;
+    t.crop.len_y = m->crop_len_y;
+    t.has_pack = true;
+    t.pack = m->pack;
+    t.resume = resume;
+
+    int32_t detail;
+    const camera_response_status_e status = apply_transaction(&t, &detail);
+    usb_task_send_response(ack, status, detail);
+    if (status == CAMERA_RESPONSE_OK)
+        sensor_mode[m->sensor_select] = mode;
+    else if (status == CAMERA_RESPONSE_BUS_ERROR)
+        sensor_mode[m->sensor_select] = SENSOR_MODE_UNKNOWN;
+}
 
 
 void camera_management_task(void const* args)
 {
-    //init_internal_hw_trig();
-
     // tim2 channel 3 is hm01b0's mclk. Drive it at 12MHz.
     // tim2 runs at 96MHz. we need to divide it by 8
     TIM2->CCER = (1 << 8);
@@ -180,7 +774,8 @@ void camera_management_task(void const* args)
     // let the MCLK run for a little bit and then do an i2c reset
     osDelay(1);
     hm01b0_i2c_reset();
-    hm01b0_i2c_init();
+    if (hm01b0_i2c_init() == HAL_OK)
+        sensor_mode[CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0] = SENSOR_MODE_BOOT_HM01B0;
 
     // select and enable hm0360
     HAL_GPIO_WritePin(camera_select_GPIO_Port, camera_select_Pin, GPIO_PIN_RESET);
@@ -191,54 +786,174 @@ void camera_management_task(void const* args)
 
     // let the MCLK run for a little bit and then do an i2c reset
     osDelay(1);
-    hm0360_i2c_init();
+    if (hm0360_i2c_init() == HAL_OK)
+        sensor_mode[CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360] = SENSOR_MODE_BOOT_HM0360;
+
+    sensor_dcmi_from_mode(CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0, SENSOR_MODE_BOOT_HM01B0);
+    sensor_dcmi_from_mode(CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360, SENSOR_MODE_BOOT_HM0360);
+
+    // only the sensor that's connected to DCMI streams.
+    sensor_sleep(CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0);
 
     // camera read task must be enabled by sending a command over serial.
     // DCMI is not enabled by default.
 
     while (1) {
-        // wait for a new request
+        // wait for a new request. While the sensors are interleaved or there's an exposure
+        // schedule, frame boundaries have to be handled in between requests; that pauses while
+        // DCMI is halted.
+        TickType_t wait = portMAX_DELAY;
+        if (frame_work_pending())
+            wait = camera_read_task_is_running() ? 0 : (10 / portTICK_PERIOD_MS);
+
         camera_management_request_t req;
-        xQueueReceive(camera_management_task_request_queue, &req, portMAX_DELAY);
+        if (xQueueReceive(camera_management_task_request_queue, &req, wait) != pdTRUE) {
+            if (frame_work_pending() && camera_read_task_is_running())
+                frame_step();
+            continue;
+        }
 
         switch(req.request_type) {
             case CAMERA_MANAGEMENT_TYPE_REG_WRITE: {
                 // don't disable dcmi; if a task needs to disable dcmi, it can do it itself by
-                // talking directly to the camera read task
-                uint8_t buf[3] = {
-                    (req.params.reg_write.addr & 0xff00) >> 8,
-                    (req.params.reg_write.addr & 0x00ff) >> 0,
-                    req.params.reg_write.data
+                // talking directly to the camera read task.
+                // This doesn't wait for the write, so a series of writes from the host goes out at
+                // bus speed. The response is sent from i2c_task once the write is done.
+                sensor_mode_check_write(req.params.reg_write.peripheral_address,
+                                        req.params.reg_write.addr);
+                frame_params_check_write(req.params.reg_write.addr);
+                if (sensor_shadow_write_is_redundant(req.params.reg_write.peripheral_address,
+                                                     req.params.reg_write.addr,
+                                                     req.params.reg_write.data)) {
+                    usb_task_send_response(&req.ack, CAMERA_RESPONSE_OK, 0);
+                    break;
+                }
+
+                i2c_transfer_t t = {
+                    .peripheral_address = req.params.reg_write.peripheral_address,
+                    .type = I2C_TRANSFER_WRITE,
+                    .reg = req.params.reg_write.addr,
+                    .len = 1,
+                    .data = {req.params.reg_write.data},
+                    .callback = host_reg_write_done
                 };
-                const uint8_t i2c_addr = req.params.reg_write.peripheral_address << 1;
-                __unused HAL_StatusTypeDef err;
-                err = HAL_I2C_Master_Transmit(&hi2c1, i2c_addr, buf, 3, 100);
+                _Static_assert(sizeof(req.ack) <= sizeof(t.context), "ack doesn't fit");
+                memcpy(t.context, &req.ack, sizeof(req.ack));
+
+                // the shadow takes the value right away, so that the redundancy check and cached
+                // reads see writes that are still queued. i2c_task runs transfers in order, so
+                // reads that do go to the sensor come after them too.
+                sensor_shadow_update(t.peripheral_address, t.reg, t.data, t.len, true);
+                i2c_task_submit(&t, portMAX_DELAY);
+                break;
+            }
 
+            case CAMERA_MANAGEMENT_TYPE_REG_READ: {
+                uint8_t vals[CAMERA_REG_READ_MAX];
+                const int failed = sensor_reg_read(req.params.reg_read.peripheral_address,
+                                                   req.params.reg_read.regs,
+                                                   req.params.reg_read.count, vals);
+                if (failed >= 0)
+                    usb_task_send_response(&req.ack, CAMERA_RESPONSE_BUS_ERROR, failed);
+                else
+                    usb_task_send_response_data(&req.ack, CAMERA_RESPONSE_OK, 0,
+                                                vals, req.params.reg_read.count);
                 break;
             }
 
-            case CAMERA_MANAGEMENT_TYPE_SENSOR_SEL: {
-                // disable dcmi
+            case CAMERA_MANAGEMENT_TYPE_SET_MODE: {
+                apply_mode(req.params.set_mode.mode, req.params.set_mode.resume, &req.ack);
+                break;
+            }
 
-                // disable active sensor (necessary? maybe just leave enabled.)
+            case CAMERA_MANAGEMENT_TYPE_INTERLEAVE: {
+                // a switch that failed since the last request is reported instead of carrying out
+                // this one.
+                if (interleave.status != CAMERA_RESPONSE_OK) {
+                    usb_task_send_response(&req.ack, interleave.status, interleave.detail);
+                    interleave.status = CAMERA_RESPONSE_OK;
+                    break;
+                }
+
+                interleave.frames_per_sensor = req.params.interleave_frames;
+                interleave.frames = 0;
+                if ((interleave.frames_per_sensor != 0) && !camera_read_task_is_running())
+                    camera_read_task_resume_dcmi(NULL);
+                usb_task_send_response(&req.ack, CAMERA_RESPONSE_OK, 0);
+                break;
+            }
 
-                // switch sensor bus
-                if (req.params.sensor_select == CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0)
-                    HAL_GPIO_WritePin(camera_select_GPIO_Port, camera_select_Pin, GPIO_PIN_SET);
-                else if (req.params.sensor_select == CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360)
-                    HAL_GPIO_WritePin(camera_select_GPIO_Port, camera_select_Pin, GPIO_PIN_RESET);
+            case CAMERA_MANAGEMENT_TYPE_FRAME_PARAMS: {
+                // a schedule that hasn't started yet is replaced before it took effect.
+                param_schedule_stop(CAMERA_RESPONSE_INVALID_STATE, 0);
+                ae.enabled = false;
+                if (req.params.frame_params.count == 0) {
+                    usb_task_send_response(&req.ack, CAMERA_RESPONSE_OK, 0);
+                    break;
+                }
+
+                memcpy(param_schedule.entries, req.params.frame_params.entries,
+                       req.params.frame_params.count * sizeof(param_schedule.entries[0]));
+                param_schedule.count = req.params.frame_params.count;
+                param_schedule.next = 0;
+                param_schedule.repeat = req.params.frame_params.repeat;
+                param_schedule.ack = req.ack;
+                param_schedule.ack_pending = true;
+                break;
+            }
 
-                // enable inactive sensor (necessary? maybe just leave enabled.)
+            case CAMERA_MANAGEMENT_TYPE_AUTO_EXPOSURE: {
+                if (req.params.auto_exposure.enable &&
+                    !auto_exposure_config_is_valid(&req.params.auto_exposure.config)) {
+                    usb_task_send_response(&req.ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                    break;
+                }
+
+                param_schedule_stop(CAMERA_RESPONSE_INVALID_STATE, 0);
+                ae.enabled = req.params.auto_exposure.enable;
+                if (ae.enabled) {
+                    ae.config = req.params.auto_exposure.config;
+                    frame_stats_set_roi(&ae.config.roi);
+                    ae.seeded = false;
+                }
+                usb_task_send_response(&req.ack, CAMERA_RESPONSE_OK, 0);
+                break;
+            }
 
-                // adjust dcmi settings
+            case CAMERA_MANAGEMENT_TYPE_SENSOR_SEL: {
+                // A transaction that does nothing but select the sensor. The host gets the time
+                // that the switch took.
+                const uint32_t t0 = timebase_now_us();
+                static camera_transaction_t t;
+                memset(&t, 0, sizeof(t));
+                t.has_sensor_select = true;
+                t.sensor_select = req.params.sensor_select;
+
+                int32_t detail;
+                const camera_response_status_e status = apply_transaction(&t, &detail);
+                if (status == CAMERA_RESPONSE_OK)
+                    detail = timebase_now_us() - t0;
+                usb_task_send_response(&req.ack, status, detail);
+                break;
+            }
 
-                // ONLY re-enable dcmi if it was enabled before.
+            case CAMERA_MANAGEMENT_TYPE_TRIGGER_CONFIG: {
+                const bool ok = trigger_configure(&req.params.trigger_config);
+                usb_task_send_response(&req.ack,
+                                       ok ? CAMERA_RESPONSE_OK : CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
 
+            case CAMERA_MANAGEMENT_TYPE_TRANSACTION: {
+                static camera_transaction_t t;
+                xQueueReceive(camera_transaction_queue, &t, portMAX_DELAY);
+                int32_t detail;
+                const camera_response_status_e status = apply_transaction(&t, &detail);
+                usb_task_send_response(&req.ack, status, detail);
                 break;
             }
 
-            case CAMERA_MANAGEMENT_TYPE_TRIGGER_CONFIG: {
-                // UNIMPLEMENTED
+            default: {
                 break;
             }
         }
@@ -248,49 +963,50 @@ void camera_management_task(void const* args)
 
 void hm01b0_i2c_reset()
 {
-    hm01b0_reg_write_t v = {0x0103, 0xff};
-    uint8_t buf[3] = {(v.ui16Reg & 0xff00) >> 8, (v.ui16Reg & 0x00ff) >> 0, v.ui8Val};
-    __unused HAL_StatusTypeDef err = HAL_I2C_Master_Transmit(&hi2c1, 0x24 << 1, buf, 3, 100);
-
-    v.ui16Reg = 0x0103; v.ui8Val = 0x00;
-    buf[0] = (v.ui16Reg & 0xff00) >> 8; buf[1] = (v.ui16Reg & 0x00ff) >> 0; buf[2] = v.ui8Val;
-    err = HAL_I2C_Master_Transmit(&hi2c1, 0x24 << 1, buf, 3, 100);
+    __unused HAL_StatusTypeDef err = sensor_reg_write(0x24, 0x0103, 0xff);
+    err = sensor_reg_write(0x24, 0x0103, 0x00);
 }
 
 
-void hm01b0_i2c_init()
+HAL_StatusTypeDef hm01b0_i2c_init()
 {
     // initialize hm01b0 over i2c
-    for (int i = 0; i < sizeof_hm01b0_init_values / sizeof(hm01b0_init_values[0]);) {
-        hm01b0_reg_write_t v = hm01b0_init_values[i++];
-        uint8_t buf[3] = {(v.ui16Reg & 0xff00) >> 8, (v.ui16Reg & 0x00ff) >> 0, v.ui8Val};
-
-        HAL_StatusTypeDef err = HAL_I2C_Master_Transmit(&hi2c1, 0x24 << 1, buf, 3, 100);
-
-        if (err) {
-            HAL_GPIO_WritePin(led2_GPIO_Port, led2_Pin, GPIO_PIN_SET);
-        }
+    static sensor_burst_t b;
+    sensor_burst_init(&b, 0x24);
+    HAL_StatusTypeDef err = HAL_OK;
+    const int n = sizeof_hm01b0_init_values / sizeof(hm01b0_init_values[0]);
+    for (int i = 0; (i < n) && (err == HAL_OK); i++) {
+        const hm01b0_reg_write_t v = hm01b0_init_values[i];
+        err = sensor_burst_add(&b, i, v.ui16Reg, v.ui8Val);
+    }
+    if (err == HAL_OK)
+        err = sensor_burst_flush(&b);
 
-        taskYIELD();
+    if (err != HAL_OK) {
+        HAL_GPIO_WritePin(led2_GPIO_Port, led2_Pin, GPIO_PIN_SET);
     }
+    return err;
 }
 
 
-void hm0360_i2c_init()
+HAL_StatusTypeDef hm0360_i2c_init()
 {
     // initialize hm0360 over i2c
-    for (int i = 0; i < sizeof_hm0360_init_values / sizeof(hm0360_init_values[0]);) {
-        hm0360_reg_write_t v = hm0360_init_values[i++];
-        uint8_t buf[3] = {(v.ui16Reg & 0xff00) >> 8, (v.ui16Reg & 0x00ff) >> 0, v.ui8Val};
-
-        HAL_StatusTypeDef err = HAL_I2C_Master_Transmit(&hi2c1, 0x35 << 1, buf, 3, 100);
-
-        if (err) {
-            HAL_GPIO_WritePin(led2_GPIO_Port, led2_Pin, GPIO_PIN_SET);
-        }
+    static sensor_burst_t b;
+    sensor_burst_init(&b, 0x35);
+    HAL_StatusTypeDef err = HAL_OK;
+    const int n = sizeof_hm0360_init_values / sizeof(hm0360_init_values[0]);
+    for (int i = 0; (i < n) && (err == HAL_OK); i++) {
+        const hm0360_reg_write_t v = hm0360_init_values[i];
+        err = sensor_burst_add(&b, i, v.ui16Reg, v.ui8Val);
+    }
+    if (err == HAL_OK)
+        err = sensor_burst_flush(&b);
 
-        taskYIELD();
+    if (err != HAL_OK) {
+        HAL_GPIO_WritePin(led2_GPIO_Port, led2_Pin, GPIO_PIN_SET);
     }
+    return err;
 }
 
 
@@ -299,31 +1015,102 @@ void camera_management_task_enqueue_request(const camera_management_request_t* r
     xQueueSendToBack(camera_management_task_request_queue, (const void*)req, portMAX_DELAY);
 }
 
-void camera_management_task_reg_write(uint8_t i2c_addr, uint16_t reg_addr, uint8_t data)
+void camera_management_task_reg_write(uint8_t i2c_addr, uint16_t reg_addr, uint8_t data,
+                                      const camera_request_ack_t* ack)
 {
     camera_management_request_t req;
     req.request_type = CAMERA_MANAGEMENT_TYPE_REG_WRITE;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
     req.params.reg_write = (i2c_reg_write_t){i2c_addr, reg_addr, data};
     camera_management_task_enqueue_request(&req);
 }
 
-void camera_management_task_sensor_select(bool which)
+void camera_management_task_reg_read(uint8_t i2c_addr, const uint16_t* regs, int count,
+                                     const camera_request_ack_t* ack)
+{
+    camera_management_request_t req;
+    req.request_type = CAMERA_MANAGEMENT_TYPE_REG_READ;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
+    req.params.reg_read.peripheral_address = i2c_addr;
+    req.params.reg_read.count = (count > CAMERA_REG_READ_MAX) ? CAMERA_REG_READ_MAX : count;
+    memcpy(req.params.reg_read.regs, regs, req.params.reg_read.count * sizeof(regs[0]));
+    camera_management_task_enqueue_request(&req);
+}
+
+void camera_management_task_sensor_select(bool which, const camera_request_ack_t* ack)
 {
     camera_management_request_t req;
     req.request_type = CAMERA_MANAGEMENT_TYPE_SENSOR_SEL;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
     req.params.sensor_select = which ?
         CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0:
         CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360;
     camera_management_task_enqueue_request(&req);
 }
 
-// start trigger generation task
-#if 0
-    TaskHandle_t trigger_generation_task_handle = xTaskCreateStatic(trigger_generation_task,
-                                                                    "trig gen task",
-                                                                    TG_TASK_BUFSZ,
-                                                                    0,
-                                                                    osPriorityNormal,
-                                                                    TGTaskBuffer,
-                                                                    &TGTaskControlBlock);
-#endif
+void camera_management_task_set_mode(int mode, bool resume, const camera_request_ack_t* ack)
+{
+    camera_management_request_t req;
+    req.request_type = CAMERA_MANAGEMENT_TYPE_SET_MODE;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
+    req.params.set_mode.mode = mode;
+    req.params.set_mode.resume = resume;
+    camera_management_task_enqueue_request(&req);
+}
+
+void camera_management_task_interleave(int frames_per_sensor, const camera_request_ack_t* ack)
+{
+    camera_management_request_t req;
+    req.request_type = CAMERA_MANAGEMENT_TYPE_INTERLEAVE;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
+    req.params.interleave_frames = frames_per_sensor;
+    camera_management_task_enqueue_request(&req);
+}
+
+void camera_management_task_trigger_config(const trigger_config_t* cfg,
+                                           const camera_request_ack_t* ack)
+{
+    camera_management_request_t req;
+    req.request_type = CAMERA_MANAGEMENT_TYPE_TRIGGER_CONFIG;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
+    req.params.trigger_config = *cfg;
+    camera_management_task_enqueue_request(&req);
+}
+
+void camera_management_task_frame_params(const camera_frame_params_t* entries, int count,
+                                         bool repeat, const camera_request_ack_t* ack)
+{
+    camera_management_request_t req;
+    req.request_type = CAMERA_MANAGEMENT_TYPE_FRAME_PARAMS;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
+    req.params.frame_params.count = (count > CAMERA_FRAME_PARAMS_MAX) ?
+                                    CAMERA_FRAME_PARAMS_MAX : count;
+    req.params.frame_params.repeat = repeat;
+    memcpy(req.params.frame_params.entries, entries,
+           req.params.frame_params.count * sizeof(entries[0]));
+    camera_management_task_enqueue_request(&req);
+}
+
+void camera_management_task_auto_exposure(bool enable, const auto_exposure_config_t* cfg,
+                                          const camera_request_ack_t* ack)
+{
+    camera_management_request_t req;
+    req.request_type = CAMERA_MANAGEMENT_TYPE_AUTO_EXPOSURE;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
+    req.params.auto_exposure.enable = enable;
+    if (cfg)
+        req.params.auto_exposure.config = *cfg;
+    camera_management_task_enqueue_request(&req);
+}
+
+void camera_management_task_transaction(const camera_transaction_t* t,
+                                        const camera_request_ack_t* ack)
+{
+    xQueueSendToBack(camera_transaction_queue, (const void*)t, portMAX_DELAY);
+
+    camera_management_request_t req;
+    req.request_type = CAMERA_MANAGEMENT_TYPE_TRANSACTION;
+    req.ack = ack ? *ack : (camera_request_ack_t){0};
+    camera_management_task_enqueue_request(&req);
+}
+
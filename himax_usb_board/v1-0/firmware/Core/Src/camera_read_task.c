@@ -1,6 +1,17 @@
 #include "camera_read_task.h"
 #include "usb_task.h"
 #include "hm01b0_init_bytes.h"
+#include "timebase.h"
+#include "trigger.h"
+#include "frame_params.h"
+#include "frame_stats.h"
+#include "burst_store.h"
+#include "tile_delta.h"
+#include "lossless_codec.h"
+#include "dct_codec.h"
+#include "bit_depth.h"
+#include "focus_metric.h"
+#include "detect_task.h"
 
 #define __unused __attribute__((unused))
 
@@ -12,12 +23,43 @@
 #include "semphr.h"
 #include "task.h"
 #include "queue.h"
+#include "event_groups.h"
 #include "list.h"
 #include "portmacro.h"
 
 SemaphoreHandle_t camera_frame_ready_semaphore;
 StaticSemaphore_t camera_frame_ready_semaphore_buffer;
 
+// CAMERA_READ_EVENT_HALTED is set while DCMI is halted. Other tasks can wait on it to find out
+// when an asynchronous halt has finished.
+EventGroupHandle_t camera_read_task_events;
+StaticEventGroup_t camera_read_task_events_buffer;
+
+// Given by the DCMI VSYNC interrupt at the end of every frame.
+SemaphoreHandle_t camera_frame_boundary_semaphore;
+StaticSemaphore_t camera_frame_boundary_semaphore_buffer;
+
+// Counts packed buffers that usb_task has finished with. Only the test pattern generator uses this;
+// DCMI can't wait for USB anyway.
+SemaphoreHandle_t camera_packedbuf_free_semaphore;
+StaticSemaphore_t camera_packedbuf_free_semaphore_buffer;
+
+// Given by usb_task once it's done with camera_statsbuf.
+SemaphoreHandle_t camera_statsbuf_free_semaphore;
+StaticSemaphore_t camera_statsbuf_free_semaphore_buffer;
+
+// Given by usb_task once it's done with camera_focusbuf.
+SemaphoreHandle_t camera_focusbuf_free_semaphore;
+StaticSemaphore_t camera_focusbuf_free_semaphore_buffer;
+
+// Counts camera_deltabufs that usb_task has finished with.
+SemaphoreHandle_t camera_deltabuf_free_semaphore;
+StaticSemaphore_t camera_deltabuf_free_semaphore_buffer;
+
+// Counts burst pieces that usb_task has finished with.
+SemaphoreHandle_t camera_burst_free_semaphore;
+StaticSemaphore_t camera_burst_free_semaphore_buffer;
+
 extern I2C_HandleTypeDef hi2c1;
 extern DCMI_HandleTypeDef hdcmi;
 
@@ -30,9 +72,30 @@ extern QueueHandle_t camera_read_task_config_queue;
 extern QueueHandle_t usb_request_queue;
 
 // buffer to hold properly packed pixels for usb xfer
+// has room for a frame marker line and a frame header in front of the pixels, and for a slice
+// header if the chunk is compressed.
 #define CAMERA_BUF_WIDTH (320)
 #define CAMERA_BUF_HEIGHT (30)
-uint8_t camera_packedbuf[2][CAMERA_BUF_WIDTH * (CAMERA_BUF_HEIGHT + 1)] = { 0 };
+uint8_t camera_packedbuf[2][CAMERA_BUF_WIDTH * (CAMERA_BUF_HEIGHT + 1) +
+                           sizeof(camera_frame_header_t) +
+                           sizeof(lossless_slice_header_t)] = { 0 };
+
+// buffer for the statistics record that follows a frame, behind its own frame marker and header.
+uint8_t camera_statsbuf[320 + sizeof(camera_frame_header_t) + sizeof(frame_stats_record_t)];
+
+// buffer for the focus record that follows a frame, likewise.
+uint8_t camera_focusbuf[320 + sizeof(camera_frame_header_t) + sizeof(focus_record_t)];
+
+// buffers for the changed tiles of a frame, behind a frame marker and header. A frame whose changed
+// tiles don't fit is dropped and followed by a keyframe.
+#define CAMERA_DELTABUF_BYTES (16 * 1024)
+uint8_t camera_deltabuf[2][CAMERA_DELTABUF_BYTES];
+
+// frame markers and headers of the frames of a burst. Their pixels are sent straight from the
+// burst store, in pieces of at most CAMERA_BURST_PIECE bytes. Two pieces can be in flight at once,
+// so two headers are enough.
+#define CAMERA_BURST_PIECE (32 * 1024)
+uint8_t camera_burst_markerbuf[2][320 + sizeof(camera_frame_header_t)];
 
 // raw buffer to hold bytes recieved directly from camera
 // same size as "packedbuf", but x2 to accommodate nybbles in "unpacked" mode.
@@ -43,13 +106,24 @@ uint8_t camera_rawbuf[2][CAMERA_BUF_WIDTH * CAMERA_BUF_HEIGHT] = { 0 };
 // Just seperated it out into a different file for readability.
 #include "camera_read_task_util.hc"
 
+camera_read_state_t camera_state;
+
 TaskHandle_t footask_handle;
 void DCMI_IRQHandler()
 {
+    BaseType_t higher_priority_task_woken = pdFALSE;
     if (DCMI->MISR & (1 << 3)) {
         DCMI->ICR = (1 << 3);
         HAL_GPIO_TogglePin(led1_GPIO_Port, led1_Pin);
+
+        // VSYNC went inactive: the sensor is in vertical blanking between two frames. This is
+        // where geometry changes are slipped in.
+        geometry_latch_from_isr(&camera_state);
+        frame_start_stamp(&camera_state);
+
+        xSemaphoreGiveFromISR(camera_frame_boundary_semaphore, &higher_priority_task_woken);
     }
+    portYIELD_FROM_ISR(higher_priority_task_woken);
 
     //BaseType_t wake_higher_priority_task = pdFALSE;
     //vTaskNotifyGiveFromISR(footask_handle, &wake_higher_priority_task);
@@ -74,6 +148,845 @@ void DMA2_Stream7_IRQHandler()
     portYIELD_FROM_ISR(higher_priority_task_woken);
 }
 
+/**
+ * Sends the statistics record of the frame that was just packed, behind a frame marker and the
+ * frame's header. It's skipped if usb_task still hasn't finished sending the last one.
+ */
+static void send_stats_record()
+{
+    if (!xSemaphoreTake(camera_statsbuf_free_semaphore, 0))
+        return;
+
+    camera_frame_header_t hdr = camera_state.header;
+    hdr.format = CAMERA_FRAME_FORMAT_STATS;
+    hdr.payload_len = sizeof(frame_stats_record_t);
+
+    memcpy(camera_statsbuf, magic, 320);
+    memcpy(camera_statsbuf + 320, &hdr, sizeof(hdr));
+    frame_stats_make_record(&camera_state.stats,
+                            (frame_stats_record_t*)(camera_statsbuf + 320 + sizeof(hdr)));
+
+    usb_write_request_t req = {
+        .buf = (void*)camera_statsbuf,
+        .len = sizeof(camera_statsbuf),
+        .done = camera_statsbuf_free_semaphore
+    };
+    if (xQueueSendToBack(usb_request_queue, (const void*)&req, 0) != pdTRUE)
+        xSemaphoreGive(camera_statsbuf_free_semaphore);
+}
+
+/**
+ * Sends the focus record of the frame that was just packed, like send_stats_record().
+ */
+static void send_focus_record()
+{
+    if (!xSemaphoreTake(camera_focusbuf_free_semaphore, 0))
+        return;
+
+    camera_frame_header_t hdr = camera_state.header;
+    hdr.format = CAMERA_FRAME_FORMAT_FOCUS;
+    hdr.payload_len = sizeof(focus_record_t);
+
+    memcpy(camera_focusbuf, magic, 320);
+    memcpy(camera_focusbuf + 320, &hdr, sizeof(hdr));
+    focus_metric_make_record(&camera_state.focus,
+                             (focus_record_t*)(camera_focusbuf + 320 + sizeof(hdr)));
+
+    usb_write_request_t req = {
+        .buf = (void*)camera_focusbuf,
+        .len = sizeof(camera_focusbuf),
+        .done = camera_focusbuf_free_semaphore
+    };
+    if (xQueueSendToBack(usb_request_queue, (const void*)&req, 0) != pdTRUE)
+        xSemaphoreGive(camera_focusbuf_free_semaphore);
+}
+
+/**
+ * Stops recording and starts sending what's in the store. A burst request is acknowledged here,
+ * with the number of frames that were recorded.
+ */
+static void burst_finish_recording()
+{
+    camera_state.burst_pixels = NULL;
+    camera_state.burst = CAMERA_BURST_DRAINING;
+    camera_state.drain_pixels = NULL;
+    camera_state.drain_left = 0;
+    camera_state.drain_marker = false;
+    camera_state.drain_frames = 0;
+    usb_task_send_response(&camera_state.burst_ack, CAMERA_RESPONSE_OK, burst_store_count());
+    camera_state.burst_ack = (camera_request_ack_t){0};
+}
+
+/**
+ * Stops keeping frames for a pre-trigger capture and throws away the ones that were kept.
+ */
+static void burst_disarm()
+{
+    trigger_event_enable(false);
+    burst_store_reset();
+    camera_state.burst_pixels = NULL;
+    camera_state.burst = CAMERA_BURST_OFF;
+}
+
+/**
+ * Returns true if there's been an event - from the host, gpio3 or motion - since the last frame
+ * start.
+ */
+static bool burst_event_take()
+{
+    const bool gpio = camera_state.burst_gpio && trigger_event_take();
+    const bool event = camera_state.burst_event || gpio;
+    camera_state.burst_event = false;
+    return event;
+}
+
+/**
+ * Called at the start of every frame while a pre-trigger ring is armed or a burst is being
+ * recorded, with the frame's header.
+ */
+static void burst_frame_start(const camera_frame_header_t* hdr)
+{
+    camera_frame_header_t h = *hdr;
+    camera_state.burst_pixels = NULL;
+
+    if (camera_state.burst == CAMERA_BURST_ARMED) {
+        if (!burst_event_take()) {
+            // Keep burst_pre frames at most, and always leave room for burst_post frames of this
+            // size after them. Going around the end of the store can waste up to one frame.
+            const uint32_t room = burst_store_capacity() / burst_store_entry_size(h.payload_len);
+            uint32_t keep = (room > (camera_state.burst_post + 1)) ?
+                            (room - camera_state.burst_post - 1) : 0;
+            if (keep > camera_state.burst_pre)
+                keep = camera_state.burst_pre;
+            while ((burst_store_count() > 0) && (burst_store_count() >= keep))
+                burst_store_pop(&(camera_frame_header_t){0});
+            if (keep > 0)
+                camera_state.burst_pixels = burst_store_begin(&h, true);
+            return;
+        }
+
+        // this frame is the first one after the event.
+        trigger_event_enable(false);
+        camera_state.burst = CAMERA_BURST_RECORDING;
+        camera_state.burst_recorded = 0;
+        h.flags |= CAMERA_FRAME_FLAG_EVENT;
+    }
+
+    if (camera_state.burst_recorded >= camera_state.burst_post) {
+        burst_finish_recording();
+        return;
+    }
+
+    camera_state.burst_pixels = burst_store_begin(&h, false);
+    if (camera_state.burst_pixels == NULL)
+        burst_finish_recording();
+}
+
+/**
+ * Called at the end of every frame while a pre-trigger ring is armed or a burst is being
+ * recorded.
+ */
+static void burst_frame_end()
+{
+    if (camera_state.burst_pixels != NULL) {
+        camera_state.burst_pixels = NULL;
+        burst_store_commit();
+        if (camera_state.burst == CAMERA_BURST_RECORDING)
+            camera_state.burst_recorded++;
+    }
+
+    if ((camera_state.burst == CAMERA_BURST_RECORDING) &&
+        (camera_state.burst_recorded >= camera_state.burst_post)) {
+        burst_finish_recording();
+        return;
+    }
+
+    // Motion is the mean absolute difference between this frame's tile means and the last one's.
+    if ((camera_state.burst == CAMERA_BURST_ARMED) && (camera_state.burst_motion_threshold != 0)) {
+        uint8_t tiles[FRAME_STATS_TILES_X * FRAME_STATS_TILES_Y];
+        frame_stats_tile_means(&camera_state.stats, tiles);
+        if (camera_state.burst_tiles_valid) {
+            uint32_t diff = 0;
+            for (int i = 0; i < sizeof(tiles); i++)
+                diff += (tiles[i] > camera_state.burst_tiles[i]) ?
+                        (tiles[i] - camera_state.burst_tiles[i]) :
+                        (camera_state.burst_tiles[i] - tiles[i]);
+            if (diff >= (camera_state.burst_motion_threshold * sizeof(tiles)))
+                camera_state.burst_event = true;
+        }
+        memcpy(camera_state.burst_tiles, tiles, sizeof(tiles));
+        camera_state.burst_tiles_valid = true;
+    }
+}
+
+/**
+ * Hands the next piece of the burst to usb_task: the frame marker and header of a frame, or up to
+ * CAMERA_BURST_PIECE bytes of its pixels. Returns false if usb_task can't take one right now or
+ * the burst has been sent.
+ */
+static bool burst_drain_step()
+{
+    if (camera_state.burst != CAMERA_BURST_DRAINING)
+        return false;
+
+    if ((camera_state.drain_left == 0) && !camera_state.drain_marker) {
+        camera_state.drain_pixels = burst_store_pop(&camera_state.drain_header);
+        if (camera_state.drain_pixels == NULL) {
+            camera_state.burst = CAMERA_BURST_OFF;
+            return false;
+        }
+        camera_state.drain_header.flags |= CAMERA_FRAME_FLAG_REPLAY;
+        camera_state.drain_left = camera_state.drain_header.payload_len;
+        camera_state.drain_marker = true;
+    }
+
+    if (!xSemaphoreTake(camera_burst_free_semaphore, 0))
+        return false;
+
+    usb_write_request_t req = {.done = camera_burst_free_semaphore};
+    uint32_t n = 0;
+    if (camera_state.drain_marker) {
+        uint8_t* buf = camera_burst_markerbuf[camera_state.drain_frames & 1];
+        memcpy(buf, magic, 320);
+        memcpy(buf + 320, &camera_state.drain_header, sizeof(camera_state.drain_header));
+        req.buf = (void*)buf;
+        req.len = 320 + sizeof(camera_state.drain_header);
+    } else {
+        n = (camera_state.drain_left < CAMERA_BURST_PIECE) ? camera_state.drain_left :
+                                                             CAMERA_BURST_PIECE;
+        req.buf = (void*)camera_state.drain_pixels;
+        req.len = n;
+    }
+
+    if (xQueueSendToBack(usb_request_queue, (const void*)&req, 0) != pdTRUE) {
+        xSemaphoreGive(camera_burst_free_semaphore);
+        return false;
+    }
+
+    if (camera_state.drain_marker) {
+        camera_state.drain_marker = false;
+        camera_state.drain_frames++;
+    } else {
+        camera_state.drain_pixels += n;
+        camera_state.drain_left -= n;
+    }
+    return true;
+}
+
+/**
+ * Called at the start of every frame whose pixels would be streamed while changed-tile streaming
+ * is on, with the frame's header. Makes the frame a keyframe when one is due, and otherwise
+ * starts comparing it with the reference instead of streaming it. If both delta buffers are still
+ * in use, the frame is skipped.
+ */
+static void delta_frame_start(camera_frame_header_t* hdr)
+{
+    tile_delta_t* d = &camera_state.delta;
+    const bool keyframe = camera_state.delta_need_keyframe ||
+                          (hdr->width != d->width) || (hdr->height != d->height) ||
+                          ((camera_state.delta_keyframe_interval != 0) &&
+                           (camera_state.delta_frames >= camera_state.delta_keyframe_interval));
+    if (keyframe) {
+        tile_delta_begin_keyframe(d, hdr->width, hdr->height);
+        hdr->flags |= CAMERA_FRAME_FLAG_KEYFRAME;
+        camera_state.frame_delta = CAMERA_DELTA_KEYFRAME;
+        camera_state.delta_need_keyframe = false;
+        camera_state.delta_frames = 1;
+        return;
+    }
+
+    camera_state.frame_pixels = false;
+    if (!xSemaphoreTake(camera_deltabuf_free_semaphore, 0))
+        return;
+
+    const uint32_t hdrlen = 320 + sizeof(camera_frame_header_t);
+    camera_state.frame_delta = CAMERA_DELTA_FRAME;
+    tile_delta_begin(d, camera_deltabuf[camera_state.delta_buf] + hdrlen,
+                     CAMERA_DELTABUF_BYTES - hdrlen);
+}
+
+/**
+ * Gives up on the frame that's part of the changed-tile stream; the host will need a keyframe.
+ */
+static void delta_frame_abandon()
+{
+    if (camera_state.frame_delta == CAMERA_DELTA_FRAME)
+        xSemaphoreGive(camera_deltabuf_free_semaphore);
+    if (camera_state.frame_delta != CAMERA_DELTA_NONE)
+        camera_state.delta_need_keyframe = true;
+    camera_state.frame_delta = CAMERA_DELTA_NONE;
+}
+
+/**
+ * Called at the end of every frame that's part of the changed-tile stream. Sends a delta frame's
+ * changed tiles.
+ */
+static void delta_frame_end()
+{
+    if (camera_state.frame_delta == CAMERA_DELTA_FRAME) {
+        uint8_t* buf = camera_deltabuf[camera_state.delta_buf];
+        camera_frame_header_t hdr = camera_state.header;
+        hdr.format = CAMERA_FRAME_FORMAT_DELTA;
+        hdr.payload_len = tile_delta_end(&camera_state.delta);
+        memcpy(buf, magic, 320);
+        memcpy(buf + 320, &hdr, sizeof(hdr));
+
+        usb_write_request_t req = {
+            .buf = (void*)buf,
+            .len = 320 + sizeof(hdr) + hdr.payload_len,
+            .done = camera_deltabuf_free_semaphore
+        };
+        if (xQueueSendToBack(usb_request_queue, (const void*)&req, 0) != pdTRUE) {
+            delta_frame_abandon();
+            return;
+        }
+        camera_state.delta_buf ^= 1;
+    }
+
+    camera_state.delta_frames++;
+    camera_state.frame_delta = CAMERA_DELTA_NONE;
+}
+
+/**
+ * Returns true if frames that are 'width' pixels wide can be compressed with 'codec'.
+ */
+static bool codec_fits(camera_codec_e codec, uint32_t width)
+{
+    switch (codec) {
+        case CAMERA_CODEC_LOSSLESS: return lossless_fits(width);
+        case CAMERA_CODEC_DCT: return dct_codec_fits(width);
+        default: return false;
+    }
+}
+
+/**
+ * Compresses 'rows' packed rows in camera_rawbuf[idx], the first of which is row 'first_row' of
+ * the frame, into camera_packedbuf[idx] as a slice behind its own frame marker and header, and
+ * returns its length, or 0 if there's nothing to send yet. See lossless_codec.h and dct_codec.h.
+ */
+static uint32_t compress_chunk(int idx, uint32_t first_row, uint32_t rows)
+{
+    uint8_t* buf = camera_packedbuf[idx];
+    const uint32_t hdrlen = 320 + sizeof(camera_frame_header_t);
+    uint8_t* out = buf + hdrlen;
+    const uint32_t out_size = sizeof(camera_packedbuf[0]) - hdrlen;
+    camera_frame_header_t hdr = camera_state.header;
+    if (camera_state.frame_codec == CAMERA_CODEC_LOSSLESS) {
+        hdr.format = CAMERA_FRAME_FORMAT_LOSSLESS;
+        hdr.payload_len = lossless_encode_slice(camera_rawbuf[idx], hdr.width, first_row, rows,
+                                                out, out_size);
+    } else {
+        hdr.format = CAMERA_FRAME_FORMAT_DCT;
+        hdr.payload_len = dct_codec_add_rows(&camera_state.dct, camera_rawbuf[idx], first_row,
+                                             rows, out, out_size);
+        if (hdr.payload_len == 0)
+            return 0;
+    }
+    memcpy(buf, magic, 320);
+    memcpy(buf + 320, &hdr, sizeof(hdr));
+    return hdrlen + hdr.payload_len;
+}
+
+/**
+ * Puts the lookup table that was committed to use and answers its request with the sequence
+ * number of the frame that's about to start.
+ */
+static void lut_swap()
+{
+    camera_state.lut_active ^= 1;
+    camera_state.lut_on = camera_state.lut_pending_on;
+    camera_state.lut_pending = false;
+    usb_task_send_response(&camera_state.lut_ack, CAMERA_RESPONSE_OK, camera_state.sequence);
+    camera_state.lut_ack = (camera_request_ack_t){0};
+}
+
+/**
+ * Takes one DMA transfer's worth of raw bytes from camera_rawbuf[idx], packs it into
+ * camera_packedbuf[idx] - behind a frame marker and frame header if it's the first transfer of a
+ * frame - and hands it to usb_task.
+ *
+ * If 'done' isn't NULL, it's given once usb_task is finished with the packed buffer (or right
+ * away if usb_task couldn't take it). If 'drop' is set, the packed buffer isn't touched and
+ * nothing is sent, but the frame bookkeeping carries on as if the chunk had been sent. The same
+ * goes for every chunk of a frame whose pixels aren't streamed.
+ */
+static void process_chunk(int idx, SemaphoreHandle_t done, bool drop)
+{
+    // If it's the first line of a frame, then pack in a synchronization line and a header.
+    uint8_t* packedbuf = camera_packedbuf[idx];
+    uint32_t buflen = 0;
+    if (camera_state.byte_count >= image_size_bytes(&camera_state.geometry)) {
+        camera_state.byte_count -= image_size_bytes(&camera_state.geometry);
+
+        // If the VSYNC interrupt changed the geometry between the last frame and this one,
+        // this buffer is the first one that was read with the new geometry.
+        if (camera_state.latched_valid) {
+            geometry_adopt_latched(&camera_state);
+            camera_state.byte_count = 0;
+        }
+
+        cprintf(putch, "frame marker %i\r\n", (int)camera_state.sequence);
+        if (camera_state.lut_pending)
+            lut_swap();
+        camera_frame_header_t hdr = frame_header(&camera_state);
+        if (camera_state.lut_on)
+            hdr.flags |= CAMERA_FRAME_FLAG_LUT;
+        frame_stats_begin(&camera_state.stats, camera_state.sequence, hdr.width, hdr.height);
+        camera_state.frame_focus = camera_state.send_focus &&
+                                   (camera_state.burst == CAMERA_BURST_OFF);
+        if (camera_state.frame_focus)
+            focus_metric_begin(&camera_state.focus, hdr.width, hdr.height,
+                               &camera_state.focus_roi);
+        camera_state.frame_pixels = (camera_state.burst == CAMERA_BURST_OFF) &&
+                                    (camera_state.pixel_interval != 0) &&
+                                    ((camera_state.sequence % camera_state.pixel_interval) == 0) &&
+                                    detect_task_gate_open();
+
+        // a frame of the changed-tile stream that never got to its end leaves the host behind.
+        delta_frame_abandon();
+        if (camera_state.frame_pixels && camera_state.delta_enabled &&
+            tile_delta_fits(hdr.width, hdr.height))
+            delta_frame_start(&hdr);
+        // the host has to end up with the same reference as tile_delta, so keyframes can't be
+        // lossy.
+        camera_state.frame_codec = CAMERA_CODEC_NONE;
+        if (camera_state.frame_pixels && codec_fits(camera_state.codec, hdr.width) &&
+            !((camera_state.codec == CAMERA_CODEC_DCT) &&
+              (camera_state.frame_delta == CAMERA_DELTA_KEYFRAME)))
+            camera_state.frame_codec = camera_state.codec;
+        if (camera_state.frame_codec == CAMERA_CODEC_DCT)
+            dct_codec_begin(&camera_state.dct, hdr.width, hdr.height, camera_state.codec_quality);
+        camera_state.frame_reduced = camera_state.frame_pixels &&
+                                     (camera_state.depth.bits != 8) &&
+                                     (camera_state.frame_codec == CAMERA_CODEC_NONE) &&
+                                     (camera_state.frame_delta == CAMERA_DELTA_NONE);
+        if (camera_state.frame_reduced) {
+            hdr.format = CAMERA_FRAME_FORMAT_LOW_DEPTH;
+            hdr.depth = camera_state.depth.bits;
+            hdr.payload_len = hdr.height * bit_depth_row_bytes(hdr.width, hdr.depth);
+        }
+        camera_state.header = hdr;
+        if ((camera_state.burst == CAMERA_BURST_ARMED) ||
+            (camera_state.burst == CAMERA_BURST_RECORDING))
+            burst_frame_start(&hdr);
+        detect_task_frame_start(&hdr, camera_state.burst == CAMERA_BURST_OFF);
+        camera_state.sequence++;
+        if (!drop && camera_state.frame_pixels) {
+            memcpy(packedbuf, magic, 320);
+            memcpy(packedbuf + 320, &hdr, sizeof(hdr));
+        }
+        packedbuf += 320 + sizeof(hdr);
+        buflen += 320 + sizeof(hdr);
+    }
+
+    if (!camera_state.frame_pixels)
+        drop = true;
+
+    const uint8_t* rawbuf = camera_rawbuf[idx];
+    const uint32_t chunk_bytes = camera_state.geometry.chunk_bytes;
+    const uint32_t width = image_width_bytes(&camera_state.geometry);
+    const uint32_t raw_width = camera_state.geometry.len_x;
+
+    // Packed pixels go to packedbuf, or to the burst store while the frame is being recorded. A
+    // dropped chunk still has to be counted in the frame's statistics, so it's packed in place in
+    // rawbuf instead: packing only ever moves bytes towards the front, and rawbuf isn't shared
+    // with USB. So is a chunk that's compressed into packedbuf afterwards, or whose rows are
+    // reduced to fewer bits on their way there.
+    uint8_t* pixels = (drop || (camera_state.frame_codec != CAMERA_CODEC_NONE) ||
+                       camera_state.frame_reduced) ? camera_rawbuf[idx] : packedbuf;
+    const uint32_t reduced_width = bit_depth_row_bytes(width, camera_state.depth.bits);
+    const uint8_t* lut = camera_state.lut[camera_state.lut_active];
+    if (camera_state.burst_pixels != NULL)
+        pixels = camera_state.burst_pixels + camera_state.byte_count;
+
+    // Chunks are made of whole rows. Each row is packed and then added to the statistics while
+    // it's still in the cache.
+    const uint32_t rows = (raw_width != 0) ? (chunk_bytes / raw_width) : 0;
+    const uint32_t first_row = (width != 0) ? (camera_state.byte_count / width) : 0;
+    for (uint32_t r = 0; r < rows; r++) {
+        const uint8_t* src = rawbuf + (r * raw_width);
+        uint8_t* dst = pixels + (r * width);
+
+        // copy bytes from rawbuf to the target buffer, packing them from nybbles to bytes if
+        // appropriate. Packed pixels always go through the lookup table, which is the identity
+        // while none is in use; that's one load per pixel in a loop that works byte by byte anyway.
+        if (camera_state.geometry.pack) {
+            for (int i = 0; i < width; i++) {
+                const uint8_t msn = src[(2 * i) + 1] & 0x0f;
+                const uint8_t lsn = src[(2 * i) + 0] & 0x0f;
+                dst[i] = lut[(msn << 4) | (lsn << 0)];
+            }
+        } else if (camera_state.lut_on) {
+            for (int i = 0; i < width; i++)
+                dst[i] = lut[src[i]];
+        } else if (pixels != rawbuf) {
+            memcpy(dst, src, width);
+        }
+        frame_stats_add_rows(&camera_state.stats, first_row + r, dst, 1);
+        detect_task_add_row(first_row + r, dst);
+        if (camera_state.frame_focus)
+            focus_metric_add_rows(&camera_state.focus, first_row + r, dst, width, 1);
+        if (!drop && camera_state.frame_reduced)
+            bit_depth_reduce_row(&camera_state.depth, dst, width, first_row + r,
+                                 packedbuf + (r * reduced_width));
+
+        if (camera_state.frame_delta == CAMERA_DELTA_KEYFRAME) {
+            tile_delta_keyframe_rows(&camera_state.delta, first_row + r, dst, 1);
+        } else if ((camera_state.frame_delta == CAMERA_DELTA_FRAME) &&
+                   !tile_delta_add_rows(&camera_state.delta, first_row + r, dst, 1)) {
+            delta_frame_abandon();
+        }
+    }
+
+    const uint32_t packed_bytes = camera_state.geometry.pack ? (chunk_bytes / 2) : chunk_bytes;
+    camera_state.byte_count += packed_bytes;
+    buflen += camera_state.frame_reduced ? (rows * reduced_width) : packed_bytes;
+    if (!drop && (camera_state.frame_codec != CAMERA_CODEC_NONE))
+        buflen = compress_chunk(idx, first_row, rows);
+    if (camera_state.byte_count >= image_size_bytes(&camera_state.geometry)) {
+        frame_stats_publish(&camera_state.stats);
+        if (camera_state.send_stats && (camera_state.burst == CAMERA_BURST_OFF))
+            send_stats_record();
+        if (camera_state.frame_focus)
+            send_focus_record();
+        detect_task_frame_end();
+
+        if ((camera_state.burst == CAMERA_BURST_ARMED) ||
+            (camera_state.burst == CAMERA_BURST_RECORDING))
+            burst_frame_end();
+    }
+
+    cprintf(putch, "bytecount = %06i\r\n", camera_state.byte_count);
+    if (drop) {
+        // a keyframe that's missing a chunk is no use to the host.
+        if (camera_state.frame_delta == CAMERA_DELTA_KEYFRAME)
+            camera_state.delta_need_keyframe = true;
+        if (done)
+            xSemaphoreGive(done);
+    } else if (buflen == 0) {
+        if (done)
+            xSemaphoreGive(done);
+    } else {
+        // Tell USB that we've got new data for it.
+        usb_write_request_t req = {
+            .buf = (void*)camera_packedbuf[idx], .len = buflen, .done = done
+        };
+        if (xQueueSendToBack(usb_request_queue, (const void*)&req, 0) != pdTRUE) {
+            // if we can't push to the queue just drop it and flash an error led
+            // HAL_GPIO_WritePin(led1_GPIO_Port, led1_Pin, GPIO_PIN_SET);
+            if (camera_state.frame_delta == CAMERA_DELTA_KEYFRAME)
+                camera_state.delta_need_keyframe = true;
+            if (done)
+                xSemaphoreGive(done);
+        }
+    }
+
+    // The delta frame goes out after the frame's last chunk.
+    if ((camera_state.frame_delta != CAMERA_DELTA_NONE) &&
+        (camera_state.byte_count >= image_size_bytes(&camera_state.geometry)))
+        delta_frame_end();
+}
+
+/**
+ * Produces the next chunk of the test pattern and sends it on like a DCMI transfer. Frames start
+ * at test_frame_rate if one was set, dropping chunks that USB hasn't made room for in time like a
+ * live sensor would. Otherwise the generator goes exactly as fast as USB takes the data.
+ */
+static void test_pattern_step()
+{
+    static int idx = 0;
+    const bool frame_start = camera_state.byte_count >= image_size_bytes(&camera_state.geometry);
+
+    if (frame_start && camera_state.test_frame_rate) {
+        const TickType_t now = xTaskGetTickCount();
+        const TickType_t period = configTICK_RATE_HZ / camera_state.test_frame_rate;
+        if ((int32_t)(now - camera_state.test_next_frame) < 0)
+            return;
+
+        // don't try to catch up on frames that were missed altogether.
+        camera_state.test_next_frame += period;
+        if ((int32_t)(now - camera_state.test_next_frame) >= 0)
+            camera_state.test_next_frame = now + period;
+    }
+
+    const TickType_t wait = camera_state.test_frame_rate ? 0 : 5;
+    const bool drop = !xSemaphoreTake(camera_packedbuf_free_semaphore, wait);
+    if (drop && !camera_state.test_frame_rate)
+        return;
+
+    if (frame_start)
+        frame_start_stamp(&camera_state);
+
+    // rawbuf isn't shared with USB, so the pattern is generated even for dropped chunks to keep
+    // the rest of the frame right.
+    test_pattern_fill(&camera_state, camera_rawbuf[idx], frame_start);
+    process_chunk(idx, drop ? NULL : camera_packedbuf_free_semaphore, drop);
+
+    idx ^= 1;
+}
+
+/**
+ * Applies one camera read config request. Halts only get started here; they finish in the main
+ * loop of camera_read_task once the DCMI reaches the end of the frame.
+ */
+static void handle_config(const camera_read_config_t* req)
+{
+    switch (req->config_type) {
+        case CAMERA_READ_CONFIG_SETSIZE:
+        case CAMERA_READ_CONFIG_SETCROP:
+        case CAMERA_READ_CONFIG_SETPACKING: {
+            taskENTER_CRITICAL();
+            camera_geometry_t g = geometry_newest(&camera_state);
+            taskEXIT_CRITICAL();
+
+            if (req->config_type == CAMERA_READ_CONFIG_SETSIZE) {
+                g.width = req->params.image_dims.width;
+                g.height = req->params.image_dims.height;
+            } else if (req->config_type == CAMERA_READ_CONFIG_SETCROP) {
+                if (!camera_read_task_crop_is_valid(req->params.crop_dims.len_x,
+                                                    req->params.crop_dims.len_y)) {
+                    usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                    break;
+                }
+
+                g.start_x = req->params.crop_dims.start_x;
+                g.start_y = req->params.crop_dims.start_y;
+                g.len_x   = req->params.crop_dims.len_x;
+                g.len_y   = req->params.crop_dims.len_y;
+                g.chunk_bytes = dma_chunk_bytes(g.len_x, g.len_y);
+            } else {
+                g.pack = req->params.pack_options.pack;
+            }
+
+            if (camera_state.halted) {
+                // apply right away; the DMA picks up the new chunk size when it's resumed.
+                camera_state.geometry = g;
+                dcmi_crop_set(&camera_state.geometry);
+
+                // a running test pattern starts over with a new frame.
+                camera_state.byte_count = image_size_bytes(&g);
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            } else {
+                // latched by the VSYNC interrupt at the end of the current frame.
+                geometry_stage(&camera_state, &g, &req->ack);
+            }
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_HALT: {
+            if (req->params.halt_options.halt) {
+                if (camera_state.halted) {
+                    usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+                    break;
+                }
+
+                camera_state.halt_ack = req->ack;
+
+                // clear the DCMI's CAPTURE bit. Note that "During normal operation, if the
+                // CAPTURE bit is cleared, the DCMI captures until the end of the frame."
+                // DCMI_IRQHandler rewrites CR's CROP bit when it latches a geometry change, so
+                // the read-modify-write can't be interrupted.
+                taskENTER_CRITICAL();
+                DCMI->CR &= ~(1 << 0);
+                taskEXIT_CRITICAL();
+                camera_state.halt_pending = 1;
+                cprintf(putch, "DMA halt pending=====================\r\n");
+            } else {
+                if (!camera_state.halted) {
+                    usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+                    break;
+                }
+
+                // start DMA
+                dma_setup_xfer(camera_state.geometry.chunk_bytes);
+
+                // start DCMI back up and alert other processes that it's started.
+                xEventGroupClearBits(camera_read_task_events, CAMERA_READ_EVENT_HALTED);
+                dcmi_restart();
+
+                cprintf(putch, "DMA resumed\r\n");
+                xQueueReset(camera_frame_ready_semaphore);
+
+                // the first transfer after a resume starts a new frame.
+                camera_state.test_pattern = CAMERA_TEST_PATTERN_OFF;
+                camera_state.byte_count = image_size_bytes(&camera_state.geometry);
+                camera_state.halted = 0;
+
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            }
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_TEST_PATTERN: {
+            if (!camera_state.halted || camera_state.halt_pending) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_INVALID_STATE, 0);
+                break;
+            }
+
+            camera_state.test_pattern = req->params.test_pattern.pattern;
+            camera_state.test_frame_rate = req->params.test_pattern.frame_rate;
+            camera_state.test_next_frame = xTaskGetTickCount();
+            camera_state.byte_count = image_size_bytes(&camera_state.geometry);
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_STREAM: {
+            camera_state.pixel_interval = req->params.stream.pixel_interval;
+            camera_state.send_stats = req->params.stream.stats;
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_BURST: {
+            if (req->params.burst.frames == 0) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            if (camera_state.burst != CAMERA_BURST_OFF) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_INVALID_STATE, 0);
+                break;
+            }
+
+            // recording starts with the next frame; see process_chunk().
+            burst_store_reset();
+            camera_state.burst = CAMERA_BURST_RECORDING;
+            camera_state.burst_pre = 0;
+            camera_state.burst_post = req->params.burst.frames;
+            camera_state.burst_recorded = 0;
+            camera_state.burst_pixels = NULL;
+            camera_state.burst_ack = req->ack;
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_RING: {
+            if ((camera_state.burst != CAMERA_BURST_OFF) &&
+                (camera_state.burst != CAMERA_BURST_ARMED)) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_INVALID_STATE, 0);
+                break;
+            }
+
+            burst_disarm();
+            if (req->params.ring.pre_frames != 0) {
+                camera_state.burst = CAMERA_BURST_ARMED;
+                camera_state.burst_pre = req->params.ring.pre_frames;
+                camera_state.burst_post = req->params.ring.post_frames;
+                camera_state.burst_gpio = req->params.ring.gpio;
+                camera_state.burst_motion_threshold = req->params.ring.motion_threshold;
+                camera_state.burst_event = false;
+                camera_state.burst_tiles_valid = false;
+                camera_state.burst_ack = (camera_request_ack_t){0};
+                trigger_event_enable(camera_state.burst_gpio);
+            }
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_EVENT: {
+            if (camera_state.burst != CAMERA_BURST_ARMED) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_INVALID_STATE, 0);
+                break;
+            }
+            camera_state.burst_event = true;
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_DELTA: {
+            if (req->params.delta.hysteresis > req->params.delta.threshold) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            camera_state.delta_enabled = req->params.delta.enable;
+            camera_state.delta.threshold = req->params.delta.threshold;
+            camera_state.delta.hysteresis = req->params.delta.hysteresis;
+            camera_state.delta_keyframe_interval = req->params.delta.keyframe_interval;
+            camera_state.delta_need_keyframe = true;
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_CODEC: {
+            const bool quality_valid = (req->params.codec.quality >= 1) &&
+                                       (req->params.codec.quality <= 100);
+            if ((req->params.codec.codec > CAMERA_CODEC_DCT) ||
+                ((req->params.codec.codec == CAMERA_CODEC_DCT) && !quality_valid)) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            camera_state.codec = req->params.codec.codec;
+            camera_state.codec_quality = req->params.codec.quality;
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_DEPTH: {
+            const bit_depth_t depth = {
+                .bits = req->params.depth.bits,
+                .threshold = req->params.depth.threshold,
+                .dither = req->params.depth.dither
+            };
+            if (!bit_depth_valid(&depth)) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            camera_state.depth = depth;
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_LUT: {
+            // the table that's waiting for a frame start must stay as it was committed.
+            if (camera_state.lut_pending) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_INVALID_STATE, 0);
+                break;
+            }
+
+            uint8_t* table = camera_state.lut[camera_state.lut_active ^ 1];
+            const uint32_t offset = req->params.lut.offset;
+            const uint32_t count = req->params.lut.count;
+            if (!req->params.lut.commit) {
+                if ((count > CAMERA_LUT_PIECE) || ((offset + count) > 256)) {
+                    usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                    break;
+                }
+                memcpy(table + offset, req->params.lut.entries, count);
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+                break;
+            }
+
+            if (count == 16) {
+                uint8_t coarse[16];
+                memcpy(coarse, table, sizeof(coarse));
+                for (int i = 0; i < 256; i++)
+                    table[i] = coarse[i >> 4];
+            } else if (count == 0) {
+                for (int i = 0; i < 256; i++)
+                    table[i] = i;
+            } else if (count != 256) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+
+            camera_state.lut_pending = true;
+            camera_state.lut_pending_on = (count != 0);
+            camera_state.lut_ack = req->ack;
+
+            // with nothing coming in, there's no frame to wait for.
+            if (camera_state.halted && (camera_state.test_pattern == CAMERA_TEST_PATTERN_OFF))
+                lut_swap();
+            break;
+        }
+
+        case CAMERA_READ_CONFIG_FOCUS: {
+            camera_state.send_focus = req->params.focus.enable;
+            camera_state.focus_roi = req->params.focus.roi;
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+    }
+}
+
 /**
  * The camera read task has no awareness of which camera is connected to it or how that camera is
  * connected. All it does is read images of the size its asked to and send them as a stream to USB.
@@ -81,15 +994,28 @@ void DMA2_Stream7_IRQHandler()
  * All camera setup is handled by camera_management_task, which also tells this task what image
  * dimensions to expect.
  */
-camera_read_state_t camera_state;
 void camera_read_task(void const* args)
 {
     camera_frame_ready_semaphore = xSemaphoreCreateBinaryStatic(&camera_frame_ready_semaphore_buffer);
+    camera_frame_boundary_semaphore =
+        xSemaphoreCreateBinaryStatic(&camera_frame_boundary_semaphore_buffer);
+    camera_read_task_events = xEventGroupCreateStatic(&camera_read_task_events_buffer);
+    camera_packedbuf_free_semaphore =
+        xSemaphoreCreateCountingStatic(2, 2, &camera_packedbuf_free_semaphore_buffer);
+    camera_statsbuf_free_semaphore =
+        xSemaphoreCreateCountingStatic(1, 1, &camera_statsbuf_free_semaphore_buffer);
+    camera_focusbuf_free_semaphore =
+        xSemaphoreCreateCountingStatic(1, 1, &camera_focusbuf_free_semaphore_buffer);
+    camera_deltabuf_free_semaphore =
+        xSemaphoreCreateCountingStatic(2, 2, &camera_deltabuf_free_semaphore_buffer);
+    camera_burst_free_semaphore =
+        xSemaphoreCreateCountingStatic(2, 2, &camera_burst_free_semaphore_buffer);
 
     // camera_read_task doesn't have control over how large incoming frames are, instead it needs
     // to be told by camera_management_task how large it should expect incoming frames to be.
     // This variable keeps track of those active camera settings.
     init_camera_read_state(&camera_state);
+    xEventGroupSetBits(camera_read_task_events, CAMERA_READ_EVENT_HALTED);
 
     // enable DMA clock
     __HAL_RCC_DMA2_CLK_ENABLE();
@@ -99,123 +1025,47 @@ void camera_read_task(void const* args)
     DCMI->IER = (1 << 3);
 
     osDelay(1);
-    int framecount = 0;
     while (1) {
-        uint32_t image_size_bytes = (camera_state.len_x * camera_state.len_y);
-        if (camera_state.pack) image_size_bytes /= 2;
-
         // This logic assumes that - when the DCMI is being halted - the CAPTURE bit will be
         // cleared before the newly finished DMA xfer is fully processed.
         // This is basically guaranteed, but if it were violated, would result in a race condition.
+        // While a burst is being sent, the loop comes around at least every tick to keep it going.
+        const TickType_t chunk_wait = (camera_state.burst == CAMERA_BURST_DRAINING) ? 1 : 10;
         if (!camera_state.halted &&
-            xSemaphoreTake(camera_frame_ready_semaphore, 10)) {
+            xSemaphoreTake(camera_frame_ready_semaphore, chunk_wait)) {
 
             // Figure out which index is the backbuffer.
             int backbuf_idx = (DMA2_Stream7->CR & (1 << 19)) ? 0 : 1;
-
-            // If it's the first line of a frame, then pack in a synchronization line.
-            uint8_t* packedbuf = camera_packedbuf[backbuf_idx];
-            uint32_t buflen = 0;
-            if (camera_state.byte_count >= image_size_bytes) {
-                cprintf(putch, "frame marker %i\r\n", framecount++);
-                memcpy(packedbuf, magic, 320);
-                packedbuf += 320;
-                buflen += 320;
-
-                camera_state.byte_count -= image_size_bytes;
-            }
-
-            uint8_t* rawbuf = camera_rawbuf[backbuf_idx];
-
-            // TODO: allow for "split transfers", where a buffer might straddle a DMA xfer boundary.
-            // copy bytes from rawbuf to target buffer, packing them from nybbles to bytes if
-            // appropriate.
-            if (camera_state.pack) {
-                for (int i = 0; i < (CAMERA_BUF_WIDTH * CAMERA_BUF_HEIGHT) / 2; i++) {
-                    const uint8_t msn = rawbuf[(2 * i) + 1] & 0x0f;
-                    const uint8_t lsn = rawbuf[(2 * i) + 0] & 0x0f;
-                    packedbuf[i] = ((msn << 4) | (lsn << 0));
-                }
-
-                camera_state.byte_count += (CAMERA_BUF_WIDTH * CAMERA_BUF_HEIGHT) / 2;
-                buflen += (CAMERA_BUF_WIDTH * CAMERA_BUF_HEIGHT) / 2;
-            } else {
-                memcpy(packedbuf, rawbuf, (CAMERA_BUF_WIDTH * CAMERA_BUF_HEIGHT));
-                camera_state.byte_count += CAMERA_BUF_WIDTH * CAMERA_BUF_HEIGHT;
-                buflen += (CAMERA_BUF_WIDTH * CAMERA_BUF_HEIGHT);
-            }
-
-            cprintf(putch, "bytecount = %06i\r\n", camera_state.byte_count);
-
-            // Tell USB that we've got new data for it.
-            usb_write_request_t req = {.buf = (void*)camera_packedbuf[backbuf_idx], .len = buflen};
-            if (xQueueSendToBack(usb_request_queue, (const void*)&req, 0) != pdTRUE) {
-                // if we can't push to the queue just drop it and flash an error led
-                // HAL_GPIO_WritePin(led1_GPIO_Port, led1_Pin, GPIO_PIN_SET);
-            }
+            process_chunk(backbuf_idx, NULL, false);
 
             // toggle the pin as a sign of life
             HAL_GPIO_TogglePin(led0_GPIO_Port, led0_Pin);
+        } else if (camera_state.halted && (camera_state.test_pattern != CAMERA_TEST_PATTERN_OFF)) {
+            test_pattern_step();
         }
 
+        while (burst_drain_step())
+            ;
+
         // If we have a request to change the camera configuration, process it now.
-        // Note that if we're halted, we add in a short delay so as to not spinlock.
-        // Also note that if a DCMI halt is pending, do not try to process any requests.
+        // Note that if we're halted, we add in a short delay so as to not spinlock. The test
+        // pattern generator paces itself.
         TickType_t wait_time = camera_state.halted ? 5 : 0;
+        if (camera_state.halted && (camera_state.test_pattern != CAMERA_TEST_PATTERN_OFF))
+            wait_time = camera_state.test_frame_rate ? 1 : 0;
+        if (camera_state.halted && (camera_state.burst == CAMERA_BURST_DRAINING))
+            wait_time = 1;
         camera_read_config_t req;
-        if (!camera_state.halt_pending &&
-            xQueueReceive(camera_read_task_config_queue, &req, wait_time)) {
-            switch (req.config_type) {
-                case CAMERA_READ_CONFIG_SETSIZE: {
-                    camera_state.width = req.params.image_dims.width;
-                    camera_state.height = req.params.image_dims.height;
-                    dcmi_crop_set(&camera_state);
-                    break;
-                }
-
-                case CAMERA_READ_CONFIG_SETCROP: {
-                    camera_state.start_x = req.params.crop_dims.start_x;
-                    camera_state.start_y = req.params.crop_dims.start_y;
-                    camera_state.len_x   = req.params.crop_dims.len_x;
-                    camera_state.len_y   = req.params.crop_dims.len_y;
-                    dcmi_crop_set(&camera_state);
-                    break;
-                }
-
-                case CAMERA_READ_CONFIG_SETPACKING: {
-                    camera_state.pack = req.params.pack_options.pack;
-
-                    break;
-                }
-
-                case CAMERA_READ_CONFIG_HALT: {
-                    camera_state.halt_callback = req.params.halt_options.halt_callback;
-                    camera_state.halt_callback_user = req.params.halt_options.halt_callback_user;
-
-                    if (req.params.halt_options.halt) {
-                        // clear the DCMI's CAPTURE bit. Note that "During normal operation, if the
-                        // CAPTURE bit is cleared, the DCMI captures until the end of the frame."
-                        DCMI->CR &= ~(1 << 0);
-                        camera_state.halt_pending = 1;
-                        cprintf(putch, "DMA halt pending=====================\r\n");
-                    } else {
-                        // start DMA
-                        dma_setup_xfer();
-
-                        // start DCMI back up and alert other processes that it's started.
-                        dcmi_restart();
-
-                        cprintf(putch, "DMA resumed\r\n");
-                        xQueueReset(camera_frame_ready_semaphore);
-                        camera_state.byte_count = 0;
-                        camera_state.halted = 0;
-
-                        if (camera_state.halt_callback) {
-                            camera_state.halt_callback(camera_state.halt_callback_user);
-                        }
-                    }
-                    break;
-                }
+        if (xQueueReceive(camera_read_task_config_queue, &req, wait_time)) {
+            if (camera_state.halt_pending && (req.config_type == CAMERA_READ_CONFIG_HALT)) {
+                // Halts and resumes have to happen in the order they were asked for, so these
+                // wait until the pending halt is done. Everything else goes ahead.
+                if (camera_state.n_deferred < CAMERA_READ_MAX_DEFERRED)
+                    camera_state.deferred[camera_state.n_deferred++] = req;
+                else
+                    usb_task_send_response(&req.ack, CAMERA_RESPONSE_INVALID_STATE, 0);
+            } else {
+                handle_config(&req);
             }
         }
 
@@ -234,22 +1084,68 @@ void camera_read_task(void const* args)
 
             cprintf(putch, "DMA halted\r\n");
 
+            // Geometry changes and lookup tables that didn't make it to a frame boundary before
+            // the halt are applied now.
+            geometry_flush(&camera_state);
+            if (camera_state.lut_pending && (camera_state.test_pattern == CAMERA_TEST_PATTERN_OFF))
+                lut_swap();
+
+            // A burst that's being recorded ends with the last whole frame, and an armed
+            // pre-trigger ring drops the frame that it was in the middle of.
+            camera_state.burst_pixels = NULL;
+            if (camera_state.burst == CAMERA_BURST_RECORDING)
+                burst_finish_recording();
+
             // Let other processes know that DCMI has been disabled so we can start changing camera
             // settings.
-            if (camera_state.halt_callback) {
-                camera_state.halt_callback(camera_state.halt_callback_user);
-            }
+            xEventGroupSetBits(camera_read_task_events, CAMERA_READ_EVENT_HALTED);
+            usb_task_send_response(&camera_state.halt_ack, CAMERA_RESPONSE_OK, 0);
+            camera_state.halt_ack = (camera_request_ack_t){0};
+
+            // Now that the halt is done, catch up on any halts / resumes that were waiting for it.
+            // If one of them is another halt, the rest keep waiting for that one.
+            int i;
+            for (i = 0; (i < camera_state.n_deferred) && !camera_state.halt_pending; i++)
+                handle_config(&camera_state.deferred[i]);
+            memmove(&camera_state.deferred[0], &camera_state.deferred[i],
+                    (camera_state.n_deferred - i) * sizeof(camera_state.deferred[0]));
+            camera_state.n_deferred -= i;
         }
     }
 }
 
-/**
- * utility function that notifies a task.
- */
-static void notifyme(void** user)
+bool camera_read_task_crop_is_valid(int len_x, int len_y)
 {
-    SemaphoreHandle_t s = (SemaphoreHandle_t)(*user);
-    xSemaphoreGive(s);
+    // see the note on crop_dims in camera_read_task.h
+    return dma_chunk_bytes(len_x, len_y) != 0;
+}
+
+bool camera_read_task_is_running()
+{
+    return !camera_state.halted;
+}
+
+bool camera_read_task_wait_frame_boundary(TickType_t timeout)
+{
+    if (camera_state.halted)
+        return true;
+
+    // throw away a stale boundary from a frame that already ended.
+    xSemaphoreTake(camera_frame_boundary_semaphore, 0);
+    return xSemaphoreTake(camera_frame_boundary_semaphore, timeout) == pdTRUE;
+}
+
+uint32_t camera_read_task_frame_start_sequence()
+{
+    return camera_state.frame_start_sequence;
+}
+
+bool camera_read_task_wait_halted(TickType_t timeout)
+{
+    const EventBits_t bits = xEventGroupWaitBits(camera_read_task_events,
+                                                 CAMERA_READ_EVENT_HALTED,
+                                                 pdFALSE, pdTRUE, timeout);
+    return (bits & CAMERA_READ_EVENT_HALTED) != 0;
 }
 
 void camera_read_task_enqueue_config(const camera_read_config_t* req)
@@ -257,65 +1153,188 @@ void camera_read_task_enqueue_config(const camera_read_config_t* req)
     xQueueSendToBack(camera_read_task_config_queue, (const void*)req, portMAX_DELAY);
 }
 
-void camera_read_task_set_size(int width, int height)
+void camera_read_task_set_size(int width, int height, const camera_request_ack_t* ack)
 {
     camera_read_config_t req = {
         .config_type = CAMERA_READ_CONFIG_SETSIZE,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
         .params.image_dims = {width, height}
     };
     xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
 }
 
-void camera_read_task_set_crop(int start_x, int start_y, int len_x, int len_y)
+void camera_read_task_set_crop(int start_x, int start_y, int len_x, int len_y,
+                               const camera_request_ack_t* ack)
 {
     camera_read_config_t req = {
         .config_type = CAMERA_READ_CONFIG_SETCROP,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
         .params.crop_dims = {start_x, start_y, len_x, len_y}
     };
     xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
 }
 
-void camera_read_task_enable_packing()
+void camera_read_task_enable_packing(const camera_request_ack_t* ack)
 {
     camera_read_config_t req = {
         .config_type = CAMERA_READ_CONFIG_SETPACKING,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
         .params.pack_options = {true}
     };
     xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
 }
 
-void camera_read_task_disable_packing()
+void camera_read_task_disable_packing(const camera_request_ack_t* ack)
 {
     camera_read_config_t req = {
         .config_type = CAMERA_READ_CONFIG_SETPACKING,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
         .params.pack_options = {false}
     };
     xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
 }
 
-void camera_read_task_halt_dcmi()
+void camera_read_task_halt_dcmi(const camera_request_ack_t* ack)
 {
-    StaticSemaphore_t sembuf;
-    SemaphoreHandle_t sem = xSemaphoreCreateBinaryStatic(&sembuf);
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_HALT,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.halt_options = {true}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
 
+void camera_read_task_resume_dcmi(const camera_request_ack_t* ack)
+{
     camera_read_config_t req = {
         .config_type = CAMERA_READ_CONFIG_HALT,
-        .params.halt_options = {notifyme, (void**)&sem, true}
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.halt_options = {false}
     };
     xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
 
-    // notifyme will give the semaphore when the dcmi has been halted.
-    xSemaphoreTake(sem, portMAX_DELAY);
+void camera_read_task_set_test_pattern(camera_test_pattern_e pattern, uint32_t frame_rate,
+                                       const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_TEST_PATTERN,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.test_pattern = {pattern, frame_rate}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
 }
 
-/**
- * Asks the camera read task to resume the DCMI interface. Blocks until this is done.
- */
-void camera_read_task_resume_dcmi()
+void camera_read_task_set_stream(uint32_t pixel_interval, bool stats,
+                                 const camera_request_ack_t* ack)
 {
     camera_read_config_t req = {
-        .config_type = CAMERA_READ_CONFIG_HALT,
-        .params.halt_options = {NULL, NULL, false}
+        .config_type = CAMERA_READ_CONFIG_STREAM,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.stream = {pixel_interval, stats}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_burst(uint32_t frames, const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_BURST,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.burst = {frames}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_ring(uint32_t pre_frames, uint32_t post_frames, bool gpio,
+                           uint8_t motion_threshold, const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_RING,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.ring = {pre_frames, post_frames, gpio, motion_threshold}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_event(const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_EVENT,
+        .ack = ack ? *ack : (camera_request_ack_t){0}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_set_delta(bool enable, uint8_t threshold, uint8_t hysteresis,
+                                uint32_t keyframe_interval, const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_DELTA,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.delta = {enable, threshold, hysteresis, keyframe_interval}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_set_codec(camera_codec_e codec, uint8_t quality,
+                                const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_CODEC,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.codec = {codec, quality}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_set_depth(uint8_t bits, uint8_t threshold, bool dither,
+                                const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_DEPTH,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.depth = {bits, threshold, dither}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_lut_write(uint32_t offset, const uint8_t* entries, uint32_t count,
+                                const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_LUT,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.lut = {
+            .commit = false,
+            .offset = (offset > 0xffff) ? 0xffff : offset,
+            .count = (count > CAMERA_LUT_PIECE) ? 0xffff : count
+        }
+    };
+
+    // a piece that's too big is refused by the camera read task.
+    if (count <= CAMERA_LUT_PIECE)
+        memcpy(req.params.lut.entries, entries, count);
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_lut_commit(uint32_t size, const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_LUT,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.lut = {.commit = true, .count = (size > 0xffff) ? 0xffff : size}
+    };
+    xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void camera_read_task_set_focus(bool enable, const frame_stats_roi_t* roi,
+                                const camera_request_ack_t* ack)
+{
+    camera_read_config_t req = {
+        .config_type = CAMERA_READ_CONFIG_FOCUS,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.focus = {.enable = enable, .roi = *roi}
     };
     xQueueSendToBack(camera_read_task_config_queue, (const void*)&req, portMAX_DELAY);
 }
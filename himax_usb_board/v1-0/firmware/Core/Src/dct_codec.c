@@ -0,0 +1,231 @@
+#include "dct_codec.h"
+#include "main.h"
+#include "timebase.h"
+#include "arm_math.h"
+
+#include <string.h>
+
+// Rows of the band that's being filled.
+static uint8_t band[DCT_CODEC_BLOCK * DCT_CODEC_MAX_WIDTH];
+
+// Orthonormal 8-point DCT-II basis in Q15, C[u][x] = c(u) cos((2x + 1) u pi / 16), and its
+// transpose.
+static q15_t dct_basis[64] = {
+    11585,  11585,  11585,  11585,  11585,  11585,  11585,  11585,
+    16069,  13623,   9102,   3196,  -3196,  -9102, -13623, -16069,
+    15137,   6270,  -6270, -15137, -15137,  -6270,   6270,  15137,
+    13623,  -3196, -16069,  -9102,   9102,  16069,   3196, -13623,
+    11585, -11585, -11585,  11585,  11585, -11585, -11585,  11585,
+     9102, -16069,   3196,  13623, -13623,  -3196,  16069,  -9102,
+     6270, -15137,  15137,  -6270,  -6270,  15137, -15137,   6270,
+     3196,  -9102,  13623, -16069,  16069, -13623,   9102,  -3196,
+};
+static q15_t dct_basis_t[64] = {
+    11585,  16069,  15137,  13623,  11585,   9102,   6270,   3196,
+    11585,  13623,   6270,  -3196, -11585, -16069, -15137,  -9102,
+    11585,   9102,  -6270, -16069, -11585,   3196,  15137,  13623,
+    11585,   3196, -15137,  -9102,  11585,  13623,  -6270, -16069,
+    11585,  -3196, -15137,   9102,  11585, -13623,  -6270,  16069,
+    11585,  -9102,  -6270,  16069, -11585,  -3196,  15137, -13623,
+    11585, -13623,   6270,   3196, -11585,  16069, -15137,   9102,
+    11585, -16069,  15137, -13623,  11585,  -9102,   6270,  -3196,
+};
+
+// Index of the n-th coefficient in zigzag order.
+static const uint8_t zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// JPEG luminance quantization table for quality 50, in natural order.
+static const uint8_t luminance_table[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99,
+};
+
+typedef struct bit_writer {
+    uint8_t* p;
+    uint8_t* end;
+    uint32_t acc;
+    uint32_t n;
+    bool overflow;
+} bit_writer_t;
+
+/**
+ * Appends the low 'nbits' (at most 24) bits of 'value', MSB first.
+ */
+static void put_bits(bit_writer_t* bw, uint32_t value, uint32_t nbits)
+{
+    bw->acc = (bw->acc << nbits) | value;
+    bw->n += nbits;
+    while (bw->n >= 8) {
+        bw->n -= 8;
+        if (bw->p == bw->end) {
+            bw->overflow = true;
+            return;
+        }
+        *bw->p++ = (bw->acc >> bw->n) & 0xff;
+    }
+}
+
+// Unsigned Exp-Golomb code of 'v': as many 0s as v + 1 has bits after its first, then v + 1.
+static void put_ue(bit_writer_t* bw, uint32_t v)
+{
+    const uint32_t bits = 32 - __CLZ(v + 1);
+    put_bits(bw, 0, bits - 1);
+    put_bits(bw, v + 1, bits);
+}
+
+static void put_se(bit_writer_t* bw, int32_t v)
+{
+    put_ue(bw, (v > 0) ? ((2 * v) - 1) : (-2 * v));
+}
+
+static void flush_bits(bit_writer_t* bw)
+{
+    if (bw->n != 0)
+        put_bits(bw, 0, 8 - bw->n);
+}
+
+/**
+ * Transforms and codes block 'bx' of the band in 'band', which has 'rows' rows of its own.
+ * 'dc' is the last block's quantized DC coefficient.
+ */
+static void code_block(const dct_codec_t* c, uint32_t bx, uint32_t rows, uint32_t shift,
+                       int32_t* dc, bit_writer_t* bw)
+{
+    q15_t x[64], t[64], y[64], state[64];
+    for (uint32_t r = 0; r < DCT_CODEC_BLOCK; r++) {
+        const uint8_t* src = band + (((r < rows) ? r : (rows - 1)) * c->width);
+        for (uint32_t col = 0; col < DCT_CODEC_BLOCK; col++) {
+            uint32_t px = (bx * DCT_CODEC_BLOCK) + col;
+            if (px >= c->width)
+                px = c->width - 1;
+            // 4 fractional bits keep the rounding of the first product out of the result.
+            x[(r * DCT_CODEC_BLOCK) + col] = ((int32_t)src[px] - 128) * 16;
+        }
+    }
+
+    // y = C x C^T. Sums of 8 products can't overflow 32 bits here, so the fast version will do.
+    const arm_matrix_instance_q15 basis = {DCT_CODEC_BLOCK, DCT_CODEC_BLOCK, dct_basis};
+    const arm_matrix_instance_q15 basis_t = {DCT_CODEC_BLOCK, DCT_CODEC_BLOCK, dct_basis_t};
+    arm_matrix_instance_q15 xm = {DCT_CODEC_BLOCK, DCT_CODEC_BLOCK, x};
+    arm_matrix_instance_q15 tm = {DCT_CODEC_BLOCK, DCT_CODEC_BLOCK, t};
+    arm_matrix_instance_q15 ym = {DCT_CODEC_BLOCK, DCT_CODEC_BLOCK, y};
+    arm_mat_mult_fast_q15(&basis, &xm, &tm, state);
+    arm_mat_mult_fast_q15(&tm, &basis_t, &ym, state);
+
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < 64; i++) {
+        const int32_t v = y[zigzag[i]];
+        const uint32_t mag = (((v < 0) ? -v : v) * (uint32_t)c->recip[i] + (1u << (15 + shift))) >>
+                             (16 + shift);
+        const int32_t q = (v < 0) ? -(int32_t)mag : (int32_t)mag;
+        if (i == 0) {
+            put_se(bw, q - *dc);
+            *dc = q;
+        } else if (mag == 0) {
+            run++;
+        } else {
+            put_ue(bw, run + 1);
+            put_ue(bw, mag - 1);
+            put_bits(bw, (v < 0) ? 1 : 0, 1);
+            run = 0;
+        }
+    }
+    put_ue(bw, 0);
+}
+
+/**
+ * Codes the band in 'band', which has 'rows' rows of its own, into 'out', which has room for
+ * 'out_size' bytes, and returns the number of bytes taken. Quantization gets coarser until the
+ * band fits.
+ */
+static uint32_t code_band(const dct_codec_t* c, uint32_t rows, uint8_t* out, uint32_t out_size)
+{
+    for (uint32_t shift = 0;; shift++) {
+        bit_writer_t bw = {.p = out + 3, .end = out + out_size};
+        if (out_size < 3)
+            bw.end = bw.p;
+        int32_t dc = 0;
+        for (uint32_t bx = 0; (bx < c->blocks_x) && !bw.overflow; bx++)
+            code_block(c, bx, rows, shift, &dc, &bw);
+        flush_bits(&bw);
+
+        // with every coefficient quantized away, a block takes 2 bits. Buffers are sized so that
+        // it fits by then.
+        if (!bw.overflow || (shift >= 15)) {
+            const uint32_t len = bw.p - (out + 3);
+            out[0] = shift;
+            out[1] = len & 0xff;
+            out[2] = len >> 8;
+            return 3 + len;
+        }
+    }
+}
+
+bool dct_codec_fits(uint32_t width)
+{
+    return (width != 0) && (width <= DCT_CODEC_MAX_WIDTH);
+}
+
+void dct_codec_begin(dct_codec_t* c, uint16_t width, uint16_t height, uint8_t quality)
+{
+    c->width = width;
+    c->height = height;
+    c->blocks_x = (width + DCT_CODEC_BLOCK - 1) / DCT_CODEC_BLOCK;
+    c->quality = quality;
+
+    const uint32_t scale = (quality < 50) ? (5000 / quality) : (200 - (2 * quality));
+    for (int i = 0; i < 64; i++) {
+        uint32_t step = ((luminance_table[zigzag[i]] * scale) + 50) / 100;
+        if (step < 1)
+            step = 1;
+        if (step > 255)
+            step = 255;
+        c->step[i] = step;
+        c->recip[i] = (4096 + (step / 2)) / step;
+    }
+}
+
+uint32_t dct_codec_add_rows(dct_codec_t* c, const uint8_t* rows, uint32_t y, uint32_t n,
+                            uint8_t* out, uint32_t out_size)
+{
+    const uint32_t start_us = timebase_now_us();
+
+    // every band that's finished gets an equal share of what's left of 'out'.
+    uint32_t bands = 0;
+    for (uint32_t r = y; (r < (y + n)) && (r < c->height); r++) {
+        if (((r % DCT_CODEC_BLOCK) == (DCT_CODEC_BLOCK - 1)) || (r == (c->height - 1u)))
+            bands++;
+    }
+
+    dct_slice_header_t hdr = {.quality = c->quality, .bands = bands};
+    uint32_t len = sizeof(hdr);
+    for (uint32_t i = 0; (i < n) && (y < c->height); i++, y++, rows += c->width) {
+        const uint32_t by = y % DCT_CODEC_BLOCK;
+        memcpy(band + (by * c->width), rows, c->width);
+        if ((by != (DCT_CODEC_BLOCK - 1)) && (y != (c->height - 1u)))
+            continue;
+
+        if (hdr.rows == 0)
+            hdr.first_row = y - by;
+        hdr.rows += by + 1;
+        len += code_band(c, by + 1, out + len, (out_size - len) / bands);
+        bands--;
+    }
+
+    if (hdr.rows == 0)
+        return 0;
+    hdr.encode_cycles = (timebase_now_us() - start_us) * (SystemCoreClock / 1000000u);
+    memcpy(out, &hdr, sizeof(hdr));
+    return len;
+}
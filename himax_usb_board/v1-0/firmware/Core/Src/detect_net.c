@@ -0,0 +1,163 @@
+#include "detect_net.h"
+#include "arm_nnfunctions.h"
+
+#include <stddef.h>
+
+typedef enum detect_layer_kind {
+    DETECT_LAYER_CONV,
+    DETECT_LAYER_DEPTHWISE,
+    DETECT_LAYER_POINTWISE,
+    DETECT_LAYER_FC
+} detect_layer_kind_e;
+
+typedef struct detect_layer {
+    detect_layer_kind_e kind;
+    uint8_t stride;
+    uint8_t ch_in, ch_out;
+    uint8_t dim_in, dim_out;
+} detect_layer_t;
+
+// See detect_net.h. The fully connected layer's ch_out is the model's number of classes.
+static const detect_layer_t layers[DETECT_NET_LAYERS] = {
+    {DETECT_LAYER_CONV,      2,  1,  8, 64, 32},
+    {DETECT_LAYER_DEPTHWISE, 1,  8,  8, 32, 32},
+    {DETECT_LAYER_POINTWISE, 1,  8, 16, 32, 32},
+    {DETECT_LAYER_DEPTHWISE, 2, 16, 16, 32, 16},
+    {DETECT_LAYER_POINTWISE, 1, 16, 32, 16, 16},
+    {DETECT_LAYER_DEPTHWISE, 2, 32, 32, 16,  8},
+    {DETECT_LAYER_POINTWISE, 1, 32, 64,  8,  8},
+    {DETECT_LAYER_DEPTHWISE, 1, 64, 64,  8,  8},
+    {DETECT_LAYER_POINTWISE, 1, 64, 64,  8,  8},
+    {DETECT_LAYER_FC,        1, 64,  0,  1,  1},
+};
+
+#define DETECT_NET_KERNEL 3
+#define DETECT_NET_POOL_DIM 8
+
+// Largest activation map (layer 2's output), and the most channels of any layer.
+#define DETECT_NET_MAX_ACTIVATIONS (32 * 32 * 16)
+#define DETECT_NET_MAX_CHANNELS 64
+
+// Layers read from one of these and write to the other.
+static q7_t activations[2][DETECT_NET_MAX_ACTIVATIONS] __attribute__((aligned(4)));
+
+// im2col scratch of the 3x3 layers, which is the biggest that any CMSIS-NN function here needs.
+static q15_t scratch[2 * DETECT_NET_MAX_CHANNELS * DETECT_NET_KERNEL * DETECT_NET_KERNEL];
+
+static const detect_model_header_t* model = NULL;
+static const q7_t* weights[DETECT_NET_LAYERS];
+static const q7_t* biases[DETECT_NET_LAYERS];
+
+static uint32_t align4(uint32_t n)
+{
+    return (n + 3) & ~3ul;
+}
+
+static uint32_t layer_ch_out(const detect_layer_t* l, uint32_t classes)
+{
+    return (l->kind == DETECT_LAYER_FC) ? classes : l->ch_out;
+}
+
+static uint32_t layer_weights(const detect_layer_t* l, uint32_t classes)
+{
+    switch (l->kind) {
+        case DETECT_LAYER_CONV:
+            return l->ch_out * DETECT_NET_KERNEL * DETECT_NET_KERNEL * l->ch_in;
+        case DETECT_LAYER_DEPTHWISE:
+            return DETECT_NET_KERNEL * DETECT_NET_KERNEL * l->ch_in;
+        default:
+            return layer_ch_out(l, classes) * l->ch_in;
+    }
+}
+
+uint32_t detect_net_model_size(uint32_t classes)
+{
+    uint32_t size = align4(sizeof(detect_model_header_t));
+    for (int i = 0; i < DETECT_NET_LAYERS; i++)
+        size += align4(layer_weights(&layers[i], classes)) +
+                align4(layer_ch_out(&layers[i], classes));
+    return size;
+}
+
+bool detect_net_load(const uint8_t* m, uint32_t size)
+{
+    model = NULL;
+    const detect_model_header_t* hdr = (const detect_model_header_t*)m;
+    if ((size < sizeof(*hdr)) || (hdr->magic != DETECT_NET_MODEL_MAGIC) ||
+        (hdr->classes < 1) || (hdr->classes > DETECT_NET_MAX_CLASSES) ||
+        (size != detect_net_model_size(hdr->classes)))
+        return false;
+
+    uint32_t offset = align4(sizeof(*hdr));
+    for (int i = 0; i < DETECT_NET_LAYERS; i++) {
+        if ((hdr->shifts[i].out_shift < 1) || (hdr->shifts[i].out_shift > 31) ||
+            (hdr->shifts[i].bias_shift > 24))
+            return false;
+        weights[i] = (const q7_t*)(m + offset);
+        offset += align4(layer_weights(&layers[i], hdr->classes));
+        biases[i] = (const q7_t*)(m + offset);
+        offset += align4(layer_ch_out(&layers[i], hdr->classes));
+    }
+
+    model = hdr;
+    return true;
+}
+
+void detect_net_unload()
+{
+    model = NULL;
+}
+
+const detect_model_header_t* detect_net_model()
+{
+    return model;
+}
+
+void detect_net_run(const int8_t* input, int8_t* logits, int8_t* scores)
+{
+    const q7_t* in = input;
+    q7_t* out = activations[0];
+    for (int i = 0; i < (DETECT_NET_LAYERS - 1); i++) {
+        const detect_layer_t* l = &layers[i];
+        const uint16_t bias_shift = model->shifts[i].bias_shift;
+        const uint16_t out_shift = model->shifts[i].out_shift;
+        switch (l->kind) {
+            case DETECT_LAYER_CONV:
+                arm_convolve_HWC_q7_basic(in, l->dim_in, l->ch_in, weights[i], l->ch_out,
+                                          DETECT_NET_KERNEL, 1, l->stride, biases[i], bias_shift,
+                                          out_shift, out, l->dim_out, scratch, NULL);
+                break;
+
+            case DETECT_LAYER_DEPTHWISE:
+                arm_depthwise_separable_conv_HWC_q7(in, l->dim_in, l->ch_in, weights[i], l->ch_out,
+                                                    DETECT_NET_KERNEL, 1, l->stride, biases[i],
+                                                    bias_shift, out_shift, out, l->dim_out,
+                                                    scratch, NULL);
+                break;
+
+            default:
+                // every 1x1 layer has a multiple of 4 channels in and of 2 out, which the fast
+                // version needs.
+                arm_convolve_1x1_HWC_q7_fast_nonsquare(in, l->dim_in, l->dim_in, l->ch_in,
+                                                       weights[i], l->ch_out, 1, 1, 0, 0, 1, 1,
+                                                       biases[i], bias_shift, out_shift, out,
+                                                       l->dim_out, l->dim_out, scratch, NULL);
+                break;
+        }
+        arm_relu_q7(out, l->dim_out * l->dim_out * l->ch_out);
+
+        in = out;
+        out = (out == activations[0]) ? activations[1] : activations[0];
+    }
+
+    // the pool works on its input in place, which is layer 8's output.
+    q7_t pooled[DETECT_NET_MAX_CHANNELS];
+    arm_avepool_q7_HWC((q7_t*)in, DETECT_NET_POOL_DIM, DETECT_NET_MAX_CHANNELS,
+                       DETECT_NET_POOL_DIM, 0, 1, 1, (q7_t*)scratch, pooled);
+
+    const int fc = DETECT_NET_LAYERS - 1;
+    arm_fully_connected_q7(pooled, weights[fc], layers[fc].ch_in, model->classes,
+                           model->shifts[fc].bias_shift, model->shifts[fc].out_shift, biases[fc],
+                           logits, scratch);
+    arm_softmax_q7(logits, model->classes, scores);
+}
@@ -0,0 +1,273 @@
+#include "detect_task.h"
+#include "timebase.h"
+
+#include <string.h>
+
+////////////////////////////////////////////////////////////////
+// FreeRTOS includes
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#include "queue.h"
+
+// queues for IPC are declared and initialized in main
+extern QueueHandle_t detect_task_request_queue;
+extern QueueHandle_t usb_request_queue;
+
+// Defined in camera_read_task_util.hc.
+extern const uint8_t magic[320];
+
+// Given by detect_task once it's done with the network input, and by usb_task once it's done
+// with detect_recordbuf.
+SemaphoreHandle_t detect_input_free_semaphore;
+StaticSemaphore_t detect_input_free_semaphore_buffer;
+SemaphoreHandle_t detect_recordbuf_free_semaphore;
+StaticSemaphore_t detect_recordbuf_free_semaphore_buffer;
+
+// Models are uploaded straight into this and loaded from it.
+static uint8_t model[DETECT_NET_MAX_MODEL_BYTES] __attribute__((aligned(4)));
+
+// Network input of the frame that's being packed or looked at.
+static int8_t input[DETECT_NET_INPUT_DIM * DETECT_NET_INPUT_DIM] __attribute__((aligned(4)));
+
+// A result behind its frame marker and header.
+static uint8_t detect_recordbuf[320 + sizeof(camera_frame_header_t) + sizeof(detect_record_t)];
+
+// Set by detect_task, read by camera_read_task at frame starts.
+static volatile bool model_ready = false;
+static volatile uint32_t interval = 0;
+static volatile bool gate = false;
+static volatile bool present = false;
+static uint8_t threshold = 0;
+static uint8_t class_index = 0;
+
+// Counted by camera_read_task, reset by detect_task when it's configured.
+static volatile uint32_t skipped = 0;
+
+// Only touched by camera_read_task: whether it holds 'input' and is filling it, the next input
+// row and the row of the frame that it comes from, and the frame columns that the input is taken
+// from.
+static bool holding = false;
+static bool sampling = false;
+static uint32_t next_input_row;
+static uint32_t next_y;
+static uint32_t frame_height;
+static uint16_t columns[DETECT_NET_INPUT_DIM];
+static camera_frame_header_t frame_header;
+
+/**
+ * Row or column of the frame that input row or column 'i' is taken from.
+ */
+static uint32_t sample_position(uint32_t i, uint32_t size)
+{
+    return (((2 * i) + 1) * size) / (2 * DETECT_NET_INPUT_DIM);
+}
+
+void detect_task_frame_start(const camera_frame_header_t* hdr, bool allowed)
+{
+    sampling = false;
+    if (!allowed || (interval == 0) || !model_ready || ((hdr->sequence % interval) != 0) ||
+        (hdr->width < DETECT_NET_INPUT_DIM) || (hdr->height < DETECT_NET_INPUT_DIM))
+        return;
+
+    // the input of a frame that never got to its end is simply overwritten.
+    if (!holding) {
+        if (!xSemaphoreTake(detect_input_free_semaphore, 0)) {
+            skipped++;
+            return;
+        }
+        holding = true;
+    }
+
+    for (uint32_t i = 0; i < DETECT_NET_INPUT_DIM; i++)
+        columns[i] = sample_position(i, hdr->width);
+    frame_header = *hdr;
+    frame_height = hdr->height;
+    next_input_row = 0;
+    next_y = sample_position(0, frame_height);
+    sampling = true;
+}
+
+void detect_task_add_row(uint32_t y, const uint8_t* row)
+{
+    if (!sampling || (y != next_y))
+        return;
+
+    int8_t* dst = input + (next_input_row * DETECT_NET_INPUT_DIM);
+    for (uint32_t i = 0; i < DETECT_NET_INPUT_DIM; i++)
+        dst[i] = (int8_t)(row[columns[i]] ^ 0x80);
+
+    next_input_row++;
+    next_y = sample_position(next_input_row, frame_height);
+}
+
+void detect_task_frame_end()
+{
+    if (!sampling || (next_input_row != DETECT_NET_INPUT_DIM))
+        return;
+    sampling = false;
+
+    detect_request_t req = {.type = DETECT_REQUEST_FRAME, .params.frame = frame_header};
+    if (xQueueSendToBack(detect_task_request_queue, (const void*)&req, 0) == pdTRUE)
+        holding = false;
+    else
+        skipped++;
+}
+
+bool detect_task_gate_open()
+{
+    return !gate || present;
+}
+
+/**
+ * Runs the model on the input of the frame with header 'hdr' and sends the result.
+ */
+static void run_frame(const camera_frame_header_t* hdr)
+{
+    // the model may have been unloaded since the frame was handed over.
+    if (!model_ready) {
+        xSemaphoreGive(detect_input_free_semaphore);
+        return;
+    }
+
+    detect_record_t rec = {0};
+    const uint32_t start_us = timebase_now_us();
+    detect_net_run(input, rec.logits, rec.scores);
+    xSemaphoreGive(detect_input_free_semaphore);
+    const uint32_t end_us = timebase_now_us();
+
+    const detect_model_header_t* m = detect_net_model();
+    rec.model_id = m->model_id;
+    rec.inference_us = end_us - start_us;
+    rec.latency_us = end_us - hdr->timestamp_us;
+    rec.skipped = skipped;
+    rec.classes = m->classes;
+    rec.present = (class_index < m->classes) && (rec.scores[class_index] >= threshold);
+    present = rec.present;
+
+    // the result counts for gating even if there's no room to send it.
+    if (!xSemaphoreTake(detect_recordbuf_free_semaphore, 0))
+        return;
+
+    camera_frame_header_t h = *hdr;
+    h.format = CAMERA_FRAME_FORMAT_DETECT;
+    h.payload_len = sizeof(rec);
+    memcpy(detect_recordbuf, magic, 320);
+    memcpy(detect_recordbuf + 320, &h, sizeof(h));
+    memcpy(detect_recordbuf + 320 + sizeof(h), &rec, sizeof(rec));
+
+    usb_write_request_t req = {
+        .buf = (void*)detect_recordbuf,
+        .len = sizeof(detect_recordbuf),
+        .done = detect_recordbuf_free_semaphore
+    };
+    if (xQueueSendToBack(usb_request_queue, (const void*)&req, 0) != pdTRUE)
+        xSemaphoreGive(detect_recordbuf_free_semaphore);
+}
+
+static void handle_request(const detect_request_t* req)
+{
+    switch (req->type) {
+        case DETECT_REQUEST_MODEL_WRITE: {
+            const uint32_t offset = req->params.write.offset;
+            const uint32_t count = req->params.write.count;
+            if ((count > DETECT_MODEL_PIECE) || ((offset + count) > sizeof(model))) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            model_ready = false;
+            detect_net_unload();
+            memcpy(model + offset, req->params.write.data, count);
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case DETECT_REQUEST_MODEL_COMMIT: {
+            const uint32_t size = req->params.commit.size;
+            model_ready = (size <= sizeof(model)) && detect_net_load(model, size);
+            present = false;
+            usb_task_send_response(&req->ack,
+                                   model_ready ? CAMERA_RESPONSE_OK : CAMERA_RESPONSE_BAD_REQUEST,
+                                   0);
+            break;
+        }
+
+        case DETECT_REQUEST_CONFIG: {
+            if ((req->params.config.threshold > 127) ||
+                (req->params.config.class_index >= DETECT_NET_MAX_CLASSES)) {
+                usb_task_send_response(&req->ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            threshold = req->params.config.threshold;
+            class_index = req->params.config.class_index;
+            gate = req->params.config.gate;
+            present = false;
+            skipped = 0;
+            interval = req->params.config.interval;
+            usb_task_send_response(&req->ack, CAMERA_RESPONSE_OK, 0);
+            break;
+        }
+
+        case DETECT_REQUEST_FRAME: {
+            run_frame(&req->params.frame);
+            break;
+        }
+    }
+}
+
+/**
+ * detect_task only ever waits on its request queue: model uploads, configuration and frames from
+ * camera_read_task are carried out one after the other, so a model never changes while it runs.
+ */
+void detect_task(void const* args)
+{
+    detect_input_free_semaphore =
+        xSemaphoreCreateCountingStatic(1, 1, &detect_input_free_semaphore_buffer);
+    detect_recordbuf_free_semaphore =
+        xSemaphoreCreateCountingStatic(1, 1, &detect_recordbuf_free_semaphore_buffer);
+
+    while (1) {
+        detect_request_t req;
+        if (xQueueReceive(detect_task_request_queue, &req, portMAX_DELAY))
+            handle_request(&req);
+    }
+}
+
+void detect_task_model_write(uint32_t offset, const uint8_t* data, uint32_t count,
+                             const camera_request_ack_t* ack)
+{
+    detect_request_t req = {
+        .type = DETECT_REQUEST_MODEL_WRITE,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.write = {
+            .offset = (offset > 0xffff) ? 0xffff : offset,
+            .count = (count > DETECT_MODEL_PIECE) ? 0xffff : count
+        }
+    };
+
+    // a piece that's too big is refused by detect_task.
+    if (count <= DETECT_MODEL_PIECE)
+        memcpy(req.params.write.data, data, count);
+    xQueueSendToBack(detect_task_request_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void detect_task_model_commit(uint32_t size, const camera_request_ack_t* ack)
+{
+    detect_request_t req = {
+        .type = DETECT_REQUEST_MODEL_COMMIT,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.commit = {size}
+    };
+    xQueueSendToBack(detect_task_request_queue, (const void*)&req, portMAX_DELAY);
+}
+
+void detect_task_configure(uint32_t interval, uint8_t threshold, uint8_t class_index, bool gate,
+                           const camera_request_ack_t* ack)
+{
+    detect_request_t req = {
+        .type = DETECT_REQUEST_CONFIG,
+        .ack = ack ? *ack : (camera_request_ack_t){0},
+        .params.config = {interval, threshold, class_index, gate}
+    };
+    xQueueSendToBack(detect_task_request_queue, (const void*)&req, portMAX_DELAY);
+}
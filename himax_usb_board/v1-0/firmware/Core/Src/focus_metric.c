@@ -0,0 +1,128 @@
+#include "focus_metric.h"
+#include "main.h"
+#include "timebase.h"
+
+#include <string.h>
+
+// Halfword lanes (x, x + 1) of the columns left of, at and right of two pixels, out of 'e' and
+// 'o', whose lanes hold columns (x - 1, x + 1) and (x, x + 2).
+#define LEFT(e, o) __PKHBT((e), (o), 16)
+#define CENTRE(e, o) __PKHTB((e), (o), 0)
+#define RIGHT(e, o) __PKHTB((o), (e), 16)
+
+/**
+ * Adds the pixels of row 'b' of the region, 'w' pixels wide, with 'a' above it and 'c' below it.
+ *
+ * Four bytes from each row at a time are split into their even and odd bytes as halfwords, and
+ * the vertical parts of the kernels are worked out on those. The horizontal parts then only take
+ * pack-halfword instructions to line up the columns on either side of the two pixels.
+ */
+static void add_row(focus_metric_t* f, const uint8_t* a, const uint8_t* b, const uint8_t* c,
+                    uint32_t w)
+{
+    uint64_t tenengrad = f->tenengrad;
+    uint64_t laplacian_sq = f->laplacian_sq;
+    int32_t laplacian_sum = 0;
+
+    uint32_t x = 1;
+    for (; (x + 3) <= w; x += 2) {
+        uint32_t aw, bw, cw;
+        memcpy(&aw, a + x - 1, sizeof(aw));
+        memcpy(&bw, b + x - 1, sizeof(bw));
+        memcpy(&cw, c + x - 1, sizeof(cw));
+        const uint32_t ae = __UXTB16(aw), ao = __UXTB16(__ROR(aw, 8));
+        const uint32_t be = __UXTB16(bw), bo = __UXTB16(__ROR(bw, 8));
+        const uint32_t ce = __UXTB16(cw), co = __UXTB16(__ROR(cw, 8));
+
+        // a + 2b + c and c - a for the Sobel kernels, a + c for the Laplacian.
+        const uint32_t se = __SADD16(__SADD16(ae, ce), __SADD16(be, be));
+        const uint32_t so = __SADD16(__SADD16(ao, co), __SADD16(bo, bo));
+        const uint32_t de = __SSUB16(ce, ae), dd = __SSUB16(co, ao);
+        const uint32_t ve = __SADD16(ae, ce), vo = __SADD16(ao, co);
+
+        const uint32_t gx = __SSUB16(RIGHT(se, so), LEFT(se, so));
+        const uint32_t dc = CENTRE(de, dd);
+        const uint32_t gy = __SADD16(__SADD16(LEFT(de, dd), RIGHT(de, dd)), __SADD16(dc, dc));
+        const uint32_t bc = __SADD16(CENTRE(be, bo), CENTRE(be, bo));
+        const uint32_t l = __SSUB16(__SADD16(CENTRE(ve, vo), __SADD16(LEFT(be, bo), RIGHT(be, bo))),
+                                    __SADD16(bc, bc));
+
+        tenengrad = __SMLALD(gx, gx, tenengrad);
+        tenengrad = __SMLALD(gy, gy, tenengrad);
+        laplacian_sq = __SMLALD(l, l, laplacian_sq);
+        laplacian_sum = (int32_t)__SMLAD(l, 0x00010001u, (uint32_t)laplacian_sum);
+    }
+
+    for (; (x + 2) <= w; x++) {
+        const int32_t gx = (a[x + 1] - a[x - 1]) + (2 * (b[x + 1] - b[x - 1])) +
+                           (c[x + 1] - c[x - 1]);
+        const int32_t gy = (c[x - 1] + (2 * c[x]) + c[x + 1]) - (a[x - 1] + (2 * a[x]) + a[x + 1]);
+        const int32_t l = a[x] + c[x] + b[x - 1] + b[x + 1] - (4 * b[x]);
+        tenengrad += (uint32_t)((gx * gx) + (gy * gy));
+        laplacian_sq += (uint32_t)(l * l);
+        laplacian_sum += l;
+    }
+
+    f->tenengrad = tenengrad;
+    f->laplacian_sq = laplacian_sq;
+    f->laplacian_sum += laplacian_sum;
+    f->count += w - 2;
+}
+
+void focus_metric_begin(focus_metric_t* f, uint16_t width, uint16_t height,
+                        const frame_stats_roi_t* roi)
+{
+    uint32_t x0 = 0, y0 = 0, x1 = width, y1 = height;
+    if ((roi->len_x != 0) && (roi->len_y != 0)) {
+        x0 = (roi->start_x < width) ? roi->start_x : width;
+        y0 = (roi->start_y < height) ? roi->start_y : height;
+        x1 = ((x0 + roi->len_x) < width) ? (x0 + roi->len_x) : width;
+        y1 = ((y0 + roi->len_y) < height) ? (y0 + roi->len_y) : height;
+    }
+    if ((x1 - x0) > FOCUS_METRIC_MAX_WIDTH)
+        x1 = x0 + FOCUS_METRIC_MAX_WIDTH;
+
+    f->x0 = x0;
+    f->x1 = x1;
+    f->y0 = y0;
+    f->y1 = y1;
+    f->newest = 0;
+    f->count = 0;
+    f->tenengrad = 0;
+    f->laplacian_sum = 0;
+    f->laplacian_sq = 0;
+    f->busy_us = 0;
+}
+
+void focus_metric_add_rows(focus_metric_t* f, uint32_t y, const uint8_t* rows, uint32_t width,
+                           uint32_t n)
+{
+    const uint32_t start_us = timebase_now_us();
+    const uint32_t w = f->x1 - f->x0;
+    for (uint32_t r = 0; r < n; r++, y++, rows += width) {
+        if ((y < f->y0) || (y >= f->y1) || (w == 0))
+            continue;
+
+        // the row that's two rows up is no longer needed once this one's been added.
+        const uint8_t* row = rows + f->x0;
+        uint8_t* oldest = f->rows[f->newest ^ 1];
+        if (((y - f->y0) >= 2) && (w >= 3))
+            add_row(f, oldest, f->rows[f->newest], row, w);
+        memcpy(oldest, row, w);
+        f->newest ^= 1;
+    }
+    f->busy_us += timebase_now_us() - start_us;
+}
+
+void focus_metric_make_record(const focus_metric_t* f, focus_record_t* r)
+{
+    r->start_x = f->x0;
+    r->start_y = f->y0;
+    r->len_x = f->x1 - f->x0;
+    r->len_y = f->y1 - f->y0;
+    r->count = f->count;
+    r->cycles = f->busy_us * (SystemCoreClock / 1000000u);
+    r->tenengrad = f->tenengrad;
+    r->laplacian_sum = f->laplacian_sum;
+    r->laplacian_sq = f->laplacian_sq;
+}
@@ -0,0 +1,65 @@
+#include "frame_params.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Enough for the settings that are waiting to take effect plus the one that's in effect.
+#define FRAME_PARAMS_HISTORY 4
+
+#define HIMAX_AUTO_EXPOSURE_REG 0x2100
+
+typedef struct frame_params_entry {
+    uint32_t sequence;
+    camera_frame_params_t params;
+} frame_params_entry_t;
+
+// Ring of recorded settings, oldest first.
+static frame_params_entry_t history[FRAME_PARAMS_HISTORY];
+static int head;
+static int count;
+
+void frame_params_record(uint32_t sequence, const camera_frame_params_t* p)
+{
+    taskENTER_CRITICAL();
+    const int idx = (head + count) % FRAME_PARAMS_HISTORY;
+    history[idx].sequence = sequence;
+    history[idx].params = *p;
+    if (count < FRAME_PARAMS_HISTORY)
+        count++;
+    else
+        head = (head + 1) % FRAME_PARAMS_HISTORY;
+    taskEXIT_CRITICAL();
+}
+
+void frame_params_forget()
+{
+    taskENTER_CRITICAL();
+    head = 0;
+    count = 0;
+    taskEXIT_CRITICAL();
+}
+
+bool frame_params_lookup(uint32_t sequence, camera_frame_params_t* p)
+{
+    bool found = false;
+    taskENTER_CRITICAL();
+    // The newest entry that's already in effect wins. Sequence numbers wrap, so compare them as
+    // differences.
+    for (int i = count - 1; i >= 0; i--) {
+        const frame_params_entry_t* e = &history[(head + i) % FRAME_PARAMS_HISTORY];
+        if ((int32_t)(sequence - e->sequence) >= 0) {
+            *p = e->params;
+            found = true;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+    return found;
+}
+
+bool frame_params_reg_is_tracked(uint16_t reg)
+{
+    return ((reg >= 0x0202) && (reg <= 0x0205)) ||
+           (reg == 0x020e) || (reg == 0x020f) ||
+           (reg == HIMAX_AUTO_EXPOSURE_REG);
+}
@@ -0,0 +1,166 @@
+#include "frame_stats.h"
+#include "main.h"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Region of interest for the next frame, and the newest finished statistics. Both are shared
+// between tasks; they're only touched inside critical sections.
+static frame_stats_roi_t next_roi;
+static frame_stats_t latest;
+static bool latest_valid;
+
+/**
+ * Sums 'n' pixels. Four pixels at a time go through the M7's sum-of-absolute-differences
+ * instruction, which adds up four bytes in one cycle.
+ */
+static uint32_t sum_pixels(const uint8_t* p, uint32_t n)
+{
+    uint32_t sum = 0;
+    uint32_t i = 0;
+    for (; (i + 4) <= n; i += 4) {
+        uint32_t w;
+        memcpy(&w, p + i, sizeof(w));
+        sum = __USADA8(w, 0, sum);
+    }
+    for (; i < n; i++)
+        sum += p[i];
+    return sum;
+}
+
+/**
+ * Adds 'n' pixels to the histogram. Pixels are loaded four at a time.
+ */
+static void histogram_add(uint32_t* histogram, const uint8_t* p, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; (i + 4) <= n; i += 4) {
+        uint32_t w;
+        memcpy(&w, p + i, sizeof(w));
+        histogram[w & 0xff]++;
+        histogram[(w >> 8) & 0xff]++;
+        histogram[(w >> 16) & 0xff]++;
+        histogram[w >> 24]++;
+    }
+    for (; i < n; i++)
+        histogram[p[i]]++;
+}
+
+void frame_stats_set_roi(const frame_stats_roi_t* roi)
+{
+    taskENTER_CRITICAL();
+    next_roi = *roi;
+    taskEXIT_CRITICAL();
+}
+
+void frame_stats_begin(frame_stats_t* s, uint32_t sequence, uint16_t width, uint16_t height)
+{
+    memset(s, 0, sizeof(*s));
+    s->sequence = sequence;
+    s->width = width;
+    s->height = height;
+
+    taskENTER_CRITICAL();
+    s->roi = next_roi;
+    taskEXIT_CRITICAL();
+}
+
+void frame_stats_add_rows(frame_stats_t* s, uint32_t y, const uint8_t* rows, uint32_t n)
+{
+    const uint32_t width = s->width;
+    const frame_stats_roi_t* roi = &s->roi;
+    const uint32_t roi_end = roi->start_x + roi->len_x;
+    const uint32_t roi_x0 = (roi->start_x < width) ? roi->start_x : width;
+    const uint32_t roi_x1 = (roi_end < width) ? roi_end : width;
+
+    for (uint32_t r = 0; (r < n) && (y < s->height); r++, y++, rows += width) {
+        // the frame's sum is made up of the tiles' sums.
+        const uint32_t ty = (y * FRAME_STATS_TILES_Y) / s->height;
+        uint32_t* tiles = s->tile_sum[ty];
+        s->tile_rows[ty]++;
+        for (uint32_t tx = 0; tx < FRAME_STATS_TILES_X; tx++) {
+            const uint32_t x0 = (tx * width) / FRAME_STATS_TILES_X;
+            const uint32_t x1 = ((tx + 1) * width) / FRAME_STATS_TILES_X;
+            const uint32_t sum = sum_pixels(rows + x0, x1 - x0);
+            tiles[tx] += sum;
+            s->sum += sum;
+        }
+        histogram_add(s->histogram, rows, width);
+        s->count += width;
+
+        const bool in_roi = (y >= roi->start_y) && (y < (roi->start_y + roi->len_y));
+        if (in_roi && (roi_x1 > roi_x0)) {
+            s->roi_sum += sum_pixels(rows + roi_x0, roi_x1 - roi_x0);
+            s->roi_count += roi_x1 - roi_x0;
+        }
+    }
+}
+
+void frame_stats_publish(const frame_stats_t* s)
+{
+    taskENTER_CRITICAL();
+    latest = *s;
+    latest_valid = true;
+    taskEXIT_CRITICAL();
+}
+
+bool frame_stats_latest(frame_stats_t* s)
+{
+    taskENTER_CRITICAL();
+    const bool valid = latest_valid;
+    *s = latest;
+    taskEXIT_CRITICAL();
+    return valid;
+}
+
+uint32_t frame_stats_weighted_mean(const frame_stats_t* s, uint32_t roi_weight)
+{
+    const uint64_t extra = (roi_weight > 1) ? (roi_weight - 1) : 0;
+    const uint64_t sum = s->sum + (extra * s->roi_sum);
+    const uint64_t count = s->count + (extra * s->roi_count);
+    return (count == 0) ? 0 : (uint32_t)(sum / count);
+}
+
+void frame_stats_make_record(const frame_stats_t* s, frame_stats_record_t* r)
+{
+    memset(r, 0, sizeof(*r));
+    r->tiles_x = FRAME_STATS_TILES_X;
+    r->tiles_y = FRAME_STATS_TILES_Y;
+    if (s->count == 0)
+        return;
+
+    r->mean_x256 = ((uint64_t)s->sum << 8) / s->count;
+
+    // no bin can hold more than every pixel.
+    while ((s->count >> r->histogram_shift) > 0xffff)
+        r->histogram_shift++;
+
+    int lo = -1, hi = 0;
+    for (int i = 0; i < 256; i++) {
+        r->histogram[i] = s->histogram[i] >> r->histogram_shift;
+        if (s->histogram[i] != 0) {
+            if (lo < 0)
+                lo = i;
+            hi = i;
+        }
+    }
+    r->min = lo;
+    r->max = hi;
+
+    frame_stats_tile_means(s, r->tiles);
+}
+
+void frame_stats_tile_means(const frame_stats_t* s, uint8_t* tiles)
+{
+    for (int ty = 0; ty < FRAME_STATS_TILES_Y; ty++) {
+        const uint32_t rows = s->tile_rows[ty];
+        for (int tx = 0; tx < FRAME_STATS_TILES_X; tx++) {
+            const uint32_t cols = (((tx + 1) * s->width) / FRAME_STATS_TILES_X) -
+                                  ((tx * s->width) / FRAME_STATS_TILES_X);
+            const uint32_t n = rows * cols;
+            tiles[(ty * FRAME_STATS_TILES_X) + tx] = (n == 0) ? 0 : (s->tile_sum[ty][tx] / n);
+        }
+    }
+}
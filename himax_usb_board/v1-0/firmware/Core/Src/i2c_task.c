@@ -0,0 +1,197 @@
+#include "i2c_task.h"
+#include "timebase.h"
+
+#include <string.h>
+
+////////////////////////////////////////////////////////////////
+// FreeRTOS includes
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+#include "queue.h"
+
+extern I2C_HandleTypeDef hi2c1;
+
+// queues for IPC are declared and initialized in main
+extern QueueHandle_t i2c_request_queue;
+
+// Given by the i2c1 interrupts when a transfer finishes or fails.
+SemaphoreHandle_t i2c_done_semaphore;
+StaticSemaphore_t i2c_done_semaphore_buffer;
+static volatile bool i2c_failed;
+
+static uint32_t bus_recoveries = 0;
+
+// A 32-byte transfer takes about 3.5 ms at 100 kHz.
+#define I2C_TRANSFER_TIMEOUT (25 / portTICK_PERIOD_MS)
+
+// i2c1 pins; see HAL_I2C_MspInit.
+#define I2C1_SDA_PORT GPIOB
+#define I2C1_SDA_PIN GPIO_PIN_7
+#define I2C1_SCL_PORT GPIOB
+#define I2C1_SCL_PIN GPIO_PIN_8
+
+static void i2c_done_from_isr(bool failed)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (failed)
+        i2c_failed = true;
+    xSemaphoreGiveFromISR(i2c_done_semaphore, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef* hi2c)
+{
+    i2c_done_from_isr(false);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef* hi2c)
+{
+    i2c_done_from_isr(false);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef* hi2c)
+{
+    i2c_done_from_isr(true);
+}
+
+static void delay_us(uint32_t us)
+{
+    const uint32_t start = timebase_now_us();
+    while ((timebase_now_us() - start) < us);
+}
+
+/**
+ * Gets a stuck bus going again. If a transfer is cut off mid-byte (e.g. by a reset of the MCU or a
+ * timeout), the sensor can be left holding SDA low and waiting for clocks that never come.
+ *
+ * SCL is clocked by hand until the sensor lets go of SDA (9 pulses at most), then a STOP is
+ * generated and the i2c peripheral is reset and initialized from scratch.
+ */
+static void i2c_bus_recover()
+{
+    HAL_I2C_DeInit(&hi2c1);
+    __HAL_RCC_I2C1_FORCE_RESET();
+    __HAL_RCC_I2C1_RELEASE_RESET();
+
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    HAL_GPIO_WritePin(I2C1_SDA_PORT, I2C1_SDA_PIN, GPIO_PIN_SET);
+    HAL_GPIO_WritePin(I2C1_SCL_PORT, I2C1_SCL_PIN, GPIO_PIN_SET);
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    GPIO_InitStruct.Pin = I2C1_SDA_PIN;
+    HAL_GPIO_Init(I2C1_SDA_PORT, &GPIO_InitStruct);
+    GPIO_InitStruct.Pin = I2C1_SCL_PIN;
+    HAL_GPIO_Init(I2C1_SCL_PORT, &GPIO_InitStruct);
+    delay_us(5);
+
+    for (int i = 0; i < 9; i++) {
+        if (HAL_GPIO_ReadPin(I2C1_SDA_PORT, I2C1_SDA_PIN) == GPIO_PIN_SET)
+            break;
+        HAL_GPIO_WritePin(I2C1_SCL_PORT, I2C1_SCL_PIN, GPIO_PIN_RESET);
+        delay_us(5);
+        HAL_GPIO_WritePin(I2C1_SCL_PORT, I2C1_SCL_PIN, GPIO_PIN_SET);
+        delay_us(5);
+    }
+
+    // STOP: SDA rises while SCL is high.
+    HAL_GPIO_WritePin(I2C1_SCL_PORT, I2C1_SCL_PIN, GPIO_PIN_RESET);
+    delay_us(5);
+    HAL_GPIO_WritePin(I2C1_SDA_PORT, I2C1_SDA_PIN, GPIO_PIN_RESET);
+    delay_us(5);
+    HAL_GPIO_WritePin(I2C1_SCL_PORT, I2C1_SCL_PIN, GPIO_PIN_SET);
+    delay_us(5);
+    HAL_GPIO_WritePin(I2C1_SDA_PORT, I2C1_SDA_PIN, GPIO_PIN_SET);
+    delay_us(5);
+
+    // HAL_I2C_MspInit gives the pins back to the peripheral.
+    HAL_I2C_Init(&hi2c1);
+
+    bus_recoveries++;
+}
+
+/**
+ * Returns true if a failed transfer might have left the bus or the peripheral in a bad state.
+ * A plain NACK doesn't.
+ */
+static bool i2c_needs_recovery(HAL_StatusTypeDef status, uint32_t error)
+{
+    return (status == HAL_TIMEOUT) || (status == HAL_BUSY) ||
+           (error & (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO | HAL_I2C_ERROR_TIMEOUT));
+}
+
+/**
+ * Carries out one transfer, recovering the bus and retrying once if it looks stuck.
+ */
+static void run_transfer(i2c_transfer_t* t)
+{
+    if ((t->len == 0) || (t->len > I2C_TRANSFER_MAX_LEN)) {
+        t->status = HAL_ERROR;
+        t->error = HAL_I2C_ERROR_SIZE;
+        return;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const uint16_t dev = t->peripheral_address << 1;
+        i2c_failed = false;
+        xSemaphoreTake(i2c_done_semaphore, 0);
+
+        HAL_StatusTypeDef status = (t->type == I2C_TRANSFER_WRITE) ?
+            HAL_I2C_Mem_Write_DMA(&hi2c1, dev, t->reg, I2C_MEMADD_SIZE_16BIT, t->data, t->len) :
+            HAL_I2C_Mem_Read_DMA(&hi2c1, dev, t->reg, I2C_MEMADD_SIZE_16BIT, t->data, t->len);
+        if (status == HAL_OK) {
+            if (!xSemaphoreTake(i2c_done_semaphore, I2C_TRANSFER_TIMEOUT))
+                status = HAL_TIMEOUT;
+            else if (i2c_failed)
+                status = HAL_ERROR;
+        }
+
+        t->status = status;
+        t->error = HAL_I2C_GetError(&hi2c1);
+        if ((status == HAL_OK) || !i2c_needs_recovery(status, t->error))
+            return;
+
+        i2c_bus_recover();
+    }
+}
+
+void i2c_task(void const* args)
+{
+    i2c_done_semaphore = xSemaphoreCreateBinaryStatic(&i2c_done_semaphore_buffer);
+
+    static i2c_transfer_t t;
+    while (1) {
+        xQueueReceive(i2c_request_queue, &t, portMAX_DELAY);
+        run_transfer(&t);
+
+        if (t.reply != NULL)
+            memcpy(t.reply, &t, sizeof(t));
+        if (t.notify != NULL)
+            xTaskNotifyGive(t.notify);
+        if (t.callback != NULL)
+            t.callback(&t);
+    }
+}
+
+bool i2c_task_submit(const i2c_transfer_t* t, TickType_t timeout)
+{
+    return xQueueSendToBack(i2c_request_queue, (const void*)t, timeout) == pdTRUE;
+}
+
+HAL_StatusTypeDef i2c_task_transfer(i2c_transfer_t* t)
+{
+    t->reply = t;
+    t->notify = xTaskGetCurrentTaskHandle();
+    t->callback = NULL;
+
+    ulTaskNotifyTake(pdTRUE, 0);
+    i2c_task_submit(t, portMAX_DELAY);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return t->status;
+}
+
+uint32_t i2c_task_bus_recoveries()
+{
+    return bus_recoveries;
+}
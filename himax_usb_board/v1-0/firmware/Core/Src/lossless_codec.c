@@ -0,0 +1,148 @@
+#include "lossless_codec.h"
+#include "main.h"
+#include "timebase.h"
+
+#include <string.h>
+
+// Zigzagged prediction errors of the row that's being coded.
+static uint8_t mapped[LOSSLESS_MAX_WIDTH];
+
+/**
+ * Works out the zigzagged prediction errors of row 'x' into 'mapped' and returns their sum.
+ * 'above' is the row above it, or NULL for the first row of a slice.
+ *
+ * The prediction error left + above - above-left is the difference between a pixel's vertical
+ * difference (x - above) and that of the pixel to its left, so four pixels at a time only take two
+ * byte-wise subtractions.
+ */
+static uint32_t map_row(const uint8_t* x, const uint8_t* above, uint32_t w)
+{
+    uint32_t sum = 0;
+    uint32_t prev = 0;
+    uint32_t i = 0;
+    for (; (i + 4) <= w; i += 4) {
+        uint32_t xw, aw = 0;
+        memcpy(&xw, x + i, sizeof(xw));
+        if (above != NULL)
+            memcpy(&aw, above + i, sizeof(aw));
+
+        // the top byte of 'prev' is the vertical difference of the pixel left of these four.
+        const uint32_t d = __USUB8(xw, aw);
+        const uint32_t e = __USUB8(d, (d << 8) | (prev >> 24));
+        const uint32_t sign = ((e >> 7) & 0x01010101u) * 0xffu;
+        const uint32_t m = ((e << 1) & 0xfefefefeu) ^ sign;
+        memcpy(mapped + i, &m, sizeof(m));
+        sum = __USADA8(m, 0, sum);
+        prev = d;
+    }
+
+    uint8_t left = prev >> 24;
+    for (; i < w; i++) {
+        const uint8_t d = x[i] - ((above != NULL) ? above[i] : 0);
+        const int8_t e = (int8_t)(uint8_t)(d - left);
+        mapped[i] = (uint8_t)((e << 1) ^ (e >> 7));
+        sum += mapped[i];
+        left = d;
+    }
+    return sum;
+}
+
+/**
+ * Number of unary bits that the row in 'mapped' takes with Rice parameter 'k'.
+ */
+static uint32_t unary_bits(uint32_t w, uint32_t k)
+{
+    const uint32_t mask = (0xffu >> k) * 0x01010101u;
+    uint32_t bits = w;
+    uint32_t i = 0;
+    for (; (i + 4) <= w; i += 4) {
+        uint32_t m;
+        memcpy(&m, mapped + i, sizeof(m));
+        bits = __USADA8((m >> k) & mask, 0, bits);
+    }
+    for (; i < w; i++)
+        bits += mapped[i] >> k;
+    return bits;
+}
+
+/**
+ * Codes the row in 'mapped' with Rice parameter 'k' into 'out', which has room for it.
+ */
+static void code_row(uint32_t w, uint32_t k, uint32_t unary_bytes, uint8_t* out)
+{
+    uint8_t* rem = out + 3;
+    uint8_t* unary = rem + (((w * k) + 7) / 8);
+    out[0] = k;
+    out[1] = unary_bytes & 0xff;
+    out[2] = unary_bytes >> 8;
+
+    // the unary bits are mostly 0, so only the 1s that end every code are written.
+    memset(unary, 0, unary_bytes);
+    const uint32_t low = (1u << k) - 1;
+    uint32_t acc = 0, n = 0, pos = 0;
+    for (uint32_t i = 0; i < w; i++) {
+        const uint32_t m = mapped[i];
+        acc |= (m & low) << n;
+        n += k;
+        while (n >= 8) {
+            *rem++ = acc & 0xff;
+            acc >>= 8;
+            n -= 8;
+        }
+
+        pos += m >> k;
+        unary[pos >> 3] |= 1 << (pos & 7);
+        pos++;
+    }
+    if (n != 0)
+        *rem = acc & 0xff;
+}
+
+bool lossless_fits(uint32_t width)
+{
+    return (width != 0) && (width <= LOSSLESS_MAX_WIDTH);
+}
+
+uint32_t lossless_encode_slice(const uint8_t* pixels, uint32_t width, uint32_t first_row,
+                               uint32_t rows, uint8_t* out, uint32_t out_size)
+{
+    const uint32_t start_us = timebase_now_us();
+    lossless_slice_header_t hdr = {.first_row = first_row, .rows = rows};
+    uint32_t len = sizeof(hdr);
+
+    for (uint32_t r = 0; r < rows; r++) {
+        const uint8_t* row = pixels + (r * width);
+        const uint32_t sum = map_row(row, (r != 0) ? (row - width) : NULL, width);
+
+        // the best k is about log2 of the mean error.
+        uint32_t k = 0;
+        while ((k < 7) && ((width << k) < sum))
+            k++;
+
+        const uint32_t unary_bytes = (unary_bits(width, k) + 7) / 8;
+        const uint32_t coded = 3 + (((width * k) + 7) / 8) + unary_bytes;
+        const uint32_t need = (coded < (1 + width)) ? coded : (1 + width);
+        if ((len + need) > out_size) {
+            hdr.stored = 1;
+            break;
+        }
+
+        if (coded < (1 + width)) {
+            code_row(width, k, unary_bytes, out + len);
+        } else {
+            out[len] = LOSSLESS_RAW_ROW;
+            memcpy(out + len + 1, row, width);
+        }
+        len += need;
+    }
+
+    if (hdr.stored) {
+        len = sizeof(hdr);
+        memcpy(out + len, pixels, rows * width);
+        len += rows * width;
+    }
+
+    hdr.encode_cycles = (timebase_now_us() - start_us) * (SystemCoreClock / 1000000u);
+    memcpy(out, &hdr, sizeof(hdr));
+    return len;
+}
@@ -27,6 +27,10 @@
 #include "camera_read_task.h"
 #include "camera_management_task.h"
 #include "usb_task.h"
+#include "i2c_task.h"
+#include "detect_task.h"
+#include "timebase.h"
+#include "trigger.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -79,6 +83,16 @@ osThreadId usbTaskHandle;
 uint32_t usbTaskBuffer[ USB_TASK_BUFSZ ];
 osStaticThreadDef_t usbTaskControlBlock;
 
+#define I2C_TASK_BUFSZ 256
+osThreadId i2cTaskHandle;
+uint32_t i2cTaskBuffer[ I2C_TASK_BUFSZ ];
+osStaticThreadDef_t i2cTaskControlBlock;
+
+#define DETECT_TASK_BUFSZ 512
+osThreadId detectTaskHandle;
+uint32_t detectTaskBuffer[ DETECT_TASK_BUFSZ ];
+osStaticThreadDef_t detectTaskControlBlock;
+
 #define USB_REQUEST_QUEUE_ITEM_SIZE (sizeof(usb_write_request_t))
 #define USB_REQUEST_QUEUE_LENGTH 4
 QueueHandle_t usb_request_queue = NULL;
@@ -105,6 +119,28 @@ StaticQueue_t camera_management_task_request_queue_static;
 uint8_t camera_management_task_request_queue_storage_area[
     CAMERA_MANAGEMENT_TASK_REQUEST_QUEUE_ITEM_SIZE * CAMERA_MANAGEMENT_TASK_REQUEST_QUEUE_LENGTH];
 
+// Transactions are too big to pass through camera_management_task_request_queue by value, so they
+// ride alongside it in their own short queue.
+#define CAMERA_TRANSACTION_QUEUE_ITEM_SIZE (sizeof(camera_transaction_t))
+#define CAMERA_TRANSACTION_QUEUE_LENGTH 1
+QueueHandle_t camera_transaction_queue = NULL;
+StaticQueue_t camera_transaction_queue_static;
+uint8_t camera_transaction_queue_storage_area[
+    CAMERA_TRANSACTION_QUEUE_ITEM_SIZE * CAMERA_TRANSACTION_QUEUE_LENGTH];
+
+#define I2C_REQUEST_QUEUE_ITEM_SIZE (sizeof(i2c_transfer_t))
+#define I2C_REQUEST_QUEUE_LENGTH 8
+QueueHandle_t i2c_request_queue = NULL;
+StaticQueue_t i2c_request_queue_static;
+uint8_t i2c_request_queue_storage_area[I2C_REQUEST_QUEUE_ITEM_SIZE * I2C_REQUEST_QUEUE_LENGTH];
+
+#define DETECT_TASK_REQUEST_QUEUE_ITEM_SIZE (sizeof(detect_request_t))
+#define DETECT_TASK_REQUEST_QUEUE_LENGTH 4
+QueueHandle_t detect_task_request_queue = NULL;
+StaticQueue_t detect_task_request_queue_static;
+uint8_t detect_task_request_queue_storage_area[
+    DETECT_TASK_REQUEST_QUEUE_ITEM_SIZE * DETECT_TASK_REQUEST_QUEUE_LENGTH];
+
 #define UART7_QUEUE_ITEM_SIZE sizeof(char)
 #define UART7_QUEUE_LENGTH 512
 QueueHandle_t uart7_queue = NULL;
@@ -183,6 +219,12 @@ int main(void)
 
   UART7_Init();
 
+  // microsecond timebase used for timestamps and latency measurements.
+  timebase_init();
+
+  // sensor and inter-board trigger pulses are scheduled on the timebase. They start out off.
+  trigger_init();
+
   /* USER CODE END 2 */
 
   /* USER CODE BEGIN RTOS_MUTEX */
@@ -218,6 +260,21 @@ int main(void)
                                                      camera_management_task_request_queue_storage_area,
                                                      &camera_management_task_request_queue_static);
 
+  camera_transaction_queue = xQueueCreateStatic(CAMERA_TRANSACTION_QUEUE_LENGTH,
+                                                CAMERA_TRANSACTION_QUEUE_ITEM_SIZE,
+                                                camera_transaction_queue_storage_area,
+                                                &camera_transaction_queue_static);
+
+  i2c_request_queue = xQueueCreateStatic(I2C_REQUEST_QUEUE_LENGTH,
+                                         I2C_REQUEST_QUEUE_ITEM_SIZE,
+                                         i2c_request_queue_storage_area,
+                                         &i2c_request_queue_static);
+
+  detect_task_request_queue = xQueueCreateStatic(DETECT_TASK_REQUEST_QUEUE_LENGTH,
+                                                 DETECT_TASK_REQUEST_QUEUE_ITEM_SIZE,
+                                                 detect_task_request_queue_storage_area,
+                                                 &detect_task_request_queue_static);
+
   uart7_queue = xQueueCreateStatic(UART7_QUEUE_LENGTH,
                                          UART7_QUEUE_ITEM_SIZE,
                                          uart7_queue_storage_area,
@@ -262,6 +319,26 @@ int main(void)
                     cameraManagementTaskBuffer,
                     &cameraManagementTaskControlBlock);
   cameraManagementTaskHandle = osThreadCreate(osThread(cameraManagementTask), NULL);
+
+  // i2c transfers run ahead of the other tasks so that queued transfers go out back to back.
+  osThreadStaticDef(i2cTask,
+                    i2c_task,
+                    osPriorityAboveNormal,
+                    0,
+                    I2C_TASK_BUFSZ,
+                    i2cTaskBuffer,
+                    &i2cTaskControlBlock);
+  i2cTaskHandle = osThreadCreate(osThread(i2cTask), NULL);
+
+  // the detection network only gets the time that the other tasks leave over.
+  osThreadStaticDef(detectTask,
+                    detect_task,
+                    osPriorityBelowNormal,
+                    0,
+                    DETECT_TASK_BUFSZ,
+                    detectTaskBuffer,
+                    &detectTaskControlBlock);
+  detectTaskHandle = osThreadCreate(osThread(detectTask), NULL);
 #endif
 
 #if 1
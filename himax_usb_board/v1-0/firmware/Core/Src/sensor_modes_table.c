@@ -0,0 +1,54 @@
+// Generated by util/sensor_modes.py; don't edit. Change the modes there instead.
+
+#include "sensor_modes_table.h"
+
+const sensor_mode_t sensor_modes[SENSOR_MODE_COUNT] = {
+    [SENSOR_MODE_HM01B0_QVGA] = {0x24, 0, 1, 4, 2, 640, 240, 0},
+    [SENSOR_MODE_HM01B0_QQVGA] = {0x24, 0, 1, 2, 1, 320, 120, 26},
+    [SENSOR_MODE_HM01B0_FULL] = {0x24, 0, 1, 4, 2, 640, 320, 52},
+    [SENSOR_MODE_HM0360_QVGA] = {0x35, 1, 0, 0, 0, 320, 240, 78},
+    [SENSOR_MODE_HM0360_VGA] = {0x35, 1, 0, 0, 0, 640, 480, 103},
+    [SENSOR_MODE_HM0360_QQVGA] = {0x35, 1, 0, 0, 0, 160, 120, 128},
+};
+
+const uint16_t sensor_mode_diffs[SENSOR_MODE_COUNT][SENSOR_MODE_COUNT] = {
+    {153, 156, 176, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF},
+    {183, 153, 203, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF},
+    {227, 234, 153, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF},
+    {SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, 153, 258, 278},
+    {SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, 296, 153, 316},
+    {SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, SENSOR_MODE_NO_DIFF, 336, 258, 153},
+};
+
+const uint8_t sensor_mode_scripts[354] = {
+    0x03, 0x40, 0x04, 0x02, 0x40, 0x01, 0x80, 0x03, 0x83, 0x01, 0x01, 0x03,
+    0x87, 0x01, 0x01, 0x03, 0x90, 0x01, 0x00, 0x30, 0x10, 0x01, 0x01, 0x00,
+    0x00, 0x00, 0x03, 0x40, 0x04, 0x01, 0x20, 0x01, 0x80, 0x03, 0x83, 0x01,
+    0x03, 0x03, 0x87, 0x01, 0x03, 0x03, 0x90, 0x01, 0x03, 0x30, 0x10, 0x01,
+    0x01, 0x00, 0x00, 0x00, 0x03, 0x40, 0x04, 0x02, 0x40, 0x01, 0x80, 0x03,
+    0x83, 0x01, 0x01, 0x03, 0x87, 0x01, 0x01, 0x03, 0x90, 0x01, 0x00, 0x30,
+    0x10, 0x01, 0x00, 0x00, 0x00, 0x00, 0x03, 0x40, 0x04, 0x01, 0x09, 0x01,
+    0x78, 0x03, 0x80, 0x03, 0x01, 0x01, 0x00, 0x20, 0x29, 0x02, 0x01, 0x05,
+    0x30, 0x30, 0x01, 0x00, 0x00, 0x00, 0x00, 0x03, 0x40, 0x04, 0x02, 0x14,
+    0x03, 0x00, 0x03, 0x80, 0x03, 0x00, 0x00, 0x00, 0x20, 0x29, 0x02, 0x02,
+    0x10, 0x30, 0x30, 0x01, 0x00, 0x00, 0x00, 0x00, 0x03, 0x40, 0x04, 0x00,
+    0x84, 0x01, 0x78, 0x03, 0x80, 0x03, 0x02, 0x02, 0x00, 0x20, 0x29, 0x02,
+    0x00, 0x80, 0x30, 0x30, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x03, 0x40, 0x02, 0x01, 0x20, 0x03, 0x83, 0x01, 0x03, 0x03, 0x87, 0x01,
+    0x03, 0x03, 0x90, 0x01, 0x03, 0x00, 0x00, 0x00, 0x30, 0x10, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x03, 0x40, 0x02, 0x02, 0x40, 0x03, 0x83, 0x01, 0x01,
+    0x03, 0x87, 0x01, 0x01, 0x03, 0x90, 0x01, 0x00, 0x00, 0x00, 0x00, 0x03,
+    0x40, 0x02, 0x02, 0x40, 0x03, 0x83, 0x01, 0x01, 0x03, 0x87, 0x01, 0x01,
+    0x03, 0x90, 0x01, 0x00, 0x30, 0x10, 0x01, 0x00, 0x00, 0x00, 0x00, 0x30,
+    0x10, 0x01, 0x01, 0x00, 0x00, 0x00, 0x03, 0x40, 0x02, 0x01, 0x20, 0x03,
+    0x83, 0x01, 0x03, 0x03, 0x87, 0x01, 0x03, 0x03, 0x90, 0x01, 0x03, 0x30,
+    0x10, 0x01, 0x01, 0x00, 0x00, 0x00, 0x03, 0x40, 0x04, 0x02, 0x14, 0x03,
+    0x00, 0x03, 0x80, 0x02, 0x00, 0x00, 0x20, 0x29, 0x02, 0x02, 0x10, 0x00,
+    0x00, 0x00, 0x03, 0x40, 0x02, 0x00, 0x84, 0x03, 0x80, 0x02, 0x02, 0x02,
+    0x20, 0x29, 0x02, 0x00, 0x80, 0x00, 0x00, 0x00, 0x03, 0x40, 0x04, 0x01,
+    0x09, 0x01, 0x78, 0x03, 0x80, 0x02, 0x01, 0x01, 0x20, 0x29, 0x02, 0x01,
+    0x05, 0x00, 0x00, 0x00, 0x03, 0x40, 0x04, 0x00, 0x84, 0x01, 0x78, 0x03,
+    0x80, 0x02, 0x02, 0x02, 0x20, 0x29, 0x02, 0x00, 0x80, 0x00, 0x00, 0x00,
+    0x03, 0x40, 0x02, 0x01, 0x09, 0x03, 0x80, 0x02, 0x01, 0x01, 0x20, 0x29,
+    0x02, 0x01, 0x05, 0x00, 0x00, 0x00,
+};
@@ -0,0 +1,153 @@
+#include "sensor_shadow.h"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Enough for every register in either sensor's init table with room to spare.
+#define SENSOR_SHADOW_MAX_REGS 384
+
+#define HIMAX_SW_RESET_REG 0x0103
+
+typedef struct sensor_shadow_entry {
+    uint16_t reg;
+    uint8_t val;
+    uint8_t reserved;
+} sensor_shadow_entry_t;
+
+typedef struct sensor_shadow {
+    uint8_t peripheral_address;
+
+    // inclusive [first, last] register ranges that are volatile
+    const uint16_t (*volatile_ranges)[2];
+    int n_volatile_ranges;
+
+    // sorted by register address
+    int count;
+    sensor_shadow_entry_t entries[SENSOR_SHADOW_MAX_REGS];
+} sensor_shadow_t;
+
+// hm01b0 and hm0360 share these parts of the register map.
+static const uint16_t himax_volatile_ranges[][2] = {
+    {0x0005, 0x0006},       // frame count
+    {0x0103, 0x0104},       // software reset, command update
+    {0x0202, 0x0205},       // integration time, analog gain; written by auto exposure
+    {0x020e, 0x020f},       // digital gain; written by auto exposure
+};
+
+static sensor_shadow_t shadows[] = {
+    {
+        .peripheral_address = 0x24,     // hm01b0
+        .volatile_ranges = himax_volatile_ranges,
+        .n_volatile_ranges = sizeof(himax_volatile_ranges) / sizeof(himax_volatile_ranges[0])
+    },
+    {
+        .peripheral_address = 0x35,     // hm0360
+        .volatile_ranges = himax_volatile_ranges,
+        .n_volatile_ranges = sizeof(himax_volatile_ranges) / sizeof(himax_volatile_ranges[0])
+    }
+};
+
+static sensor_shadow_t* find_shadow(uint8_t peripheral_address)
+{
+    for (int i = 0; i < sizeof(shadows) / sizeof(shadows[0]); i++)
+        if (shadows[i].peripheral_address == peripheral_address)
+            return &shadows[i];
+    return NULL;
+}
+
+static bool is_volatile(const sensor_shadow_t* s, uint16_t reg)
+{
+    for (int i = 0; i < s->n_volatile_ranges; i++)
+        if ((reg >= s->volatile_ranges[i][0]) && (reg <= s->volatile_ranges[i][1]))
+            return true;
+    return false;
+}
+
+/**
+ * Returns the index of the entry for 'reg', or of the place where it would have to be inserted.
+ */
+static int find_entry(const sensor_shadow_t* s, uint16_t reg)
+{
+    int lo = 0, hi = s->count;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (s->entries[mid].reg < reg) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+bool sensor_shadow_lookup(uint8_t peripheral_address, uint16_t reg, uint8_t* val)
+{
+    const sensor_shadow_t* s = find_shadow(peripheral_address);
+    if ((s == NULL) || is_volatile(s, reg))
+        return false;
+
+    bool found = false;
+    taskENTER_CRITICAL();
+    const int i = find_entry(s, reg);
+    if ((i < s->count) && (s->entries[i].reg == reg)) {
+        *val = s->entries[i].val;
+        found = true;
+    }
+    taskEXIT_CRITICAL();
+    return found;
+}
+
+bool sensor_shadow_write_is_redundant(uint8_t peripheral_address, uint16_t reg, uint8_t val)
+{
+    uint8_t cur;
+    return sensor_shadow_lookup(peripheral_address, reg, &cur) && (cur == val);
+}
+
+void sensor_shadow_update(uint8_t peripheral_address, uint16_t reg, const uint8_t* vals, int len,
+                          bool is_write)
+{
+    sensor_shadow_t* s = find_shadow(peripheral_address);
+    if (s == NULL)
+        return;
+
+    // one register at a time so that interrupts aren't held off for long.
+    for (int k = 0; k < len; k++) {
+        const uint16_t r = reg + k;
+        if (is_write && (r == HIMAX_SW_RESET_REG)) {
+            // everything goes back to its default, which we don't know.
+            taskENTER_CRITICAL();
+            s->count = 0;
+            taskEXIT_CRITICAL();
+            continue;
+        }
+        if (is_volatile(s, r))
+            continue;
+
+        taskENTER_CRITICAL();
+        const int i = find_entry(s, r);
+        if ((i < s->count) && (s->entries[i].reg == r)) {
+            s->entries[i].val = vals[k];
+        } else if (s->count < SENSOR_SHADOW_MAX_REGS) {
+            memmove(&s->entries[i + 1], &s->entries[i], (s->count - i) * sizeof(s->entries[0]));
+            s->entries[i] = (sensor_shadow_entry_t){.reg = r, .val = vals[k]};
+            s->count++;
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
+void sensor_shadow_forget(uint8_t peripheral_address, uint16_t reg, int len)
+{
+    sensor_shadow_t* s = find_shadow(peripheral_address);
+    if (s == NULL)
+        return;
+
+    for (int k = 0; k < len; k++) {
+        taskENTER_CRITICAL();
+        const int i = find_entry(s, reg + k);
+        if ((i < s->count) && (s->entries[i].reg == (uint16_t)(reg + k))) {
+            memmove(&s->entries[i], &s->entries[i + 1], (s->count - i - 1) * sizeof(s->entries[0]));
+            s->count--;
+        }
+        taskEXIT_CRITICAL();
+    }
+}
@@ -0,0 +1,138 @@
+#include "tile_delta.h"
+#include "main.h"
+
+#include <string.h>
+
+// What the host has put together. Rows are 'width' apart.
+static uint8_t reference[TILE_DELTA_MAX_PIXELS];
+
+// Rows of the current row of tiles. The tiles can only be compared once all of their rows are in,
+// and by then the chunks that the first rows came in are gone.
+static uint8_t band[TILE_DELTA_TILE * TILE_DELTA_MAX_WIDTH];
+
+/**
+ * Sum of absolute differences of 'n' bytes. Four bytes at a time go through the M7's
+ * sum-of-absolute-differences instruction.
+ */
+static uint32_t sad_bytes(const uint8_t* a, const uint8_t* b, uint32_t n)
+{
+    uint32_t sad = 0;
+    uint32_t i = 0;
+    for (; (i + 4) <= n; i += 4) {
+        uint32_t wa, wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        sad = __USADA8(wa, wb, sad);
+    }
+    for (; i < n; i++)
+        sad += (a[i] > b[i]) ? (a[i] - b[i]) : (b[i] - a[i]);
+    return sad;
+}
+
+static uint32_t tiles_along(uint32_t n)
+{
+    return (n + TILE_DELTA_TILE - 1) / TILE_DELTA_TILE;
+}
+
+bool tile_delta_fits(uint32_t width, uint32_t height)
+{
+    return (width != 0) && (height != 0) && (width <= TILE_DELTA_MAX_WIDTH) &&
+           ((width * height) <= TILE_DELTA_MAX_PIXELS) &&
+           ((tiles_along(width) * tiles_along(height)) <= TILE_DELTA_MAX_TILES);
+}
+
+uint32_t tile_delta_bitmap_bytes(uint32_t width, uint32_t height)
+{
+    return ((tiles_along(width) * tiles_along(height) + 31) / 32) * 4;
+}
+
+void tile_delta_begin_keyframe(tile_delta_t* d, uint16_t width, uint16_t height)
+{
+    d->width = width;
+    d->height = height;
+    d->tiles_x = tiles_along(width);
+    d->tiles_y = tiles_along(height);
+    memset(d->changed, 0, sizeof(d->changed));
+}
+
+void tile_delta_keyframe_rows(tile_delta_t* d, uint32_t y, const uint8_t* rows, uint32_t n)
+{
+    for (uint32_t r = 0; (r < n) && (y < d->height); r++, y++, rows += d->width)
+        memcpy(reference + (y * d->width), rows, d->width);
+}
+
+void tile_delta_begin(tile_delta_t* d, uint8_t* out, uint32_t out_size)
+{
+    const uint32_t bitmap_bytes = tile_delta_bitmap_bytes(d->width, d->height);
+    d->out = out;
+    d->out_size = out_size;
+    d->out_len = bitmap_bytes;
+    d->overflow = (bitmap_bytes > out_size);
+    if (!d->overflow)
+        memset(out, 0, bitmap_bytes);
+    memset(d->sad, 0, sizeof(d->sad));
+}
+
+static bool bit_is_set(const uint8_t* bitmap, uint32_t i)
+{
+    return (bitmap[i >> 3] & (1 << (i & 7))) != 0;
+}
+
+/**
+ * Decides which tiles of row of tiles 'ty', which has 'rows' rows, changed, and puts those into
+ * the payload and the reference.
+ */
+static void finish_band(tile_delta_t* d, uint32_t ty, uint32_t rows)
+{
+    const uint32_t y0 = ty * TILE_DELTA_TILE;
+    for (uint32_t tx = 0; tx < d->tiles_x; tx++) {
+        const uint32_t x0 = tx * TILE_DELTA_TILE;
+        const uint32_t w = ((d->width - x0) < TILE_DELTA_TILE) ? (d->width - x0) : TILE_DELTA_TILE;
+        const uint32_t i = (ty * d->tiles_x) + tx;
+
+        const uint32_t limit = bit_is_set(d->changed, i) ? (d->threshold - d->hysteresis) :
+                                                           d->threshold;
+        if (d->sad[tx] <= (limit * w * rows))
+            continue;
+
+        if ((d->out_len + (w * rows)) > d->out_size) {
+            d->overflow = true;
+            return;
+        }
+        for (uint32_t r = 0; r < rows; r++) {
+            const uint8_t* src = band + (r * d->width) + x0;
+            memcpy(d->out + d->out_len, src, w);
+            memcpy(reference + ((y0 + r) * d->width) + x0, src, w);
+            d->out_len += w;
+        }
+        d->out[i >> 3] |= (1 << (i & 7));
+    }
+    memset(d->sad, 0, sizeof(d->sad));
+}
+
+bool tile_delta_add_rows(tile_delta_t* d, uint32_t y, const uint8_t* rows, uint32_t n)
+{
+    for (uint32_t r = 0; (r < n) && (y < d->height) && !d->overflow; r++, y++, rows += d->width) {
+        const uint32_t by = y % TILE_DELTA_TILE;
+        memcpy(band + (by * d->width), rows, d->width);
+
+        // compare the row while it's still in the cache.
+        const uint8_t* ref = reference + (y * d->width);
+        for (uint32_t tx = 0; tx < d->tiles_x; tx++) {
+            const uint32_t x0 = tx * TILE_DELTA_TILE;
+            const uint32_t w = ((d->width - x0) < TILE_DELTA_TILE) ? (d->width - x0) :
+                                                                     TILE_DELTA_TILE;
+            d->sad[tx] += sad_bytes(rows + x0, ref + x0, w);
+        }
+
+        if ((by == (TILE_DELTA_TILE - 1)) || (y == (d->height - 1u)))
+            finish_band(d, y / TILE_DELTA_TILE, by + 1);
+    }
+    return !d->overflow;
+}
+
+uint32_t tile_delta_end(tile_delta_t* d)
+{
+    memcpy(d->changed, d->out, tile_delta_bitmap_bytes(d->width, d->height));
+    return d->out_len;
+}
@@ -0,0 +1,18 @@
+#include "timebase.h"
+
+void timebase_init()
+{
+    __HAL_RCC_TIM5_CLK_ENABLE();
+
+    // TIM5 is on APB1, so its kernel clock is 96MHz. Divide it down to 1MHz.
+    TIM5->CR1 = 0;
+    TIM5->PSC = 96 - 1;
+    TIM5->ARR = 0xfffffffful;
+    TIM5->CNT = 0;
+
+    // Generate an update event so that the new prescaler value is loaded immediately.
+    TIM5->EGR = (1 << 0);
+    TIM5->SR = 0;
+
+    TIM5->CR1 |= (1 << 0);
+}
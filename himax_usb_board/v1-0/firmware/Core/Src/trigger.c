@@ -0,0 +1,372 @@
+#include "trigger.h"
+#include "timebase.h"
+
+// Output compare modes (OCxM) in TIM5->CCMR1.
+#define OCM_FROZEN            0ul
+#define OCM_ACTIVE_ON_MATCH   1ul
+#define OCM_INACTIVE_ON_MATCH 2ul
+#define OCM_FORCE_INACTIVE    4ul
+#define OCM_FORCE_ACTIVE      5ul
+
+// The first controller pulse goes out this long after trigger_configure().
+#define TRIGGER_START_US 100
+
+// EXTI line of gpio3 (PF9).
+#define TRIGGER_IN_EXTI_LINE 9
+
+/**
+ * One TIM5 compare channel that generates pulses, one edge at a time.
+ */
+typedef struct trigger_channel {
+    // 1 or 2. CCxIF, CCxIE and CCxG are all at bit 'channel' of their registers.
+    int channel;
+
+    // The edge that the compare is set up for.
+    bool rising;
+    uint32_t at;
+
+    // true from the moment a pulse is scheduled until its falling edge.
+    bool busy;
+} trigger_channel_t;
+
+static volatile trigger_channel_t sync_ch = {.channel = 1};
+static volatile trigger_channel_t sensor_ch = {.channel = 2};
+
+static trigger_config_t config;
+
+// Sequence number and rising edge of the last sync pulse.
+static volatile uint32_t sync_sequence = TRIGGER_SYNC_NONE;
+static volatile uint32_t sync_us;
+
+// Bits of the sync block that a peripheral is receiving. rx_index is the index of the next pulse
+// in the block, or 0 while waiting for a marker.
+static uint32_t rx_index;
+static uint32_t rx_value;
+static uint32_t rx_rise_us;
+
+static volatile uint32_t last_us;
+static volatile uint32_t count;
+static volatile uint32_t missed;
+
+// gpio3 events; see trigger_event_enable().
+static volatile bool event_enabled;
+static volatile bool event_pending;
+
+static void set_ocm(int channel, uint32_t mode)
+{
+    // OC1M is at bits 6:4 and 16, OC2M at bits 14:12 and 24.
+    const int shift = (channel == 1) ? 4 : 12;
+    TIM5->CCMR1 = (TIM5->CCMR1 & ~((7ul << shift) | (1ul << (shift + 12)))) | (mode << shift);
+}
+
+/**
+ * Sets up the channel's compare for the next edge. If 'at' has already passed by the time that's
+ * done, the edge is forced right away and the compare interrupt is raised by hand, so that
+ * TIM5_IRQHandler still does its part.
+ */
+static void schedule_edge(volatile trigger_channel_t* c, uint32_t at, bool rising)
+{
+    c->rising = rising;
+    c->at = at;
+
+    set_ocm(c->channel, rising ? OCM_ACTIVE_ON_MATCH : OCM_INACTIVE_ON_MATCH);
+    if (c->channel == 1)
+        TIM5->CCR1 = at;
+    else
+        TIM5->CCR2 = at;
+
+    if ((int32_t)(at - timebase_now_us()) <= 0) {
+        set_ocm(c->channel, rising ? OCM_FORCE_ACTIVE : OCM_FORCE_INACTIVE);
+        TIM5->EGR = (1ul << c->channel);
+    }
+}
+
+static void sensor_pulse_start(uint32_t at)
+{
+    if (sensor_ch.busy) {
+        missed++;
+        return;
+    }
+    sensor_ch.busy = true;
+    schedule_edge(&sensor_ch, at, true);
+}
+
+/**
+ * Width of the controller's sync pulse with sequence number 'seq'. See trigger.h for the encoding.
+ */
+static uint32_t sync_width(uint32_t seq)
+{
+    const uint32_t i = seq % TRIGGER_SYNC_BLOCK;
+    if (i == 0)
+        return 3 * config.width_us;
+
+    const uint32_t marker = seq - i;
+    return ((marker >> (i - 1)) & 1) ? (2 * config.width_us) : config.width_us;
+}
+
+/**
+ * Only used by a controller: CH1 times the sync pulses.
+ */
+static void sync_edge()
+{
+    if (sync_ch.rising) {
+        gpio4_GPIO_Port->BSRR = gpio4_Pin;
+        const uint32_t at = sync_ch.at;
+        sync_sequence++;
+        sync_us = at;
+
+        sensor_pulse_start(at + config.delay_us);
+        schedule_edge(&sync_ch, at + sync_width(sync_sequence), false);
+    } else {
+        gpio4_GPIO_Port->BSRR = (uint32_t)gpio4_Pin << 16;
+        schedule_edge(&sync_ch, sync_us + config.period_us, true);
+    }
+}
+
+/**
+ * Takes the width of a sync pulse that a peripheral received and decodes the sequence number from
+ * it. See trigger.h for the encoding.
+ */
+static void sync_decode(uint32_t width)
+{
+    const uint32_t w = config.width_us;
+    if (width >= ((5 * w) / 2)) {
+        rx_index = 1;
+        rx_value = 0;
+        return;
+    }
+
+    // waiting for a marker
+    if (rx_index == 0)
+        return;
+
+    if (width >= ((3 * w) / 2))
+        rx_value |= (1ul << (rx_index - 1));
+    if (++rx_index < TRIGGER_SYNC_BLOCK)
+        return;
+
+    // That was the last pulse of the block, so its sequence number is the marker's + 32. If this
+    // doesn't agree with the count, pulses were lost or misread; the block wins.
+    rx_index = 0;
+    sync_sequence = rx_value + (TRIGGER_SYNC_BLOCK - 1);
+}
+
+static void sensor_edge()
+{
+    // hm01b0_trig has already been switched by the compare unit.
+    if (sensor_ch.rising) {
+        hm0360_trig_GPIO_Port->BSRR = hm0360_trig_Pin;
+        last_us = sensor_ch.at;
+        count++;
+        schedule_edge(&sensor_ch, sensor_ch.at + config.width_us, false);
+    } else {
+        hm0360_trig_GPIO_Port->BSRR = (uint32_t)hm0360_trig_Pin << 16;
+        set_ocm(sensor_ch.channel, OCM_FROZEN);
+        sensor_ch.busy = false;
+    }
+}
+
+void TIM5_IRQHandler()
+{
+    const uint32_t sr = TIM5->SR & TIM5->DIER;
+    if (sr & (1ul << sync_ch.channel)) {
+        TIM5->SR = ~(1ul << sync_ch.channel);
+        sync_edge();
+    }
+    if (sr & (1ul << sensor_ch.channel)) {
+        TIM5->SR = ~(1ul << sensor_ch.channel);
+        sensor_edge();
+    }
+}
+
+// gpio3 (PF9) is the trigger input. EXTI9 fires on both edges.
+void EXTI9_5_IRQHandler()
+{
+    if (!(EXTI->PR & (1ul << TRIGGER_IN_EXTI_LINE)))
+        return;
+    EXTI->PR = (1ul << TRIGGER_IN_EXTI_LINE);
+
+    if (config.role != TRIGGER_ROLE_PERIPHERAL) {
+        if (gpio3_GPIO_Port->IDR & gpio3_Pin)
+            event_pending = true;
+        return;
+    }
+
+    const uint32_t now = timebase_now_us();
+
+    // The pin tells which edge this was. A pulse that's shorter than the interrupt latency looks
+    // like a falling edge with a bogus width, which the next block's sequence number corrects.
+    if (gpio3_GPIO_Port->IDR & gpio3_Pin) {
+        gpio4_GPIO_Port->BSRR = gpio4_Pin;
+        rx_rise_us = now;
+        if (sync_sequence != TRIGGER_SYNC_NONE)
+            sync_sequence++;
+        sync_us = now;
+
+        // With no delay, this forces hm01b0_trig high before returning.
+        sensor_pulse_start(now + config.delay_us);
+    } else {
+        gpio4_GPIO_Port->BSRR = (uint32_t)gpio4_Pin << 16;
+        sync_decode(now - rx_rise_us);
+    }
+}
+
+static void trigger_stop()
+{
+    // The trigger interrupts are above the FreeRTOS syscall priority, so a FreeRTOS critical
+    // section wouldn't keep them out.
+    __disable_irq();
+    if (!event_enabled)
+        EXTI->IMR &= ~(1ul << TRIGGER_IN_EXTI_LINE);
+    TIM5->DIER &= ~((1ul << sync_ch.channel) | (1ul << sensor_ch.channel));
+    TIM5->SR = ~((1ul << sync_ch.channel) | (1ul << sensor_ch.channel));
+    NVIC_ClearPendingIRQ(TIM5_IRQn);
+    if (!event_enabled)
+        NVIC_ClearPendingIRQ(EXTI9_5_IRQn);
+
+    set_ocm(sync_ch.channel, OCM_FORCE_INACTIVE);
+    set_ocm(sensor_ch.channel, OCM_FORCE_INACTIVE);
+    gpio4_GPIO_Port->BSRR = (uint32_t)gpio4_Pin << 16;
+    hm0360_trig_GPIO_Port->BSRR = (uint32_t)hm0360_trig_Pin << 16;
+
+    sync_ch.busy = false;
+    sensor_ch.busy = false;
+    sync_sequence = TRIGGER_SYNC_NONE;
+    rx_index = 0;
+
+    // gpio3 may stay unmasked for events, which the interrupt tells from sync pulses by the role.
+    config.role = TRIGGER_ROLE_OFF;
+    __enable_irq();
+}
+
+void trigger_init()
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+    // hm01b0_trig is TIM5 CH2.
+    GPIO_InitStruct.Pin = hm01b0_trig_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    GPIO_InitStruct.Alternate = GPIO_AF2_TIM5;
+    HAL_GPIO_Init(hm01b0_trig_GPIO_Port, &GPIO_InitStruct);
+
+    // CubeMX gives hm0360_trig to TIM1 CH3, but TIM1 doesn't run; drive it by hand instead.
+    HAL_GPIO_WritePin(hm0360_trig_GPIO_Port, hm0360_trig_Pin, GPIO_PIN_RESET);
+    GPIO_InitStruct.Pin = hm0360_trig_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Alternate = 0;
+    HAL_GPIO_Init(hm0360_trig_GPIO_Port, &GPIO_InitStruct);
+
+    // setup gpio3 (trigger in) as input
+    GPIO_InitStruct.Pin = gpio3_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+    HAL_GPIO_Init(gpio3_GPIO_Port, &GPIO_InitStruct);
+
+    // setup exti 9 to be triggered by PF9, but leave it masked until we're a peripheral.
+    // P'F' requires '5'. (A = '0', B = '1', etc)
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    SYSCFG->EXTICR[TRIGGER_IN_EXTI_LINE >> 2] &= ~(0b1111 << ((TRIGGER_IN_EXTI_LINE & 0x03) * 4));
+    SYSCFG->EXTICR[TRIGGER_IN_EXTI_LINE >> 2] |=  (0b0101 << ((TRIGGER_IN_EXTI_LINE & 0x03) * 4));
+    EXTI->RTSR |= (1ul << TRIGGER_IN_EXTI_LINE);
+    EXTI->FTSR |= (1ul << TRIGGER_IN_EXTI_LINE);
+    EXTI->IMR &= ~(1ul << TRIGGER_IN_EXTI_LINE);
+
+    // Both compare channels are outputs without preload, so new compare values take effect right
+    // away. Only CH2 is connected to a pin; it's active high.
+    TIM5->CCMR1 &= ~((3ul << 0) | (1ul << 3) | (3ul << 8) | (1ul << 11));
+    TIM5->CCER &= ~((0xful << 0) | (0xful << 4));
+    TIM5->CCER |= (1ul << 4);
+    trigger_stop();
+
+    HAL_NVIC_SetPriority(TIM5_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(TIM5_IRQn);
+    HAL_NVIC_SetPriority(EXTI9_5_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+}
+
+bool trigger_configure(const trigger_config_t* cfg)
+{
+    trigger_stop();
+    config.role = TRIGGER_ROLE_OFF;
+    if (cfg->role == TRIGGER_ROLE_OFF)
+        return true;
+
+    if (cfg->width_us < TRIGGER_MIN_US)
+        return false;
+    if ((cfg->role == TRIGGER_ROLE_CONTROLLER) &&
+        ((cfg->period_us < (cfg->delay_us + cfg->width_us + TRIGGER_MIN_US)) ||
+         (cfg->period_us < ((3 * cfg->width_us) + TRIGGER_MIN_US))))
+        return false;
+    if ((cfg->role != TRIGGER_ROLE_CONTROLLER) && (cfg->role != TRIGGER_ROLE_PERIPHERAL))
+        return false;
+
+    config = *cfg;
+    last_us = 0;
+    count = 0;
+    missed = 0;
+
+    TIM5->DIER |= (1ul << sync_ch.channel) | (1ul << sensor_ch.channel);
+    if (config.role == TRIGGER_ROLE_CONTROLLER) {
+        // sync_edge() counts this up to 0 for the first pulse.
+        sync_sequence = TRIGGER_SYNC_NONE;
+        schedule_edge(&sync_ch, timebase_now_us() + TRIGGER_START_US, true);
+    } else {
+        EXTI->PR = (1ul << TRIGGER_IN_EXTI_LINE);
+        EXTI->IMR |= (1ul << TRIGGER_IN_EXTI_LINE);
+    }
+    return true;
+}
+
+uint32_t trigger_last_us()
+{
+    return last_us;
+}
+
+uint32_t trigger_count()
+{
+    return count;
+}
+
+uint32_t trigger_missed()
+{
+    return missed;
+}
+
+void trigger_sync_last(uint32_t* sequence, uint32_t* at_us)
+{
+    // The pair is updated from a priority 1 interrupt, so keep it out while reading.
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *sequence = sync_sequence;
+    *at_us = sync_us;
+    __set_PRIMASK(primask);
+}
+
+void trigger_event_enable(bool enable)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    event_enabled = enable;
+    event_pending = false;
+    if (config.role != TRIGGER_ROLE_PERIPHERAL) {
+        if (enable) {
+            EXTI->PR = (1ul << TRIGGER_IN_EXTI_LINE);
+            EXTI->IMR |= (1ul << TRIGGER_IN_EXTI_LINE);
+        } else {
+            EXTI->IMR &= ~(1ul << TRIGGER_IN_EXTI_LINE);
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+bool trigger_event_take()
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const bool pending = event_pending;
+    event_pending = false;
+    __set_PRIMASK(primask);
+    return pending;
+}
@@ -1,12 +1,17 @@
 #include "main.h"
 #include "usb_device.h"
+#include "usbd_cdc_if.h"
 #include "cmsis_os.h"
 #include "usb_task.h"
 #include "camera_management_task.h"
 #include "camera_read_task.h"
+#include "detect_task.h"
+#include "sensor_modes_table.h"
+#include "timebase.h"
 
 #include "camera_command.pb.h"
 #include "pb_decode.h"
+#include "pb_encode.h"
 
 extern QueueHandle_t camera_read_task_config_queue;
 extern QueueHandle_t camera_management_task_request_queue;
@@ -14,46 +19,328 @@ extern QueueHandle_t camera_management_task_request_queue;
 extern QueueHandle_t usb_cdc_rx_queue;
 extern QueueHandle_t usb_request_queue;
 
+// Given by CDC_TransmitCplt_HS (usbd_cdc_if.c) once the USB peripheral has sent a buffer.
+SemaphoreHandle_t usb_tx_complete_semaphore;
+StaticSemaphore_t usb_tx_complete_semaphore_buffer;
+
+// How long to wait for the host to pick up a buffer before giving up on it.
+#define USB_TX_TIMEOUT (100 / portTICK_PERIOD_MS)
+
 #define USB_READ_TASK_BUFSZ 512
 osThreadId usbReadTaskHandle;
 uint32_t usbReadTaskBuffer[ USB_READ_TASK_BUFSZ ];
 osStaticThreadDef_t usbReadTaskControlBlock;
 
-static void handle_camera_read_config(const pb_camera_request_t* pb)
+// Responses are framed by this preamble so that the host can pick them out of the image data.
+// Must match camerainterface.py:RESPONSE_PREAMBLE.
+static const uint8_t response_magic[16] = {
+    0x28, 0xb6, 0xe3, 0x1d, 0x8b, 0x2c, 0xa7, 0x35,
+    0x40, 0x55, 0x34, 0x33, 0x4e, 0x6c, 0xd4, 0x90
+};
+
+// Encoded responses have to stay put until usb_task has handed them to the USB peripheral, so
+// they're kept in a small ring of buffers instead of on the sender's stack. Each buffer has a
+// semaphore that's taken by whoever fills it and given back by usb_task once it's been sent, so
+// a slow USB link makes senders wait for a buffer rather than overwrite one that's still queued.
+#define USB_RESPONSE_SLOTS 8
+#define USB_RESPONSE_MAXLEN 96
+static uint8_t response_bufs[USB_RESPONSE_SLOTS][USB_RESPONSE_MAXLEN];
+static SemaphoreHandle_t response_free[USB_RESPONSE_SLOTS];
+static StaticSemaphore_t response_free_buffer[USB_RESPONSE_SLOTS];
+static int response_slot = 0;
+
+void usb_task_send_response(const camera_request_ack_t* ack,
+                            camera_response_status_e status,
+                            int32_t detail)
+{
+    usb_task_send_response_data(ack, status, detail, NULL, 0);
+}
+
+void usb_task_send_response_data(const camera_request_ack_t* ack,
+                                 camera_response_status_e status,
+                                 int32_t detail,
+                                 const uint8_t* data,
+                                 int len)
+{
+    if ((ack == NULL) || (ack->request_id == 0))
+        return;
+
+    pb_camera_response_t resp = PB_CAMERA_RESPONSE_INIT_ZERO;
+    resp.request_id = ack->request_id;
+    resp.status = (int)status;      // camera_response_status_e mirrors status_e
+    resp.detail = detail;
+    resp.exec_time_us = timebase_now_us() - ack->received_us;
+    if (data != NULL) {
+        if (len > sizeof(resp.reg_values.bytes))
+            len = sizeof(resp.reg_values.bytes);
+        memcpy(resp.reg_values.bytes, data, len);
+        resp.reg_values.size = len;
+    }
+
+    // If more than USB_RESPONSE_SLOTS senders end up with the same slot, its semaphore hands it
+    // to them one at a time.
+    taskENTER_CRITICAL();
+    const int slot = response_slot;
+    response_slot = (response_slot + 1) % USB_RESPONSE_SLOTS;
+    taskEXIT_CRITICAL();
+    xSemaphoreTake(response_free[slot], portMAX_DELAY);
+    uint8_t* buf = response_bufs[slot];
+
+    // [preamble] [1-byte length] [pb_camera_response]
+    const int hdrlen = sizeof(response_magic) + 1;
+    memcpy(buf, response_magic, sizeof(response_magic));
+    pb_ostream_t stream = pb_ostream_from_buffer(buf + hdrlen, USB_RESPONSE_MAXLEN - hdrlen);
+    if (!pb_encode(&stream, PB_CAMERA_RESPONSE_FIELDS, &resp)) {
+        xSemaphoreGive(response_free[slot]);
+        return;
+    }
+    buf[hdrlen - 1] = stream.bytes_written;
+
+    // usb_task always gets through its queue (a stuck transfer times out), so waiting for room
+    // can't hang; it's better than losing the acknowledgement of a request that was carried out.
+    usb_write_request_t req = {
+        .buf = buf,
+        .len = hdrlen + stream.bytes_written,
+        .done = response_free[slot]
+    };
+    xQueueSendToBack(usb_request_queue, (const void*)&req, portMAX_DELAY);
+}
+
+static void handle_camera_read_config(const pb_camera_request_t* pb,
+                                      const camera_request_ack_t* ack)
 {
     const pb_camera_read_request_t* rr = &pb->request.dcmi_config;
     switch(rr->which_request) {
         case PB_CAMERA_READ_REQUEST_CROP_TAG: {
-            camera_read_task_set_size(rr->request.crop.len_x, rr->request.crop.len_y);
+            camera_read_task_set_size(rr->request.crop.len_x, rr->request.crop.len_y, NULL);
             camera_read_task_set_crop(rr->request.crop.start_x, rr->request.crop.start_y,
-                                      rr->request.crop.len_x, rr->request.crop.len_y);
+                                      rr->request.crop.len_x, rr->request.crop.len_y, ack);
             break;
         }
 
         case PB_CAMERA_READ_REQUEST_PACK_TAG: {
-            if (rr->request.pack.pack) camera_read_task_enable_packing();
-            else camera_read_task_disable_packing();
+            if (rr->request.pack.pack) camera_read_task_enable_packing(ack);
+            else camera_read_task_disable_packing(ack);
             break;
         }
 
         case PB_CAMERA_READ_REQUEST_DCMI_HALT_TAG: {
-            // Note that halting DCMI will block this thread until DCMI has actually been halted,
+            // This doesn't wait for the halt; the response is sent once DCMI has actually halted,
             // which can take up to 1 camera frame.
-            if (rr->request.dcmi_halt.halt) camera_read_task_halt_dcmi();
-            else camera_read_task_resume_dcmi();
+            if (rr->request.dcmi_halt.halt) camera_read_task_halt_dcmi(ack);
+            else camera_read_task_resume_dcmi(ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_TEST_PATTERN_TAG: {
+            camera_read_task_set_test_pattern(
+                (camera_test_pattern_e)rr->request.test_pattern.pattern,
+                rr->request.test_pattern.frame_rate, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_STREAM_TAG: {
+            camera_read_task_set_stream(rr->request.stream.pixel_interval,
+                                        rr->request.stream.stats, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_BURST_TAG: {
+            camera_read_task_burst(rr->request.burst.frames, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_RING_TAG: {
+            if (rr->request.ring.motion_threshold > 255) {
+                usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            camera_read_task_ring(rr->request.ring.pre_frames, rr->request.ring.post_frames,
+                                  rr->request.ring.gpio, rr->request.ring.motion_threshold, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_EVENT_TAG: {
+            camera_read_task_event(ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_DELTA_TAG: {
+            const pb_camera_read_request_delta_t* d = &rr->request.delta;
+            if ((d->threshold > 255) || (d->hysteresis > 255)) {
+                usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            camera_read_task_set_delta(d->enable, d->threshold, d->hysteresis,
+                                       d->keyframe_interval, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_CODEC_TAG: {
+            // a quality that doesn't fit in 8 bits is passed on as 0, which is out of range too.
+            const pb_camera_read_request_codec_t* c = &rr->request.codec;
+            camera_read_task_set_codec((camera_codec_e)c->codec,
+                                       (c->quality > 255) ? 0 : c->quality, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_LUT_TAG: {
+            const pb_camera_read_request_lut_t* l = &rr->request.lut;
+            if (l->commit)
+                camera_read_task_lut_commit(l->size, ack);
+            else
+                camera_read_task_lut_write(l->offset, l->entries.bytes, l->entries.size, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_FOCUS_TAG: {
+            const pb_camera_read_request_set_crop_t* roi = &rr->request.focus.roi;
+            if ((roi->start_x < 0) || (roi->start_y < 0) || (roi->len_x < 0) || (roi->len_y < 0) ||
+                (roi->start_x > 0xffff) || (roi->start_y > 0xffff) ||
+                (roi->len_x > 0xffff) || (roi->len_y > 0xffff)) {
+                usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            const frame_stats_roi_t r = {roi->start_x, roi->start_y, roi->len_x, roi->len_y};
+            camera_read_task_set_focus(rr->request.focus.enable, &r, ack);
+            break;
+        }
+
+        case PB_CAMERA_READ_REQUEST_DEPTH_TAG: {
+            const pb_camera_read_request_depth_t* d = &rr->request.depth;
+            camera_read_task_set_depth((d->bits > 255) ? 0 : d->bits,
+                                       (d->threshold > 255) ? 255 : d->threshold, d->dither, ack);
+            break;
+        }
+
+        default: {
+            usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
             break;
         }
     }
 }
 
-static void handle_camera_management_request(const pb_camera_request_t* pb)
+static void handle_detect_request(const pb_camera_request_t* pb, const camera_request_ack_t* ack)
+{
+    const pb_detect_request_t* dr = &pb->request.detect;
+
+    switch (dr->which_request) {
+        case PB_DETECT_REQUEST_MODEL_TAG: {
+            const pb_detect_request_model_t* m = &dr->request.model;
+            if (m->commit)
+                detect_task_model_commit(m->size, ack);
+            else
+                detect_task_model_write(m->offset, m->data.bytes, m->data.size, ack);
+            break;
+        }
+
+        case PB_DETECT_REQUEST_CONFIG_TAG: {
+            // values that don't fit in 8 bits are passed on as 255, which is out of range too.
+            const pb_detect_request_config_t* c = &dr->request.config;
+            detect_task_configure(c->interval, (c->threshold > 255) ? 255 : c->threshold,
+                                  (c->class_index > 255) ? 255 : c->class_index, c->gate, ack);
+            break;
+        }
+
+        default: {
+            usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+            break;
+        }
+    }
+}
+
+static void handle_camera_management_request(const pb_camera_request_t* pb,
+                                             const camera_request_ack_t* ack)
 {
     const pb_camera_management_request_t* mr = &pb->request.camera_management;
     switch(mr->which_request) {
         case PB_CAMERA_MANAGEMENT_REQUEST_REG_WRITE_TAG: {
             camera_management_task_reg_write((uint8_t)mr->request.reg_write.i2c_peripheral_address,
                                              (uint16_t)mr->request.reg_write.register_address,
-                                             (uint8_t)mr->request.reg_write.value);
+                                             (uint8_t)mr->request.reg_write.value,
+                                             ack);
+            break;
+        }
+
+        case PB_CAMERA_MANAGEMENT_REQUEST_REG_READ_TAG: {
+            const pb_camera_management_request_reg_read_t* rr = &mr->request.reg_read;
+            if ((rr->register_addresses_count == 0) ||
+                (rr->register_addresses_count > CAMERA_REG_READ_MAX)) {
+                usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+
+            uint16_t regs[CAMERA_REG_READ_MAX];
+            for (int i = 0; i < rr->register_addresses_count; i++)
+                regs[i] = (uint16_t)rr->register_addresses[i];
+            camera_management_task_reg_read((uint8_t)rr->i2c_peripheral_address, regs,
+                                            rr->register_addresses_count, ack);
+            break;
+        }
+
+        case PB_CAMERA_MANAGEMENT_REQUEST_SET_MODE_TAG: {
+            if (mr->request.set_mode.mode >= SENSOR_MODE_COUNT) {
+                usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            camera_management_task_set_mode(mr->request.set_mode.mode,
+                                            mr->request.set_mode.resume, ack);
+            break;
+        }
+
+        case PB_CAMERA_MANAGEMENT_REQUEST_INTERLEAVE_TAG: {
+            camera_management_task_interleave(mr->request.interleave.frames_per_sensor, ack);
+            break;
+        }
+
+        case PB_CAMERA_MANAGEMENT_REQUEST_FRAME_PARAMS_TAG: {
+            const pb_camera_management_request_frame_params_t* fp = &mr->request.frame_params;
+            camera_frame_params_t entries[CAMERA_FRAME_PARAMS_MAX];
+            for (int i = 0; i < fp->entries_count; i++) {
+                const pb_camera_management_request_frame_params_entry_t* e = &fp->entries[i];
+                if ((e->exposure_lines > 0xffff) || (e->analog_gain > 3) ||
+                    (e->digital_gain > 0xff)) {
+                    usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, i);
+                    return;
+                }
+                entries[i] = (camera_frame_params_t){
+                    e->exposure_lines, e->analog_gain, e->digital_gain
+                };
+            }
+            camera_management_task_frame_params(entries, fp->entries_count, fp->repeat, ack);
+            break;
+        }
+
+        case PB_CAMERA_MANAGEMENT_REQUEST_AUTO_EXPOSURE_TAG: {
+            const pb_camera_management_request_auto_exposure_t* ae = &mr->request.auto_exposure;
+            if (!ae->enable) {
+                camera_management_task_auto_exposure(false, NULL, ack);
+                break;
+            }
+
+            // Anything that doesn't fit auto_exposure_config_t is rejected here; the rest is
+            // checked by camera_management_task.
+            const pb_camera_read_request_set_crop_t* roi = &ae->roi;
+            if ((ae->target > 0xff) || (ae->tolerance > 0xff) ||
+                (ae->max_exposure_lines > 0xffff) || (ae->max_digital_gain > 0xff) ||
+                (ae->max_analog_gain > 0xff) || (ae->speed > 0xffff) || (ae->roi_weight > 0xff) ||
+                (roi->start_x < 0) || (roi->start_y < 0) || (roi->len_x < 0) || (roi->len_y < 0) ||
+                (roi->start_x > 0xffff) || (roi->start_y > 0xffff) ||
+                (roi->len_x > 0xffff) || (roi->len_y > 0xffff)) {
+                usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                break;
+            }
+            const auto_exposure_config_t cfg = {
+                .target = ae->target,
+                .tolerance = ae->tolerance,
+                .max_exposure_lines = ae->max_exposure_lines,
+                .max_analog_gain = ae->max_analog_gain,
+                .max_digital_gain = ae->max_digital_gain,
+                .speed = ae->speed,
+                .roi = {roi->start_x, roi->start_y, roi->len_x, roi->len_y},
+                .roi_weight = ae->roi_weight
+            };
+            camera_management_task_auto_exposure(true, &cfg, ack);
             break;
         }
 
@@ -61,19 +348,63 @@ static void handle_camera_management_request(const pb_camera_request_t* pb)
             // "true" selects hm01b0, "false" selects hm0360.
             if (mr->request.sensor_select.sensor_select ==
                 PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT_SENSOR_SELECT_E_HM01_B0)
-                camera_management_task_sensor_select(true);
+                camera_management_task_sensor_select(true, ack);
             else
-                camera_management_task_sensor_select(false);
+                camera_management_task_sensor_select(false, ack);
             break;
         }
 
         case PB_CAMERA_MANAGEMENT_REQUEST_TRIGGER_CONFIG_TAG: {
-            // TODO impl
+            // The roles are numbered the same in the proto and in trigger.h.
+            const trigger_config_t cfg = {
+                .role = (trigger_role_e)mr->request.trigger_config.role,
+                .period_us = mr->request.trigger_config.period_us,
+                .width_us = mr->request.trigger_config.pulse_width_us,
+                .delay_us = mr->request.trigger_config.delay_us
+            };
+            camera_management_task_trigger_config(&cfg, ack);
+            break;
+        }
+
+        default: {
+            usb_task_send_response(ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
             break;
         }
     }
 }
 
+static void handle_camera_transaction(const pb_camera_request_t* pb,
+                                      const camera_request_ack_t* ack)
+{
+    const pb_camera_transaction_t* pt = &pb->request.transaction;
+
+    // only usb_read_task calls this, so it's safe to keep the (large) transaction off its stack.
+    static camera_transaction_t t;
+    t.peripheral_address = (uint8_t)pt->i2c_peripheral_address;
+    t.reg_writes_count = pt->reg_writes_count;
+    memcpy(t.reg_writes, pt->reg_writes, pt->reg_writes_count * sizeof(t.reg_writes[0]));
+
+    t.has_sensor_select = pt->has_sensor_select;
+    t.sensor_select = (pt->sensor_select.sensor_select ==
+                       PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT_SENSOR_SELECT_E_HM01_B0) ?
+        CAMERA_MANAGEMENT_SENSOR_SELECT_HM01B0 :
+        CAMERA_MANAGEMENT_SENSOR_SELECT_HM0360;
+
+    t.has_crop = pt->has_crop;
+    t.crop.start_x = pt->crop.start_x;
+    t.crop.start_y = pt->crop.start_y;
+    t.crop.len_x = pt->crop.len_x;
+    t.crop.len_y = pt->crop.len_y;
+
+    t.has_pack = pt->has_pack;
+    t.pack = pt->pack.pack;
+
+    t.resume = pt->resume;
+    t.reg_script = NULL;
+
+    camera_management_task_transaction(&t, ack);
+}
+
 /**
  * The usb_read_task uses the CDC_Receive_HS callback to get data.
  *
@@ -122,19 +453,32 @@ void usb_read_task(void const* args)
                 stream.callback = pb_callback;
                 stream.state = &ss;
 
-                pb_camera_request_t request = PB_CAMERA_REQUEST_INIT_ZERO;
-                if (pb_decode(&stream, PB_CAMERA_REQUEST_FIELDS, &request)) {
-                    current_buffer_len = -1;
-                    ss.len = 0;
-
-                    // TODO: handle message.
-                    if (request.which_request == PB_CAMERA_REQUEST_CAMERA_MANAGEMENT_TAG) {
-                        handle_camera_management_request(&request);
-                    } else if (request.which_request == PB_CAMERA_REQUEST_DCMI_CONFIG_TAG) {
-                        handle_camera_read_config(&request);
-                    }
+                // static because transactions make this too big for the stack. pb_decode
+                // initializes every field.
+                static pb_camera_request_t request;
+                const bool decoded = pb_decode(&stream, PB_CAMERA_REQUEST_FIELDS, &request);
+                current_buffer_len = -1;
+                ss.len = 0;
+
+                camera_request_ack_t ack = {
+                    .request_id = request.request_id,
+                    .received_us = timebase_now_us()
+                };
+
+                if (!decoded) {
+                    // request_id might not have been decoded, so the host may not be able to
+                    // match this response to its request.
+                    usb_task_send_response(&ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
+                } else if (request.which_request == PB_CAMERA_REQUEST_CAMERA_MANAGEMENT_TAG) {
+                    handle_camera_management_request(&request, &ack);
+                } else if (request.which_request == PB_CAMERA_REQUEST_DCMI_CONFIG_TAG) {
+                    handle_camera_read_config(&request, &ack);
+                } else if (request.which_request == PB_CAMERA_REQUEST_TRANSACTION_TAG) {
+                    handle_camera_transaction(&request, &ack);
+                } else if (request.which_request == PB_CAMERA_REQUEST_DETECT_TAG) {
+                    handle_detect_request(&request, &ack);
                 } else {
-                    while (1);
+                    usb_task_send_response(&ack, CAMERA_RESPONSE_BAD_REQUEST, 0);
                 }
             }
             taskYIELD();
@@ -145,6 +489,13 @@ void usb_read_task(void const* args)
 
 void usb_task(void const* args)
 {
+    usb_tx_complete_semaphore = xSemaphoreCreateBinaryStatic(&usb_tx_complete_semaphore_buffer);
+
+    // Responses are only sent for requests that usb_read_task has received, so these are ready
+    // before anyone needs them.
+    for (int i = 0; i < USB_RESPONSE_SLOTS; i++)
+        response_free[i] = xSemaphoreCreateCountingStatic(1, 1, &response_free_buffer[i]);
+
     MX_USB_DEVICE_Init();
 
     osThreadStaticDef(usbReadTask,
@@ -162,8 +513,24 @@ void usb_task(void const* args)
         usb_write_request_t req;
         xQueueReceive(usb_request_queue, &req, portMAX_DELAY);
 
-        // send the request
+        // send the request. If the previous transfer is still in flight, give it a few ms to
+        // finish rather than dropping this buffer; responses in particular are small and tend to
+        // be queued right behind a large image buffer.
+        xSemaphoreTake(usb_tx_complete_semaphore, 0);
         uint8_t rs = CDC_Transmit_HS(req.buf, req.len);
+        for (int tries = 0; (rs == USBD_BUSY) && (tries < 5); tries++) {
+            osDelay(1);
+            rs = CDC_Transmit_HS(req.buf, req.len);
+        }
+
+        // Wait for the transfer to finish so that whoever owns the buffer knows when it's free.
+        // This also means that the next transfer can start as soon as this one is done instead
+        // of polling for the peripheral to become free.
+        if (rs == USBD_OK)
+            xSemaphoreTake(usb_tx_complete_semaphore, USB_TX_TIMEOUT);
+
+        if (req.done != NULL)
+            xSemaphoreGive(req.done);
 
         HAL_GPIO_WritePin(led2_GPIO_Port, led2_Pin, GPIO_PIN_RESET);
         if ((rs == USBD_FAIL) || (rs == USBD_BUSY)) {
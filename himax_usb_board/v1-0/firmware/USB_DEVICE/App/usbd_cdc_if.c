@@ -25,6 +25,7 @@
 
 #include "main.h"
 #include "cmsis_os.h"
+#include "semphr.h"
 
 /* USER CODE END INCLUDE */
 
@@ -325,6 +326,11 @@ static int8_t CDC_TransmitCplt_HS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
   UNUSED(Buf);
   UNUSED(Len);
   UNUSED(epnum);
+
+  // let usb_task know that the buffer it handed us has been sent. Semaphore defined in usb_task.c
+  extern SemaphoreHandle_t usb_tx_complete_semaphore;
+  BaseType_t wake_task = pdFALSE;
+  xSemaphoreGiveFromISR(usb_tx_complete_semaphore, &wake_task);
   /* USER CODE END 14 */
   return result;
 }
@@ -3,11 +3,101 @@
 import argparse
 import time
 import serial
+import numpy as np
+
+from camera_command_pb2 import *
+from camerainterface import *
+
+PATTERNS = {
+    "ramp": pb_camera_read_request_test_pattern.pattern_e.RAMP,
+    "counter": pb_camera_read_request_test_pattern.pattern_e.COUNTER,
+    "lfsr": pb_camera_read_request_test_pattern.pattern_e.LFSR,
+}
 
 def parse_arguments():
     parser = argparse.ArgumentParser(description="Measure incoming bytes on a serial port.")
     parser.add_argument("port", type=str, help="Serial port to open (e.g., COM3 or /dev/ttyUSB0)")
     parser.add_argument("-t", "--time", type=float, default=1.0, help="Duration to keep the port open in seconds")
+    parser.add_argument("--pattern", choices=PATTERNS.keys(), default=None,
+                        help="Halt the sensor and measure the camera's synthetic test pattern instead, "
+                             "checking every frame")
+    parser.add_argument("--rate", type=int, default=0,
+                        help="Test pattern frame rate in fps; 0 means as fast as the link allows")
+    parser.add_argument("--pack", action="store_true",
+                        help="Run the test pattern through the nybble packing path")
+    parser.add_argument("--crop", type=int, nargs=4, default=[2, 2, 320, 240],
+                        metavar=("START_X", "START_Y", "WIDTH", "HEIGHT"),
+                        help="Frame geometry for the test pattern")
+    parser.add_argument("--sweep", action="store_true",
+                        help="Measure every test pattern with packing off and on, at each of --rates")
+    parser.add_argument("--rates", type=int, nargs="+", default=[0],
+                        help="Frame rates to use with --sweep")
+    parser.add_argument("--switch", type=int, default=None, metavar="COUNT",
+                        help="Switch between the two image sensors COUNT times with DCMI running, "
+                             "--time seconds apart, and report how long the switches took")
+    parser.add_argument("--interleave", type=int, default=None, metavar="K",
+                        help="Alternate between the two image sensors every K frames for --time "
+                             "seconds and report frames per sensor and frames lost per switch")
+    parser.add_argument("--trigger", type=int, default=None, metavar="PERIOD_US",
+                        help="Trigger the sensor from the camera's timer every PERIOD_US for --time "
+                             "seconds and report the trigger-to-frame latency and its jitter")
+    parser.add_argument("--trigger-width", type=int, default=10, metavar="US",
+                        help="Trigger pulse width for --trigger")
+    parser.add_argument("--trigger-delay", type=int, default=0, metavar="US",
+                        help="Trigger delay for --trigger")
+    parser.add_argument("--bracket", type=int, nargs=2, default=None, metavar=("SHORT", "LONG"),
+                        help="Alternate between two exposures (in lines) with the per-frame "
+                             "schedule for --time seconds and check that each frame's brightness "
+                             "matches the exposure that its header reports")
+    parser.add_argument("--ae", type=int, default=None, metavar="TARGET",
+                        help="Start from a dark exposure and compare how many frames the firmware's "
+                             "auto exposure and an equivalent host-side loop take to reach a mean "
+                             "pixel value of TARGET")
+    parser.add_argument("--stats", type=int, default=None, metavar="PIXEL_INTERVAL",
+                        help="Run --pattern with a statistics record after every frame and the "
+                             "pixels of only every PIXEL_INTERVAL-th frame (0: none), and check "
+                             "the records against the pattern")
+    parser.add_argument("--burst", type=int, default=None, metavar="FRAMES",
+                        help="Record a burst of up to FRAMES frames of --pattern into the camera's "
+                             "RAM, then check the replayed frames and report the capture rate")
+    parser.add_argument("--ring", type=int, nargs=2, default=None, metavar=("PRE", "POST"),
+                        help="Arm a pre-trigger capture of PRE + POST frames of --pattern at "
+                             "--rate, fire an event from the host after --time seconds and check "
+                             "the frames that come back")
+    parser.add_argument("--delta", type=int, nargs=2, default=None,
+                        metavar=("THRESHOLD", "HYSTERESIS"),
+                        help="Stream the sensor's frames (or --pattern) for --time seconds as they "
+                             "are, then as changed tiles, and compare the data and frame rates")
+    parser.add_argument("--lossless", action="store_true",
+                        help="Stream the sensor's frames (or --pattern) for --time seconds "
+                             "with lossless compression and report the compression ratio, the "
+                             "camera's cycles per pixel and the host's decode rate")
+    parser.add_argument("--depth", type=int, choices=[4, 2, 1], default=None,
+                        help="Stream the sensor's frames (or --pattern) for --time seconds with 8 "
+                             "bits per pixel, then with DEPTH, and compare the data and frame "
+                             "rates")
+    parser.add_argument("--threshold", type=int, default=128,
+                        help="Threshold of 1-bit pixels for --depth")
+    parser.add_argument("--dither", action="store_true",
+                        help="Dither the pixels for --depth")
+    parser.add_argument("--lut", type=float, default=None, metavar="GAMMA",
+                        help="Stream --pattern (ramp by default) for --time seconds and swap in a "
+                             "gamma lookup table halfway through, then check which frames went "
+                             "through it and compare the frame rates")
+    parser.add_argument("--dct", type=int, default=None, metavar="QUALITY",
+                        help="Like --lossless, but with lossy DCT compression at QUALITY (1 - "
+                             "100), and report the camera's cycles per 8x8 block and, for "
+                             "--pattern, the PSNR")
+    parser.add_argument("--detect", type=int, default=None, metavar="CLASSES",
+                        help="Upload a random detection model with CLASSES (1 - 4) classes, run it "
+                             "on every frame of --pattern (ramp by default) for --time seconds, "
+                             "check its results against the host's reference and report the "
+                             "inferences/s, then do the same with frames gated on a detection")
+    parser.add_argument("--focus", type=int, nargs=4, default=None, metavar=("X", "Y", "W", "H"),
+                        help="Stream --pattern (ramp by default) with focus records over this "
+                             "region (0 0 0 0 for the whole frame) for --time seconds, with and "
+                             "then without pixels, check the records against the host's reference "
+                             "and report their rate and cost")
     return parser.parse_args()
 
 def open_serial_port(port, timeout):
@@ -27,17 +117,870 @@ def count_bytes(ser, duration):
 
     return byte_count
 
+def measure_pattern(camera, pattern, rate, pack, crop, duration):
+    """
+    Runs one test pattern configuration for 'duration' seconds and returns a dict of results.
+    Dropped frames are gaps in the frame sequence numbers; integrity errors are frames that arrived
+    whole but don't match the pattern.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(pack))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.set_test_pattern(pattern, rate))
+
+    bytes_start = camera.bytes_received
+    discarded_start = camera.discarded_bytes
+    truncated_start = camera.truncated_frames
+    frames = 0
+    dropped = 0
+    errors = 0
+    last_sequence = None
+
+    start_time = time.time()
+    end_time = start_time + duration
+    while time.time() < end_time:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            if (header.source != FRAME_SOURCE_TEST_PATTERN):
+                continue
+
+            frames += 1
+            if (last_sequence is not None):
+                dropped += (header.sequence - last_sequence - 1) & 0xffffffff
+            last_sequence = header.sequence
+
+            expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+            if (not np.array_equal(image, expected)):
+                errors += 1
+    elapsed = time.time() - start_time
+
+    camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+
+    total = frames + dropped
+    return {
+        "MB/s": (camera.bytes_received - bytes_start) / elapsed / 1e6,
+        "fps": frames / elapsed,
+        "frames": frames,
+        "dropped": dropped,
+        "drop rate": (dropped / total) if total else 0.0,
+        "truncated": camera.truncated_frames - truncated_start,
+        "integrity errors": errors,
+        "discarded bytes": camera.discarded_bytes - discarded_start,
+    }
+
+def stats_match(stats, image):
+    """
+    Returns True if 'stats' (a FrameStats) are what the camera should have worked out for 'image'.
+    """
+    height, width = image.shape
+    # the camera shifts the histogram down until every bin fits in 16 bits.
+    shift = 0
+    while ((image.size >> shift) > 0xffff):
+        shift += 1
+    histogram = (np.bincount(image.ravel(), minlength=256) >> shift) << shift
+    ys = [(ty * height) // stats.tiles.shape[0] for ty in range(stats.tiles.shape[0] + 1)]
+    xs = [(tx * width) // stats.tiles.shape[1] for tx in range(stats.tiles.shape[1] + 1)]
+    tiles = np.array([[int(image[ys[ty]:ys[ty + 1], xs[tx]:xs[tx + 1]].mean())
+                       for tx in range(len(xs) - 1)] for ty in range(len(ys) - 1)])
+    return ((stats.min == image.min()) and (stats.max == image.max()) and
+            (abs(stats.mean - image.mean()) < (1 / 256)) and
+            np.array_equal(stats.histogram, histogram) and np.array_equal(stats.tiles, tiles))
+
+def measure_stats(camera, pattern, rate, pixel_interval, crop, duration):
+    """
+    Runs a test pattern with statistics records on and pixels of every 'pixel_interval'-th frame
+    for 'duration' seconds. Returns the number of statistics records, how many of them didn't
+    match the pattern, the number of frames with pixels and the data rate in MB/s.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.set_stream(pixel_interval, True))
+    camera.wait_response(camera.set_test_pattern(pattern, rate))
+
+    bytes_start = camera.bytes_received
+    records = 0
+    errors = 0
+    frames = 0
+    start_time = time.time()
+    while (time.time() - start_time) < duration:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            camera.pop_frame_with_header()
+            frames += 1
+        while camera.stats_ready():
+            header, stats = camera.pop_stats()
+            records += 1
+            expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+            if (not stats_match(stats, expected)):
+                errors += 1
+    elapsed = time.time() - start_time
+
+    camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    camera.wait_response(camera.set_stream(1, False))
+    return records, errors, frames, (camera.bytes_received - bytes_start) / elapsed / 1e6
+
+def measure_burst(camera, pattern, frames, crop, duration):
+    """
+    Records a burst of up to 'frames' test pattern frames and waits up to 'duration' seconds for
+    them to be sent. Returns the number of frames recorded, the number received, how many of those
+    didn't match the pattern, the capture rate in frames per second (from the frames' own
+    timestamps) and how long the burst took to send.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.set_test_pattern(pattern, 0))
+
+    recorded = camera.wait_response(camera.burst_capture(frames), timeout=duration).detail
+    drain_start = time.time()
+    timestamps = []
+    errors = 0
+    while ((len(timestamps) < recorded) and ((time.time() - drain_start) < duration)):
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            if (not (header.flags & FRAME_FLAG_REPLAY)):
+                continue
+            timestamps.append(header.timestamp_us)
+            expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+            if (not np.array_equal(image, expected)):
+                errors += 1
+    drain_time = time.time() - drain_start
+
+    camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    span_us = (timestamps[-1] - timestamps[0]) & 0xffffffff if (len(timestamps) > 1) else 0
+    fps = ((len(timestamps) - 1) * 1e6 / span_us) if span_us else 0.0
+    return recorded, len(timestamps), errors, fps, drain_time
+
+def measure_ring(camera, pattern, rate, pre, post, crop, duration):
+    """
+    Arms a pre-trigger capture of test pattern frames, waits 'duration' seconds, fires an event
+    and collects the frames that come back. Returns the number of bytes received while armed, the
+    number of frames received from before and after the event, the number of gaps in their
+    sequence numbers and how many didn't match the pattern.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.arm_ring(pre, post))
+    camera.wait_response(camera.set_test_pattern(pattern, rate))
+
+    bytes_start = camera.bytes_received
+    start_time = time.time()
+    while (time.time() - start_time) < duration:
+        camera.try_read_bytes()
+        time.sleep(0.01)
+    idle_bytes = camera.bytes_received - bytes_start
+
+    camera.wait_response(camera.fire_event())
+    sequences = []
+    before = 0
+    errors = 0
+    seen_event = False
+    start_time = time.time()
+    while ((len(sequences) < (pre + post)) and ((time.time() - start_time) < max(duration, 5))):
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            if (not (header.flags & FRAME_FLAG_REPLAY)):
+                continue
+            seen_event = seen_event or bool(header.flags & FRAME_FLAG_EVENT)
+            before += 0 if seen_event else 1
+            sequences.append(header.sequence)
+            expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+            if (not np.array_equal(image, expected)):
+                errors += 1
+
+    camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    gaps = sum(1 for (a, b) in zip(sequences, sequences[1:]) if (((b - a) & 0xffffffff) != 1))
+    return idle_bytes, before, len(sequences) - before, gaps, errors
+
+def measure_delta(camera, pattern, rate, crop, duration):
+    """
+    Streams frames for 'duration' seconds with the current changed-tile setting, from the sensor or
+    from 'pattern' if that isn't None. Returns the data rate in MB/s, the frame rate, the number of
+    keyframes and delta frames and, for a pattern, how many rebuilt frames didn't match it.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    if (pattern is not None):
+        camera.wait_response(camera.set_test_pattern(pattern, rate))
+    else:
+        camera.wait_response(camera.resume_dcmi())
+
+    bytes_start = camera.bytes_received
+    keyframes = 0
+    deltas = 0
+    errors = 0
+    start_time = time.time()
+    while (time.time() - start_time) < duration:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            keyframes += 1 if (header.flags & FRAME_FLAG_KEYFRAME) else 0
+            deltas += 1 if (header.format == FRAME_FORMAT_DELTA) else 0
+            if (pattern is None):
+                continue
+            expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+            if (not np.array_equal(image, expected)):
+                errors += 1
+    elapsed = time.time() - start_time
+
+    if (pattern is not None):
+        camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    return ((camera.bytes_received - bytes_start) / elapsed / 1e6, (keyframes + deltas) / elapsed,
+            keyframes, deltas, errors)
+
+def measure_depth(camera, bits, threshold, dither, pattern, rate, crop, duration):
+    """
+    Streams frames with 'bits' bits per pixel for 'duration' seconds, from the sensor or from
+    'pattern' if that isn't None. Returns the data rate in MB/s, the frame rate and, for a pattern,
+    how many frames didn't match it after the same reduction on the host.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.set_depth(bits, threshold, dither))
+    if (pattern is not None):
+        camera.wait_response(camera.set_test_pattern(pattern, rate))
+    else:
+        camera.wait_response(camera.resume_dcmi())
+
+    bytes_start = camera.bytes_received
+    frames = 0
+    errors = 0
+    start_time = time.time()
+    while (time.time() - start_time) < duration:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            frames += 1
+            if (pattern is None):
+                continue
+            expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+            if (header.depth != 8):
+                expected = expand_depth(reduce_depth(expected, header.depth, threshold, dither),
+                                        header.depth)
+            if ((header.depth != bits) or not np.array_equal(image, expected)):
+                errors += 1
+    elapsed = time.time() - start_time
+
+    if (pattern is not None):
+        camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    camera.wait_response(camera.set_depth(8))
+    return (camera.bytes_received - bytes_start) / elapsed / 1e6, frames / elapsed, errors
+
+def measure_lut(camera, table, pattern, rate, crop, duration):
+    """
+    Streams 'pattern' for 'duration' seconds, and halfway through, uploads 'table' and swaps it in
+    while frames keep coming. Returns the frame rates before and after the swap, the sequence
+    number of the first frame with the table, and how many frames didn't match the pattern (or
+    the pattern through the table, for frames with FRAME_FLAG_LUT) or were on the wrong side of
+    the swap.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.upload_lut(None))
+    camera.wait_response(camera.set_test_pattern(pattern, rate))
+
+    frames = []
+    swap_sequence = None
+    start_time = time.time()
+    swap_time = None
+    while (time.time() - start_time) < duration:
+        if ((swap_time is None) and ((time.time() - start_time) >= (duration / 2))):
+            swap_time = time.time()
+            swap_sequence = camera.wait_response(camera.upload_lut(table), timeout=2.0).detail
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            frames.append(camera.pop_frame_with_header())
+    elapsed = time.time() - start_time
+
+    camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    camera.wait_response(camera.upload_lut(None))
+
+    errors = 0
+    for header, image in frames:
+        expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+        with_lut = bool(header.flags & FRAME_FLAG_LUT)
+        if (with_lut):
+            expected = table[expected]
+        after = (swap_sequence is not None) and \
+                (((header.sequence - swap_sequence) & 0xffffffff) < 0x80000000)
+        if ((with_lut != after) or not np.array_equal(image, expected)):
+            errors += 1
+
+    before = sum(1 for (h, _) in frames if not (h.flags & FRAME_FLAG_LUT))
+    half = (swap_time - start_time) if (swap_time is not None) else elapsed
+    return (before / half, (len(frames) - before) / max(elapsed - half, 1e-6), swap_sequence,
+            errors)
+
+def measure_codec(camera, codec, quality, pattern, rate, crop, duration):
+    """
+    Streams frames compressed with 'codec' at 'quality' for 'duration' seconds, from the sensor or
+    from 'pattern' if that isn't None. Returns the compression ratio (image bytes per byte
+    received, markers and headers included), the frame rate, the camera's CPU cycles per pixel, the
+    host's decode rate in megapixels per second and, for a pattern, how many frames didn't match it
+    and the PSNR of all frames against it in dB (infinite if they all matched).
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.set_codec(codec, quality))
+    if (pattern is not None):
+        camera.wait_response(camera.set_test_pattern(pattern, rate))
+    else:
+        camera.wait_response(camera.resume_dcmi())
+
+    bytes_start = camera.bytes_received
+    pixels_start = camera.codec_pixels
+    cycles_start = camera.codec_encode_cycles
+    decode_start = camera.codec_decode_seconds
+    frames = 0
+    image_bytes = 0
+    errors = 0
+    squared_error = 0
+    start_time = time.time()
+    while (time.time() - start_time) < duration:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            frames += 1
+            image_bytes += image.size
+            if (pattern is None):
+                continue
+            expected = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+            if (not np.array_equal(image, expected)):
+                errors += 1
+                squared_error += int(np.sum((image.astype(np.int32) - expected) ** 2))
+    elapsed = time.time() - start_time
+
+    if (pattern is not None):
+        camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    camera.wait_response(camera.set_codec(pb_camera_read_request_codec.codec_e.NONE))
+
+    received = camera.bytes_received - bytes_start
+    pixels = camera.codec_pixels - pixels_start
+    decode_seconds = camera.codec_decode_seconds - decode_start
+    psnr = (10 * np.log10((255 ** 2) * image_bytes / squared_error)) if squared_error else np.inf
+    return ((image_bytes / received) if received else 0.0, frames / elapsed,
+            ((camera.codec_encode_cycles - cycles_start) / pixels) if pixels else 0.0,
+            (pixels / decode_seconds / 1e6) if decode_seconds else 0.0, errors, psnr)
+
+def random_detect_model(classes, images, seed=1):
+    """
+    Makes a DetectModel with random weights and biases, and shifts that keep most of every layer's
+    outputs on 'images' within int8, so that results on them aren't all saturated or zero.
+    """
+    rng = np.random.default_rng(seed)
+    weights, biases, shifts = [], [], []
+    xs = [detect_input(image) for image in images]
+    for layer in DETECT_LAYERS:
+        fc = (layer[0] == 'fc')
+        w = rng.integers(-64, 64, size=detect_weight_shape(layer, classes))
+        b = rng.integers(-32, 32, size=(classes if fc else layer[3]))
+        if (fc):
+            xs = [detect_pool(x) for x in xs]
+        accs = [detect_accumulate(layer, x, w) for x in xs]
+        top = np.percentile(np.abs(np.concatenate([a.ravel() for a in accs])), 99.5)
+        out_shift = max(1, int(np.ceil(np.log2(max(top, 1) / 64))))
+        bias_shift = min(out_shift, 24)
+        xs = [np.maximum(detect_requantize(a, b, bias_shift, out_shift), 0) for a in accs]
+        weights.append(w)
+        biases.append(b)
+        shifts.append((bias_shift, out_shift))
+    return DetectModel(seed, shifts, weights, biases)
+
+def measure_detect(camera, model, pattern, rate, crop, duration, gate):
+    """
+    Streams 'pattern' with 'model' run on every frame for 'duration' seconds, gating frames on its
+    class 0 reaching a score of 64 if 'gate' is set. Returns the number of results, how many of
+    them didn't match detect_reference() on the pattern, how many had something seen, the number
+    of frames with pixels, the mean inference and latency times in us and the frames that the
+    camera skipped because it was busy.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.upload_detect_model(model), timeout=2.0)
+    camera.wait_response(camera.set_detect(1, 64, 0, gate))
+    camera.wait_response(camera.set_test_pattern(pattern, rate))
+
+    results = []
+    frames = 0
+    start_time = time.time()
+    while (time.time() - start_time) < duration:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            camera.pop_frame_with_header()
+            frames += 1
+        while camera.detection_ready():
+            results.append(camera.pop_detection())
+
+    camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    camera.wait_response(camera.set_detect(0))
+
+    errors = 0
+    for header, result in results:
+        image = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+        logits, scores = detect_reference(model, detect_input(image))
+        if ((result.model_id != model.model_id) or not np.array_equal(result.logits, logits) or
+            not np.array_equal(result.scores, scores)):
+            errors += 1
+
+    present = sum(1 for (_, r) in results if r.present)
+    inference_us = np.mean([r.inference_us for (_, r) in results]) if results else 0
+    latency_us = np.mean([r.latency_us for (_, r) in results]) if results else 0
+    skipped = results[-1][1].skipped if results else 0
+    return len(results), errors, present, frames, inference_us, latency_us, skipped
+
+def measure_focus(camera, roi, pixel_interval, pattern, rate, crop, duration):
+    """
+    Streams 'pattern' with focus records over 'roi' and the pixels of every 'pixel_interval'-th
+    frame for 'duration' seconds. Returns the number of records, how many of them didn't match
+    focus_reference() on the pattern, the number of frames with pixels and the camera's mean cycles
+    per covered pixel.
+    """
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.set_image_packing(False))
+    camera.wait_response(camera.set_image_crop(*crop))
+    camera.wait_response(camera.set_stream(pixel_interval, False))
+    camera.wait_response(camera.set_focus(True, roi))
+    camera.wait_response(camera.set_test_pattern(pattern, rate))
+
+    records = []
+    frames = 0
+    start_time = time.time()
+    while (time.time() - start_time) < duration:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            camera.pop_frame_with_header()
+            frames += 1
+        while camera.focus_ready():
+            records.append(camera.pop_focus())
+
+    camera.wait_response(camera.set_test_pattern(pb_camera_read_request_test_pattern.pattern_e.OFF))
+    camera.wait_response(camera.set_focus(False))
+    camera.wait_response(camera.set_stream(1, False))
+
+    errors = 0
+    for header, metrics in records:
+        image = expected_test_pattern(pattern, header.sequence, header.width, header.height)
+        if (metrics._replace(cycles=0) != focus_reference(image, roi)):
+            errors += 1
+
+    pixels = sum(m.count for (_, m) in records)
+    cycles = sum(m.cycles for (_, m) in records) / max(pixels, 1)
+    return len(records), errors, frames, cycles
+
+def measure_switches(camera, count, interval):
+    """
+    Alternates between the image sensors with DCMI running and returns the camera's reported switch
+    times in microseconds, along with the number of frames that arrived.
+    """
+    camera.wait_response(camera.select_hm01b0(), timeout=2.0)
+    camera.wait_response(camera.resume_dcmi(), timeout=2.0)
+
+    switch_us = []
+    frames = 0
+    for i in range(count):
+        end_time = time.time() + interval
+        while time.time() < end_time:
+            camera.try_read_bytes()
+            while camera.frame_ready():
+                camera.pop_frame_with_header()
+                frames += 1
+
+        select = camera.select_hm0360 if ((i % 2) == 0) else camera.select_hm01b0
+        switch_us.append(camera.wait_response(select(), timeout=2.0).detail)
+
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    return switch_us, frames
+
+def measure_interleave(camera, k, duration):
+    """
+    Runs interleaved capture for 'duration' seconds. Returns the frame count per sensor, the number
+    of switches and the estimated number of frame periods lost at each switch.
+
+    The two sensors free-run, so what's lost at a switch is estimated from the header timestamps:
+    the gap between the last frame of one sensor and the first frame of the other, in units of the
+    new sensor's frame period (the median gap between its consecutive frames).
+    """
+    camera.wait_response(camera.set_interleave(k), timeout=2.0)
+
+    headers = []
+    end_time = time.time() + duration
+    while time.time() < end_time:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, _ = camera.pop_frame_with_header()
+            headers.append(header)
+
+    camera.wait_response(camera.set_interleave(0), timeout=2.0)
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+
+    counts = {FRAME_SENSOR_HM01B0: 0, FRAME_SENSOR_HM0360: 0}
+    periods = {FRAME_SENSOR_HM01B0: [], FRAME_SENSOR_HM0360: []}
+    for prev, cur in zip(headers, headers[1:]):
+        if (prev.sensor == cur.sensor):
+            periods[cur.sensor].append((cur.timestamp_us - prev.timestamp_us) & 0xffffffff)
+    for h in headers:
+        counts[h.sensor] = counts.get(h.sensor, 0) + 1
+
+    lost = []
+    for prev, cur in zip(headers, headers[1:]):
+        if ((prev.sensor != cur.sensor) and periods.get(cur.sensor)):
+            gap = (cur.timestamp_us - prev.timestamp_us) & 0xffffffff
+            lost.append(max(round(gap / np.median(periods[cur.sensor])) - 1, 0))
+
+    return counts, lost
+
+def measure_trigger(camera, period_us, width_us, delay_us, duration):
+    """
+    Runs the camera as a trigger controller for 'duration' seconds and returns the trigger-to-frame
+    latency of every frame that had a trigger pulse before it, in microseconds, along with the
+    number of frames.
+
+    The latency runs from the rising edge of the trigger pulse to the camera's timestamp of the
+    frame start, so it includes the sensor's exposure and the jitter of the frame-start interrupt.
+    """
+    role = pb_camera_management_request_trigger_config.role_e
+    camera.wait_response(camera.configure_trigger(role.CONTROLLER, period_us, width_us, delay_us),
+                         timeout=2.0)
+    camera.wait_response(camera.resume_dcmi(), timeout=2.0)
+
+    latencies = []
+    frames = 0
+    end_time = time.time() + duration
+    while time.time() < end_time:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, _ = camera.pop_frame_with_header()
+            frames += 1
+            if (header.trigger_us != 0):
+                latencies.append((header.timestamp_us - header.trigger_us) & 0xffffffff)
+
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    camera.wait_response(camera.configure_trigger(role.OFF), timeout=2.0)
+    return latencies, frames
+
+def measure_bracket(camera, short, long, duration):
+    """
+    Alternates the exposure between 'short' and 'long' lines on every frame for 'duration' seconds.
+    Returns, for each frame offset d in -2 .. 2, the fraction of frames whose brightness agrees
+    with the exposure that frame (i + d)'s header reports, along with the number of frames with
+    known settings.
+
+    A frame counts as bright if its mean is above the midpoint of the darkest and the brightest
+    frame. If the headers are right, the agreement is close to 1 at d = 0; a peak at another d
+    means that CAMERA_FRAME_PARAMS_LATENCY is off by d frames.
+    """
+    camera.wait_response(camera.disable_autoexposure(), timeout=2.0)
+    camera.wait_response(camera.resume_dcmi(), timeout=2.0)
+    camera.wait_response(camera.schedule_frame_params([(short, 0, 0x40), (long, 0, 0x40)],
+                                                      repeat=True), timeout=2.0)
+
+    frames = []
+    end_time = time.time() + duration
+    while time.time() < end_time:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            if (header.flags & FRAME_FLAG_PARAMS_VALID):
+                frames.append((header.exposure_lines == long,
+                               image.mean()))
+
+    camera.wait_response(camera.schedule_frame_params([]), timeout=2.0)
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    if (len(frames) < 5):
+        return {}, len(frames)
+
+    means = [m for (_, m) in frames]
+    midpoint = (min(means) + max(means)) / 2
+    bright = [m > midpoint for m in means]
+    agreement = {}
+    for d in range(-2, 3):
+        pairs = [(bright[i], frames[i + d][0]) for i in range(max(0, -d), len(frames) - max(0, d))]
+        agreement[d] = sum(b == l for (b, l) in pairs) / len(pairs)
+    return agreement, len(frames)
+
+# Parameters of both auto exposure loops in measure_ae().
+AE_TOLERANCE = 6
+AE_MAX_EXPOSURE_LINES = 0x0200
+AE_SPEED = 192
+AE_DARK = (4, 0, 0x40)
+
+def host_ae_step(params, brightness, target):
+    """
+    The firmware's auto exposure control law (auto_exposure.c), for a host-side loop: returns the
+    (exposure_lines, analog_gain, digital_gain) to follow a frame that was taken with 'params' and
+    came out with mean 'brightness', or None if it's close enough to 'target'.
+    """
+    if (abs(brightness - target) <= AE_TOLERANCE):
+        return None
+    (lines, analog, digital) = params
+    total = max((lines << analog) * digital, 0x40)
+    desired = min(max((total * target) // max(brightness, 1), total // 4), total * 4)
+    t = max(total + ((desired - total) * AE_SPEED) // 256, 0x40)
+    lines = min(max(t // 0x40, 1), AE_MAX_EXPOSURE_LINES)
+    gain = t // lines
+    analog = 0
+    while ((analog < 3) and (gain >= (0x40 << (analog + 1)))):
+        analog += 1
+    return (lines, analog, min(max(gain >> analog, 0x40), 0xff))
+
+def measure_ae(camera, target, firmware, duration):
+    """
+    Sets a dark exposure, starts an auto exposure loop - in the firmware if 'firmware' is set,
+    otherwise on the host, sending new settings after every frame - and returns the number of
+    frames and the time in seconds until three frames in a row are within AE_TOLERANCE of 'target',
+    or None if that doesn't happen within 'duration' seconds.
+    """
+    camera.wait_response(camera.disable_autoexposure(), timeout=2.0)
+    camera.wait_response(camera.resume_dcmi(), timeout=2.0)
+    camera.wait_response(camera.schedule_frame_params([AE_DARK]), timeout=2.0)
+    time.sleep(0.2)
+    camera.try_read_bytes()
+    while camera.frame_ready():
+        camera.pop_frame_with_header()
+
+    if (firmware):
+        camera.wait_response(camera.set_auto_exposure(True, target, AE_TOLERANCE,
+                                                      AE_MAX_EXPOSURE_LINES, speed=AE_SPEED),
+                             timeout=2.0)
+
+    frames = 0
+    in_range = 0
+    start = time.time()
+    result = None
+    while (time.time() - start) < duration:
+        camera.try_read_bytes()
+        while camera.frame_ready():
+            header, image = camera.pop_frame_with_header()
+            frames += 1
+            brightness = int(image.mean())
+            in_range = (in_range + 1) if (abs(brightness - target) <= AE_TOLERANCE) else 0
+            if ((in_range == 3) and (result is None)):
+                result = (frames, time.time() - start)
+            if ((not firmware) and (header.flags & FRAME_FLAG_PARAMS_VALID)):
+                params = (header.exposure_lines, header.analog_gain, header.digital_gain)
+                step = host_ae_step(params, brightness, target)
+                if (step is not None):
+                    camera.wait_response(camera.schedule_frame_params([step]), timeout=2.0)
+        if (result is not None):
+            break
+
+    if (firmware):
+        camera.wait_response(camera.set_auto_exposure(False), timeout=2.0)
+    camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+    return result
+
+def print_result(name, result):
+    print(f"{name:<28} " +
+          f"{result['MB/s']:7.3f} MB/s  {result['fps']:7.2f} fps  " +
+          f"frames {result['frames']:6d}  dropped {result['dropped']:5d} ({100 * result['drop rate']:5.1f}%)  " +
+          f"truncated {result['truncated']:4d}  errors {result['integrity errors']:4d}  " +
+          f"discarded {result['discarded bytes']:8d} B")
+
 def main():
     args = parse_arguments()
     ser = open_serial_port(args.port, args.time)
 
-    print(f"Opened serial port {args.port}. Measuring for {args.time} seconds...")
-    byte_count = count_bytes(ser, args.time)
-    ser.close()
+    if ((args.pattern is None) and not args.sweep and (args.switch is None) and
+        (args.interleave is None) and (args.trigger is None) and (args.bracket is None) and
+        (args.ae is None) and (args.stats is None) and (args.burst is None) and
+        (args.ring is None) and (args.delta is None) and not args.lossless and
+        (args.dct is None) and (args.depth is None) and
+        (args.lut is None) and (args.detect is None) and (args.focus is None)):
+        print(f"Opened serial port {args.port}. Measuring for {args.time} seconds...")
+        byte_count = count_bytes(ser, args.time)
+        ser.close()
+
+        bandwidth_mbps = byte_count / args.time / 1e6
+        print(f"Total Bytes Received: {byte_count}")
+        print(f"Bandwidth: {bandwidth_mbps:.3f} MB/s")
+        return
+
+    camera = CameraInterface(ser)
+    camera.CHUNK_SIZE = (1 << 16)
+
+    if (args.switch is not None):
+        switch_us, frames = measure_switches(camera, args.switch, args.time)
+        ser.close()
+        print(f"{len(switch_us)} sensor switches, {frames} frames")
+        print(f"switch time: min {min(switch_us)} us  mean {np.mean(switch_us):.0f} us  "
+              f"max {max(switch_us)} us")
+        return
+
+    if (args.trigger is not None):
+        latencies, frames = measure_trigger(camera, args.trigger, args.trigger_width,
+                                            args.trigger_delay, args.time)
+        ser.close()
+        print(f"{frames} frames, {len(latencies)} with a trigger")
+        if (latencies):
+            print(f"trigger-to-frame latency: min {min(latencies)} us  "
+                  f"mean {np.mean(latencies):.1f} us  max {max(latencies)} us  "
+                  f"jitter (std) {np.std(latencies):.1f} us")
+        return
+
+    if (args.lossless):
+        pattern = PATTERNS[args.pattern] if (args.pattern is not None) else None
+        ratio, fps, cycles, decode_mpx, errors, psnr = measure_codec(
+            camera, pb_camera_read_request_codec.codec_e.LOSSLESS, 0, pattern, args.rate,
+            args.crop, args.time)
+        ser.close()
+        print(f"compression ratio {ratio:.2f}  {fps:7.2f} fps  camera {cycles:.1f} cycles/pixel  "
+              f"host decode {decode_mpx:.1f} Mpixel/s  errors {errors}")
+        return
+
+    if (args.dct is not None):
+        pattern = PATTERNS[args.pattern] if (args.pattern is not None) else None
+        ratio, fps, cycles, decode_mpx, errors, psnr = measure_codec(
+            camera, pb_camera_read_request_codec.codec_e.DCT, args.dct, pattern, args.rate,
+            args.crop, args.time)
+        ser.close()
+        print(f"quality {args.dct}: compression ratio {ratio:.2f}  {fps:7.2f} fps  "
+              f"camera {cycles * 64:.0f} cycles/block  host decode {decode_mpx:.2f} Mpixel/s"
+              + (f"  PSNR {psnr:.1f} dB" if (pattern is not None) else ""))
+        return
+
+    if (args.focus is not None):
+        name = args.pattern if (args.pattern is not None) else "ramp"
+        for pixel_interval in (1, 0):
+            records, errors, frames, cycles = measure_focus(camera, tuple(args.focus),
+                                                            pixel_interval, PATTERNS[name],
+                                                            args.rate, args.crop, args.time)
+            print(f"{'with' if pixel_interval else 'without'} pixels: "
+                  f"{records / args.time:7.2f} focus records/s  frames with pixels {frames}  "
+                  f"errors {errors}  camera {cycles:.2f} cycles/pixel")
+        ser.close()
+        return
 
-    bandwidth_mbps = byte_count / args.time / 1e6
-    print(f"Total Bytes Received: {byte_count}")
-    print(f"Bandwidth: {bandwidth_mbps:.3f} MB/s")
+    if (args.detect is not None):
+        name = args.pattern if (args.pattern is not None) else "ramp"
+        width, height = args.crop[2], args.crop[3]
+        model = random_detect_model(args.detect, [expected_test_pattern(PATTERNS[name], s, width,
+                                                                        height)
+                                                  for s in range(4)])
+        for gate in (False, True):
+            results, errors, present, frames, inference_us, latency_us, skipped = measure_detect(
+                camera, model, PATTERNS[name], args.rate, args.crop, args.time, gate)
+            print(f"{'gated' if gate else 'ungated'}: {results / args.time:7.2f} results/s  "
+                  f"errors {errors}  seen {present}  frames with pixels {frames}  "
+                  f"skipped {skipped}")
+            if (inference_us > 0):
+                print(f"  inference {inference_us:.0f} us ({1e6 / inference_us:.1f} inferences/s)  "
+                      f"latency {latency_us:.0f} us")
+        ser.close()
+        return
+
+    if (args.lut is not None):
+        name = args.pattern if (args.pattern is not None) else "ramp"
+        fps_before, fps_after, swap_sequence, errors = measure_lut(
+            camera, gamma_lut(args.lut), PATTERNS[name], args.rate, args.crop, args.time)
+        ser.close()
+        print(f"without table {fps_before:7.2f} fps  with table {fps_after:7.2f} fps  "
+              f"swapped in at frame {swap_sequence}  errors {errors}")
+        return
+
+    if (args.depth is not None):
+        pattern = PATTERNS[args.pattern] if (args.pattern is not None) else None
+        for bits in (8, args.depth):
+            mbps, fps, errors = measure_depth(camera, bits, args.threshold, args.dither, pattern,
+                                              args.rate, args.crop, args.time)
+            print(f"{bits} bit: {mbps:7.3f} MB/s  {fps:7.2f} fps  errors {errors}")
+        ser.close()
+        return
+
+    if (args.delta is not None):
+        pattern = PATTERNS[args.pattern] if (args.pattern is not None) else None
+        for enable in (False, True):
+            camera.wait_response(camera.set_delta(enable, args.delta[0], args.delta[1]))
+            mbps, fps, keyframes, deltas, errors = measure_delta(camera, pattern, args.rate,
+                                                                 args.crop, args.time)
+            print(f"{'delta' if enable else 'raw':5}: {mbps:7.3f} MB/s  {fps:7.2f} fps  "
+                  f"keyframes {keyframes}  delta frames {deltas}  errors {errors}")
+        camera.wait_response(camera.set_delta(False))
+        ser.close()
+        return
+
+    if (args.ring is not None):
+        name = args.pattern if (args.pattern is not None) else "ramp"
+        idle_bytes, before, after, gaps, errors = measure_ring(camera, PATTERNS[name], args.rate,
+                                                               args.ring[0], args.ring[1],
+                                                               args.crop, args.time)
+        ser.close()
+        print(f"{idle_bytes} bytes while armed  frames before event {before}  after {after}  "
+              f"gaps {gaps}  errors {errors}")
+        return
+
+    if (args.burst is not None):
+        name = args.pattern if (args.pattern is not None) else "ramp"
+        recorded, received, errors, fps, drain_time = measure_burst(camera, PATTERNS[name],
+                                                                    args.burst, args.crop,
+                                                                    args.time)
+        ser.close()
+        print(f"recorded {recorded} frames at {fps:.1f} fps  received {received}  "
+              f"errors {errors}  sent in {drain_time:.2f} s")
+        return
+
+    if (args.stats is not None):
+        name = args.pattern if (args.pattern is not None) else "ramp"
+        records, errors, frames, mbps = measure_stats(camera, PATTERNS[name], args.rate,
+                                                      args.stats, args.crop, args.time)
+        ser.close()
+        print(f"{records / args.time:7.2f} stats records/s  errors {errors}  "
+              f"frames with pixels {frames}  {mbps:7.3f} MB/s")
+        return
+
+    if (args.ae is not None):
+        for (name, firmware) in (("firmware", True), ("host", False)):
+            result = measure_ae(camera, args.ae, firmware, args.time)
+            if (result is None):
+                print(f"{name} auto exposure: didn't converge within {args.time} s")
+            else:
+                print(f"{name} auto exposure: converged after {result[0]} frames, "
+                      f"{1000 * result[1]:.0f} ms")
+        ser.close()
+        return
+
+    if (args.bracket is not None):
+        agreement, frames = measure_bracket(camera, args.bracket[0], args.bracket[1], args.time)
+        ser.close()
+        print(f"{frames} frames with known exposure")
+        for (d, a) in agreement.items():
+            print(f"brightness of frame i vs. exposure in header of frame i{d:+d}: "
+                  f"{100 * a:5.1f}% agree")
+        return
+
+    if (args.interleave is not None):
+        counts, lost = measure_interleave(camera, args.interleave, args.time)
+        ser.close()
+        print(f"hm01b0 frames {counts[FRAME_SENSOR_HM01B0]}  "
+              f"hm0360 frames {counts[FRAME_SENSOR_HM0360]}  switches {len(lost)}")
+        if (lost):
+            print(f"frames lost per switch: mean {np.mean(lost):.2f}  max {max(lost)}")
+        return
+
+    if (args.sweep):
+        runs = [(name, rate, pack) for pack in (False, True)
+                                   for name in PATTERNS
+                                   for rate in args.rates]
+    else:
+        runs = [(args.pattern, args.rate, args.pack)]
+
+    print(f"Opened serial port {args.port}. Measuring {len(runs)} configuration(s) for "
+          f"{args.time} seconds each...")
+    for (name, rate, pack) in runs:
+        result = measure_pattern(camera, PATTERNS[name], rate, pack, args.crop, args.time)
+        rate_name = f"{rate} fps" if rate else "max"
+        print_result(f"{name} {'packed' if pack else 'raw'} {rate_name}", result)
+
+    ser.close()
 
 if __name__ == "__main__":
     main()
@@ -1,12 +1,11 @@
 # -*- coding: utf-8 -*-
 # Generated by the protocol buffer compiler.  DO NOT EDIT!
 # source: camera_command.proto
-# Protobuf Python Version: 4.25.2
 """Generated protocol buffer code."""
+from google.protobuf.internal import builder as _builder
 from google.protobuf import descriptor as _descriptor
 from google.protobuf import descriptor_pool as _descriptor_pool
 from google.protobuf import symbol_database as _symbol_database
-from google.protobuf.internal import builder as _builder
 # @@protoc_insertion_point(imports)
 
 _sym_db = _symbol_database.Default()
@@ -14,31 +13,81 @@ _sym_db = _symbol_database.Default()
 
 
 
-DESCRIPTOR = _descriptor_pool.Default().AddSerializedFile(b'\n\x14\x63\x61mera_command.proto\"q\n&pb_camera_management_request_reg_write\x12\x1e\n\x16i2c_peripheral_address\x18\x01 \x01(\x05\x12\x18\n\x10register_address\x18\x02 \x01(\x05\x12\r\n\x05value\x18\x03 \x01(\x05\"\xab\x01\n*pb_camera_management_request_sensor_select\x12R\n\rsensor_select\x18\x01 \x01(\x0e\x32;.pb_camera_management_request_sensor_select.sensor_select_e\")\n\x0fsensor_select_e\x12\n\n\x06HM01B0\x10\x00\x12\n\n\x06HM0360\x10\x01\"-\n+pb_camera_management_request_trigger_config\"\xf5\x01\n\x1cpb_camera_management_request\x12<\n\treg_write\x18\x01 \x01(\x0b\x32\'.pb_camera_management_request_reg_writeH\x00\x12\x44\n\rsensor_select\x18\x02 \x01(\x0b\x32+.pb_camera_management_request_sensor_selectH\x00\x12\x46\n\x0etrigger_config\x18\x03 \x01(\x0b\x32,.pb_camera_management_request_trigger_configH\x00\x42\t\n\x07request\"a\n\x1fpb_camera_read_request_set_crop\x12\x0f\n\x07start_x\x18\x01 \x01(\x05\x12\x0f\n\x07start_y\x18\x02 \x01(\x05\x12\r\n\x05len_x\x18\x03 \x01(\x05\x12\r\n\x05len_y\x18\x04 \x01(\x05\"2\n\"pb_camera_read_request_set_packing\x12\x0c\n\x04pack\x18\x01 \x01(\x08\"2\n\"pb_camera_read_request_dcmi_enable\x12\x0c\n\x04halt\x18\x01 \x01(\x08\"\xc4\x01\n\x16pb_camera_read_request\x12\x30\n\x04\x63rop\x18\x01 \x01(\x0b\x32 .pb_camera_read_request_set_cropH\x00\x12\x33\n\x04pack\x18\x02 \x01(\x0b\x32#.pb_camera_read_request_set_packingH\x00\x12\x38\n\tdcmi_halt\x18\x03 \x01(\x0b\x32#.pb_camera_read_request_dcmi_enableH\x00\x42\t\n\x07request\"\x8a\x01\n\x11pb_camera_request\x12:\n\x11\x63\x61mera_management\x18\x01 \x01(\x0b\x32\x1d.pb_camera_management_requestH\x00\x12.\n\x0b\x64\x63mi_config\x18\x02 \x01(\x0b\x32\x17.pb_camera_read_requestH\x00\x42\t\n\x07requestb\x06proto3')
+DESCRIPTOR = _descriptor_pool.Default().AddSerializedFile(b'\n\x14\x63\x61mera_command.proto\"q\n&pb_camera_management_request_reg_write\x12\x1e\n\x16i2c_peripheral_address\x18\x01 \x01(\x05\x12\x18\n\x10register_address\x18\x02 \x01(\x05\x12\r\n\x05value\x18\x03 \x01(\x05\"c\n%pb_camera_management_request_reg_read\x12\x1e\n\x16i2c_peripheral_address\x18\x01 \x01(\x05\x12\x1a\n\x12register_addresses\x18\x02 \x03(\r\"\xab\x01\n*pb_camera_management_request_sensor_select\x12R\n\rsensor_select\x18\x01 \x01(\x0e\x32;.pb_camera_management_request_sensor_select.sensor_select_e\")\n\x0fsensor_select_e\x12\n\n\x06HM01B0\x10\x00\x12\n\n\x06HM0360\x10\x01\"\xe0\x01\n+pb_camera_management_request_trigger_config\x12\x41\n\x04role\x18\x01 \x01(\x0e\x32\x33.pb_camera_management_request_trigger_config.role_e\x12\x11\n\tperiod_us\x18\x02 \x01(\r\x12\x16\n\x0epulse_width_us\x18\x03 \x01(\r\x12\x10\n\x08\x64\x65lay_us\x18\x04 \x01(\r\"1\n\x06role_e\x12\x07\n\x03OFF\x10\x00\x12\x0e\n\nCONTROLLER\x10\x01\x12\x0e\n\nPERIPHERAL\x10\x02\"E\n%pb_camera_management_request_set_mode\x12\x0c\n\x04mode\x18\x01 \x01(\r\x12\x0e\n\x06resume\x18\x02 \x01(\x08\"D\n\'pb_camera_management_request_interleave\x12\x19\n\x11\x66rames_per_sensor\x18\x01 \x01(\r\"\xca\x01\n)pb_camera_management_request_frame_params\x12\x41\n\x07\x65ntries\x18\x01 \x03(\x0b\x32\x30.pb_camera_management_request_frame_params.entry\x12\x0e\n\x06repeat\x18\x02 \x01(\x08\x1aJ\n\x05\x65ntry\x12\x16\n\x0e\x65xposure_lines\x18\x01 \x01(\r\x12\x13\n\x0b\x61nalog_gain\x18\x02 \x01(\r\x12\x14\n\x0c\x64igital_gain\x18\x03 \x01(\r\"\x80\x02\n*pb_camera_management_request_auto_exposure\x12\x0e\n\x06\x65nable\x18\x01 \x01(\x08\x12\x0e\n\x06target\x18\x02 \x01(\r\x12\x11\n\ttolerance\x18\x03 \x01(\r\x12\x1a\n\x12max_exposure_lines\x18\x04 \x01(\r\x12\x17\n\x0fmax_analog_gain\x18\x05 \x01(\r\x12\x18\n\x10max_digital_gain\x18\x06 \x01(\r\x12\r\n\x05speed\x18\x07 \x01(\r\x12-\n\x03roi\x18\x08 \x01(\x0b\x32 .pb_camera_read_request_set_crop\x12\x12\n\nroi_weight\x18\t \x01(\r\"\xb7\x04\n\x1cpb_camera_management_request\x12<\n\treg_write\x18\x01 \x01(\x0b\x32\'.pb_camera_management_request_reg_writeH\x00\x12\x44\n\rsensor_select\x18\x02 \x01(\x0b\x32+.pb_camera_management_request_sensor_selectH\x00\x12\x46\n\x0etrigger_config\x18\x03 \x01(\x0b\x32,.pb_camera_management_request_trigger_configH\x00\x12:\n\x08reg_read\x18\x04 \x01(\x0b\x32&.pb_camera_management_request_reg_readH\x00\x12:\n\x08set_mode\x18\x05 \x01(\x0b\x32&.pb_camera_management_request_set_modeH\x00\x12>\n\ninterleave\x18\x06 \x01(\x0b\x32(.pb_camera_management_request_interleaveH\x00\x12\x42\n\x0c\x66rame_params\x18\x07 \x01(\x0b\x32*.pb_camera_management_request_frame_paramsH\x00\x12\x44\n\rauto_exposure\x18\x08 \x01(\x0b\x32+.pb_camera_management_request_auto_exposureH\x00\x42\t\n\x07request\"a\n\x1fpb_camera_read_request_set_crop\x12\x0f\n\x07start_x\x18\x01 \x01(\x05\x12\x0f\n\x07start_y\x18\x02 \x01(\x05\x12\r\n\x05len_x\x18\x03 \x01(\x05\x12\r\n\x05len_y\x18\x04 \x01(\x05\"2\n\"pb_camera_read_request_set_packing\x12\x0c\n\x04pack\x18\x01 \x01(\x08\"2\n\"pb_camera_read_request_dcmi_enable\x12\x0c\n\x04halt\x18\x01 \x01(\x08\"\xb1\x01\n#pb_camera_read_request_test_pattern\x12?\n\x07pattern\x18\x01 \x01(\x0e\x32..pb_camera_read_request_test_pattern.pattern_e\x12\x12\n\nframe_rate\x18\x02 \x01(\r\"5\n\tpattern_e\x12\x07\n\x03OFF\x10\x00\x12\x08\n\x04RAMP\x10\x01\x12\x0b\n\x07\x43OUNTER\x10\x02\x12\x08\n\x04LFSR\x10\x03\"F\n\x1dpb_camera_read_request_stream\x12\x16\n\x0epixel_interval\x18\x01 \x01(\r\x12\r\n\x05stats\x18\x02 \x01(\x08\".\n\x1cpb_camera_read_request_burst\x12\x0e\n\x06\x66rames\x18\x01 \x01(\r\"n\n\x1bpb_camera_read_request_ring\x12\x12\n\npre_frames\x18\x01 \x01(\r\x12\x13\n\x0bpost_frames\x18\x02 \x01(\r\x12\x0c\n\x04gpio\x18\x03 \x01(\x08\x12\x18\n\x10motion_threshold\x18\x04 \x01(\r\"\x1e\n\x1cpb_camera_read_request_event\"p\n\x1cpb_camera_read_request_delta\x12\x0e\n\x06\x65nable\x18\x01 \x01(\x08\x12\x11\n\tthreshold\x18\x02 \x01(\r\x12\x12\n\nhysteresis\x18\x03 \x01(\r\x12\x19\n\x11keyframe_interval\x18\x04 \x01(\r\"\x91\x01\n\x1cpb_camera_read_request_codec\x12\x34\n\x05\x63odec\x18\x01 \x01(\x0e\x32%.pb_camera_read_request_codec.codec_e\x12\x0f\n\x07quality\x18\x02 \x01(\r\"*\n\x07\x63odec_e\x12\x08\n\x04NONE\x10\x00\x12\x0c\n\x08LOSSLESS\x10\x01\x12\x07\n\x03\x44\x43T\x10\x02\"O\n\x1cpb_camera_read_request_depth\x12\x0c\n\x04\x62its\x18\x01 \x01(\r\x12\x11\n\tthreshold\x18\x02 \x01(\r\x12\x0e\n\x06\x64ither\x18\x03 \x01(\x08\"[\n\x1apb_camera_read_request_lut\x12\x0e\n\x06offset\x18\x01 \x01(\r\x12\x0f\n\x07\x65ntries\x18\x02 \x01(\x0c\x12\x0e\n\x06\x63ommit\x18\x03 \x01(\x08\x12\x0c\n\x04size\x18\x04 \x01(\r\"]\n\x1cpb_camera_read_request_focus\x12\x0e\n\x06\x65nable\x18\x01 \x01(\x08\x12-\n\x03roi\x18\x02 \x01(\x0b\x32 .pb_camera_read_request_set_crop\"\xae\x05\n\x16pb_camera_read_request\x12\x30\n\x04\x63rop\x18\x01 \x01(\x0b\x32 .pb_camera_read_request_set_cropH\x00\x12\x33\n\x04pack\x18\x02 \x01(\x0b\x32#.pb_camera_read_request_set_packingH\x00\x12\x38\n\tdcmi_halt\x18\x03 \x01(\x0b\x32#.pb_camera_read_request_dcmi_enableH\x00\x12<\n\x0ctest_pattern\x18\x04 \x01(\x0b\x32$.pb_camera_read_request_test_patternH\x00\x12\x30\n\x06stream\x18\x05 \x01(\x0b\x32\x1e.pb_camera_read_request_streamH\x00\x12.\n\x05\x62urst\x18\x06 \x01(\x0b\x32\x1d.pb_camera_read_request_burstH\x00\x12,\n\x04ring\x18\x07 \x01(\x0b\x32\x1c.pb_camera_read_request_ringH\x00\x12.\n\x05\x65vent\x18\x08 \x01(\x0b\x32\x1d.pb_camera_read_request_eventH\x00\x12.\n\x05\x64\x65lta\x18\t \x01(\x0b\x32\x1d.pb_camera_read_request_deltaH\x00\x12.\n\x05\x63odec\x18\n \x01(\x0b\x32\x1d.pb_camera_read_request_codecH\x00\x12.\n\x05\x64\x65pth\x18\x0b \x01(\x0b\x32\x1d.pb_camera_read_request_depthH\x00\x12*\n\x03lut\x18\x0c \x01(\x0b\x32\x1b.pb_camera_read_request_lutH\x00\x12.\n\x05\x66ocus\x18\r \x01(\x0b\x32\x1d.pb_camera_read_request_focusH\x00\x42\t\n\x07request\"\x82\x02\n\x15pb_camera_transaction\x12\x1e\n\x16i2c_peripheral_address\x18\x01 \x01(\x05\x12\x12\n\nreg_writes\x18\x02 \x03(\r\x12\x42\n\rsensor_select\x18\x03 \x01(\x0b\x32+.pb_camera_management_request_sensor_select\x12.\n\x04\x63rop\x18\x04 \x01(\x0b\x32 .pb_camera_read_request_set_crop\x12\x31\n\x04pack\x18\x05 \x01(\x0b\x32#.pb_camera_read_request_set_packing\x12\x0e\n\x06resume\x18\x06 \x01(\x08\"U\n\x17pb_detect_request_model\x12\x0e\n\x06offset\x18\x01 \x01(\r\x12\x0c\n\x04\x64\x61ta\x18\x02 \x01(\x0c\x12\x0e\n\x06\x63ommit\x18\x03 \x01(\x08\x12\x0c\n\x04size\x18\x04 \x01(\r\"b\n\x18pb_detect_request_config\x12\x10\n\x08interval\x18\x01 \x01(\r\x12\x11\n\tthreshold\x18\x02 \x01(\r\x12\x13\n\x0b\x63lass_index\x18\x03 \x01(\r\x12\x0c\n\x04gate\x18\x04 \x01(\x08\"v\n\x11pb_detect_request\x12)\n\x05model\x18\x01 \x01(\x0b\x32\x18.pb_detect_request_modelH\x00\x12+\n\x06\x63onfig\x18\x02 \x01(\x0b\x32\x19.pb_detect_request_configH\x00\x42\t\n\x07request\"\xf3\x01\n\x11pb_camera_request\x12:\n\x11\x63\x61mera_management\x18\x01 \x01(\x0b\x32\x1d.pb_camera_management_requestH\x00\x12.\n\x0b\x64\x63mi_config\x18\x02 \x01(\x0b\x32\x17.pb_camera_read_requestH\x00\x12-\n\x0btransaction\x18\x04 \x01(\x0b\x32\x16.pb_camera_transactionH\x00\x12$\n\x06\x64\x65tect\x18\x05 \x01(\x0b\x32\x12.pb_detect_requestH\x00\x12\x12\n\nrequest_id\x18\x03 \x01(\rB\t\n\x07request\"\xe8\x01\n\x12pb_camera_response\x12\x12\n\nrequest_id\x18\x01 \x01(\r\x12,\n\x06status\x18\x02 \x01(\x0e\x32\x1c.pb_camera_response.status_e\x12\x0e\n\x06\x64\x65tail\x18\x03 \x01(\x05\x12\x14\n\x0c\x65xec_time_us\x18\x04 \x01(\r\x12\x12\n\nreg_values\x18\x05 \x01(\x0c\"V\n\x08status_e\x12\x06\n\x02OK\x10\x00\x12\x0f\n\x0b\x42\x41\x44_REQUEST\x10\x01\x12\r\n\tBUS_ERROR\x10\x02\x12\x11\n\rINVALID_STATE\x10\x03\x12\x0f\n\x0bUNSUPPORTED\x10\x04\x62\x06proto3')
 
-_globals = globals()
-_builder.BuildMessageAndEnumDescriptors(DESCRIPTOR, _globals)
-_builder.BuildTopDescriptorsAndMessages(DESCRIPTOR, 'camera_command_pb2', _globals)
+_builder.BuildMessageAndEnumDescriptors(DESCRIPTOR, globals())
+_builder.BuildTopDescriptorsAndMessages(DESCRIPTOR, 'camera_command_pb2', globals())
 if _descriptor._USE_C_DESCRIPTORS == False:
+
   DESCRIPTOR._options = None
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_REG_WRITE']._serialized_start=24
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_REG_WRITE']._serialized_end=137
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT']._serialized_start=140
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT']._serialized_end=311
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT_SENSOR_SELECT_E']._serialized_start=270
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT_SENSOR_SELECT_E']._serialized_end=311
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_TRIGGER_CONFIG']._serialized_start=313
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST_TRIGGER_CONFIG']._serialized_end=358
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST']._serialized_start=361
-  _globals['_PB_CAMERA_MANAGEMENT_REQUEST']._serialized_end=606
-  _globals['_PB_CAMERA_READ_REQUEST_SET_CROP']._serialized_start=608
-  _globals['_PB_CAMERA_READ_REQUEST_SET_CROP']._serialized_end=705
-  _globals['_PB_CAMERA_READ_REQUEST_SET_PACKING']._serialized_start=707
-  _globals['_PB_CAMERA_READ_REQUEST_SET_PACKING']._serialized_end=757
-  _globals['_PB_CAMERA_READ_REQUEST_DCMI_ENABLE']._serialized_start=759
-  _globals['_PB_CAMERA_READ_REQUEST_DCMI_ENABLE']._serialized_end=809
-  _globals['_PB_CAMERA_READ_REQUEST']._serialized_start=812
-  _globals['_PB_CAMERA_READ_REQUEST']._serialized_end=1008
-  _globals['_PB_CAMERA_REQUEST']._serialized_start=1011
-  _globals['_PB_CAMERA_REQUEST']._serialized_end=1149
+  _PB_CAMERA_MANAGEMENT_REQUEST_REG_WRITE._serialized_start=24
+  _PB_CAMERA_MANAGEMENT_REQUEST_REG_WRITE._serialized_end=137
+  _PB_CAMERA_MANAGEMENT_REQUEST_REG_READ._serialized_start=139
+  _PB_CAMERA_MANAGEMENT_REQUEST_REG_READ._serialized_end=238
+  _PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT._serialized_start=241
+  _PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT._serialized_end=412
+  _PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT_SENSOR_SELECT_E._serialized_start=371
+  _PB_CAMERA_MANAGEMENT_REQUEST_SENSOR_SELECT_SENSOR_SELECT_E._serialized_end=412
+  _PB_CAMERA_MANAGEMENT_REQUEST_TRIGGER_CONFIG._serialized_start=415
+  _PB_CAMERA_MANAGEMENT_REQUEST_TRIGGER_CONFIG._serialized_end=639
+  _PB_CAMERA_MANAGEMENT_REQUEST_TRIGGER_CONFIG_ROLE_E._serialized_start=590
+  _PB_CAMERA_MANAGEMENT_REQUEST_TRIGGER_CONFIG_ROLE_E._serialized_end=639
+  _PB_CAMERA_MANAGEMENT_REQUEST_SET_MODE._serialized_start=641
+  _PB_CAMERA_MANAGEMENT_REQUEST_SET_MODE._serialized_end=710
+  _PB_CAMERA_MANAGEMENT_REQUEST_INTERLEAVE._serialized_start=712
+  _PB_CAMERA_MANAGEMENT_REQUEST_INTERLEAVE._serialized_end=780
+  _PB_CAMERA_MANAGEMENT_REQUEST_FRAME_PARAMS._serialized_start=783
+  _PB_CAMERA_MANAGEMENT_REQUEST_FRAME_PARAMS._serialized_end=985
+  _PB_CAMERA_MANAGEMENT_REQUEST_FRAME_PARAMS_ENTRY._serialized_start=911
+  _PB_CAMERA_MANAGEMENT_REQUEST_FRAME_PARAMS_ENTRY._serialized_end=985
+  _PB_CAMERA_MANAGEMENT_REQUEST_AUTO_EXPOSURE._serialized_start=988
+  _PB_CAMERA_MANAGEMENT_REQUEST_AUTO_EXPOSURE._serialized_end=1244
+  _PB_CAMERA_MANAGEMENT_REQUEST._serialized_start=1247
+  _PB_CAMERA_MANAGEMENT_REQUEST._serialized_end=1814
+  _PB_CAMERA_READ_REQUEST_SET_CROP._serialized_start=1816
+  _PB_CAMERA_READ_REQUEST_SET_CROP._serialized_end=1913
+  _PB_CAMERA_READ_REQUEST_SET_PACKING._serialized_start=1915
+  _PB_CAMERA_READ_REQUEST_SET_PACKING._serialized_end=1965
+  _PB_CAMERA_READ_REQUEST_DCMI_ENABLE._serialized_start=1967
+  _PB_CAMERA_READ_REQUEST_DCMI_ENABLE._serialized_end=2017
+  _PB_CAMERA_READ_REQUEST_TEST_PATTERN._serialized_start=2020
+  _PB_CAMERA_READ_REQUEST_TEST_PATTERN._serialized_end=2197
+  _PB_CAMERA_READ_REQUEST_TEST_PATTERN_PATTERN_E._serialized_start=2144
+  _PB_CAMERA_READ_REQUEST_TEST_PATTERN_PATTERN_E._serialized_end=2197
+  _PB_CAMERA_READ_REQUEST_STREAM._serialized_start=2199
+  _PB_CAMERA_READ_REQUEST_STREAM._serialized_end=2269
+  _PB_CAMERA_READ_REQUEST_BURST._serialized_start=2271
+  _PB_CAMERA_READ_REQUEST_BURST._serialized_end=2317
+  _PB_CAMERA_READ_REQUEST_RING._serialized_start=2319
+  _PB_CAMERA_READ_REQUEST_RING._serialized_end=2429
+  _PB_CAMERA_READ_REQUEST_EVENT._serialized_start=2431
+  _PB_CAMERA_READ_REQUEST_EVENT._serialized_end=2461
+  _PB_CAMERA_READ_REQUEST_DELTA._serialized_start=2463
+  _PB_CAMERA_READ_REQUEST_DELTA._serialized_end=2575
+  _PB_CAMERA_READ_REQUEST_CODEC._serialized_start=2578
+  _PB_CAMERA_READ_REQUEST_CODEC._serialized_end=2723
+  _PB_CAMERA_READ_REQUEST_CODEC_CODEC_E._serialized_start=2681
+  _PB_CAMERA_READ_REQUEST_CODEC_CODEC_E._serialized_end=2723
+  _PB_CAMERA_READ_REQUEST_DEPTH._serialized_start=2725
+  _PB_CAMERA_READ_REQUEST_DEPTH._serialized_end=2804
+  _PB_CAMERA_READ_REQUEST_LUT._serialized_start=2806
+  _PB_CAMERA_READ_REQUEST_LUT._serialized_end=2897
+  _PB_CAMERA_READ_REQUEST_FOCUS._serialized_start=2899
+  _PB_CAMERA_READ_REQUEST_FOCUS._serialized_end=2992
+  _PB_CAMERA_READ_REQUEST._serialized_start=2995
+  _PB_CAMERA_READ_REQUEST._serialized_end=3681
+  _PB_CAMERA_TRANSACTION._serialized_start=3684
+  _PB_CAMERA_TRANSACTION._serialized_end=3942
+  _PB_DETECT_REQUEST_MODEL._serialized_start=3944
+  _PB_DETECT_REQUEST_MODEL._serialized_end=4029
+  _PB_DETECT_REQUEST_CONFIG._serialized_start=4031
+  _PB_DETECT_REQUEST_CONFIG._serialized_end=4129
+  _PB_DETECT_REQUEST._serialized_start=4131
+  _PB_DETECT_REQUEST._serialized_end=4249
+  _PB_CAMERA_REQUEST._serialized_start=4252
+  _PB_CAMERA_REQUEST._serialized_end=4495
+  _PB_CAMERA_RESPONSE._serialized_start=4498
+  _PB_CAMERA_RESPONSE._serialized_end=4730
+  _PB_CAMERA_RESPONSE_STATUS_E._serialized_start=4644
+  _PB_CAMERA_RESPONSE_STATUS_E._serialized_end=4730
 # @@protoc_insertion_point(module_scope)
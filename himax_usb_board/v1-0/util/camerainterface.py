@@ -1,11 +1,664 @@
 import serial
+import struct
 import time
 import numpy as np
+from collections import namedtuple, OrderedDict
 from enum import Enum, auto
 #from camera_command_pb2.pb_camera_management_request_sensor_select import sensor_select_e as sensor_select_e
 from camera_command_pb2 import *
+import sensor_modes
 from collections import deque
 
+class CameraResponseError(Exception):
+    """
+    Raised when the camera reports that a request failed.
+    """
+    def __init__(self, response):
+        self.response = response
+        status = pb_camera_response.status_e.Name(response.status)
+        super().__init__(f"request {response.request_id} failed with status {status} "
+                         f"(detail = {response.detail})")
+
+# Header that follows the frame marker. Must match camera_read_task.h:camera_frame_header_t.
+FRAME_HEADER_FORMAT = '<BBHIIHHBBBBIIIIHBB'
+FRAME_HEADER_SIZE = struct.calcsize(FRAME_HEADER_FORMAT)
+FRAME_HEADER_VERSION = 6
+
+# header.flags bits
+FRAME_FLAG_PARAMS_VALID = (1 << 0)
+# The frame was recorded by a burst capture (see burst_capture()) and isn't live.
+FRAME_FLAG_REPLAY = (1 << 1)
+# The first frame after the event of a pre-trigger capture (see arm_ring()).
+FRAME_FLAG_EVENT = (1 << 2)
+# The frame is whole and resets the reference of the FRAME_FORMAT_DELTA frames after it.
+FRAME_FLAG_KEYFRAME = (1 << 3)
+# The frame's pixels went through the lookup table uploaded with upload_lut().
+FRAME_FLAG_LUT = (1 << 4)
+
+# Most lookup table entries per request. Must match camera_read_task.h:CAMERA_LUT_PIECE.
+LUT_PIECE = 64
+
+# header.format
+FRAME_FORMAT_RAW8 = 0
+FRAME_FORMAT_STATS = 1
+FRAME_FORMAT_DELTA = 2
+FRAME_FORMAT_LOSSLESS = 3
+FRAME_FORMAT_DCT = 4
+FRAME_FORMAT_LOW_DEPTH = 5
+# The payload is a DetectResult of the frame: see detect_task.h.
+FRAME_FORMAT_DETECT = 6
+# The payload is the frame's FocusMetrics: see focus_metric.h.
+FRAME_FORMAT_FOCUS = 7
+
+# Side of the tiles of a FRAME_FORMAT_DELTA frame. Must match tile_delta.h:TILE_DELTA_TILE.
+DELTA_TILE = 16
+
+# Widest region that focus metrics cover. Must match focus_metric.h:FOCUS_METRIC_MAX_WIDTH.
+FOCUS_MAX_WIDTH = 640
+
+# Header of a FRAME_FORMAT_LOSSLESS slice. Must match lossless_codec.h:lossless_slice_header_t.
+LOSSLESS_SLICE_FORMAT = '<HHB3xI'
+LOSSLESS_SLICE_SIZE = struct.calcsize(LOSSLESS_SLICE_FORMAT)
+LOSSLESS_RAW_ROW = 0xff
+
+# Header of a FRAME_FORMAT_DCT slice. Must match dct_codec.h:dct_slice_header_t.
+DCT_SLICE_FORMAT = '<HHBBxxI'
+DCT_SLICE_SIZE = struct.calcsize(DCT_SLICE_FORMAT)
+
+# Must match dct_codec.c:luminance_table and zigzag.
+DCT_LUMINANCE_TABLE = np.array([
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99])
+DCT_ZIGZAG = np.array([
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63])
+
+# Orthonormal 8-point DCT-II basis, C[u][x].
+DCT_BASIS = np.array([[(np.sqrt(1 / 8) if (u == 0) else 0.5) * np.cos((2 * x + 1) * u * np.pi / 16)
+                       for x in range(8)] for u in range(8)])
+
+# A decoded FRAME_FORMAT_LOSSLESS or FRAME_FORMAT_DCT slice: rows first_row onwards of a frame,
+# as a (rows, width) array, and the CPU cycles that the camera took to code them.
+CodecSlice = namedtuple('CodecSlice', ['first_row', 'pixels', 'encode_cycles'])
+
+# Payload of a FRAME_FORMAT_STATS frame. Must match frame_stats.h:frame_stats_record_t.
+STATS_RECORD_FORMAT = '<BBBBHBx256H64B'
+STATS_RECORD_SIZE = struct.calcsize(STATS_RECORD_FORMAT)
+
+FRAME_SOURCE_DCMI = 0
+FRAME_SOURCE_TEST_PATTERN = 1
+
+FRAME_SENSOR_HM01B0 = 0
+FRAME_SENSOR_HM0360 = 1
+FRAME_SENSOR_NONE = 0xff
+
+# header.sync_sequence of a frame from a board that isn't synchronized.
+FRAME_SYNC_NONE = 0xffffffff
+
+FrameHeader = namedtuple('FrameHeader', ['version', 'header_len', 'flags', 'sequence',
+                                         'timestamp_us', 'width', 'height', 'format', 'source',
+                                         'sensor', 'depth', 'payload_len',
+                                         'trigger_us', 'sync_sequence', 'sync_offset_us',
+                                         'exposure_lines', 'analog_gain', 'digital_gain'])
+
+# Statistics of one frame, as the camera gathered them while packing it. 'mean' is a float,
+# 'histogram' holds the number of pixels of every value (rounded down to a multiple of
+# 2^histogram_shift) and 'tiles' is the mean of every tile of the image, as a (tiles_y, tiles_x)
+# array.
+FrameStats = namedtuple('FrameStats', ['min', 'max', 'mean', 'histogram', 'tiles'])
+
+def parse_stats_record(payload):
+    """
+    Turns the payload of a FRAME_FORMAT_STATS frame into FrameStats.
+    """
+    fields = struct.unpack(STATS_RECORD_FORMAT, payload)
+    lo, hi, tiles_x, tiles_y, mean_x256, shift = fields[0:6]
+    histogram = np.array(fields[6:262], dtype=np.uint32) << shift
+    tiles = np.array(fields[262:], dtype=np.uint8).reshape((tiles_y, tiles_x))
+    return FrameStats(lo, hi, mean_x256 / 256, histogram, tiles)
+
+# Payload of a FRAME_FORMAT_FOCUS frame. Must match focus_metric.h:focus_record_t.
+FOCUS_RECORD_FORMAT = '<HHHHIIQqQ'
+FOCUS_RECORD_SIZE = struct.calcsize(FOCUS_RECORD_FORMAT)
+
+# Focus metrics of one frame. 'roi' is the (start_x, start_y, len_x, len_y) that was covered and
+# 'count' the number of pixels that the sums were taken over, 'cycles' what they cost the camera.
+# 'tenengrad' is the mean squared Sobel gradient magnitude and 'laplacian_var' the variance of the
+# Laplacian, both floats worked out from the sums; higher is sharper.
+FocusMetrics = namedtuple('FocusMetrics', ['roi', 'count', 'cycles', 'tenengrad_sum',
+                                           'laplacian_sum', 'laplacian_sq', 'tenengrad',
+                                           'laplacian_var'])
+
+def _focus_metrics(roi, count, cycles, tenengrad_sum, laplacian_sum, laplacian_sq):
+    if (count == 0):
+        return FocusMetrics(roi, 0, cycles, 0, 0, 0, 0.0, 0.0)
+    mean = laplacian_sum / count
+    return FocusMetrics(roi, count, cycles, tenengrad_sum, laplacian_sum, laplacian_sq,
+                        tenengrad_sum / count, (laplacian_sq / count) - (mean * mean))
+
+def parse_focus_record(payload):
+    """
+    Turns the payload of a FRAME_FORMAT_FOCUS frame into FocusMetrics.
+    """
+    fields = struct.unpack(FOCUS_RECORD_FORMAT, payload)
+    return _focus_metrics(tuple(fields[0:4]), *fields[4:])
+
+def focus_reference(image, roi=None):
+    """
+    The FocusMetrics that the camera sends for 'image' over 'roi' (start_x, start_y, len_x, len_y),
+    or over the whole image if that's None or has no size. 'cycles' is 0.
+    """
+    height, width = image.shape
+    x0, y0, x1, y1 = 0, 0, width, height
+    if ((roi is not None) and (roi[2] != 0) and (roi[3] != 0)):
+        x0, y0 = min(roi[0], width), min(roi[1], height)
+        x1, y1 = min(x0 + roi[2], width), min(y0 + roi[3], height)
+    x1 = min(x1, x0 + FOCUS_MAX_WIDTH)
+    covered = (x0, y0, x1 - x0, y1 - y0)
+    r = image[y0:y1, x0:x1].astype(np.int64)
+    if ((r.shape[0] < 3) or (r.shape[1] < 3)):
+        return _focus_metrics(covered, 0, 0, 0, 0, 0)
+
+    a, b, c = r[:-2], r[1:-1], r[2:]
+    gx = (a[:, 2:] - a[:, :-2]) + 2 * (b[:, 2:] - b[:, :-2]) + (c[:, 2:] - c[:, :-2])
+    gy = (c[:, :-2] + 2 * c[:, 1:-1] + c[:, 2:]) - (a[:, :-2] + 2 * a[:, 1:-1] + a[:, 2:])
+    lap = a[:, 1:-1] + c[:, 1:-1] + b[:, :-2] + b[:, 2:] - 4 * b[:, 1:-1]
+    return _focus_metrics(covered, lap.size, 0, int(np.sum(gx * gx + gy * gy)),
+                          int(np.sum(lap)), int(np.sum(lap * lap)))
+
+# 4x4 ordered dither pattern of LOW_DEPTH frames, in 1/16ths of an output step. Must match
+# bit_depth.c:bayer.
+DEPTH_BAYER = np.array([[ 0,  8,  2, 10],
+                        [12,  4, 14,  6],
+                        [ 3, 11,  1,  9],
+                        [15,  7, 13,  5]])
+
+def depth_row_bytes(width, bits):
+    """
+    Length of a row of a FRAME_FORMAT_LOW_DEPTH frame with 'bits' bits per pixel.
+    """
+    return ((width * bits) + 7) // 8
+
+def unpack_depth(payload, width, height, bits):
+    """
+    Unpacks the payload of a FRAME_FORMAT_LOW_DEPTH frame into a (height, width) array of pixel
+    values 0 - 2^bits - 1. Every byte is split into all of its pixels at once.
+    """
+    data = np.frombuffer(payload, dtype=np.uint8).reshape((height, depth_row_bytes(width, bits)))
+    shifts = np.arange(8 - bits, -1, -bits, dtype=np.uint8)
+    pixels = (data[:, :, None] >> shifts) & ((1 << bits) - 1)
+    return pixels.reshape((height, -1))[:, :width]
+
+def expand_depth(pixels, bits):
+    """
+    Scales pixel values 0 - 2^bits - 1 to 0 - 255.
+    """
+    return ((pixels.astype(np.uint32) * 255) // ((1 << bits) - 1)).astype(np.uint8)
+
+def reduce_depth(image, bits, threshold=128, dither=False):
+    """
+    Cuts 'image' down to 'bits' bits per pixel the way the camera does for FRAME_FORMAT_LOW_DEPTH
+    frames, returning pixel values 0 - 2^bits - 1. See bit_depth.h.
+    """
+    p = image.astype(np.int32)
+    if (dither):
+        y, x = np.indices(image.shape)
+        p = np.minimum(p - (p >> bits) + ((DEPTH_BAYER[y & 3, x & 3] * (256 >> bits)) // 16), 255)
+        threshold = 128
+    if (bits == 1):
+        return (p >= threshold).astype(np.uint8)
+    return (p >> (8 - bits)).astype(np.uint8)
+
+def gamma_lut(gamma, black=0, white=255):
+    """
+    A 256-entry lookup table for upload_lut() that stretches 'black' - 'white' to 0 - 255 and
+    applies 'gamma' to it: out = 255 * ((p - black) / (white - black)) ^ gamma. A gamma below 1
+    brightens the shadows, which also spends more of a reduced bit depth on them.
+    """
+    x = np.clip((np.arange(256) - black) / max(white - black, 1), 0.0, 1.0)
+    return np.rint(255 * (x ** gamma)).astype(np.uint8)
+
+def delta_bitmap_bytes(width, height):
+    """
+    Length of the tile bitmap at the front of a FRAME_FORMAT_DELTA payload.
+    """
+    tiles = (-(-width // DELTA_TILE)) * (-(-height // DELTA_TILE))
+    return ((tiles + 31) // 32) * 4
+
+class DeltaReconstructor:
+    """
+    Rebuilds whole images from a stream of keyframes and FRAME_FORMAT_DELTA frames, the same way
+    the camera keeps its reference frame. See tile_delta.h for the payload layout.
+    """
+    def __init__(self):
+        self.reference = None
+
+    def invalidate(self):
+        """
+        Forgets the reference, e.g. after a frame got lost on the way. Delta frames can't be
+        rebuilt until the next keyframe.
+        """
+        self.reference = None
+
+    def keyframe(self, image):
+        self.reference = image.copy()
+
+    def apply(self, header, payload):
+        """
+        Puts the changed tiles of a FRAME_FORMAT_DELTA frame into the reference and returns a copy
+        of it, or returns None if there's no reference to put them into.
+        """
+        w, h, t = header.width, header.height, DELTA_TILE
+        if ((self.reference is None) or (self.reference.shape != (h, w))):
+            return None
+
+        tiles_x, tiles_y = -(-w // t), -(-h // t)
+        nbitmap = delta_bitmap_bytes(w, h)
+        bits = np.unpackbits(np.frombuffer(payload[:nbitmap], dtype=np.uint8), bitorder='little')
+        changed = bits[:(tiles_x * tiles_y)].reshape((tiles_y, tiles_x)).astype(bool)
+        pixels = np.frombuffer(payload[nbitmap:], dtype=np.uint8)
+
+        if (((w % t) == 0) and ((h % t) == 0)):
+            # every tile is whole, so the reference can be looked at as a grid of tiles, and all
+            # changed tiles can be put in at once. Tiles are in the payload row by row, which is the
+            # order that boolean indexing picks them in.
+            if (len(pixels) != (np.count_nonzero(changed) * t * t)):
+                self.invalidate()
+                return None
+            grid = self.reference.reshape((tiles_y, t, tiles_x, t)).swapaxes(1, 2)
+            grid[changed] = pixels.reshape((-1, t, t))
+            return self.reference.copy()
+
+        offset = 0
+        for ty, tx in zip(*np.nonzero(changed)):
+            y0, x0 = ty * t, tx * t
+            th, tw = min(t, h - y0), min(t, w - x0)
+            tile = pixels[offset:(offset + (tw * th))]
+            if (len(tile) != (tw * th)):
+                self.invalidate()
+                return None
+            self.reference[y0:(y0 + th), x0:(x0 + tw)] = tile.reshape((th, tw))
+            offset += tw * th
+        return self.reference.copy()
+
+def decode_lossless_slice(payload, width):
+    """
+    Decodes the payload of a FRAME_FORMAT_LOSSLESS frame into a CodecSlice, or returns None if
+    it's damaged. See lossless_codec.h for the format.
+
+    Only the row headers are walked one by one. The codes of all rows are found at once from the
+    positions of the 1s in their unary bits, and the prediction is undone for the whole slice with
+    two cumulative sums.
+    """
+    first_row, rows, stored, cycles = struct.unpack_from(LOSSLESS_SLICE_FORMAT, payload)
+    data = np.frombuffer(payload, dtype=np.uint8, offset=LOSSLESS_SLICE_SIZE)
+    if (stored):
+        if (len(data) != (rows * width)):
+            return None
+        return CodecSlice(first_row, data.reshape((rows, width)), cycles)
+
+    # where every row's parts are.
+    ks = np.zeros(rows, dtype=np.int64)
+    starts = np.zeros(rows, dtype=np.int64)
+    unary_lens = np.zeros(rows, dtype=np.int64)
+    pos = 0
+    try:
+        for r in range(rows):
+            k = int(data[pos])
+            ks[r] = k
+            if (k == LOSSLESS_RAW_ROW):
+                starts[r] = pos + 1
+                pos += 1 + width
+                continue
+            unary_lens[r] = int(data[pos + 1]) | (int(data[pos + 2]) << 8)
+            starts[r] = pos + 3
+            pos += 3 + (((width * k) + 7) // 8) + unary_lens[r]
+    except IndexError:
+        return None
+    if ((pos != len(data)) or np.any((ks > 7) & (ks != LOSSLESS_RAW_ROW))):
+        return None
+
+    raw = (ks == LOSSLESS_RAW_ROW)
+    coded = np.flatnonzero(~raw)
+    mapped = np.zeros((rows, width), dtype=np.uint8)
+    if (len(coded) != 0):
+        ck = ks[coded]
+        rem_lens = ((width * ck) + 7) // 8
+
+        # the unary parts of all rows, one after the other. Every row has 'width' codes, each
+        # ending in a 1, and padding is 0s, so the 1s split up into rows by themselves.
+        ustarts = starts[coded] + rem_lens
+        ubytes = np.concatenate([data[s:(s + n)] for (s, n) in zip(ustarts, unary_lens[coded])])
+        ones = np.flatnonzero(np.unpackbits(ubytes, bitorder='little'))
+        if (len(ones) != (len(coded) * width)):
+            return None
+        ones = ones.reshape((len(coded), width))
+        row_bit = 8 * np.concatenate(([0], np.cumsum(unary_lens[coded])[:-1]))
+        q = np.diff(ones, axis=1, prepend=(row_bit - 1)[:, None]) - 1
+
+        # the low bits, a batch of rows with the same k at a time.
+        rem = np.zeros((len(coded), width), dtype=np.int64)
+        for k in np.unique(ck):
+            if (k == 0):
+                continue
+            sel = np.flatnonzero(ck == k)
+            n = ((width * k) + 7) // 8
+            idx = starts[coded[sel]][:, None] + np.arange(n)
+            bits = np.unpackbits(data[idx], axis=1, bitorder='little')[:, :(width * k)]
+            rem[sel] = bits.reshape((len(sel), width, k)) @ (1 << np.arange(k))
+        m = (q << ck[:, None]) | rem
+        if (np.any(m > 0xff)):
+            return None
+        mapped[coded] = m
+
+    # undo the zigzag and the prediction. A pixel's error is its vertical difference minus its
+    # left neighbour's, so the vertical differences are the row-wise sums of the errors and the
+    # pixels are the column-wise sums of those. Raw rows restart the column-wise sums.
+    errors = (mapped >> 1) ^ (0 - (mapped & 1)).astype(np.uint8)
+    vertical = np.cumsum(errors, axis=1, dtype=np.uint8)
+    vertical[raw] = 0
+    sums = np.cumsum(vertical, axis=0, dtype=np.uint8)
+    base = np.zeros((rows, width), dtype=np.uint8)
+    if (np.any(raw)):
+        raw_rows = np.flatnonzero(raw)
+        base[raw_rows] = data[starts[raw_rows][:, None] + np.arange(width)] - sums[raw_rows]
+        last_raw = np.maximum.accumulate(np.where(raw, np.arange(rows), -1))
+        base = np.where((last_raw >= 0)[:, None], base[np.maximum(last_raw, 0)], 0)
+    return CodecSlice(first_row, (sums + base).astype(np.uint8), cycles)
+
+def dct_quantization_steps(quality):
+    """
+    The camera's quantization table for 'quality' (1 - 100), as an 8x8 array.
+    """
+    scale = (5000 // quality) if (quality < 50) else (200 - (2 * quality))
+    return np.clip(((DCT_LUMINANCE_TABLE * scale) + 50) // 100, 1, 255).reshape((8, 8))
+
+class _BitReader:
+    """
+    Reads the MSB-first codes of a FRAME_FORMAT_DCT band. The bits are kept as a string of '0's
+    and '1's, so that Exp-Golomb prefixes can be found with bytes.find().
+    """
+    def __init__(self, data):
+        self.bits = np.unpackbits(np.frombuffer(data, dtype=np.uint8)).tobytes() \
+                      .translate(bytes.maketrans(b'\x00\x01', b'01'))
+        self.pos = 0
+
+    def ue(self):
+        one = self.bits.find(b'1', self.pos)
+        if (one < 0):
+            raise IndexError("out of bits")
+        n = one - self.pos
+        end = one + n + 1
+        if (end > len(self.bits)):
+            raise IndexError("out of bits")
+        self.pos = end
+        return int(self.bits[one:end], 2) - 1
+
+    def se(self):
+        v = self.ue()
+        return ((v + 1) // 2) if (v & 1) else -(v // 2)
+
+    def bit(self):
+        if (self.pos >= len(self.bits)):
+            raise IndexError("out of bits")
+        self.pos += 1
+        return self.bits[self.pos - 1] == ord('1')
+
+def decode_dct_slice(payload, width):
+    """
+    Decodes the payload of a FRAME_FORMAT_DCT frame into a CodecSlice, or returns None if it's
+    damaged. See dct_codec.h for the format. The codes are read one by one; dequantization and the
+    inverse DCT are done for a whole band at once.
+    """
+    first_row, rows, quality, bands, cycles = struct.unpack_from(DCT_SLICE_FORMAT, payload)
+    if (not (1 <= quality <= 100)):
+        return None
+    steps = dct_quantization_steps(quality)
+    blocks_x = -(-width // 8)
+    out = np.zeros((bands * 8, blocks_x * 8), dtype=np.uint8)
+    pos = DCT_SLICE_SIZE
+    try:
+        for b in range(bands):
+            shift = payload[pos]
+            n = payload[pos + 1] | (payload[pos + 2] << 8)
+            bits = _BitReader(payload[(pos + 3):(pos + 3 + n)])
+            pos += 3 + n
+
+            zz = np.zeros((blocks_x, 64), dtype=np.int64)
+            dc = 0
+            for bx in range(blocks_x):
+                dc += bits.se()
+                zz[bx, 0] = dc
+                i = 1
+                while True:
+                    run = bits.ue()
+                    if (run == 0):
+                        break
+                    i += run - 1
+                    mag = bits.ue() + 1
+                    if (i > 63):
+                        return None
+                    zz[bx, i] = -mag if bits.bit() else mag
+                    i += 1
+
+            coefficients = np.zeros((blocks_x, 64), dtype=np.int64)
+            coefficients[:, DCT_ZIGZAG] = zz
+            f = coefficients.reshape((blocks_x, 8, 8)) * (steps << shift)
+            blocks = np.einsum('ux,buv,vy->bxy', DCT_BASIS, f, DCT_BASIS) + 128
+            out[(b * 8):((b + 1) * 8)] = np.clip(np.rint(blocks), 0, 255).astype(np.uint8) \
+                                            .transpose((1, 0, 2)).reshape((8, blocks_x * 8))
+    except IndexError:
+        return None
+    if ((pos != len(payload)) or (rows > (bands * 8))):
+        return None
+    return CodecSlice(first_row, out[:rows, :width], cycles)
+
+# Payload of a FRAME_FORMAT_DETECT frame. Must match detect_task.h:detect_record_t.
+DETECT_RECORD_FORMAT = '<IIIIBBxx4b4b'
+DETECT_RECORD_SIZE = struct.calcsize(DETECT_RECORD_FORMAT)
+
+# Must match detect_net.h and detect_task.h.
+DETECT_INPUT_DIM = 64
+DETECT_MAX_CLASSES = 4
+DETECT_MODEL_MAGIC = 0x314e4e44
+DETECT_MODEL_HEADER_FORMAT = '<IIB3x20B'
+DETECT_MODEL_PIECE = 128
+
+# Layers of the detection network as (kind, stride, ch_in, ch_out, dim_in, dim_out). The fully
+# connected layer's ch_out is the model's number of classes. Must match detect_net.c:layers.
+DETECT_LAYERS = [
+    ('conv', 2,  1,  8, 64, 32),
+    ('dw',   1,  8,  8, 32, 32),
+    ('pw',   1,  8, 16, 32, 32),
+    ('dw',   2, 16, 16, 32, 16),
+    ('pw',   1, 16, 32, 16, 16),
+    ('dw',   2, 32, 32, 16,  8),
+    ('pw',   1, 32, 64,  8,  8),
+    ('dw',   1, 64, 64,  8,  8),
+    ('pw',   1, 64, 64,  8,  8),
+    ('fc',   1, 64,  0,  1,  1),
+]
+
+# A model for the detection network. 'shifts' holds a (bias_shift, out_shift) pair per layer,
+# 'weights' and 'biases' an int8 array per layer; weights are shaped (out, 3, 3, in) for the
+# first layer, (3, 3, channels) for depthwise layers and (out, in) for the rest.
+DetectModel = namedtuple('DetectModel', ['model_id', 'shifts', 'weights', 'biases'])
+
+# Result of running the model on a frame. inference_us is how long the network took on the
+# camera, latency_us how long it was from the frame's start until the result was ready, and
+# skipped counts the frames that the camera couldn't run the model on since it was configured
+# because it was still busy. 'present' is set if the score of the class that's being looked for
+# reached the threshold. logits are the outputs of the last layer, scores their softmax in
+# 1/128ths.
+DetectResult = namedtuple('DetectResult', ['model_id', 'inference_us', 'latency_us', 'skipped',
+                                           'present', 'logits', 'scores'])
+
+def parse_detect_record(payload):
+    """
+    Turns the payload of a FRAME_FORMAT_DETECT frame into a DetectResult.
+    """
+    fields = struct.unpack(DETECT_RECORD_FORMAT, payload)
+    model_id, inference_us, latency_us, skipped, classes, present = fields[0:6]
+    logits = np.array(fields[6:(6 + classes)], dtype=np.int8)
+    scores = np.array(fields[10:(10 + classes)], dtype=np.int8)
+    return DetectResult(model_id, inference_us, latency_us, skipped, bool(present), logits, scores)
+
+def detect_weight_shape(layer, classes):
+    """
+    Shape of the weights of 'layer' (an entry of DETECT_LAYERS) in a DetectModel.
+    """
+    kind, _, ch_in, ch_out, _, _ = layer
+    if (kind == 'conv'):
+        return (ch_out, 3, 3, ch_in)
+    if (kind == 'dw'):
+        return (3, 3, ch_in)
+    return ((classes if (kind == 'fc') else ch_out), ch_in)
+
+def _align4(n):
+    return (n + 3) & ~3
+
+def detect_model_size(classes):
+    """
+    Size in bytes of a model with 'classes' classes, as upload_detect_model() sends it.
+    """
+    size = _align4(struct.calcsize(DETECT_MODEL_HEADER_FORMAT))
+    for layer in DETECT_LAYERS:
+        size += _align4(int(np.prod(detect_weight_shape(layer, classes))))
+        size += _align4(classes if (layer[0] == 'fc') else layer[3])
+    return size
+
+def pack_detect_model(model):
+    """
+    Lays out a DetectModel the way the camera takes it; see detect_net.h.
+    """
+    classes = len(model.biases[-1])
+    shifts = [s for pair in model.shifts for s in pair]
+    out = bytearray(struct.pack(DETECT_MODEL_HEADER_FORMAT, DETECT_MODEL_MAGIC, model.model_id,
+                                classes, *shifts))
+    for layer, w, b in zip(DETECT_LAYERS, model.weights, model.biases):
+        for a in (np.asarray(w, dtype=np.int8).reshape(detect_weight_shape(layer, classes)),
+                  np.asarray(b, dtype=np.int8)):
+            out += bytes(_align4(len(out)) - len(out)) + a.tobytes()
+    out += bytes(_align4(len(out)) - len(out))
+    assert (len(out) == detect_model_size(classes))
+    return bytes(out)
+
+def detect_input(image):
+    """
+    The network input that the camera makes out of a frame: the pixels nearest to the centres of
+    a 64x64 grid, as p - 128. Frames must be at least 64 pixels wide and high.
+    """
+    height, width = image.shape
+    ys = ((2 * np.arange(DETECT_INPUT_DIM) + 1) * height) // (2 * DETECT_INPUT_DIM)
+    xs = ((2 * np.arange(DETECT_INPUT_DIM) + 1) * width) // (2 * DETECT_INPUT_DIM)
+    return (image[ys][:, xs].astype(np.int32) - 128)[:, :, None]
+
+def detect_accumulate(layer, x, weights):
+    """
+    The sums of products that 'layer' (an entry of DETECT_LAYERS) works out from its input 'x',
+    an int (dim, dim, channels) array, before bias, rounding and shifts.
+    """
+    kind, stride, ch_in, _, _, dim_out = layer
+    w = np.asarray(weights, dtype=np.int64)
+    if (kind == 'fc'):
+        return w @ x.reshape(-1).astype(np.int64)
+    if (kind == 'pw'):
+        return np.einsum('yxi,oi->yxo', x.astype(np.int64), w)
+
+    padded = np.pad(x.astype(np.int64), ((1, 1), (1, 1), (0, 0)))
+    acc = 0
+    for ky in range(3):
+        for kx in range(3):
+            window = padded[ky:(ky + (stride * dim_out)):stride, kx:(kx + (stride * dim_out)):stride]
+            if (kind == 'conv'):
+                acc = acc + np.einsum('yxi,oi->yxo', window, w[:, ky, kx, :])
+            else:
+                acc = acc + (window * w[ky, kx])
+    return acc
+
+def detect_requantize(acc, bias, bias_shift, out_shift):
+    """
+    Turns sums of products into a layer's int8 outputs the way CMSIS-NN does.
+    """
+    acc = acc + (np.asarray(bias, dtype=np.int64) << bias_shift) + (1 << (out_shift - 1))
+    return np.clip(acc >> out_shift, -128, 127)
+
+def _trunc_div(a, n):
+    return np.sign(a) * (np.abs(a) // n)
+
+def detect_pool(x):
+    """
+    arm_avepool_q7_HWC over all of 'x', a (dim, dim, channels) array: it averages along every row
+    first and then down the column of those averages, rounding towards zero both times.
+    """
+    return _trunc_div(_trunc_div(x.sum(axis=1), x.shape[1]).sum(axis=0), x.shape[0])
+
+def detect_softmax(logits):
+    """
+    arm_softmax_q7: a base 2 softmax in 1/128ths.
+    """
+    v = np.asarray(logits, dtype=np.int64)
+    base = int(v.max()) - 8
+    live = v > base
+    total = int(np.sum(1 << np.clip(v[live] - base, 0, 31)))
+    out_base = 0x100000 // total
+    out = np.clip(out_base >> np.clip(13 + base - v, 0, 31), -128, 127)
+    return np.where(live, out, 0).astype(np.int8)
+
+def detect_reference(model, x):
+    """
+    Runs a DetectModel on a network input (see detect_input()) exactly like the camera does and
+    returns (logits, scores).
+    """
+    for i, layer in enumerate(DETECT_LAYERS[:-1]):
+        acc = detect_accumulate(layer, x, model.weights[i])
+        x = np.maximum(detect_requantize(acc, model.biases[i], *model.shifts[i]), 0)
+
+    acc = detect_accumulate(DETECT_LAYERS[-1], detect_pool(x), model.weights[-1])
+    logits = detect_requantize(acc, model.biases[-1], *model.shifts[-1]).astype(np.int8)
+    return logits, detect_softmax(logits)
+
+_lfsr_cache = np.zeros(0, dtype=np.uint8)
+
+def _lfsr_bytes(n):
+    """
+    Low bytes of the camera's test-pattern LFSR for the first n steps of a frame.
+    """
+    global _lfsr_cache
+    if (len(_lfsr_cache) < n):
+        out = np.empty(n, dtype=np.uint8)
+        lfsr = 0xace1ace1
+        for i in range(n):
+            lfsr = (lfsr >> 1) ^ (0x80200003 if (lfsr & 1) else 0)
+            out[i] = lfsr & 0xff
+        _lfsr_cache = out
+    return _lfsr_cache[:n]
+
+def expected_test_pattern(pattern, sequence, width, height):
+    """
+    Returns the image that the camera's test-pattern source sends as frame number 'sequence'.
+    See camera_command.proto:pb_camera_read_request_test_pattern for the patterns.
+    """
+    pe = pb_camera_read_request_test_pattern.pattern_e
+    n = width * height
+    if (pattern == pe.RAMP):
+        y, x = np.indices((height, width))
+        return ((x + y + sequence) & 0xff).astype(np.uint8)
+    elif (pattern == pe.COUNTER):
+        words = ((np.arange((n + 1) // 2) + sequence) & 0xffff).astype('<u2')
+        return np.frombuffer(words.tobytes()[:n], dtype=np.uint8).reshape((height, width))
+    elif (pattern == pe.LFSR):
+        return (_lfsr_bytes(n) ^ (sequence & 0xff)).reshape((height, width))
+    raise ValueError(f"no test pattern {pattern}")
+
 class CameraInterface:
     """
     Utility class for configuring the camera.
@@ -17,18 +670,32 @@ class CameraInterface:
     def __init__(self, serial):
         # data state variables
         self.frame_queue = deque()
+        self.stats_queue = deque()
+        self.detect_queue = deque()
+        self.focus_queue = deque()
+        self.delta = DeltaReconstructor()
         self.image_data = b''
 
         # serial comm params
         self.CHUNK_SIZE = (1 << 12)
         self.serial = serial
 
+        # request / response state. Responses that arrive are held here, keyed by request id,
+        # until someone waits on them. Most requests' responses are never waited on, so only the
+        # newest MAX_HELD_RESPONSES are kept.
+        self.next_request_id = 1
+        self.responses = OrderedDict()
+
         # camera config state
         self.cameratype = pb_camera_management_request_sensor_select.sensor_select_e.HM01B0
         self.dcmi_halted = True
         self.packed = True
         self.cropdims = [2, 2, 320, 240]    # start_x, start_y, width, height
 
+        # Header of the last frame that was decoded. Every frame carries its own dimensions, so
+        # crop changes show up in the stream exactly when the camera applied them.
+        self.frame_header = None
+
         # data rate telemetry
         self.MA_RATE = 0.05
         self.MA_WINDOW_LENGTH = 10
@@ -40,6 +707,19 @@ class CameraInterface:
         self.total_bytes_read = 0
         self.last_time = time.time()
 
+        # stream health counters; these only ever count up.
+        self.bytes_received = 0
+        self.discarded_bytes = 0
+        self.truncated_frames = 0
+
+        # FRAME_FORMAT_LOSSLESS / FRAME_FORMAT_DCT frame that's being put together from its
+        # slices, as [header, image, rows still missing], and codec telemetry: pixels decoded, the
+        # camera's cycles for coding them and the time it took to decode them here.
+        self.codec_frame = None
+        self.codec_pixels = 0
+        self.codec_encode_cycles = 0
+        self.codec_decode_seconds = 0.0
+
 
     ################################################################
     ###      Configuration methods
@@ -53,10 +733,49 @@ class CameraInterface:
         self.serial.write((len(msg) & 0xff).to_bytes(1, 'little'))
         self.serial.write(msg)
 
+    def send_request(self, msg):
+        """
+        Tags a pb_camera_request with a fresh request id and transmits it.
+        Returns the request id, which can be passed to wait_response().
+        """
+        request_id = self.next_request_id
+        self.next_request_id = (self.next_request_id % 0xffffffff) + 1
+
+        msg.request_id = request_id
+        self.__write_serial_with_prefix(msg.SerializeToString())
+        return request_id
+
+    def wait_response(self, request_id, timeout=1.0, check=True):
+        """
+        Reads from the camera until the response to the given request arrives and returns it as a
+        pb_camera_response. Frames that arrive while waiting are queued as usual.
+
+        Raises TimeoutError if no response arrives within 'timeout' seconds, and
+        CameraResponseError if 'check' is set and the camera reports a failure.
+        """
+        deadline = time.time() + timeout
+        while request_id not in self.responses:
+            if (time.time() > deadline):
+                raise TimeoutError(f"no response to request {request_id} after {timeout} s")
+            if (self.serial.in_waiting == 0):
+                time.sleep(0.001)
+            self.try_read_bytes()
+
+        response = self.responses.pop(request_id)
+        if (check and (response.status != pb_camera_response.status_e.OK)):
+            raise CameraResponseError(response)
+        return response
+
+    def request(self, msg, timeout=1.0, check=True):
+        """
+        Sends a request and blocks until the camera has carried it out.
+        """
+        return self.wait_response(self.send_request(msg), timeout, check)
+
     def __get_i2c_addr(self):
         return 0x24 if (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0) else 0x35
 
-    def __set_image_packing(self, do_pack):
+    def set_image_packing(self, do_pack):
         self.packed = do_pack
         msg = pb_camera_request(
             dcmi_config=pb_camera_read_request(
@@ -66,7 +785,7 @@ class CameraInterface:
             )
         )
 
-        self.__write_serial_with_prefix(msg.SerializeToString())
+        return self.send_request(msg)
 
     def set_image_crop(self, start_x, start_y, width, height):
         self.cropdims = [start_x, start_y, width, height]
@@ -87,14 +806,18 @@ class CameraInterface:
             )
         )
 
-        self.__write_serial_with_prefix(msg.SerializeToString())
+        return self.send_request(msg)
 
     def __select_image_sensor(self, cameratype):
         """
-        Tells the camera to select an image sensor.
-        The DCMI interface should be halted before calling this function.
+        Tells the camera to switch to an image sensor. The camera halts and resumes DCMI as needed
+        and restores the crop and packing that were last used with that sensor; the response's
+        'detail' is how long the switch took in microseconds.
+
+        Returns the request id.
         """
         self.cameratype = cameratype
+        self.packed = (cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0)
 
         msg = pb_camera_request(
             camera_management=pb_camera_management_request(
@@ -103,21 +826,180 @@ class CameraInterface:
                 )
             )
         )
-
-        self.__write_serial_with_prefix(msg.SerializeToString())
-
-        if (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0):
-            self.__set_image_packing(True)
-        else:
-            self.__set_image_packing(False)
+        return self.send_request(msg)
 
     def select_hm01b0(self):
-        self.__select_image_sensor(pb_camera_management_request_sensor_select.sensor_select_e.HM01B0)
-        self.set_image_crop(self.cropdims[0], self.cropdims[1], self.cropdims[2], self.cropdims[3])
+        return self.__select_image_sensor(pb_camera_management_request_sensor_select.sensor_select_e.HM01B0)
 
     def select_hm0360(self):
-        self.__select_image_sensor(pb_camera_management_request_sensor_select.sensor_select_e.HM0360)
-        self.set_image_crop(self.cropdims[0], self.cropdims[1], self.cropdims[2], self.cropdims[3])
+        return self.__select_image_sensor(pb_camera_management_request_sensor_select.sensor_select_e.HM0360)
+
+    def transaction(self, reg_writes=(), cameratype=None, crop=None, resume=False):
+        """
+        Sends a batch of configuration changes that the camera applies together at the next frame
+        boundary. DCMI is only halted and resumed (once) if the frame geometry changes.
+
+        'reg_writes' is a list of (register_addr, value) tuples for the selected image sensor,
+        'cameratype' optionally switches image sensor (packing follows the sensor), and 'crop'
+        optionally sets (start_x, start_y, width, height). If 'resume' is set, DCMI is left running
+        afterwards even if it was halted before.
+
+        Returns the request id.
+        """
+        if (cameratype is not None):
+            self.cameratype = cameratype
+            self.packed = (cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0)
+        if (crop is not None):
+            self.cropdims = list(crop)
+
+        t = pb_camera_transaction(i2c_peripheral_address=self.__get_i2c_addr(), resume=resume)
+        t.reg_writes.extend([((reg & 0xffff) << 8) | (val & 0xff) for (reg, val) in reg_writes])
+
+        if (cameratype is not None):
+            t.sensor_select.sensor_select = cameratype
+            t.pack.pack = self.packed
+
+        # A sensor switch can change packing, which changes the dcmi crop, so resend it.
+        if ((crop is not None) or (cameratype is not None)):
+            start_x, start_y, width, height = self.cropdims
+            t.crop.start_x = start_x * 2 if (self.packed) else start_x
+            t.crop.start_y = start_y
+            t.crop.len_x = width * 2 if (self.packed) else width
+            t.crop.len_y = height
+
+        msg = pb_camera_request(transaction=t)
+        if ((msg.ByteSize() + 6) > 0xff):
+            # 6 bytes are reserved for the request id.
+            raise ValueError(f"transaction with {len(reg_writes)} register writes is too long; "
+                             "split it up.")
+
+        return self.send_request(msg)
+
+    def set_mode(self, name, resume=False):
+        """
+        Switches to one of the precompiled sensor modes in sensor_modes.py, e.g. 'hm0360_vga'. The
+        camera selects the mode's sensor and applies its registers, crop and packing together, like
+        a transaction.
+
+        Returns the request id.
+        """
+        mode = sensor_modes.MODES[sensor_modes.MODE_IDS[name]]
+        self.cameratype = (pb_camera_management_request_sensor_select.sensor_select_e.HM01B0
+                           if (mode.sensor == sensor_modes.HM01B0) else
+                           pb_camera_management_request_sensor_select.sensor_select_e.HM0360)
+        self.packed = mode.sensor.pack
+        self.cropdims = list(mode.crop)
+
+        msg = pb_camera_request(
+            camera_management=pb_camera_management_request(
+                set_mode=pb_camera_management_request_set_mode(
+                    mode=sensor_modes.MODE_IDS[name],
+                    resume=resume
+                )
+            )
+        )
+        return self.send_request(msg)
+
+    def set_interleave(self, frames_per_sensor):
+        """
+        Alternates DCMI between the two image sensors every 'frames_per_sensor' frames, resuming
+        DCMI if it's halted. 0 stops interleaving and leaves the current sensor selected. Each
+        frame's header.sensor says which sensor it came from.
+
+        If a switch fails, the camera stops interleaving by itself, and the response to the next
+        set_interleave() carries the failure instead; that request isn't carried out.
+
+        Returns the request id.
+        """
+        msg = pb_camera_request(
+            camera_management=pb_camera_management_request(
+                interleave=pb_camera_management_request_interleave(
+                    frames_per_sensor=frames_per_sensor
+                )
+            )
+        )
+        return self.send_request(msg)
+
+    def configure_trigger(self, role, period_us=0, pulse_width_us=10, delay_us=0):
+        """
+        Configures the camera's hardware-timed trigger pulses. 'role' is one of
+        pb_camera_management_request_trigger_config.role_e (OFF, CONTROLLER, PERIPHERAL);
+        'period_us' only matters for a controller. See camera_command.proto for the details.
+
+        Each frame's header.trigger_us is the time of the last trigger pulse before the frame
+        started, so header.timestamp_us - header.trigger_us is the trigger-to-frame latency.
+
+        Returns the request id.
+        """
+        msg = pb_camera_request(
+            camera_management=pb_camera_management_request(
+                trigger_config=pb_camera_management_request_trigger_config(
+                    role=role,
+                    period_us=period_us,
+                    pulse_width_us=pulse_width_us,
+                    delay_us=delay_us
+                )
+            )
+        )
+        return self.send_request(msg)
+
+    def schedule_frame_params(self, entries, repeat=False):
+        """
+        Replaces the camera's per-frame exposure / gain schedule with 'entries', a list of
+        (exposure_lines, analog_gain, digital_gain) tuples: one is applied at every frame boundary,
+        under group hold. With 'repeat', they're cycled through; otherwise the last one stays in
+        effect. An empty list stops the schedule. Autoexposure must be off.
+
+        Frames that were taken with scheduled settings have FRAME_FLAG_PARAMS_VALID set in
+        header.flags, and header.exposure_lines, analog_gain and digital_gain say which.
+
+        Returns the request id. Its response's detail is the sequence number of the first frame
+        that's taken with entries[0].
+        """
+        pb_entry = pb_camera_management_request_frame_params.entry
+        msg = pb_camera_request(
+            camera_management=pb_camera_management_request(
+                frame_params=pb_camera_management_request_frame_params(
+                    entries=[pb_entry(exposure_lines=e, analog_gain=a, digital_gain=d)
+                             for (e, a, d) in entries],
+                    repeat=repeat
+                )
+            )
+        )
+        return self.send_request(msg)
+
+    def set_auto_exposure(self, enable, target=128, tolerance=4, max_exposure_lines=0x0200,
+                          max_analog_gain=3, max_digital_gain=0xff, speed=192, roi=None,
+                          roi_weight=1):
+        """
+        Turns the firmware's auto exposure on or off. It measures every frame on the camera and
+        corrects exposure and gains at frame boundaries without any USB traffic; the frame headers
+        echo the settings. The sensor's own autoexposure must be off. See
+        camera_command.proto:pb_camera_management_request_auto_exposure for the parameters.
+
+        'max_exposure_lines' should stay below the sensor mode's frame length, or the frame rate
+        drops. 'roi' is (start_x, start_y, width, height) in pixels of the frame, and its pixels
+        count 'roi_weight' times.
+
+        Returns the request id.
+        """
+        (x, y, w, h) = roi if (roi is not None) else (0, 0, 0, 0)
+        msg = pb_camera_request(
+            camera_management=pb_camera_management_request(
+                auto_exposure=pb_camera_management_request_auto_exposure(
+                    enable=enable,
+                    target=target,
+                    tolerance=tolerance,
+                    max_exposure_lines=max_exposure_lines,
+                    max_analog_gain=max_analog_gain,
+                    max_digital_gain=max_digital_gain,
+                    speed=speed,
+                    roi=pb_camera_read_request_set_crop(start_x=x, start_y=y, len_x=w, len_y=h),
+                    roi_weight=roi_weight
+                )
+            )
+        )
+        return self.send_request(msg)
 
     def write_i2c_register(self, register_addr, value):
         # Create a reg_write request
@@ -134,11 +1016,39 @@ class CameraInterface:
         camera_request = pb_camera_request()
         camera_request.camera_management.CopyFrom(camera_management_request)
 
-        # To serialize the message to a byte string (for sending over a network or writing to a file)
-        serialized_data = camera_request.SerializeToString()
-        print(' '.join([f"{x:02x}" for x in serialized_data]))
-        print('\n')
-        self.__write_serial_with_prefix(serialized_data)
+        return self.send_request(camera_request)
+
+    # Must match camera_management_task.h:CAMERA_REG_READ_MAX.
+    MAX_REGISTER_READS = 16
+
+    def request_register_read(self, register_addrs):
+        """
+        Asks for the values of up to MAX_REGISTER_READS registers of the selected image sensor.
+        Returns the request id; the values arrive in the response's reg_values, in the same order.
+        """
+        if (len(register_addrs) > self.MAX_REGISTER_READS):
+            raise ValueError(f"can't read more than {self.MAX_REGISTER_READS} registers at once")
+
+        msg = pb_camera_request(
+            camera_management=pb_camera_management_request(
+                reg_read=pb_camera_management_request_reg_read(
+                    i2c_peripheral_address=self.__get_i2c_addr(),
+                    register_addresses=register_addrs
+                )
+            )
+        )
+        return self.send_request(msg)
+
+    def read_i2c_registers(self, register_addrs, timeout=1.0):
+        """
+        Reads registers of the selected image sensor and returns their values as a list.
+        """
+        values = []
+        for i in range(0, len(register_addrs), self.MAX_REGISTER_READS):
+            chunk = list(register_addrs[i:i + self.MAX_REGISTER_READS])
+            response = self.wait_response(self.request_register_read(chunk), timeout)
+            values.extend(response.reg_values)
+        return values
 
     def __set_dcmi_state(self, do_halt):
         """
@@ -151,56 +1061,283 @@ class CameraInterface:
             )
         )
 
-        self.__write_serial_with_prefix(msg.SerializeToString())
+        return self.send_request(msg)
 
     def halt_dcmi(self):
-        self.__set_dcmi_state(True)
+        """
+        Returns a request id whose response arrives once DCMI has actually halted.
+        """
+        return self.__set_dcmi_state(True)
 
     def resume_dcmi(self):
-        self.__set_dcmi_state(False)
+        return self.__set_dcmi_state(False)
+
+    def set_test_pattern(self, pattern, frame_rate=0):
+        """
+        Makes the camera send a synthetic test pattern (a pb_camera_read_request_test_pattern.pattern_e)
+        through its whole image pipeline instead of sensor data, at 'frame_rate' frames per second
+        or, if that's 0, as fast as the link allows. DCMI must be halted. Resuming DCMI or
+        passing pattern_e.OFF stops the pattern.
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                test_pattern=pb_camera_read_request_test_pattern(
+                    pattern=pattern, frame_rate=frame_rate
+                )
+            )
+        )
+
+        return self.send_request(msg)
+
+    def set_stream(self, pixel_interval=1, stats=False):
+        """
+        Makes the camera send the pixels of every 'pixel_interval'-th frame, or of none if that's
+        0, and a statistics record after every frame if 'stats' is set. The records end up in
+        pop_stats().
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                stream=pb_camera_read_request_stream(
+                    pixel_interval=pixel_interval, stats=stats
+                )
+            )
+        )
+
+        return self.send_request(msg)
+
+    def set_delta(self, enable, threshold=4, hysteresis=2, keyframe_interval=30):
+        """
+        Makes the camera send only the 16x16 tiles that changed since the last frame it sent, with
+        a whole keyframe every 'keyframe_interval' frames (0: only when needed). A tile has changed
+        if its pixels differ from what was last sent by more than 'threshold' on average, or
+        'threshold' - 'hysteresis' if it changed in the last frame. Frames are rebuilt here, so
+        pop_frame() still returns whole images; frames sent before the first keyframe are dropped.
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                delta=pb_camera_read_request_delta(
+                    enable=enable, threshold=threshold, hysteresis=hysteresis,
+                    keyframe_interval=keyframe_interval
+                )
+            )
+        )
+
+        return self.send_request(msg)
+
+    def set_codec(self, codec, quality=75):
+        """
+        Makes the camera compress the frames that it streams whole with 'codec', a
+        pb_camera_read_request_codec.codec_e, at 'quality' (1 - 100) if it's lossy. Frames are
+        decoded here, so pop_frame() still returns whole images; their headers are those of their
+        first slices.
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                codec=pb_camera_read_request_codec(codec=codec, quality=quality)
+            )
+        )
+
+        return self.send_request(msg)
+
+    def set_depth(self, bits, threshold=128, dither=False):
+        """
+        Makes the camera send the frames that it streams whole with 'bits' (8, 4, 2 or 1) bits per
+        pixel, see pb_camera_read_request_depth. pop_frame() returns them scaled back up to 0 -
+        255; header.depth says how many bits they had, and unpack_depth() gets at the values
+        themselves.
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                depth=pb_camera_read_request_depth(bits=bits, threshold=threshold, dither=dither)
+            )
+        )
+
+        return self.send_request(msg)
+
+    def upload_lut(self, table):
+        """
+        Uploads a pixel lookup table - 256 entries, 16 entries that each stand for 16 pixel values,
+        or none to stop using one - and commits it. Returns the request id of the commit; its
+        response comes once the table is in use, and its detail is the sequence number of the first
+        frame that went through it. Raises CameraResponseError if the camera refuses a piece,
+        which it does while an earlier commit is still waiting for a frame start.
+        """
+        table = np.asarray(table if (table is not None) else [], dtype=np.uint8)
+        for offset in range(0, len(table), LUT_PIECE):
+            self.request(pb_camera_request(
+                dcmi_config=pb_camera_read_request(
+                    lut=pb_camera_read_request_lut(
+                        offset=offset, entries=table[offset:(offset + LUT_PIECE)].tobytes())
+                )
+            ))
+
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                lut=pb_camera_read_request_lut(commit=True, size=len(table))
+            )
+        )
+
+        return self.send_request(msg)
+
+    def set_focus(self, enable, roi=None):
+        """
+        Makes the camera send focus metrics of 'roi' (start_x, start_y, len_x, len_y), or of the
+        whole frame if that's None, after every frame if 'enable' is set; they end up in
+        pop_focus(). set_stream(0) leaves nothing but the metrics (and statistics, if they're on).
+        """
+        focus = pb_camera_read_request_focus(enable=enable)
+        if (roi is not None):
+            focus.roi.CopyFrom(pb_camera_read_request_set_crop(start_x=roi[0], start_y=roi[1],
+                                                               len_x=roi[2], len_y=roi[3]))
+        msg = pb_camera_request(dcmi_config=pb_camera_read_request(focus=focus))
+
+        return self.send_request(msg)
+
+    def upload_detect_model(self, model):
+        """
+        Uploads a model for the detection network, a DetectModel or what pack_detect_model() made
+        of one, and commits it. Returns the request id of the commit. Raises CameraResponseError
+        if the camera refuses a piece.
+        """
+        data = model if isinstance(model, (bytes, bytearray)) else pack_detect_model(model)
+        for offset in range(0, len(data), DETECT_MODEL_PIECE):
+            self.request(pb_camera_request(
+                detect=pb_detect_request(
+                    model=pb_detect_request_model(
+                        offset=offset, data=bytes(data[offset:(offset + DETECT_MODEL_PIECE)]))
+                )
+            ))
+
+        msg = pb_camera_request(
+            detect=pb_detect_request(
+                model=pb_detect_request_model(commit=True, size=len(data))
+            )
+        )
+
+        return self.send_request(msg)
+
+    def set_detect(self, interval=1, threshold=64, class_index=0, gate=False):
+        """
+        Makes the camera run its detection model on every 'interval'-th frame, or on none if that's
+        0, and send the results, which pop_detection() returns. Something is seen if the score of
+        class 'class_index' is at least 'threshold' (0 - 127); with 'gate', frames' pixels are only
+        streamed while it is. See pb_detect_request_config.
+        """
+        msg = pb_camera_request(
+            detect=pb_detect_request(
+                config=pb_detect_request_config(interval=interval, threshold=threshold,
+                                                class_index=class_index, gate=gate)
+            )
+        )
+
+        return self.send_request(msg)
+
+    def burst_capture(self, frames):
+        """
+        Makes the camera record the next 'frames' frames into its RAM at full speed and send them
+        afterwards, with FRAME_FLAG_REPLAY set in their headers. Returns the request id. Its
+        response comes once recording is done; the detail is the number of frames recorded.
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                burst=pb_camera_read_request_burst(frames=frames)
+            )
+        )
+
+        return self.send_request(msg)
+
+    def arm_ring(self, pre_frames, post_frames, gpio=False, motion_threshold=0):
+        """
+        Makes the camera keep its newest 'pre_frames' frames in RAM, sending nothing, until an
+        event: fire_event(), a rising edge on gpio3 if 'gpio' is set, or a change of the image's
+        8x8 tile means of 'motion_threshold' on average if that isn't 0. Then it records
+        'post_frames' more and sends them all with FRAME_FLAG_REPLAY set; the first one after the
+        event also has FRAME_FLAG_EVENT. pre_frames = 0 disarms.
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                ring=pb_camera_read_request_ring(
+                    pre_frames=pre_frames, post_frames=post_frames, gpio=gpio,
+                    motion_threshold=motion_threshold
+                )
+            )
+        )
+
+        return self.send_request(msg)
+
+    def fire_event(self):
+        """
+        Fires the event of a pre-trigger capture that was armed with arm_ring().
+        """
+        msg = pb_camera_request(
+            dcmi_config=pb_camera_read_request(
+                event=pb_camera_read_request_event()
+            )
+        )
+
+        return self.send_request(msg)
 
     ################################################################
     ### sensor-specific commands
     ################################################################
+    # The *_writes methods return the (register_addr, value) pairs that a setting needs on the
+    # selected sensor so that they can be batched into a transaction. The setters below write them
+    # one at a time and return the request id of the last write.
+    def __is_himax(self):
+        return ((self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0) or
+                (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM0360))
+
+    def __write_all(self, writes):
+        request_id = None
+        for (reg, val) in writes:
+            request_id = self.write_i2c_register(reg, val)
+        return request_id
+
+    def command_update_writes(self):
+        return [(0x0104, 1)] if self.__is_himax() else []
+
+    def autoexposure_writes(self, enable):
+        if (not self.__is_himax()):
+            return []
+        if (not enable):
+            return [(0x2100, 0)]
+        if (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0):
+            return [(0x2100, 1)]
+        return [(0x2100, 0x1f)]
+
+    def analog_gain_writes(self, gain):
+        return [(0x0205, (gain << 4))] if self.__is_himax() else []
+
+    def digital_gain_writes(self, gain):
+        if (not self.__is_himax()):
+            return []
+        return [(0x020e, ((gain >> 6) & 0x03)), (0x020f, ((gain & 0x3f) << 2))]
+
+    def exposure_writes(self, exp):
+        """
+        'exp' is the integration time in lines.
+        """
+        if (not self.__is_himax()):
+            return []
+        return [(0x0202, ((exp >> 8) & 0xff)), (0x0203, (exp & 0xff))]
+
     def force_command_update(self):
-        if ((self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0) or
-            (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM0360)):
-            self.write_i2c_register(0x0104, 1)
-        else:
-            pass
+        return self.__write_all(self.command_update_writes())
 
     def disable_autoexposure(self):
-        if ((self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0) or
-            (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM0360)):
-            self.write_i2c_register(0x2100, 0)
-        else:
-            pass
+        return self.__write_all(self.autoexposure_writes(False))
 
     def enable_autoexposure(self):
-        if (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0):
-            self.write_i2c_register(0x2100, 1)
-        elif (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM0360):
-            self.write_i2c_register(0x2100, 0x1f)
-        else:
-            pass
+        return self.__write_all(self.autoexposure_writes(True))
 
     def set_analog_gain(self, gain):
-        if ((self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0) or
-            (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM0360)):
-            self.write_i2c_register(0x0205, (gain << 4))
-        else:
-            pass
+        return self.__write_all(self.analog_gain_writes(gain))
 
     def set_digital_gain(self, gain):
-        if ((self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM01B0) or
-            (self.cameratype == pb_camera_management_request_sensor_select.sensor_select_e.HM0360)):
-            self.write_i2c_register(0x020e, ((gain >> 6) & 0x03))
-            self.write_i2c_register(0x020f, ((gain & 0x3f) << 2))
-        else:
-            pass
+        return self.__write_all(self.digital_gain_writes(gain))
 
     def set_exposure(self, exp):
-        pass
+        return self.__write_all(self.exposure_writes(exp))
 
     ################################################################
     ### Camera read functions
@@ -211,20 +1348,131 @@ class CameraInterface:
         If it isn't, the array is discarded.
         If it is, the preamble is aligned to the start of the array.
         """
-        if (arr[0:len(preamble)] == preamble):
-            return arr
+        idx = arr.find(preamble)
+        if (idx >= 0):
+            return arr[idx:]
+
+        # keep a tail that could be the start of a preamble that hasn't fully arrived.
+        return arr[-(len(preamble) - 1):]
+
+    def __extract_responses(self):
+        """
+        Cuts any complete response records out of the incoming byte stream and files them in
+        self.responses. Responses can be spliced in anywhere in the image data.
 
-        for i in range(len(arr) - len(preamble) + 1):
-            if (arr[i:(i + len(preamble))] == preamble):
-                return arr[i:]
+        Returns the offset of a response record that has started arriving but isn't complete yet,
+        or None. Image bytes past that offset can't be trusted until the record is complete.
+        """
+        hdrlen = len(self.RESPONSE_PREAMBLE) + 1
+        while True:
+            idx = self.image_data.find(self.RESPONSE_PREAMBLE)
+            if (idx < 0):
+                break
+            if ((len(self.image_data) < (idx + hdrlen)) or
+                (len(self.image_data) < (idx + hdrlen + self.image_data[idx + hdrlen - 1]))):
+                return idx
+
+            end = idx + hdrlen + self.image_data[idx + hdrlen - 1]
+            response = pb_camera_response()
+            response.ParseFromString(self.image_data[idx + hdrlen:end])
+            self.responses[response.request_id] = response
+            if (len(self.responses) > self.MAX_HELD_RESPONSES):
+                self.responses.popitem(last=False)
+            self.image_data = self.image_data[:idx] + self.image_data[end:]
+
+        # The tail of the buffer might be the start of a preamble that hasn't fully arrived.
+        for n in range(len(self.RESPONSE_PREAMBLE) - 1, 0, -1):
+            if (self.image_data[-n:] == self.RESPONSE_PREAMBLE[:n]):
+                return len(self.image_data) - n
+
+        return None
+
+    def __drop_front(self, n, discard=False):
+        """
+        Removes n bytes from the front of image_data. 'discard' counts them as lost.
+        """
+        self.image_data = self.image_data[n:]
+        if (discard):
+            self.discarded_bytes += n
 
-        return b''
+    def __parse_header(self):
+        """
+        Returns the FrameHeader behind the frame marker at the front of image_data, or None if it
+        doesn't make sense.
+        """
+        start = len(self.PREAMBLE)
+        header = FrameHeader._make(struct.unpack(FRAME_HEADER_FORMAT,
+                                                 self.image_data[start:(start + FRAME_HEADER_SIZE)]))
+        if ((header.version != FRAME_HEADER_VERSION) or
+            (header.header_len != FRAME_HEADER_SIZE)):
+            return None
+        if ((header.format == FRAME_FORMAT_RAW8) and
+            (header.payload_len == (header.width * header.height))):
+            return header
+        if ((header.format == FRAME_FORMAT_STATS) and (header.payload_len == STATS_RECORD_SIZE)):
+            return header
+        if ((header.format == FRAME_FORMAT_DELTA) and
+            (delta_bitmap_bytes(header.width, header.height) <= header.payload_len <=
+             (delta_bitmap_bytes(header.width, header.height) + (header.width * header.height)))):
+            return header
+        if ((header.format == FRAME_FORMAT_LOSSLESS) and
+            (LOSSLESS_SLICE_SIZE <= header.payload_len <=
+             (LOSSLESS_SLICE_SIZE + (header.height * (header.width + 1))))):
+            return header
+        if ((header.format == FRAME_FORMAT_DCT) and
+            (DCT_SLICE_SIZE <= header.payload_len <= (1 << 16))):
+            return header
+        if ((header.format == FRAME_FORMAT_LOW_DEPTH) and (header.depth in (1, 2, 4)) and
+            (header.payload_len == (header.height * depth_row_bytes(header.width, header.depth)))):
+            return header
+        if ((header.format == FRAME_FORMAT_DETECT) and (header.payload_len == DETECT_RECORD_SIZE)):
+            return header
+        if ((header.format == FRAME_FORMAT_FOCUS) and (header.payload_len == FOCUS_RECORD_SIZE)):
+            return header
+        return None
+
+    def __queue_frame(self, header, image_array):
+        if (header.flags & FRAME_FLAG_KEYFRAME):
+            self.delta.keyframe(image_array)
+        self.frame_queue.append((header, image_array))
+        self.frame_header = header
+        self.total_frames_decoded += 1
+
+    def __add_slice(self, header, payload):
+        """
+        Decodes a FRAME_FORMAT_LOSSLESS or FRAME_FORMAT_DCT slice into the frame that it belongs
+        to, and queues the frame once all of its rows are in. A frame that's missing slices when
+        the next one starts counts as truncated.
+        """
+        decode = decode_lossless_slice if (header.format == FRAME_FORMAT_LOSSLESS) else decode_dct_slice
+        start = time.perf_counter()
+        s = decode(payload, header.width)
+        self.codec_decode_seconds += time.perf_counter() - start
 
-    def get_imagesize(self):
-        return self.cropdims[2] * self.cropdims[3]
+        frame = self.codec_frame
+        if ((frame is not None) and (frame[0].sequence != header.sequence)):
+            self.truncated_frames += 1
+            if (frame[0].flags & FRAME_FLAG_KEYFRAME):
+                self.delta.invalidate()
+            frame = None
+        if (s is None):
+            self.codec_frame = None
+            self.truncated_frames += 1
+            return
+        if (frame is None):
+            frame = [header, np.zeros((header.height, header.width), dtype=np.uint8), header.height]
 
-    def get_framesize(self):
-        return self.get_imagesize() + len(self.PREAMBLE)
+        rows = s.pixels.shape[0]
+        frame[1][s.first_row:(s.first_row + rows)] = s.pixels
+        frame[2] -= rows
+        self.codec_pixels += s.pixels.size
+        self.codec_encode_cycles += s.encode_cycles
+        if (frame[2] > 0):
+            self.codec_frame = frame
+            return
+
+        self.codec_frame = None
+        self.__queue_frame(frame[0], frame[1])
 
     def try_read_bytes(self):
         """
@@ -238,6 +1486,7 @@ class CameraInterface:
             bytes_to_read = min(self.serial.in_waiting, self.CHUNK_SIZE)
             data = self.serial.read(bytes_to_read)
             self.total_bytes_read += len(data)
+            self.bytes_received += len(data)
             self.image_data = self.image_data + data
 
             # update data rate telemetry
@@ -263,17 +1512,80 @@ class CameraInterface:
             self.frame_rate_buffer = [0] * self.MA_WINDOW_LENGTH
             raise
 
-        self.image_data = self.__align_preamble(self.image_data, self.PREAMBLE[0:32])
+        partial_response = self.__extract_responses()
+
+        unaligned_len = len(self.image_data)
+        aligned = self.__align_preamble(self.image_data, self.PREAMBLE[0:32])
+        self.__drop_front(unaligned_len - len(aligned), discard=True)
+        if (partial_response is not None):
+            partial_response = max(0, partial_response - (unaligned_len - len(self.image_data)))
+
+        # wait for the frame marker and header, and the whole frame after that.
+        headersize = len(self.PREAMBLE) + FRAME_HEADER_SIZE
+        if ((len(self.image_data) < headersize) or
+            ((partial_response is not None) and (partial_response < headersize)) or
+            (self.image_data[0:32] != self.PREAMBLE[0:32])):
+            return
+
+        header = self.__parse_header()
+        if (header is None):
+            # not a real frame marker; look for the next one.
+            self.__drop_front(32, discard=True)
+            return
+
+        framesize = headersize + header.payload_len
+        if ((len(self.image_data) < framesize) or
+            ((partial_response is not None) and (partial_response < framesize))):
+            return
+
+        # If parts of this frame were dropped on the way, the next frame marker shows up early.
+        nxt = self.image_data.find(self.PREAMBLE[0:32], 32, framesize)
+        if (nxt >= 0):
+            self.truncated_frames += 1
+            self.delta.invalidate()
+            self.__drop_front(nxt, discard=True)
+            return
+
+        if (header.format == FRAME_FORMAT_STATS):
+            self.stats_queue.append((header, parse_stats_record(self.image_data[headersize:framesize])))
+            self.__drop_front(framesize)
+            return
+
+        if (header.format == FRAME_FORMAT_DETECT):
+            self.detect_queue.append((header, parse_detect_record(self.image_data[headersize:framesize])))
+            self.__drop_front(framesize)
+            return
+
+        if (header.format == FRAME_FORMAT_FOCUS):
+            self.focus_queue.append((header, parse_focus_record(self.image_data[headersize:framesize])))
+            self.__drop_front(framesize)
+            return
+
+        if ((header.format == FRAME_FORMAT_LOSSLESS) or (header.format == FRAME_FORMAT_DCT)):
+            self.__add_slice(header, self.image_data[headersize:framesize])
+            self.__drop_front(framesize)
+            return
+
+        if (header.format == FRAME_FORMAT_DELTA):
+            image_array = self.delta.apply(header, self.image_data[headersize:framesize])
+            self.__drop_front(framesize)
+            if (image_array is None):
+                return
+            self.__queue_frame(header, image_array)
+            return
+
+        if (header.format == FRAME_FORMAT_LOW_DEPTH):
+            pixels = unpack_depth(self.image_data[headersize:framesize], header.width,
+                                  header.height, header.depth)
+            self.__queue_frame(header, expand_depth(pixels, header.depth))
+            self.__drop_front(framesize)
+            return
 
         # If we decoded a full frame, convert it to numpy and add it to our queue of images.
-        if ((len(self.image_data) >= self.get_framesize()) and
-            (self.image_data[0:32] == self.PREAMBLE[0:32])):
-            image_data_no_preamble = self.image_data[len(CameraInterface.PREAMBLE):]
-            image_array = np.frombuffer(image_data_no_preamble[0:self.get_imagesize()], dtype=np.uint8) \
-                                        .reshape((self.cropdims[3], self.cropdims[2]))
-            self.frame_queue.append(image_array)
-            self.image_data = self.image_data[self.get_framesize():]
-            self.total_frames_decoded += 1
+        image_array = np.frombuffer(self.image_data[headersize:framesize], dtype=np.uint8) \
+                                    .reshape((header.height, header.width))
+        self.__queue_frame(header, image_array)
+        self.__drop_front(framesize)
 
     def get_frame_rate(self):
         return sum(self.frame_rate_buffer) / sum(self.dt_buffer)
@@ -286,6 +1598,12 @@ class CameraInterface:
         If a frame is available, pops it.
         Returns a single numpy array
         """
+        return self.frame_queue.popleft()[1]
+
+    def pop_frame_with_header(self):
+        """
+        Like pop_frame, but returns a (FrameHeader, numpy array) tuple.
+        """
         return self.frame_queue.popleft()
 
     def frame_ready(self):
@@ -294,6 +1612,55 @@ class CameraInterface:
         """
         return len(self.frame_queue) > 0
 
+    def pop_stats(self):
+        """
+        Pops the oldest statistics record as a (FrameHeader, FrameStats) tuple. The header is the
+        one of the frame that the statistics belong to, with format FRAME_FORMAT_STATS.
+        """
+        return self.stats_queue.popleft()
+
+    def stats_ready(self):
+        """
+        Returns True if there's a statistics record.
+        """
+        return len(self.stats_queue) > 0
+
+    def pop_detection(self):
+        """
+        Pops the oldest detection result as a (FrameHeader, DetectResult) tuple. The header is the
+        one of the frame that the model was run on, with format FRAME_FORMAT_DETECT.
+        """
+        return self.detect_queue.popleft()
+
+    def detection_ready(self):
+        """
+        Returns True if there's a detection result.
+        """
+        return len(self.detect_queue) > 0
+
+    def pop_focus(self):
+        """
+        Pops the oldest focus record as a (FrameHeader, FocusMetrics) tuple. The header is the one
+        of the frame that the metrics belong to, with format FRAME_FORMAT_FOCUS.
+        """
+        return self.focus_queue.popleft()
+
+    def focus_ready(self):
+        """
+        Returns True if there's a focus record.
+        """
+        return len(self.focus_queue) > 0
+
+    # Responses that are held for wait_response(). Older ones are dropped once there are more; a
+    # caller that waits on a request after this many newer responses have arrived times out.
+    MAX_HELD_RESPONSES = 256
+
+    # Marks a length-prefixed pb_camera_response spliced into the image stream.
+    RESPONSE_PREAMBLE = bytes([
+        0x28, 0xb6, 0xe3, 0x1d, 0x8b, 0x2c, 0xa7, 0x35,
+        0x40, 0x55, 0x34, 0x33, 0x4e, 0x6c, 0xd4, 0x90
+    ])
+
     PREAMBLE = bytes([
         0x48, 0xc1, 0x20, 0xa3, 0xb3, 0x94, 0x74, 0xc2, 0xa6, 0xb7,
         0xc7, 0x76, 0x1e, 0x07, 0x4c, 0x07, 0xde, 0x00, 0x46, 0x44,
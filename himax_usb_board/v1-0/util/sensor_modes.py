@@ -0,0 +1,273 @@
+#!/usr/bin/python3
+"""
+Named image sensor modes (resolution, binning, frame timing) and the build-time tool that turns
+them into the firmware's mode tables.
+
+Each mode lists the value of every mode-dependent register of its sensor; all of a sensor's modes
+must set the same registers. For every pair of modes of the same sensor, the generator computes the
+registers that differ and stores them as runs of consecutive registers, so that a mode switch on
+the camera is a handful of i2c bursts instead of a stream of single writes from the host. The
+firmware follows every switch with a command update, and falls back to a mode's full register list
+when it doesn't know the sensor's current mode.
+
+The firmware build runs this script (see the 'sensor_modes' target in firmware/Makefile):
+
+    python3 sensor_modes.py --output ../firmware/Core
+
+'--stats' prints the size of every diff.
+"""
+import argparse
+import os
+from collections import namedtuple
+
+Sensor = namedtuple('Sensor', ['name', 'i2c_addr', 'select', 'pack'])
+
+# 'select' must match camera_management_task.h:CAMERA_MANAGEMENT_SENSOR_SELECT_*. The hm01b0 on
+# this board is in 4-bit mode, so its data is packed and the DCMI sees 2 bytes per pixel.
+HM01B0 = Sensor('hm01b0', 0x24, 0, True)
+HM0360 = Sensor('hm0360', 0x35, 1, False)
+
+# 'crop' is (start_x, start_y, width, height) in pixels of the image that the sensor sends.
+Mode = namedtuple('Mode', ['name', 'sensor', 'crop', 'regs', 'description'])
+
+def _be16(reg, value):
+    return [(reg, (value >> 8) & 0xff), (reg + 1, value & 0xff)]
+
+def _hm01b0_regs(frame_length, line_length, qvga_window, binning):
+    return (_be16(0x0340, frame_length) + _be16(0x0342, line_length) +
+            [(0x3010, 0x01 if qvga_window else 0x00),
+             (0x0383, 0x03 if binning else 0x01),
+             (0x0387, 0x03 if binning else 0x01),
+             (0x0390, 0x03 if binning else 0x00)])
+
+def _hm0360_regs(frame_length, line_length, subsample):
+    # auto exposure must not integrate for longer than a frame.
+    return (_be16(0x0340, frame_length) + _be16(0x0342, line_length) +
+            [(0x0380, subsample), (0x0381, subsample), (0x0382, 0x00)] +
+            _be16(0x2029, frame_length - 4) +
+            [(0x3030, 0x00)])
+
+# Mode ids are indices into this list, so only ever append to it. The first mode of each sensor is
+# the one that its init table in the firmware (hm01b0_init_bytes.c / hm0360_init_bytes.c) leaves it
+# in.
+MODES = [
+    Mode('hm01b0_qvga', HM01B0, (2, 2, 320, 240),
+         _hm01b0_regs(0x0240, 0x0180, qvga_window=True, binning=False),
+         "324x244 window, the init table's frame timing"),
+    Mode('hm01b0_qqvga', HM01B0, (1, 1, 160, 120),
+         _hm01b0_regs(0x0120, 0x0180, qvga_window=True, binning=True),
+         "2x2 binned QVGA window; about twice the frame rate"),
+    Mode('hm01b0_full', HM01B0, (2, 2, 320, 320),
+         _hm01b0_regs(0x0240, 0x0180, qvga_window=False, binning=False),
+         "full 324x324 array"),
+    Mode('hm0360_qvga', HM0360, (0, 0, 320, 240),
+         _hm0360_regs(0x0109, 0x0178, subsample=1),
+         "2x subsampled, the init table's frame timing"),
+    Mode('hm0360_vga', HM0360, (0, 0, 640, 480),
+         _hm0360_regs(0x0214, 0x0300, subsample=0),
+         "full 640x480 array"),
+    Mode('hm0360_qqvga', HM0360, (0, 0, 160, 120),
+         _hm0360_regs(0x0084, 0x0178, subsample=2),
+         "4x subsampled; half the QVGA frame length"),
+]
+
+MODE_IDS = {m.name: i for (i, m) in enumerate(MODES)}
+
+# Must match sizeof(camera_rawbuf[0]) in camera_read_task.c.
+DCMI_RAWBUF_BYTES = 9600
+
+def dcmi_crop(mode):
+    """
+    Returns the (start_x, start_y, len_x, len_y) DCMI crop of a mode. With packing, the DCMI sees
+    2 bytes for every pixel.
+    """
+    (x, y, w, h) = mode.crop
+    return (2 * x, y, 2 * w, h) if mode.sensor.pack else (x, y, w, h)
+
+def _crop_is_valid(len_x, len_y):
+    # mirrors camera_read_task_util.hc:dma_chunk_bytes()
+    for lines in range(DCMI_RAWBUF_BYTES // len_x, 0, -1):
+        if (((len_y % lines) == 0) and (((len_x * lines) % 4) == 0)):
+            return True
+    return False
+
+def check_modes():
+    for sensor in (HM01B0, HM0360):
+        modes = [m for m in MODES if (m.sensor == sensor)]
+        regs = [r for (r, _) in modes[0].regs]
+        for m in modes:
+            if (sorted(r for (r, _) in m.regs) != sorted(regs)):
+                raise ValueError(f"{m.name} doesn't set the same registers as {modes[0].name}")
+            if (len(set(r for (r, _) in m.regs)) != len(m.regs)):
+                raise ValueError(f"{m.name} sets a register twice")
+
+    for m in MODES:
+        (_, _, len_x, len_y) = dcmi_crop(m)
+        if (not _crop_is_valid(len_x, len_y)):
+            raise ValueError(f"{m.name}'s crop can't be read by the firmware's DMA")
+
+# An i2c write costs about 4 bytes of overhead (address, 2 register address bytes, start / stop), so
+# it's cheaper to rewrite a few registers with their current values than to start a new burst.
+MAX_BRIDGE = 3
+
+def runs(writes, known=None):
+    """
+    Groups (register, value) writes into runs of consecutive registers: [(first_reg, [values])].
+    Gaps of up to MAX_BRIDGE registers whose values are in 'known' are filled in to join two runs.
+    """
+    out = []
+    for (reg, val) in sorted(writes):
+        if (out):
+            end = out[-1][0] + len(out[-1][1])
+            gap = range(end, reg)
+            if ((len(gap) <= MAX_BRIDGE) and (known is not None) and all(r in known for r in gap)):
+                out[-1][1].extend([known[r] for r in gap] + [val])
+                continue
+        out.append((reg, [val]))
+    return out
+
+def diff(src, dst):
+    """
+    The writes that take a sensor from mode 'src' to mode 'dst', or all of dst's writes if 'src' is
+    None.
+    """
+    old = dict(src.regs) if (src is not None) else {}
+    return [(r, v) for (r, v) in dst.regs if (old.get(r) != v)]
+
+def encode_script(writes, dst):
+    """
+    Encodes writes the way camera_management_task.c:apply_mode_script() reads them: runs of
+    [reg_h, reg_l, n, n values], then n = 0.
+    """
+    out = []
+    for (reg, vals) in runs(writes, dict(dst.regs)):
+        out += [(reg >> 8) & 0xff, reg & 0xff, len(vals)] + vals
+    return out + [0, 0, 0]
+
+def generate(outdir):
+    check_modes()
+
+    # identical scripts (e.g. every mode to itself) are only stored once.
+    blob = []
+    offsets = {}
+    def add(script):
+        key = tuple(script)
+        if (key not in offsets):
+            offsets[key] = len(blob)
+            blob.extend(script)
+        return offsets[key]
+
+    full = [add(encode_script(diff(None, m), m)) for m in MODES]
+    diffs = [[add(encode_script(diff(a, b), b)) if (a.sensor == b.sensor) else None
+              for b in MODES] for a in MODES]
+    if (len(blob) >= 0xffff):
+        raise ValueError("mode scripts don't fit 16-bit offsets")
+
+    banner = "// Generated by util/sensor_modes.py; don't edit. Change the modes there instead.\n"
+    boot = {s.name: next(i for (i, m) in enumerate(MODES) if (m.sensor == s)) for s in (HM01B0, HM0360)}
+
+    h = [banner,
+         "#ifndef _SENSOR_MODES_TABLE_H",
+         "#define _SENSOR_MODES_TABLE_H",
+         "",
+         "#include <stdint.h>",
+         "",
+         f"#define SENSOR_MODE_COUNT {len(MODES)}",
+         "",
+         "// The firmware doesn't know which mode a sensor is in.",
+         "#define SENSOR_MODE_UNKNOWN (-1)",
+         "",
+         "// sensor_mode_diffs entry for modes of two different sensors.",
+         "#define SENSOR_MODE_NO_DIFF 0xffff",
+         "",
+         "enum {"]
+    h += [f"    SENSOR_MODE_{m.name.upper()} = {i},    // {m.description}" for (i, m) in enumerate(MODES)]
+    h += ["};",
+          "",
+          "// The modes that the sensors' init tables leave them in.",
+          f"#define SENSOR_MODE_BOOT_HM01B0 SENSOR_MODE_{MODES[boot['hm01b0']].name.upper()}",
+          f"#define SENSOR_MODE_BOOT_HM0360 SENSOR_MODE_{MODES[boot['hm0360']].name.upper()}",
+          "",
+          "typedef struct sensor_mode {",
+          "    // Should be 7 bits, right-justified.",
+          "    uint8_t peripheral_address;",
+          "",
+          "    // CAMERA_MANAGEMENT_SENSOR_SELECT_*",
+          "    uint8_t sensor_select;",
+          "",
+          "    // DCMI read path settings that go with the mode. The crop is in DCMI bytes.",
+          "    uint8_t pack;",
+          "    uint16_t crop_start_x;",
+          "    uint16_t crop_start_y;",
+          "    uint16_t crop_len_x;",
+          "    uint16_t crop_len_y;",
+          "",
+          "    // Offset in sensor_mode_scripts of the script that sets every register of the mode.",
+          "    uint16_t full;",
+          "} sensor_mode_t;",
+          "",
+          "extern const sensor_mode_t sensor_modes[SENSOR_MODE_COUNT];",
+          "",
+          "// sensor_mode_diffs[from][to] is the offset in sensor_mode_scripts of the script that",
+          "// switches a sensor from one of its modes to another.",
+          "extern const uint16_t sensor_mode_diffs[SENSOR_MODE_COUNT][SENSOR_MODE_COUNT];",
+          "",
+          "// Each script is a series of runs of consecutive registers: [reg_h, reg_l, n, n values].",
+          "// A run with n = 0 ends the script. The firmware follows every script with a command update.",
+          "extern const uint8_t sensor_mode_scripts[];",
+          "",
+          "#endif",
+          ""]
+
+    c = [banner,
+         '#include "sensor_modes_table.h"',
+         "",
+         "const sensor_mode_t sensor_modes[SENSOR_MODE_COUNT] = {"]
+    for (i, m) in enumerate(MODES):
+        (x, y, w, hh) = dcmi_crop(m)
+        c.append(f"    [SENSOR_MODE_{m.name.upper()}] = "
+                 f"{{0x{m.sensor.i2c_addr:02x}, {m.sensor.select}, {int(m.sensor.pack)}, "
+                 f"{x}, {y}, {w}, {hh}, {full[i]}}},")
+    c += ["};",
+          "",
+          "const uint16_t sensor_mode_diffs[SENSOR_MODE_COUNT][SENSOR_MODE_COUNT] = {"]
+    for row in diffs:
+        c.append("    {" + ", ".join("SENSOR_MODE_NO_DIFF" if (d is None) else str(d) for d in row) + "},")
+    c += ["};",
+          "",
+          f"const uint8_t sensor_mode_scripts[{len(blob)}] = {{"]
+    for i in range(0, len(blob), 12):
+        c.append("    " + " ".join(f"0x{b:02x}," for b in blob[i:i + 12]))
+    c += ["};", ""]
+
+    with open(os.path.join(outdir, 'Inc', 'sensor_modes_table.h'), 'w') as f:
+        f.write("\n".join(h))
+    with open(os.path.join(outdir, 'Src', 'sensor_modes_table.c'), 'w') as f:
+        f.write("\n".join(c))
+
+def print_stats():
+    check_modes()
+    for a in MODES:
+        for b in MODES:
+            if ((a.sensor != b.sensor) or (a is b)):
+                continue
+            d = diff(a, b)
+            # +1 for the command update
+            print(f"{a.name:>14} -> {b.name:<14} {len(d):2d} registers in "
+                  f"{len(runs(d, dict(b.regs))) + 1:d} bursts")
+
+def main():
+    parser = argparse.ArgumentParser(description="Generates the firmware's sensor mode tables.")
+    parser.add_argument('--output', default=os.path.join(os.path.dirname(__file__), '..', 'firmware', 'Core'),
+                        help="firmware 'Core' directory to put sensor_modes_table.{c,h} in")
+    parser.add_argument('--stats', action='store_true',
+                        help="print the size of every mode switch instead of generating")
+    args = parser.parse_args()
+
+    if (args.stats):
+        print_stats()
+    else:
+        generate(args.output)
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,7 @@ import argparse
 
 from camera_command_pb2 import *
 from camerainterface import *
+import sensor_modes
 
 def establish_serial_connection(port):
     while True:
@@ -20,42 +21,49 @@ def establish_serial_connection(port):
 def read_image_from_serial(args):
     ser = establish_serial_connection(args.port)
     camera = CameraInterface(ser)
-    print(f"framesize = {camera.get_framesize()}")
 
-    # Setup camera configuration
-    camera.halt_dcmi()
-
-    camera.disable_autoexposure()
+    # Setup camera configuration. Everything goes out as a single transaction that the camera
+    # applies at a frame boundary, halting DCMI at most once.
+    cameratype = (pb_camera_management_request_sensor_select.sensor_select_e.HM01B0
+                  if (args.camera_select == "hm01b0") else
+                  pb_camera_management_request_sensor_select.sensor_select_e.HM0360)
+    camera.cameratype = cameratype
 
-    if (args.camera_select == "hm01b0"):
-        camera.select_hm01b0()
-    elif (args.camera_select == "hm0360"):
-        camera.select_hm0360()
+    # A precompiled mode sets the sensor, resolution and crop by itself.
+    crop = (2, 2, args.width, args.height)
+    if (args.mode is not None):
+        camera.wait_response(camera.set_mode(args.mode), timeout=2.0)
+        (cameratype, crop) = (None, None)
+        (_, _, args.width, args.height) = camera.cropdims
 
-    camera.set_image_crop(2, 2, args.width, args.height)
+    writes = camera.autoexposure_writes(False)
 
     if (args.analog_gain is not None):
-        camera.set_analog_gain(args.analog_gain)
+        writes += camera.analog_gain_writes(args.analog_gain)
 
     if (args.digital_gain is not None):
-        camera.set_digital_gain(args.digital_gain)
+        writes += camera.digital_gain_writes(args.digital_gain)
 
     if (args.exposure is not None):
-        camera.set_exposure(args.exposure)
+        writes += camera.exposure_writes(args.exposure)
 
-    camera.force_command_update()
-
-    # Perform manual register writes
+    # Manual register writes
     for regwrite in args.write_registers:
         if (len(regwrite.split(':')) != 2):
             raise ValueError(f"{regwrite} is a malformed register write string.")
         reg = int(regwrite.split(':')[0], 16)
         write = int(regwrite.split(':')[1], 16)
         print(f"Writing value {write:02x} to register {reg:04x} of image sensor.")
-        camera.write_i2c_register(reg, write)
+        writes.append((reg, write))
+
+    writes += camera.command_update_writes()
 
-    # Start dcmi back up
-    camera.resume_dcmi()
+    response = camera.wait_response(camera.transaction(writes,
+                                                       cameratype=cameratype,
+                                                       crop=crop,
+                                                       resume=True),
+                                    timeout=2.0)
+    print(f"camera configured in {response.exec_time_us / 1000:.1f} ms")
 
     saved_frame_count = 0
 
@@ -121,6 +129,9 @@ def main():
                         help="Select image sensor to read from. Can be hm01b0 or hm0360.")
 
     # File saving options
+    parser.add_argument('--mode', type=str, default=None, choices=list(sensor_modes.MODE_IDS),
+                        help='Precompiled sensor mode (see sensor_modes.py). Overrides '
+                             '--camera-select, --width and --height.')
     parser.add_argument('--nframes', type=int, default=None,
                         help='Number of frames to read before halting. '
                         'If no value is specified, then frames are read indefinately.')
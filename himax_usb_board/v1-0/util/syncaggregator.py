@@ -0,0 +1,141 @@
+#!/usr/bin/python3
+"""
+Captures from several lilcams whose gpio4 -> gpio3 sync lines are chained together and groups their
+frames by the sync sequence number in the frame headers, instead of by arrival time.
+
+The first port becomes the trigger controller; every other port becomes a peripheral.
+"""
+
+import argparse
+import time
+import serial
+import numpy as np
+
+from camera_command_pb2 import *
+from camerainterface import *
+
+class FrameAggregator:
+    """
+    Collects frames from several CameraInterfaces and groups them by header.sync_sequence.
+
+    A group is done once every camera has delivered a frame for its sequence number. USB can hold
+    back one board's frames for a while, so incomplete groups are kept until 'max_lag' newer
+    sequence numbers have shown up; after that the missing frames are taken to be dropped.
+    """
+    def __init__(self, cameras, period_us, max_lag=8):
+        self.cameras = cameras
+        self.period_us = period_us
+        self.max_lag = max_lag
+
+        # sequence number -> one (FrameHeader, image) or None per camera
+        self.pending = {}
+        self.newest = None
+
+        # per camera: frames that came in before the camera synced up, and extra frames for a
+        # sequence number that already had one.
+        self.unsynced_frames = [0] * len(cameras)
+        self.extra_frames = [0] * len(cameras)
+
+    def sync_time_us(self, header):
+        """
+        Time of a frame start in microseconds since the controller's sync pulse 0. This is the same
+        timebase for every board: only the offset from the last sync pulse comes from the board's
+        own clock.
+        """
+        return header.sync_sequence * self.period_us + header.sync_offset_us
+
+    def poll(self):
+        """
+        Reads whatever the cameras have sent and returns the groups that are done, oldest first, as
+        (sequence number, [(FrameHeader, image) or None for each camera]) tuples.
+        """
+        for (i, camera) in enumerate(self.cameras):
+            camera.try_read_bytes()
+            while camera.frame_ready():
+                header, image = camera.pop_frame_with_header()
+                if (header.sync_sequence == FRAME_SYNC_NONE):
+                    self.unsynced_frames[i] += 1
+                    continue
+
+                group = self.pending.setdefault(header.sync_sequence, [None] * len(self.cameras))
+                # A sensor that isn't in trigger mode can start more than one frame per sync
+                # pulse; the first one is closest to the pulse.
+                if (group[i] is None):
+                    group[i] = (header, image)
+                else:
+                    self.extra_frames[i] += 1
+
+                if ((self.newest is None) or (header.sync_sequence > self.newest)):
+                    self.newest = header.sync_sequence
+
+        done = []
+        for sequence in sorted(self.pending):
+            group = self.pending[sequence]
+            if (all(f is not None for f in group) or ((self.newest - sequence) > self.max_lag)):
+                done.append((sequence, group))
+        for (sequence, _) in done:
+            del self.pending[sequence]
+        return done
+
+def parse_arguments():
+    parser = argparse.ArgumentParser(description="Capture from several synchronized cameras and "
+                                                 "group their frames by sync sequence number.")
+    parser.add_argument("ports", type=str, nargs="+",
+                        help="Serial ports of the cameras; the first one is the trigger controller")
+    parser.add_argument("-t", "--time", type=float, default=5.0, help="Capture duration in seconds")
+    parser.add_argument("--period", type=int, default=100000, metavar="US",
+                        help="Trigger period in microseconds")
+    parser.add_argument("--width", type=int, default=10, metavar="US",
+                        help="Trigger pulse width in microseconds")
+    parser.add_argument("--delay", type=int, default=0, metavar="US",
+                        help="Delay from the sync pulse to the sensor trigger in microseconds")
+    parser.add_argument("--max-lag", type=int, default=8,
+                        help="How many sync periods to wait for a late frame before giving up on it")
+    return parser.parse_args()
+
+def main():
+    args = parse_arguments()
+    cameras = [CameraInterface(serial.Serial(port, timeout=0.1)) for port in args.ports]
+    for camera in cameras:
+        camera.CHUNK_SIZE = (1 << 16)
+
+    # Peripherals have to be listening before the controller's first pulse.
+    role = pb_camera_management_request_trigger_config.role_e
+    for camera in cameras[1:]:
+        camera.wait_response(camera.configure_trigger(role.PERIPHERAL, 0, args.width, args.delay),
+                             timeout=2.0)
+    cameras[0].wait_response(cameras[0].configure_trigger(role.CONTROLLER, args.period, args.width,
+                                                          args.delay), timeout=2.0)
+    for camera in cameras:
+        camera.wait_response(camera.resume_dcmi(), timeout=2.0)
+
+    aggregator = FrameAggregator(cameras, args.period, args.max_lag)
+    complete = 0
+    missing = [0] * len(cameras)
+    skew_us = []
+    end_time = time.time() + args.time
+    while time.time() < end_time:
+        for (sequence, group) in aggregator.poll():
+            for (i, frame) in enumerate(group):
+                if (frame is None):
+                    missing[i] += 1
+            if all(f is not None for f in group):
+                complete += 1
+                times = [aggregator.sync_time_us(header) for (header, _) in group]
+                skew_us.append(max(times) - min(times))
+
+    for camera in cameras:
+        camera.wait_response(camera.halt_dcmi(), timeout=2.0)
+        camera.wait_response(camera.configure_trigger(role.OFF), timeout=2.0)
+        camera.serial.close()
+
+    print(f"{complete} complete groups")
+    for (i, port) in enumerate(args.ports):
+        print(f"{port}: missing from {missing[i]} groups, {aggregator.unsynced_frames[i]} frames "
+              f"before sync, {aggregator.extra_frames[i]} extra frames")
+    if (skew_us):
+        print(f"frame start skew between boards: mean {np.mean(skew_us):.1f} us  "
+              f"max {max(skew_us)} us")
+
+if __name__ == "__main__":
+    main()